@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stdint.h>
+
+// ==== 投币脉冲串解码 ====
+// 多币种投币器每投入一枚币输出 N 个脉冲（N 由币种决定）。
+// ISR 只记录上升沿时间戳，解码器在任务上下文按脉冲间隔分组：
+// 相邻脉冲间隔超过 gapUs 即认为上一枚币的脉冲串结束；脉冲数达到面值表中的最大值时不可能再长，立即结束。
+// 其余脉冲串只能在静默满 gapUs 后判定，在末脉冲之后 gapUs 才上报；面值表只有 {1, 1} 时每枚币在脉冲到达即上报
+// （主机侧自检见 tools/coin_pulse）。比最大值更长的脉冲串会被拆成多枚，面值表须列出投币器会发出的最长脉冲串。
+// 不依赖 Arduino，可在主机侧直接编译。
+
+// 脉冲数 → 面值（游戏币个数）
+struct CoinDenomination {
+  uint8_t  pulses;
+  uint16_t value;
+};
+
+// 解码结果：一枚币
+struct DecodedCoin {
+  uint8_t  pulses;
+  uint16_t value;
+  bool     known;   // 脉冲数是否在面值表中（未列出时按 1 脉冲 = 1 面值 计）
+  uint32_t firstUs; // 首个/末个脉冲时间戳
+  uint32_t lastUs;
+};
+
+// ISR → 任务 的单生产者/单消费者时间戳环形缓冲（ISR 与消费任务位于同一核）
+template <uint16_t N>
+class PulseRing {
+  static_assert(N && (N & (N - 1)) == 0, "PulseRing size must be a power of two");
+
+ public:
+  // ISR 内调用；满时丢弃并计数。强制内联进 IRAM_ATTR 的 ISR：OTA 擦写 flash 时 cache 关闭而投币中断照常，
+  // 若编译器把 push 放在 flash 里单独成函数，此时取指会崩溃（头文件主机侧也要编译，不用 IRAM_ATTR）
+  __attribute__((always_inline)) bool push(uint32_t tsUs) {
+    const uint16_t h = head_;
+    if ((uint16_t)(h - tail_) >= N) {
+      dropped_ = dropped_ + 1;
+      return false;
+    }
+    buf_[h & (N - 1)] = tsUs;
+    head_ = (uint16_t)(h + 1);
+    return true;
+  }
+
+  bool pop(uint32_t& tsUs) {
+    const uint16_t t = tail_;
+    if (t == head_) return false;
+    tsUs = buf_[t & (N - 1)];
+    tail_ = (uint16_t)(t + 1);
+    return true;
+  }
+
+  uint32_t dropped() const { return dropped_; }
+
+ private:
+  volatile uint32_t buf_[N] = {};
+  volatile uint16_t head_    = 0;
+  volatile uint16_t tail_    = 0;
+  volatile uint32_t dropped_ = 0;
+};
+
+// ISR 去抖：距上一个接受的上升沿不足 windowUs 的边沿（触点抖动、毛刺）丢弃
+class PulseDebounce {
+ public:
+  explicit PulseDebounce(uint32_t windowUs) : windowUs_(windowUs) {}
+
+  // ISR 内调用，同 PulseRing::push 强制内联；返回是否为有效脉冲
+  __attribute__((always_inline)) bool accept(uint32_t nowUs) {
+    if ((uint32_t)(nowUs - lastUs_) < windowUs_) return false;
+    lastUs_ = nowUs;
+    return true;
+  }
+
+  void reset() { lastUs_ = 0; }
+
+ private:
+  uint32_t          windowUs_;
+  volatile uint32_t lastUs_ = 0;
+};
+
+class CoinPulseDecoder {
+ public:
+  CoinPulseDecoder(const CoinDenomination* table, uint8_t tableLen, uint32_t gapUs)
+      : table_(table), tableLen_(tableLen), gapUs_(gapUs) {
+    for (uint8_t i = 0; i < tableLen; i++) {
+      if (table[i].pulses > maxPulses_) maxPulses_ = table[i].pulses;
+    }
+  }
+
+  // 送入一个脉冲时间戳；结束一枚币时写入 out 并返回 true：
+  // - 与上一脉冲间隔超过 gap：结束上一枚
+  // - 本脉冲使脉冲数达到面值表最大值：结束本枚，不等 gap
+  // 达到最大值即结束，未结束的脉冲串总少于最大值，所以两者不会在同一次调用里发生
+  bool feed(uint32_t tsUs, DecodedCoin& out) {
+    bool done = false;
+    if (pulses_ && (uint32_t)(tsUs - lastUs_) > gapUs_) {
+      out  = finish();
+      done = true;
+    }
+    if (!pulses_) firstUs_ = tsUs;
+    if (pulses_ < UINT8_MAX) pulses_++;
+    lastUs_ = tsUs;
+    if (pulses_ == maxPulses_) {
+      out  = finish();
+      done = true;
+    }
+    return done;
+  }
+
+  // 无新脉冲时调用；当前脉冲串静默超过 gap 则结束
+  bool poll(uint32_t nowUs, DecodedCoin& out) {
+    if (!pulses_ || (uint32_t)(nowUs - lastUs_) <= gapUs_) return false;
+    out = finish();
+    return true;
+  }
+
+  // 距当前脉冲串判定结束还需等待的时长；无未完成脉冲串时返回 UINT32_MAX
+  uint32_t usUntilDue(uint32_t nowUs) const {
+    if (!pulses_) return UINT32_MAX;
+    const uint32_t elapsed = nowUs - lastUs_;
+    return elapsed > gapUs_ ? 0 : gapUs_ - elapsed + 1;
+  }
+
+  bool pending() const { return pulses_ != 0; }
+  void reset() { pulses_ = 0; }
+
+ private:
+  DecodedCoin finish() {
+    DecodedCoin coin = { pulses_, pulses_, false, firstUs_, lastUs_ };
+    for (uint8_t i = 0; i < tableLen_; i++) {
+      if (table_[i].pulses == pulses_) {
+        coin.value = table_[i].value;
+        coin.known = true;
+        break;
+      }
+    }
+    pulses_ = 0;
+    return coin;
+  }
+
+  const CoinDenomination* table_;
+  uint8_t  tableLen_;
+  uint32_t gapUs_;
+  uint8_t  maxPulses_ = 0;  // 面值表中最长的脉冲串；空表时为 0，只按 gap 结束
+  uint8_t  pulses_ = 0;
+  uint32_t firstUs_ = 0;
+  uint32_t lastUs_  = 0;
+};
@@ -0,0 +1,441 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "coin_pulse.h"
+#include "config.h"
+#include "cp936.h"
+#include "event_backlog.h"
+#include "event_stamp.h"
+#include "payout_scheduler.h"
+#include "protocol.h"
+#include "raster_print.h"
+
+// ==== 投币盒核心逻辑：会话、投币计数、吐币、打印、事件与续传 ====
+// 从 main.cpp 抽出，不依赖 Arduino/BLE，固件与主机侧工具（tools/coinbox_farm 等）共用同一份逻辑。
+// 时钟、通知发送、继电器、打印机串口与日志经 CoinBoxPlatform 注入。
+// 多连接（gatt_clients.h）：事件经 publish() 交给平台按订阅扇出，应答经 reply() 只发给 cmd.client。
+// 固件内的线程约定：CMD_TIME_PING / CMD_SET_EVENT_FORMAT / CMD_GET_CAPS 可在 BLE 回调内直接 execute()，
+// 其余指令与 feedPulse()/flushCoins()/servicePayout() 只在 I/O 任务内调用；printReceipt() 与
+// CMD_PRINT_RASTER / CMD_PRINT_QR 只在打印任务内调用（应答经 reply() 发回）。
+
+class CoinBoxPlatform {
+ public:
+  virtual uint64_t nowUs() = 0;                                           // 单调时钟（us）
+  virtual void notify(uint8_t kind, const uint8_t* data, size_t len) = 0; // EVENT_KIND_COIN / EVENT_KIND_STATUS
+  virtual void setRelay(uint8_t hopper, bool on) = 0;
+  virtual void printerWrite(const uint8_t* data, size_t len) = 0;       // 打印机串口（CP936 + ESC/POS）
+  virtual uint32_t random32() = 0;
+  virtual uint16_t peerMtu(uint16_t client) {
+    (void)client;
+    return 23;
+  }
+  // coin/status 事件：data[len, len + stampLen) 为时间戳尾部（未扩展时 stampLen = 0）；默认整帧交给 notify()
+  virtual void publish(uint8_t kind, const uint8_t* data, size_t len, size_t stampLen) {
+    notify(kind, data, len + stampLen);
+  }
+  // 指令应答（TIME_PONG/CAPS/续传）只发给发出指令的连接；单连接平台默认走 status 通知
+  virtual void reply(uint16_t client, const uint8_t* data, size_t len) {
+    (void)client;
+    notify(EVENT_KIND_STATUS, data, len);
+  }
+  virtual void discardPendingPulses() {}  // 会话开启：丢弃尚未处理的脉冲
+  virtual void onActivity() {}            // 投币入账、吐币完成
+  virtual void vlog(const char* fmt, va_list ap) {
+    (void)fmt;
+    (void)ap;
+  }
+
+ protected:
+  ~CoinBoxPlatform() = default;
+};
+
+// 吐币定时统计：继电器实际动作时刻 - 计划时刻（us）
+struct PayoutTiming {
+  uint32_t runs;
+  int32_t  minErrUs;
+  int32_t  maxErrUs;
+  uint64_t sumAbsErrUs;
+};
+
+class CoinBoxCore {
+ public:
+  CoinBoxCore(CoinBoxPlatform& io, const HopperSpec* hoppers, uint8_t hopperCount,
+              const CoinDenomination* denominations, uint8_t denominationCount)
+      : io_(io),
+        hopperCount_(hopperCount < PAYOUT_MAX_HOPPERS ? hopperCount : PAYOUT_MAX_HOPPERS),
+        decoder_(denominations, denominationCount, COIN_TRAIN_GAP_US),
+        scheduler_(hoppers, hopperCount) {}
+
+  // ==== 指令（已按 protocol.h 的指令表校验长度并解出字段） ====
+  void execute(const CommandFrame& cmd, uint32_t rxUs) {
+    switch (cmd.op) {
+      case CMD_START_SESSION:
+        startSession(rxUs);
+        break;
+      case CMD_PAYOUT: {
+        uint8_t tag;
+        if (cmd.argCount >= 2 && cmd.b != PAYOUT_TAG_ALL) {
+          tag = (uint8_t)cmd.b;
+        } else {
+          tag = nextPayoutTag_;
+          nextPayoutTag_ = (uint8_t)((nextPayoutTag_ + 1) % PAYOUT_TAG_ALL);
+        }
+        log("[CMD] PAYOUT -> target: %u, tag: %u", (unsigned)cmd.a, tag);
+        submitPayout(tag, (uint16_t)cmd.a, rxUs);
+        break;
+      }
+      case CMD_PRINT_RECEIPT:
+        printReceipt(cmd.data, cmd.dataLen);
+        break;
+      case CMD_PAYOUT_CANCEL: {
+        const uint8_t tag = cmd.argCount ? (uint8_t)cmd.a : PAYOUT_TAG_ALL;
+        log("[CMD] PAYOUT_CANCEL -> tag: %u", tag);
+        cancelPayout(tag);
+        break;
+      }
+      case CMD_SET_EVENT_FORMAT:
+        extendedEvents_ = (cmd.a & EVENT_FORMAT_EXTENDED) != 0;
+        log("[CMD] SET_EVENT_FORMAT -> extended=%d", extendedEvents_ ? 1 : 0);
+        break;
+      case CMD_TIME_PING:
+        notifyTimePong(cmd.client, cmd.a, rxUs);
+        break;
+      case CMD_RESUME:
+        resumeSession(cmd.client, cmd.a, (uint16_t)cmd.b);
+        break;
+      case CMD_GET_CAPS:
+        io_.reply(cmd.client, kCapabilities.bytes, sizeof(kCapabilities.bytes));
+        break;
+      case CMD_PRINT_RASTER:
+        printRaster(cmd.client, cmd.a, cmd.data, cmd.dataLen);
+        break;
+      case CMD_PRINT_QR:
+        printQr(cmd.client, (uint8_t)cmd.a, cmd.data, cmd.dataLen);
+        break;
+      default:
+        log("[CMD] 0x%02X not handled by core", cmd.op);
+        break;
+    }
+  }
+
+  // 连接断开：会话、计数与事件序号保留，客户端重连后用 CMD_RESUME 补齐；事件格式按连接重新协商
+  // （多连接固件在最后一个连接断开时调用，其余情况按剩余连接的格式重发 CMD_SET_EVENT_FORMAT）
+  void onDisconnect() { extendedEvents_ = false; }
+
+  // ==== 投币：逐个送入脉冲时间戳，处理完一批后 flushCoins() 判定静默结束的币并上报一次 ====
+  void feedPulse(uint32_t tsUs) {
+    DecodedCoin coin;
+    if (decoder_.feed(tsUs, coin)) creditCoin(coin);
+  }
+
+  void flushCoins() {
+    DecodedCoin coin;
+    if (decoder_.poll((uint32_t)io_.nowUs(), coin)) creditCoin(coin);
+    if (!coinsChanged_) return;
+    coinsChanged_ = false;
+    notifyCoinTotal(lastCoin_.firstUs, lastCoin_.lastUs);
+  }
+
+  // ==== 吐币：到期事件处理后立即落到继电器，记录动作时刻误差；返回是否处理了到期事件 ====
+  bool servicePayout() {
+    const uint64_t dueUs = scheduler_.nextEventUs();
+    const uint64_t nowUs = io_.nowUs();
+    if (dueUs == UINT64_MAX || nowUs < dueUs) return false;
+    scheduler_.tick(nowUs);
+    applyRelays();
+    recordPayoutTiming((int32_t)(io_.nowUs() - dueUs));
+    reportPayoutCompletion();
+    return true;
+  }
+
+  // 下一个吐币截止时刻（UINT64_MAX = 无）；未结束脉冲串距判定还需的时长（UINT32_MAX = 无）
+  uint64_t nextPayoutUs() const { return scheduler_.nextEventUs(); }
+  uint32_t coinDueInUs(uint32_t nowUs) const { return decoder_.usUntilDue(nowUs); }
+  bool payoutBusy() const { return scheduler_.busy(); }
+  bool coinPending() const { return decoder_.pending(); }
+
+  // ==== 打印：UTF-8 转 CP936 后直接写打印机串口；转码结果（\0 结尾）留在 receiptText() 供其他打印路径使用 ====
+  size_t printReceipt(const uint8_t* text, size_t len) {
+    static constexpr auto kTitleLine = cp936Literal("=== 交易小票 ===\n");
+    static const uint8_t kSelectChineseMode[] = { 0x1C, 0x26 };  // FS &：进入汉字模式
+    static const uint8_t kFeed[] = { '\n', '\n', '\n' };
+
+    // CP936 不长于 UTF-8；CP936 字节不含 0
+    receiptLen_ = transcoder_.convert(text, len, receipt_, sizeof(receipt_) - 1);
+    receipt_[receiptLen_] = '\0';
+    log("[CMD] PRINT_RECEIPT utf8=%u, cp936=%u, unmapped=%u, cacheHit=%u/%u", (unsigned)len,
+        (unsigned)receiptLen_, (unsigned)transcoder_.unmapped(), (unsigned)transcoder_.hits(),
+        (unsigned)(transcoder_.hits() + transcoder_.misses()));
+
+    io_.printerWrite(kSelectChineseMode, sizeof(kSelectChineseMode));
+    io_.printerWrite(kTitleLine.bytes, kTitleLine.len);
+    io_.printerWrite(receipt_, receiptLen_);
+    io_.printerWrite(kFeed, sizeof(kFeed));
+    return receiptLen_;
+  }
+
+  uint8_t* receiptText() { return receipt_; }
+  const RasterStats& rasterStats() const { return raster_.stats(); }
+
+  // ==== 状态 ====
+  uint16_t coinTotal() const { return coinTotal_; }
+  uint16_t coinValue() const { return coinValue_; }
+  uint32_t sessionId() const { return sessionId_; }
+  uint16_t eventSeq() const { return eventSeq_; }
+  bool extendedEvents() const { return extendedEvents_; }
+  const PayoutTiming& payoutTiming() const { return timing_; }
+
+ private:
+  void log(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    io_.vlog(fmt, ap);
+    va_end(ap);
+  }
+
+  // coin/status 事件统一出口：分配序号并记入积压（断线期间的通知无人接收），扩展格式时追加时间戳尾部
+  void notifyEvent(uint8_t kind, uint8_t* buf, size_t len, uint32_t originUs, uint32_t readyUs) {
+    const uint16_t seq = eventSeq_++;
+    backlog_.push(seq, kind, buf, len);
+    size_t stampLen = 0;
+    if (extendedEvents_) {
+      const EventStamp stamp = { seq, (uint32_t)io_.nowUs(), originUs, readyUs };
+      stampLen = encodeEventStamp(buf + len, stamp);
+    }
+    io_.publish(kind, buf, len, stampLen);
+  }
+
+  // [枚数 u16 LE, 面值合计 u16 LE]；只读前 2 字节的旧客户端不受影响
+  void notifyCoinTotal(uint32_t originUs, uint32_t readyUs) {
+    uint8_t buf[4 + EVENT_STAMP_LEN];
+    putLe16(buf, coinTotal_);
+    putLe16(buf + 2, coinValue_);
+    notifyEvent(EVENT_KIND_COIN, buf, 4, originUs, readyUs);
+  }
+
+  void creditCoin(const DecodedCoin& coin) {
+    coinTotal_++;
+    coinValue_ = (uint16_t)(coinValue_ + coin.value);
+    lastCoin_     = coin;
+    coinsChanged_ = true;
+    log("[COIN] pulses=%u, value=%u%s, total=%u, valueTotal=%u", coin.pulses, coin.value,
+        coin.known ? "" : " (unmapped)", coinTotal_, coinValue_);
+    io_.onActivity();
+  }
+
+  // [EVT_PAYOUT_DONE, 面值合计 u16 LE, 料斗数 u8, 各料斗枚数 u16 LE...]（每次连续运行一条）
+  void notifyPayoutDone(const PayoutCompletion& plan) {
+    const uint16_t value = plan.value > UINT16_MAX ? UINT16_MAX : (uint16_t)plan.value;
+    uint8_t payload[4 + 2 * PAYOUT_MAX_HOPPERS + EVENT_STAMP_LEN];
+    size_t len = 0;
+    payload[len++] = EVT_PAYOUT_DONE;
+    putLe16(payload + len, value);
+    len += 2;
+    payload[len++] = plan.hopperCount;
+    for (uint8_t i = 0; i < plan.hopperCount; i++) {
+      putLe16(payload + len, plan.coins[i]);
+      len += 2;
+    }
+    uint32_t originUs = (uint32_t)plan.finishUs;
+    for (uint8_t i = 0; i < plan.requestCount; i++) {
+      if ((int32_t)(plan.requests[i].originUs - originUs) < 0) originUs = plan.requests[i].originUs;
+    }
+    notifyEvent(EVENT_KIND_STATUS, payload, len, originUs, (uint32_t)plan.finishUs);
+  }
+
+  // [EVT_PAYOUT_REQUEST_DONE, tag u8, 请求面值 u16 LE, 实际面值 u16 LE, 状态 u8]（每笔请求一条）
+  void notifyPayoutRequestDone(const PayoutRequestResult& r, uint32_t readyUs) {
+    uint8_t payload[7 + EVENT_STAMP_LEN] = { EVT_PAYOUT_REQUEST_DONE, r.tag };
+    putLe16(payload + 2, r.requested);
+    putLe16(payload + 4, r.paid);
+    payload[6] = r.status;
+    notifyEvent(EVENT_KIND_STATUS, payload, 7, r.originUs, readyUs);
+  }
+
+  // [EVT_TIME_PONG, nonce u32, rxUs u32, txUs u32]（不占事件序号）
+  void notifyTimePong(uint16_t client, uint32_t nonce, uint32_t rxUs) {
+    uint8_t payload[EVENT_TIME_PONG_LEN];
+    payload[0] = EVT_TIME_PONG;
+    putLe32(payload + 1, nonce);
+    putLe32(payload + 5, rxUs);
+    putLe32(payload + 9, (uint32_t)io_.nowUs());
+    io_.reply(client, payload, sizeof(payload));
+  }
+
+  void recordPayoutTiming(int32_t errUs) {
+    timing_.runs++;
+    if (errUs < timing_.minErrUs) timing_.minErrUs = errUs;
+    if (errUs > timing_.maxErrUs) timing_.maxErrUs = errUs;
+    timing_.sumAbsErrUs += (uint64_t)(errUs < 0 ? -errUs : errUs);
+  }
+
+  // 调度器给出继电器位图，这里只负责把位图变化落到引脚
+  void applyRelays() {
+    const uint8_t mask = scheduler_.relayMask();
+    const uint8_t diff = mask ^ relayState_;
+    for (uint8_t h = 0; h < hopperCount_; h++) {
+      if (diff & (1u << h)) io_.setRelay(h, (mask & (1u << h)) != 0);
+    }
+    relayState_ = mask;
+  }
+
+  // 运行结束后先逐笔上报请求结果，再上报整次运行（含各料斗枚数）
+  void reportPayoutCompletion() {
+    PayoutCompletion done;
+    if (!scheduler_.takeCompletion(done)) return;
+    for (uint8_t i = 0; i < done.requestCount; i++) {
+      const PayoutRequestResult& r = done.requests[i];
+      notifyPayoutRequestDone(r, (uint32_t)done.finishUs);
+      log("[PAYOUT] tag %u requested=%u, paid=%u, status=%u", r.tag, r.requested, r.paid, r.status);
+    }
+    notifyPayoutDone(done);
+    log("[PAYOUT] run done, value=%u", (unsigned)done.value);
+    io_.onActivity();
+  }
+
+  void submitPayout(uint8_t tag, uint16_t target, uint32_t rxUs) {
+    if (!scheduler_.submit(tag, target, io_.nowUs(), rxUs)) {
+      const PayoutRequestResult rejected = { tag, target, 0, PAYOUT_STATUS_REJECTED, rxUs };
+      notifyPayoutRequestDone(rejected, (uint32_t)io_.nowUs());
+      log("[PAYOUT] WARNING: request queue full, rejected");
+      return;
+    }
+    applyRelays();
+    reportPayoutCompletion();  // 凑不出任何面值时立即结束
+  }
+
+  void cancelPayout(uint8_t tag) {
+    if (!scheduler_.cancel(tag, io_.nowUs())) {
+      log("[PAYOUT] cancel: nothing to cancel");
+      return;
+    }
+    applyRelays();
+    reportPayoutCompletion();
+  }
+
+  void startSession(uint32_t rxUs) {
+    io_.discardPendingPulses();
+    decoder_.reset();
+    coinsChanged_ = false;
+    coinTotal_    = 0;
+    coinValue_    = 0;
+    backlog_.clear();
+    sessionId_ = io_.random32() | 1u;
+
+    uint8_t payload[5 + EVENT_STAMP_LEN] = { EVT_SESSION_STARTED };
+    putLe32(payload + 1, sessionId_);
+    notifyEvent(EVENT_KIND_STATUS, payload, 5, rxUs, (uint32_t)io_.nowUs());
+    notifyCoinTotal(rxUs, (uint32_t)io_.nowUs());
+    log("[CMD] START_SESSION -> counters reset, session=0x%08X", (unsigned)sessionId_);
+  }
+
+  // 重连续传：回放 lastSeq 之后的事件，首帧附当前快照；帧长受对端 MTU 限制，装不下时分多帧
+  void resumeSession(uint16_t client, uint32_t clientSession, uint16_t lastSeq) {
+    const uint16_t headSeq = (uint16_t)(eventSeq_ - 1);
+    ResumeSnapshot snap = { sessionId_, coinTotal_, coinValue_, headSeq, RESUME_STATUS_OK };
+    if (!sessionId_ || clientSession != sessionId_) {
+      snap.status = RESUME_STATUS_UNKNOWN;
+    } else if (!backlog_.covers(lastSeq, headSeq)) {
+      snap.status = RESUME_STATUS_PARTIAL;
+    }
+
+    const uint16_t mtu = io_.peerMtu(client);
+    size_t cap = mtu > 3 ? mtu - 3 : 20;
+    uint8_t frame[RESUME_FRAME_MAX];
+    if (cap > sizeof(frame)) cap = sizeof(frame);
+
+    uint16_t cursor = lastSeq;
+    uint8_t frames = 0;
+    uint8_t status = snap.status;
+    for (;;) {
+      const size_t len = backlog_.buildResumeFrame(EVT_RESUME_BATCH, snap, frames == 0, cursor, frame, cap);
+      if (!len) break;
+      io_.reply(client, frame, len);
+      frames++;
+      status = (uint8_t)((frame[1] >> 1) & 0x03);
+      if (!(frame[1] & RESUME_FLAG_MORE)) break;
+    }
+    log("[CMD] RESUME -> status=%u, fromSeq=%u, toSeq=%u, headSeq=%u, frames=%u", status, lastSeq, cursor, headSeq,
+        frames);
+  }
+
+  // 光栅分片：边解压边按条带写打印机，每片应答一次；只在开始、完成与出错时记日志。
+  // 开了新会话或换了发图连接（所有者变化）后，已完成图像不再作为重发依据（都在打印任务内比较，不跨线程）
+  void printRaster(uint16_t client, uint32_t offset, const uint8_t* data, size_t len) {
+    auto uart = [this](const uint8_t* p, size_t n) { io_.printerWrite(p, n); };
+    if (client != rasterClient_ || sessionId_ != rasterSession_) {
+      raster_.forgetDone();
+      rasterClient_  = client;
+      rasterSession_ = sessionId_;
+    }
+    const RasterStats& st = raster_.stats();
+    const uint32_t startsBefore = st.starts, imagesBefore = st.images, abortedBefore = st.aborted;
+    const RasterAck ack = raster_.feed(offset, data, len, uart);
+    if (st.starts != startsBefore) {
+      log("[PRN] raster started%s", st.aborted != abortedBefore ? " (unfinished image dropped)" : "");
+    }
+    if (st.images != imagesBefore) {
+      log("[PRN] raster %ux%u enc=%u done: stream=%u B, uart=%u B", (unsigned)raster_.width() * 8,
+          (unsigned)ack.rows, (unsigned)raster_.encoding(), (unsigned)ack.next, (unsigned)raster_.lastOutBytes());
+    } else if (ack.status >= RASTER_GAP) {
+      log("[PRN] raster status=%u, expected offset %u (chunk %u+%u)", ack.status, (unsigned)ack.next,
+          (unsigned)offset, (unsigned)len);
+    }
+    replyRaster(client, ack);
+  }
+
+  void printQr(uint16_t client, uint8_t options, const uint8_t* text, size_t len) {
+    auto uart = [this](const uint8_t* p, size_t n) { io_.printerWrite(p, n); };
+    const RasterAck ack = raster_.printQr(options, text, len, uart);
+    const QrCode& qr = raster_.qr();
+    if (ack.status == RASTER_DONE) {
+      log("[PRN] QR v%u-%c %ux%u modules, mask=%u, text=%u B -> %u rows, uart=%u B", qr.version(),
+          "LMQH"[qr.ecc()], qr.size(), qr.size(), qr.mask(), (unsigned)len, (unsigned)ack.rows,
+          (unsigned)raster_.lastOutBytes());
+    } else {
+      log("[PRN] QR rejected: status=%u, text=%u B", ack.status, (unsigned)len);
+    }
+    replyRaster(client, ack);
+  }
+
+  void replyRaster(uint16_t client, const RasterAck& ack) {
+    uint8_t frame[RASTER_ACK_LEN];
+    io_.reply(client, frame, encodeRasterAck(ack, frame));
+  }
+
+  CoinBoxPlatform& io_;
+  uint8_t hopperCount_;
+
+  // 事件时间戳（扩展事件格式，见 event_stamp.h）
+  volatile bool extendedEvents_ = false;
+  uint16_t eventSeq_            = 0;
+
+  // 会话与断线续传（见 event_backlog.h）
+  uint32_t sessionId_ = 0;  // 0 = 尚未开启会话
+  EventBacklog<EVENT_BACKLOG_LEN> backlog_;
+
+  // 投币会话累计
+  volatile uint16_t coinTotal_ = 0;  // 枚数
+  volatile uint16_t coinValue_ = 0;  // 面值合计
+  CoinPulseDecoder decoder_;
+  bool        coinsChanged_ = false;
+  DecodedCoin lastCoin_     = {};
+
+  // 吐币
+  PayoutScheduler scheduler_;
+  uint8_t relayState_    = 0;  // 当前继电器位图
+  uint8_t nextPayoutTag_ = 0;  // 未带 tag 的请求由固件分配
+  PayoutTiming timing_   = { 0, INT32_MAX, INT32_MIN, 0 };
+
+  // 打印
+  Cp936Transcoder transcoder_;
+  uint8_t receipt_[PRINT_JOB_MAX_BYTES + 1] = {};
+  size_t  receiptLen_                       = 0;
+  RasterPrinter raster_;               // 光栅/二维码（见 raster_print.h）
+  uint16_t      rasterClient_  = 0;    // 上一个光栅分片的连接与会话
+  uint32_t      rasterSession_ = 0;
+};
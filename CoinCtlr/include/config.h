@@ -7,7 +7,14 @@
 #define PIN_DISPENSE_RELAY          25    // 继电器/电机驱动输出（HIGH=启，LOW=停）
 
 // ==== 去抖与时序（可按机械特性调整） ====
-#define COIN_ACCEPTOR_DEBOUNCE_US   20000  // 投币器脉冲去抖（us）- 100ms脉冲用20ms去抖
+#define COIN_ACCEPTOR_DEBOUNCE_US   8000   // 投币器上升沿去抖（us）：只滤毛刺，需小于脉冲串内的脉冲周期
+
+// ==== 多币种脉冲识别（每枚币 N 个脉冲） ====
+#define COIN_TRAIN_GAP_US           250000 // 同一枚币脉冲间隔上限（us），超过即视为下一枚币；也是短于表中最长项的脉冲串的上报时延
+#define COIN_PULSE_RING_SIZE        64     // ISR 时间戳缓冲（2 的幂）
+// 脉冲数 → 面值（游戏币个数）；未列出的脉冲数按 1 脉冲 = 1 面值 计。最长的一项即脉冲串上限：达到即上报，更长的会被拆开
+// 例：{ {1, 1}, {2, 5}, {3, 10} } 表示 1/2/3 脉冲分别为 1/5/10 面值
+#define COIN_DENOMINATIONS          { {1, 1} }
 
 #define DISPENSE_GAP_MS             120   // 每两枚之间停顿（ms）
 #define PER_COIN_TIMEOUT_MS         1500  // 单枚超时（ms）
@@ -20,23 +27,127 @@
 #define UUID_CHAR_COIN              "8F1D0002-7E08-4E27-9D94-7A2C3B6E10A1" // Notify: u16 LE 总币数
 #define UUID_CHAR_CMD               "8F1D0003-7E08-4E27-9D94-7A2C3B6E10A1" // Write: 指令
 #define UUID_CHAR_STATUS            "8F1D0004-7E08-4E27-9D94-7A2C3B6E10A1" // Notify: 事件
+#define UUID_CHAR_OTA               "8F1D0005-7E08-4E27-9D94-7A2C3B6E10A1" // Write/Notify: 固件升级（见 ota_update.h）
+#define BLE_LOCAL_MTU               247   // 本端 MTU：单帧最多 244 字节（续传回放、OTA 分片）
+#define BLE_MAX_CONNECTIONS         3     // 同时连接的中心数（玩家 + 运维，见 gatt_clients.h；≤ sdkconfig CONFIG_BTDM_CTRL_BLE_MAX_CONN）
+#define CLIENT_OWNER_HOLD_MS        120000 // 所有者断线后归属保留时长：期间只有同一对端地址重连能接回
 
 // ==== 协议常量 ====
 #define CMD_START_SESSION           0x01  // 开启投币会话
 #define CMD_PAYOUT                  0x02  // 吐币（u16 个数）
 #define CMD_PRINT_RECEIPT           0x03  // 打印小票（后续携带数据）
 #define CMD_DEBUG_PRINTER           0x04  // 调试打印机（测试不同方式）
+#define CMD_PAYOUT_CANCEL           0x05  // 取消吐币（u8 tag，缺省/0xFF 取消全部）
+#define CMD_SET_EVENT_FORMAT        0x06  // 事件格式（u8 标志，bit0=扩展时间戳尾部）
+#define CMD_TIME_PING               0x07  // 时钟同步（u32 nonce）→ EVT_TIME_PONG
+#define CMD_RESUME                  0x08  // 断线续传（u32 会话号, u16 已收到的最后 seq）→ EVT_RESUME_BATCH
+#define CMD_GET_CAPS                0x09  // 查询协议版本与支持的指令 → EVT_CAPS
+#define CMD_SET_ROLE                0x0A  // 声明本连接角色（u8 CLIENT_ROLE_*）→ EVT_ROLE
+#define CMD_PRINT_RASTER            0x0B  // 光栅图像分片（u32 偏移, 压缩流字节）→ EVT_RASTER_ACK
+#define CMD_PRINT_QR                0x0C  // 设备端生成二维码（u8 纠错级别|模块点数<<4, 文本）→ EVT_RASTER_ACK
+// 各指令的负载布局与长度限制见 protocol.h
 
-#define EVT_PAYOUT_DONE             0x10  // 吐币完成（u16 已吐币数）
+#define EVT_PAYOUT_DONE             0x10  // 吐币完成（u16 已吐面值, u8 料斗数, 各料斗 u16 枚数）
+#define EVT_PAYOUT_REQUEST_DONE     0x11  // 单笔吐币结果（u8 tag, u16 请求, u16 实际, u8 状态）
+#define EVT_TIME_PONG               0x12  // 时钟同步应答（u32 nonce, u32 收到时刻, u32 发出时刻）
+#define EVT_RESUME_BATCH            0x13  // 续传批量回放（快照 + 断线期间事件，见 event_backlog.h）
+#define EVT_SESSION_STARTED         0x14  // 会话开启（u32 会话号）
+#define EVT_CAPS                    0x15  // 能力应答（u8 协议版本, u8 指令数, 各指令操作码）
+#define EVT_ROLE                    0x16  // 角色应答（u8 角色, u8 是否会话所有者, u8 当前连接数）
+#define EVT_REJECTED                0x17  // 指令被拒（u8 操作码, u8 原因 REJECT_*），只发给发出指令的连接
+#define EVT_RASTER_ACK              0x18  // 图像打印应答（u8 RASTER_*, u32 下一偏移, u16 已出行数），只发给发出指令的连接
 
-// ==== 打印机/BLE 扩展指令 ====
-#define CMD_PRINT_RECEIPT           0x03  // 打印小票（后续携带数据）
+#define EVENT_FORMAT_EXTENDED       0x01  // CMD_SET_EVENT_FORMAT 标志位
+
+#define CLIENT_ROLE_PLAYER          0x00  // 默认：可开局/吐币（须为会话所有者）
+#define CLIENT_ROLE_OPERATOR        0x01  // 运维：只监看、调试打印机、取消吐币；须 MITM 加密配对
+#define REJECT_NOT_OWNER            0x01  // 会话由其他连接持有
+#define REJECT_ROLE                 0x02  // 本连接角色无权执行（或角色值无效、未配对的连接声明运维）
 
+// ==== 打印机 ====
 // 打印机串口配置（如有需要可根据硬件调整）
 #define PRINTER_UART_BAUD           115200
 #define PRINTER_UART_TX_PIN         17    // ESP32 TX2 默认 17
 #define PRINTER_UART_RX_PIN         16    // ESP32 RX2 默认 16
 
+// ==== 光栅图像 / 二维码打印（见 raster_print.h、qr_code.h） ====
+// App 发 PackBits 压缩的 1bpp 位图，打印任务边收边解压，满一条带即以 GS v 0 写串口，不缓存整幅图
+#define RASTER_MAX_WIDTH_BYTES      48    // 纸宽 384 点（58mm 机芯）
+#define RASTER_MAX_HEIGHT           4096  // 单幅图像行数上限（约 51cm）
+#define RASTER_BAND_ROWS            24    // 每条 GS v 0 的行数（RAM = 行数 × 宽度字节）
+#define RASTER_TRIM_BANDS           1     // 条带右侧空白不发、空白带改 ESC J 走纸（要求纵向移动单位 1 点，58mm 机芯默认）
+#define QR_MAX_VERSION              10    // 设备端二维码版本上限（57×57 模块，字节模式 L 级 271 字节）
+#define QR_MAX_TEXT_BYTES           271   // CMD_PRINT_QR 文本上限；实际容量随纠错级别降低，超出回 RASTER_ERR_QR
+#define QR_MODULE_DOTS_MAX          8     // 自动选择模块尺寸时的上限（点，8 点 = 1mm）
+#define QR_QUIET_MODULES            4     // 上下静区（模块数，走纸实现；左右为空白纸边）
+
 // ==== 吐币速度（时间换算吐币，不依赖出币传感器） ====
 // 实测：每秒约 7.1 枚
-#define DISPENSE_COINS_PER_SEC      6.5f
\ No newline at end of file
+#define DISPENSE_COINS_PER_SEC      6.5f
+
+// ==== 多料斗并行吐币 ====
+// 每个料斗：{ 继电器引脚, 标定速率（枚/秒）, 面值 }；同时启动，大面值优先、小面值找零
+// 例：{ { 25, 6.5f, 1 }, { 26, 6.5f, 1 }, { 27, 6.0f, 5 } }
+#define HOPPER_COUNT                1     // 不超过 PAYOUT_MAX_HOPPERS(8)
+#define HOPPERS                     { { PIN_DISPENSE_RELAY, DISPENSE_COINS_PER_SEC, 1 } }
+
+// ==== 任务划分（双核） ====
+// core0：BLE 协议栈（Bluedroid/控制器由 sdkconfig 固定在 core0，回调只做解析与入队）
+// core1：投币/吐币 I/O 任务（高优先级，继电器定时）与打印任务（低优先级）
+#define BLE_CORE                    0
+#define IO_TASK_CORE                1
+#define IO_TASK_PRIO                (configMAX_PRIORITIES - 2)
+#define IO_TASK_STACK               4096
+#define PRINTER_TASK_CORE           1
+#define PRINTER_TASK_PRIO           2     // 低于 I/O 任务，高于 Arduino loop(1)
+#define PRINTER_TASK_STACK          6144
+#define IO_QUEUE_LEN                16    // BLE/ISR → I/O 任务
+#define PRINT_QUEUE_LEN             4     // BLE → 打印任务
+#define PRINT_JOB_MAX_BYTES         512   // 单张小票最大文本长度
+// 断线续传：保留最近 N 条 coin/status 事件；单帧回放上限（字节，实际受对端 MTU 限制）
+#define EVENT_BACKLOG_LEN           32
+#define RESUME_FRAME_MAX            244
+// 吐币定时：提前该时长从 vTaskDelay 醒来，剩余部分忙等到截止时刻（us）
+#define PAYOUT_SPIN_US              1500
+
+// ==== 低功耗（事件驱动 + 自动浅睡/调频） ====
+// 需 sdkconfig 打开 CONFIG_PM_ENABLE 与 CONFIG_FREERTOS_USE_TICKLESS_IDLE；未打开时
+// esp_pm_configure 失败，串口告警后按全速运行，其余逻辑不变
+#define POWER_SAVE_ENABLE           1
+#define POWER_MAX_FREQ_MHZ          240
+#define POWER_MIN_FREQ_MHZ          80    // 不低于 80：APB 固定 80MHz，UART 波特率与 esp_timer 不受调频影响
+#define POWER_LIGHT_SLEEP           1     // 无人持锁时自动浅睡；投币脚高电平唤醒
+#define POWER_AWAKE_MA              50.0f // 电流模型：持锁（全速/禁浅睡）时整板电流（假设值，未实测）
+#define POWER_SLEEP_MA              1.5f  // 电流模型：浅睡平均电流（含 BLE 广播；假设值，未实测）
+#define DIAG_MIN_INTERVAL_MS        1000  // 诊断行最短间隔，突发事件合并为一行
+#define DIAG_IDLE_INTERVAL_MS       60000 // 空闲时诊断行间隔（唯一的周期性唤醒）
+
+// ==== 现场录制（见 session_log.h） ====
+// 打开后从上电起记录投币器边沿、指令帧、继电器/打印机串口与通知，由 loop() 经调试串口以
+// "[CAP] <十六进制>" 行导出；主机侧 tools/session_replay 直接读取串口日志重放比对
+#define CAPTURE_ENABLE              0
+#define CAPTURE_BUFFER_BYTES        8192  // RAM 环形缓冲；导出跟不上时丢弃记录并计数
+#define CAPTURE_LINE_BYTES          48    // 每行 [CAP] 的字节数
+
+// ==== BLE 固件升级（见 ota_update.h） ====
+// 升级包边收边解压写入未运行的 app 分区（分区表需含 ota_0/ota_1）；新镜像试运行自检通过才确认，否则回滚
+#define OTA_FRAME_MAX               244   // 单帧上限（MTU - 3）；分片数据 = 帧长 - OTA_CHUNK_HEADER_LEN
+#define OTA_WINDOW                  8     // 未确认分片上限（= 接收队列长度）
+#define OTA_TASK_CORE               1
+#define OTA_TASK_PRIO               1     // 低于打印任务：升级期间投币/吐币/打印照常
+#define OTA_TASK_STACK              4096
+#define OTA_LZ_MAX_WINDOW_BITS      12    // 解压窗口上限（RAM = 1 << bits 字节）
+#define OTA_ERASE_BLOCK             4096  // 每次擦除长度：擦除期间两核 cache 关闭，按扇区擦除使单次停顿最短
+#define OTA_DEFER_MS                20    // 吐币运行中或脉冲串未结束时推迟擦写，避免 cache 关闭影响继电器定时
+#define OTA_RESTART_DELAY_MS        300   // APPLY 应答发出后再重启
+#define OTA_MAX_TRIAL_BOOTS         3     // 新镜像试运行启动次数上限（自检前崩溃/看门狗重启也计数），超过即回滚
+#define OTA_SELF_CHECK_MS           30000 // 新镜像运行该时长且自检通过后确认，否则回滚
+#define OTA_SELF_CHECK_MIN_HEAP     32768 // 自检要求的最小空闲堆（字节）
+// 以下两项每台机器不同，不进版本库：在 platformio.ini 的 build_flags 里给出，缺省或仍为旧默认值时固件拒绝编译
+//   -DOTA_PAIRING_PIN=<6 位数字>  -DOTA_AUTH_KEY='"<64 位十六进制>"'
+#ifndef OTA_PAIRING_PIN
+#define OTA_PAIRING_PIN             0     // 升级特征要求 MITM 加密配对写入：静态 6 位配对码
+#endif
+#ifndef OTA_AUTH_KEY
+#define OTA_AUTH_KEY                ""    // 升级包 HMAC-SHA256 密钥（32 字节），与 tools/ota_sim pack -a 一致
+#endif
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cp936_data.h"
+
+// ==== UTF-8 → CP936（GBK）转码 ====
+// 打印机原生编码为 CP936，每个汉字 2 字节（UTF-8 为 3 字节）。查找表在编译期由 cp936_data.h 构建：
+// - CJK 统一汉字 U+4E00–U+9FA5 全部可转：位图标记该字属于 GB2312（1）还是按序落在 GBK/3、GBK/4（0）。
+//   GB2312 汉字的码位按 Unicode 顺序存一张 u16 表，用位图的 rank 索引；扩展汉字的码位由其前面 0 的个数推算
+// - 其他字符（符号、全角、假名等）：按 Unicode 排序的 (Unicode, CP936) 对，二分查找
+// 运行时常量约 20KB（按 Unicode 直接索引需 128KB）；原始码表只参与编译期计算，不进固件。
+// Cp936Transcoder 在查找前加一个直接映射缓存，收据里反复出现的字直接命中。
+// 无法转换的字符（含非法 UTF-8）输出 '?'。不依赖 Arduino，可在主机侧直接编译。
+
+#define CP936_CACHE_SIZE            64    // 2 的幂
+#define CP936_UNMAPPED              '?'
+
+namespace cp936_detail {
+
+constexpr uint32_t kCjkFirst    = 0x4E00;
+constexpr uint32_t kCjkLast     = 0x9FA5;
+constexpr uint32_t kCjkCount    = kCjkLast - kCjkFirst + 1;
+constexpr uint32_t kWords       = (kCjkCount + 31) / 32;
+constexpr uint32_t kRankStride  = 8;  // 每 8 个位图字记一次前缀计数
+constexpr size_t   kSlots       = sizeof(kCp936Gb2312Hanzi) / sizeof(kCp936Gb2312Hanzi[0]);
+constexpr size_t   kSymbolCount = sizeof(kCp936Symbols) / sizeof(kCp936Symbols[0]);
+
+// GB2312 码位 → Unicode 的反表（仅编译期使用）
+struct HanziInverse {
+  uint16_t code[kCjkCount];
+};
+
+constexpr HanziInverse invertGb2312() {
+  HanziInverse inv = {};
+  for (size_t i = 0; i < kSlots; i++) {
+    const uint16_t u = kCp936Gb2312Hanzi[i];
+    if (!u) continue;
+    inv.code[u - kCjkFirst] = (uint16_t)(((0xB0 + i / 94) << 8) | (0xA1 + i % 94));
+  }
+  return inv;
+}
+
+constexpr HanziInverse kInverse = invertGb2312();
+
+constexpr size_t countGb2312() {
+  size_t n = 0;
+  for (uint32_t i = 0; i < kCjkCount; i++) n += kInverse.code[i] != 0;
+  return n;
+}
+
+constexpr size_t kGb2312Count = countGb2312();
+
+struct HanziTable {
+  uint32_t bits[kWords];
+  uint16_t rank[(kWords + kRankStride - 1) / kRankStride];
+  uint16_t gb2312[kGb2312Count];
+};
+
+constexpr HanziTable buildHanziTable() {
+  HanziTable t = {};
+  size_t ones = 0;
+  for (uint32_t i = 0; i < kCjkCount; i++) {
+    if (i % (32 * kRankStride) == 0) t.rank[i / (32 * kRankStride)] = (uint16_t)ones;
+    if (!kInverse.code[i]) continue;
+    t.bits[i / 32] |= 1u << (i % 32);
+    t.gb2312[ones++] = kInverse.code[i];
+  }
+  return t;
+}
+
+constexpr bool symbolsSorted() {
+  for (size_t i = 1; i < kSymbolCount; i++) {
+    if (kCp936Symbols[i - 1][0] >= kCp936Symbols[i][0]) return false;
+  }
+  return true;
+}
+
+static_assert(kGb2312Count + CP936_HANZI_EXTENSION_COUNT == kCjkCount,
+              "cp936_data.h must cover every CJK ideograph U+4E00..U+9FA5");
+static_assert(symbolsSorted(), "kCp936Symbols must be sorted by Unicode");
+
+}  // namespace cp936_detail
+
+constexpr cp936_detail::HanziTable kCp936Hanzi = cp936_detail::buildHanziTable();
+
+// GBK/3（8140–A0FE，每区 190 位）之后接 GBK/4（AA40–FEA0，每区 96 位）中的第 k 个码位；位跳过 0x7F
+constexpr uint16_t cp936ExtensionCode(uint32_t k) {
+  uint32_t lead = 0, t = 0;
+  if (k < 32 * 190) {
+    lead = 0x81 + k / 190;
+    t    = k % 190;
+  } else {
+    k -= 32 * 190;
+    lead = 0xAA + k / 96;
+    t    = k % 96;
+  }
+  return (uint16_t)((lead << 8) | (0x40 + t + (t >= 0x3F ? 1 : 0)));
+}
+
+// 单个码位 → CP936；< 0x100 为单字节，0 = 无法转换（U+0000 由调用方按 ASCII 处理）
+constexpr uint16_t cp936Lookup(uint32_t ucs) {
+  using namespace cp936_detail;
+  if (ucs < 0x80) return (uint16_t)ucs;
+  if (ucs >= kCjkFirst && ucs <= kCjkLast) {
+    const uint32_t i = ucs - kCjkFirst;
+    const uint32_t w = i / 32;
+    const uint32_t b = i % 32;
+    uint32_t ones = kCp936Hanzi.rank[w / kRankStride];
+    for (uint32_t k = w - w % kRankStride; k < w; k++) ones += (uint32_t)__builtin_popcount(kCp936Hanzi.bits[k]);
+    ones += (uint32_t)__builtin_popcount(kCp936Hanzi.bits[w] & ((1u << b) - 1));
+    if ((kCp936Hanzi.bits[w] >> b) & 1) return kCp936Hanzi.gb2312[ones];
+    return cp936ExtensionCode(i - ones);
+  }
+  if (ucs > 0xFFFF) return 0;
+  size_t lo = 0, hi = kSymbolCount;
+  while (lo < hi) {
+    const size_t mid = (lo + hi) / 2;
+    if (kCp936Symbols[mid][0] < ucs) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < kSymbolCount && kCp936Symbols[lo][0] == ucs ? kCp936Symbols[lo][1] : 0;
+}
+
+// 解一个 UTF-8 字符，返回消耗字节数（≥1）；非法序列置 ucs = UINT32_MAX 并只消耗 1 字节
+template <typename Byte>
+constexpr size_t decodeUtf8(const Byte* p, size_t n, uint32_t& ucs) {
+  const uint8_t c = (uint8_t)p[0];
+  ucs = UINT32_MAX;
+  if (c < 0x80) {
+    ucs = c;
+    return 1;
+  }
+  size_t len = 0;
+  uint32_t v = 0, min = 0;
+  if ((c & 0xE0) == 0xC0) {
+    len = 2; v = c & 0x1F; min = 0x80;
+  } else if ((c & 0xF0) == 0xE0) {
+    len = 3; v = c & 0x0F; min = 0x800;
+  } else if ((c & 0xF8) == 0xF0) {
+    len = 4; v = c & 0x07; min = 0x10000;
+  } else {
+    return 1;
+  }
+  if (n < len) return 1;
+  for (size_t i = 1; i < len; i++) {
+    const uint8_t cc = (uint8_t)p[i];
+    if ((cc & 0xC0) != 0x80) return 1;
+    v = (v << 6) | (cc & 0x3F);
+  }
+  if (v < min || v > 0x10FFFF || (v >= 0xD800 && v < 0xE000)) return 1;
+  ucs = v;
+  return len;
+}
+
+// 写出一个 CP936 字符，返回字节数
+constexpr size_t putCp936(uint16_t code, uint8_t* out) {
+  if (code < 0x100) {
+    out[0] = (uint8_t)code;
+    return 1;
+  }
+  out[0] = (uint8_t)(code >> 8);
+  out[1] = (uint8_t)code;
+  return 2;
+}
+
+// 编译期转换字符串字面量，用于固定文案（如小票标题）；结果以 \0 结尾
+template <size_t N>
+struct Cp936Literal {
+  uint8_t bytes[N];
+  size_t  len;
+};
+
+template <size_t N>
+constexpr Cp936Literal<N> cp936Literal(const char (&utf8)[N]) {
+  Cp936Literal<N> s = {};
+  size_t i = 0;
+  while (i + 1 < N) {  // 不含字面量结尾的 \0
+    uint32_t ucs = 0;
+    i += decodeUtf8(utf8 + i, N - 1 - i, ucs);
+    const uint16_t code = ucs == UINT32_MAX ? 0 : cp936Lookup(ucs);
+    s.len += putCp936(code || !ucs ? code : (uint16_t)CP936_UNMAPPED, s.bytes + s.len);
+  }
+  s.bytes[s.len] = 0;
+  return s;
+}
+
+class Cp936Transcoder {
+ public:
+  // 转换 len 字节 UTF-8，返回写入字节数。输出不会长于输入，cap ≥ len 时不会截断；
+  // 否则在字符边界截断
+  size_t convert(const uint8_t* in, size_t len, uint8_t* out, size_t cap) {
+    size_t i = 0, o = 0;
+    while (i < len) {
+      const uint8_t c = in[i];
+      if (c < 0x80) {  // ASCII 快路径
+        if (o >= cap) break;
+        out[o++] = c;
+        i++;
+        continue;
+      }
+      uint32_t ucs = 0;
+      const size_t used = decodeUtf8(in + i, len - i, ucs);
+      uint16_t code = ucs == UINT32_MAX ? 0 : lookup(ucs);
+      if (!code) {
+        code = CP936_UNMAPPED;
+        unmapped_++;
+      }
+      if (o + (code < 0x100 ? 1 : 2) > cap) break;
+      o += putCp936(code, out + o);
+      i += used;
+    }
+    return o;
+  }
+
+  uint32_t hits() const { return hits_; }
+  uint32_t misses() const { return misses_; }
+  uint32_t unmapped() const { return unmapped_; }
+
+ private:
+  static_assert(CP936_CACHE_SIZE >= 2 && (CP936_CACHE_SIZE & (CP936_CACHE_SIZE - 1)) == 0,
+                "CP936_CACHE_SIZE must be a power of two");
+  static constexpr uint32_t kCacheBits = (uint32_t)__builtin_ctz(CP936_CACHE_SIZE);
+
+  uint16_t lookup(uint32_t ucs) {
+    if (ucs > 0xFFFF) return 0;
+    const uint32_t slot = (ucs * 0x9E3779B1u) >> (32 - kCacheBits);  // 乘法散列，相邻码位分散到不同槽
+    if (tag_[slot] == ucs) {
+      hits_++;
+      return code_[slot];
+    }
+    misses_++;
+    const uint16_t code = cp936Lookup(ucs);
+    tag_[slot]  = (uint16_t)ucs;  // ucs ≥ 0x80，0 表示空槽
+    code_[slot] = code;
+    return code;
+  }
+
+  uint16_t tag_[CP936_CACHE_SIZE]  = {};
+  uint16_t code_[CP936_CACHE_SIZE] = {};
+  uint32_t hits_     = 0;
+  uint32_t misses_   = 0;
+  uint32_t unmapped_ = 0;
+};
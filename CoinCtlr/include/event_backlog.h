@@ -0,0 +1,157 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "event_stamp.h"
+
+// ==== 断线续传：事件积压与批量重放 ====
+// 设备为每条 coin/status 事件分配序号（event_stamp.h 的 seq），并在有界环形缓冲里保留最近 N 条。
+// 客户端重连并重新订阅后发送 CMD_RESUME(会话号, 已收到的最后 seq)，设备用一条（MTU 不足时多条）
+// EVT_RESUME_BATCH 回放之后的事件；首帧带当前会话快照，后续帧只带条目：
+//   首帧：[0x13][flags u8][sessionId u32][coinTotal u16][coinValue u16][headSeq u16] + 条目...
+//   后续：[0x13][flags u8]（bit3 置位）+ 条目...
+//   条目：[seq u16][kindLen u8][payload...]，kindLen 低 5 位 = 负载长度，bit7 = 1 为 status 事件、0 为 coin 事件；
+//   条目排到帧尾，个数由帧长决定
+// flags：bit0 = 还有后续帧；bit1-2 = 状态（RESUME_STATUS_*）；bit3 = 后续帧（无快照）
+// MTU 23（cap 20）时首帧装得下一条 4 字节 coin 事件，后续帧每帧两条、或一条 ≤ 15 字节的 status 事件。
+// 连后续帧都装不下的事件（> 5 个料斗的吐币完成）不跳过：回放停在它之前并以 RESUME_STATUS_MTU 结束，
+// 客户端协商更大 MTU 后以最后收到的条目 seq 重发 CMD_RESUME。快照在首帧，客户端收完末帧（bit0 清零）再以它为准。
+// 不依赖 Arduino，可在主机侧直接编译。
+
+#define EVENT_KIND_COIN             0x02  // 与特征 UUID 末段一致
+#define EVENT_KIND_STATUS           0x04
+#define EVENT_BACKLOG_MAX_PAYLOAD   20    // 单条事件负载上限（不含时间戳尾部）
+#define RESUME_HEADER_LEN           12    // 首帧（含快照）
+#define RESUME_CONT_HEADER_LEN      2     // 后续帧
+#define RESUME_ENTRY_OVERHEAD       3
+#define RESUME_ENTRY_STATUS         0x80  // kindLen：status 事件
+#define RESUME_ENTRY_LEN_MASK       0x1F
+
+enum ResumeStatus : uint8_t {
+  RESUME_STATUS_OK      = 0,  // 断线期间的事件全部回放
+  RESUME_STATUS_PARTIAL = 1,  // 积压已溢出，较早事件丢失，以快照为准
+  RESUME_STATUS_UNKNOWN = 2,  // 会话号不匹配，需重新开启会话
+  RESUME_STATUS_MTU     = 3,  // 下一条事件超出对端 MTU，回放到此为止（之前的条目有效），以快照为准
+};
+
+#define RESUME_FLAG_MORE            0x01
+#define RESUME_FLAG_CONTINUED       0x08
+
+struct ResumeSnapshot {
+  uint32_t sessionId;
+  uint16_t coinTotal;
+  uint16_t coinValue;
+  uint16_t headSeq;   // 设备最后分配的 seq
+  uint8_t  status;
+};
+
+// seq 回绕比较：a 在 b 之后
+inline bool seqAfter(uint16_t a, uint16_t b) { return (int16_t)(a - b) > 0; }
+
+template <uint8_t N>
+class EventBacklog {
+ public:
+  void push(uint16_t seq, uint8_t kind, const uint8_t* payload, size_t len) {
+    Entry& e = entries_[head_];
+    e.seq  = seq;
+    e.kind = kind;
+    e.len  = (uint8_t)(len < EVENT_BACKLOG_MAX_PAYLOAD ? len : EVENT_BACKLOG_MAX_PAYLOAD);
+    memcpy(e.payload, payload, e.len);
+    head_ = (uint8_t)((head_ + 1) % N);
+    if (count_ < N) count_++;
+  }
+
+  void clear() {
+    head_  = 0;
+    count_ = 0;
+  }
+
+  // afterSeq 之后直到 headSeq 的事件是否都还在积压中
+  bool covers(uint16_t afterSeq, uint16_t headSeq) const {
+    const uint16_t missed = (uint16_t)(headSeq - afterSeq);
+    if (!seqAfter(headSeq, afterSeq)) return true;
+    if (!count_) return false;
+    const Entry& oldest = entries_[(head_ + N - count_) % N];
+    return missed <= count_ && !seqAfter(oldest.seq, (uint16_t)(afterSeq + 1));
+  }
+
+  // 构建一帧 EVT_RESUME_BATCH：first 为首帧（带快照）；从 cursor 之后的事件开始装入，装满 cap 字节为止；
+  // 返回帧长并推进 cursor（只越过已装入的事件），仍有未装入的事件时置 more
+  size_t buildResumeFrame(uint8_t eventId, const ResumeSnapshot& snap, bool first, uint16_t& cursor,
+                          uint8_t* out, size_t cap) const {
+    const size_t header = first ? RESUME_HEADER_LEN : RESUME_CONT_HEADER_LEN;
+    if (cap < header) return 0;
+    size_t len = header;
+    uint8_t count = 0;
+    uint8_t status = snap.status;
+    bool more = false;
+    if (snap.status != RESUME_STATUS_UNKNOWN) {
+      for (uint8_t i = 0; i < count_; i++) {
+        const Entry& e = entries_[(head_ + N - count_ + i) % N];
+        if (!seqAfter(e.seq, cursor)) continue;
+        if (len + RESUME_ENTRY_OVERHEAD + e.len > cap) {
+          // 后续帧空帧都放不下：不能丢弃，结束回放并告知客户端；首帧放不下的留给后续帧
+          if (count == 0 && !first) status = RESUME_STATUS_MTU;
+          else more = true;
+          break;
+        }
+        putLe16(out + len, e.seq);
+        len += 2;
+        out[len++] = (uint8_t)((e.kind == EVENT_KIND_STATUS ? RESUME_ENTRY_STATUS : 0) | e.len);
+        memcpy(out + len, e.payload, e.len);
+        len += e.len;
+        cursor = e.seq;
+        count++;
+      }
+    }
+    out[0] = eventId;
+    out[1] = (uint8_t)((more ? RESUME_FLAG_MORE : 0) | (status << 1) | (first ? 0 : RESUME_FLAG_CONTINUED));
+    if (first) {
+      putLe32(out + 2, snap.sessionId);
+      putLe16(out + 6, snap.coinTotal);
+      putLe16(out + 8, snap.coinValue);
+      putLe16(out + 10, snap.headSeq);
+    }
+    return len;
+  }
+
+ private:
+  struct Entry {
+    uint16_t seq;
+    uint8_t  kind;
+    uint8_t  len;
+    uint8_t  payload[EVENT_BACKLOG_MAX_PAYLOAD];
+  };
+
+  Entry   entries_[N] = {};
+  uint8_t head_  = 0;
+  uint8_t count_ = 0;
+};
+
+// 解析一帧 EVT_RESUME_BATCH 的条目（主机侧工具与测试用）；每个条目调用 fn(kind, seq, payload, len)，
+// 首帧时填写 snap，返回 false 表示帧格式错误
+template <typename Fn>
+inline bool parseResumeFrame(const uint8_t* p, size_t len, ResumeSnapshot& snap, Fn&& fn) {
+  if (len < RESUME_CONT_HEADER_LEN) return false;
+  const bool first = !(p[1] & RESUME_FLAG_CONTINUED);
+  size_t off = first ? RESUME_HEADER_LEN : RESUME_CONT_HEADER_LEN;
+  if (len < off) return false;
+  snap.status = (uint8_t)((p[1] >> 1) & 0x03);
+  if (first) {
+    snap.sessionId = getLe32(p + 2);
+    snap.coinTotal = getLe16(p + 6);
+    snap.coinValue = getLe16(p + 8);
+    snap.headSeq   = getLe16(p + 10);
+  }
+  while (off < len) {
+    if (off + RESUME_ENTRY_OVERHEAD > len) return false;
+    const uint8_t n = p[off + 2] & RESUME_ENTRY_LEN_MASK;
+    if (off + RESUME_ENTRY_OVERHEAD + n > len) return false;
+    fn((uint8_t)(p[off + 2] & RESUME_ENTRY_STATUS ? EVENT_KIND_STATUS : EVENT_KIND_COIN), getLe16(p + off),
+       p + off + RESUME_ENTRY_OVERHEAD, (size_t)n);
+    off += RESUME_ENTRY_OVERHEAD + n;
+  }
+  return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ==== 事件时间戳（扩展事件格式） ====
+// 客户端用 CMD_SET_EVENT_FORMAT 打开后，coin/status 通知在原有负载之后追加固定长度尾部：
+//   [seq u16][notifyUs u32][originUs u32][readyUs u32]（均为 LE，设备单调时钟低 32 位，us）
+// - seq：事件序号，每条 coin/status 事件递增（无论是否扩展），可据此发现丢包
+// - originUs：事件起点（投币：首个脉冲；吐币：收到指令）
+// - readyUs：设备侧判定完成（投币：末个脉冲；吐币：继电器全部停止）
+// - notifyUs：调用 notify 的时刻
+// 旧字段位置不变，只读前几个字节的客户端不受影响。
+// 时钟同步：CMD_TIME_PING(nonce u32) → [EVT_TIME_PONG, nonce u32, rxUs u32, txUs u32]
+// 不依赖 Arduino，主机侧分析工具共用本文件解码。
+
+#define EVENT_STAMP_LEN             14
+#define EVENT_TIME_PONG_LEN         13
+
+struct EventStamp {
+  uint16_t seq;
+  uint32_t notifyUs;
+  uint32_t originUs;
+  uint32_t readyUs;
+};
+
+inline void putLe16(uint8_t* p, uint16_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)(v >> 8);
+}
+
+inline void putLe32(uint8_t* p, uint32_t v) {
+  for (uint8_t i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+inline uint16_t getLe16(const uint8_t* p) {
+  return (uint16_t)(p[0] | ((uint16_t)p[1] << 8));
+}
+
+inline uint32_t getLe32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// 写入尾部，返回写入字节数（EVENT_STAMP_LEN）
+inline size_t encodeEventStamp(uint8_t* out, const EventStamp& s) {
+  putLe16(out, s.seq);
+  putLe32(out + 2, s.notifyUs);
+  putLe32(out + 6, s.originUs);
+  putLe32(out + 10, s.readyUs);
+  return EVENT_STAMP_LEN;
+}
+
+// 从完整通知负载末尾解出尾部；负载过短返回 false
+inline bool decodeEventStamp(const uint8_t* frame, size_t len, EventStamp& s) {
+  if (len < EVENT_STAMP_LEN) return false;
+  const uint8_t* p = frame + len - EVENT_STAMP_LEN;
+  s.seq      = getLe16(p);
+  s.notifyUs = getLe32(p + 2);
+  s.originUs = getLe32(p + 6);
+  s.readyUs  = getLe32(p + 10);
+  return true;
+}
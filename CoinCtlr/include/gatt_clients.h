@@ -0,0 +1,280 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include "event_backlog.h"
+#include "ota_update.h"
+
+// ==== 多连接 GATT：连接表、角色、订阅与会话归属 ====
+// 同时接受最多 BLE_MAX_CONNECTIONS 个中心（如玩家 iPad + 运维终端），每个连接各自记录：
+//   - 角色（CMD_SET_ROLE）：默认玩家，不发该指令的旧 App 照常工作；运维连接只监看、调试打印机、取消吐币。
+//     运维须先完成 MITM 加密配对（与升级特征同一套静态配对码，setPaired 由 GAP 鉴权完成事件调用），否则拒绝，
+//     未配对的中心不能借运维身份取消所有者的吐币
+//   - 订阅：coin/status 特征的 CCCD 按连接写入，通知只发给订阅了该特征的连接
+//   - 事件格式（CMD_SET_EVENT_FORMAT）与 MTU：按连接协商，扩展时间戳尾部只发给要求的连接
+// 会话归属：开局/吐币/打印（小票、图像、二维码）只接受所有者连接；无所有者时首个发出这类指令的玩家连接
+// 成为所有者。所有者断线后归属按对端地址保留 CLIENT_OWNER_HOLD_MS：同一地址重连后直接接回（发 CMD_RESUME 或
+// 任一归属指令，不依赖会话号：会话号随 EVT_SESSION_STARTED 广播给所有订阅者，不能当凭据），发过 CMD_SET_ROLE 的
+// 其他玩家一律拒绝，超时后才可认领；从未发 CMD_SET_ROLE 的旧 App 不受保留限制（它不会续传也不处理拒绝事件）。
+// 所有者主动改为运维则立即释放。
+// 固件升级：只接受运维连接（特征本身要求 MITM 加密配对写入），OTA_OP_BEGIN 认领升级，之后的分片/APPLY 只接受该连接；
+// 该连接断开、ABORT 或改回玩家即释放，重连后再发 BEGIN 续传。
+// 扇出：按特征维护订阅者位图，发送时只遍历位图；负载只构造一次，各连接按格式/MTU 取前缀长度，不逐连接拷贝。
+// 本身不加锁、不依赖 Arduino：固件在临界区内修改连接表并取发送目标，临界区外逐个发送；tools/gatt_fanout 共用。
+
+#define CLIENT_NONE                 0xFFFF  // 无连接（会话无所有者）
+#define CLIENT_EVENT_KINDS          8       // 订阅位图按 EVENT_KIND_* 下标
+
+// 一次发送：连接、槽位（回填统计用）与该连接应收的负载长度
+struct ClientTarget {
+  uint16_t conn;
+  uint8_t  slot;
+  uint16_t len;
+};
+
+struct ClientSlot {
+  bool     active;
+  uint16_t conn;
+  uint8_t  addr[6];        // 对端地址（连接事件的 remote_bda）；全 0 = 未知，不与任何地址匹配
+  uint8_t  role;
+  bool     roleSet;        // 发过 CMD_SET_ROLE（识别多连接协议的客户端）
+  bool     paired;         // 链路已 MITM 加密配对（运维角色的前提）
+  uint8_t  subscriptions;  // bit EVENT_KIND_*
+  bool     extended;
+  uint16_t mtu;
+  uint32_t sent;
+  uint32_t dropped;        // 协议栈拒收（发送缓冲满或连接已断）
+};
+
+template <uint8_t N>
+class GattClients {
+  static_assert(N >= 1 && N <= 8, "subscriber masks are 8 bits");
+
+ public:
+  // 新连接占一个槽位（默认玩家、未订阅、基础格式、MTU 23）；addr 为对端地址（可为空）；已满返回 -1
+  int connect(uint16_t conn, const uint8_t* addr = nullptr) {
+    if (find(conn) >= 0) return find(conn);
+    for (uint8_t i = 0; i < N; i++) {
+      if (slots_[i].active) continue;
+      slots_[i] = {};
+      slots_[i].active = true;
+      slots_[i].conn   = conn;
+      slots_[i].role   = CLIENT_ROLE_PLAYER;
+      slots_[i].mtu    = 23;
+      if (addr) memcpy(slots_[i].addr, addr, sizeof(slots_[i].addr));
+      count_++;
+      return i;
+    }
+    return -1;
+  }
+
+  // 断开：清订阅，所有者断开则按其地址转为保留（nowMs 起算超时）；返回该连接是否曾为所有者
+  bool disconnect(uint16_t conn, uint32_t nowMs) {
+    const int i = find(conn);
+    if (i < 0) return false;
+    for (uint8_t k = 0; k < CLIENT_EVENT_KINDS; k++) subscribers_[k] &= (uint8_t)~(1u << i);
+    slots_[i].active = false;
+    count_--;
+    if (otaConn_ == conn) otaConn_ = CLIENT_NONE;
+    if (owner_ != conn) return false;
+    owner_  = CLIENT_NONE;
+    held_   = true;
+    heldMs_ = nowMs;
+    memcpy(heldAddr_, slots_[i].addr, sizeof(heldAddr_));
+    return true;
+  }
+
+  void setSubscribed(uint16_t conn, uint8_t kind, bool on) {
+    const int i = find(conn);
+    if (i < 0 || kind >= CLIENT_EVENT_KINDS) return;
+    if (on) {
+      slots_[i].subscriptions |= (uint8_t)(1u << kind);
+      subscribers_[kind] |= (uint8_t)(1u << i);
+    } else {
+      slots_[i].subscriptions &= (uint8_t)~(1u << kind);
+      subscribers_[kind] &= (uint8_t)~(1u << i);
+    }
+  }
+
+  void setMtu(uint16_t conn, uint16_t mtu) {
+    const int i = find(conn);
+    if (i >= 0) slots_[i].mtu = mtu;
+  }
+
+  void setExtended(uint16_t conn, bool on) {
+    const int i = find(conn);
+    if (i >= 0) slots_[i].extended = on;
+  }
+
+  // 核心逻辑只要有一个连接要求扩展格式就生成时间戳尾部，其余连接发送时截掉
+  bool anyExtended() const {
+    for (uint8_t i = 0; i < N; i++) {
+      if (slots_[i].active && slots_[i].extended) return true;
+    }
+    return false;
+  }
+
+  // 配对结果按对端地址落到连接（GAP 事件只带地址）；配对失败的运维连接降回玩家。返回是否找到连接
+  bool setPaired(const uint8_t* addr, bool mitm) {
+    bool found = false;
+    for (uint8_t i = 0; i < N; i++) {
+      if (!slots_[i].active || !sameAddr(slots_[i].addr, addr)) continue;
+      slots_[i].paired = mitm;
+      if (!mitm && slots_[i].role == CLIENT_ROLE_OPERATOR) setRole(slots_[i].conn, CLIENT_ROLE_PLAYER);
+      found = true;
+    }
+    return found;
+  }
+
+  // 未知角色、未配对的连接声明运维返回 false；所有者改为运维即释放归属
+  bool setRole(uint16_t conn, uint8_t role) {
+    const int i = find(conn);
+    if (i < 0 || (role != CLIENT_ROLE_PLAYER && role != CLIENT_ROLE_OPERATOR)) return false;
+    if (role == CLIENT_ROLE_OPERATOR && !slots_[i].paired) return false;
+    slots_[i].role    = role;
+    slots_[i].roleSet = true;
+    if (role != CLIENT_ROLE_PLAYER && owner_ == conn) owner_ = CLIENT_NONE;
+    if (role != CLIENT_ROLE_OPERATOR && otaConn_ == conn) otaConn_ = CLIENT_NONE;
+    return true;
+  }
+
+  // 升级帧鉴权：返回 0 放行，否则为 REJECT_*。非运维连接一律拒绝；BEGIN 认领（已有其他连接在升级则拒绝），
+  // 其余操作只接受认领的连接；ABORT 放行后释放
+  uint8_t authorizeOta(uint16_t conn, uint8_t otaOp) {
+    const int i = find(conn);
+    if (i < 0 || slots_[i].role != CLIENT_ROLE_OPERATOR) return REJECT_ROLE;
+    if (otaOp == OTA_OP_BEGIN) {
+      if (otaConn_ != CLIENT_NONE && otaConn_ != conn) return REJECT_NOT_OWNER;
+      otaConn_ = conn;
+      return 0;
+    }
+    if (otaConn_ != conn) return REJECT_NOT_OWNER;
+    if (otaOp == OTA_OP_ABORT) otaConn_ = CLIENT_NONE;
+    return 0;
+  }
+
+  // 指令鉴权：返回 0 放行，否则为 REJECT_*；放行开局/吐币类指令时顺带认领归属
+  uint8_t authorize(uint16_t conn, uint8_t op, uint32_t nowMs) {
+    const int i = find(conn);
+    if (i < 0) return REJECT_NOT_OWNER;
+    const bool player   = slots_[i].role == CLIENT_ROLE_PLAYER;
+    const bool owned    = owner_ != CLIENT_NONE && owner_ != conn;
+    const bool returned = heldFor(nowMs) && sameAddr(slots_[i].addr, heldAddr_);
+    switch (op) {
+      case CMD_START_SESSION:
+      case CMD_PAYOUT:
+      case CMD_PRINT_RECEIPT:
+      case CMD_PRINT_RASTER:
+      case CMD_PRINT_QR:
+        if (!player) return REJECT_ROLE;
+        if (owned || (heldFor(nowMs) && !returned && slots_[i].roleSet)) return REJECT_NOT_OWNER;
+        owner_ = conn;
+        held_  = false;
+        return 0;
+      case CMD_PAYOUT_CANCEL:  // 停料斗属于安全操作，运维也可执行
+      case CMD_DEBUG_PRINTER:
+        if (owned && player) return REJECT_NOT_OWNER;
+        return 0;
+      case CMD_RESUME:         // 任何连接都可取快照；断线所有者的地址重连时接回归属
+        if (player && owner_ == CLIENT_NONE && returned) {
+          owner_ = conn;
+          held_  = false;
+        }
+        return 0;
+      default:
+        return 0;
+    }
+  }
+
+  // 某类事件的发送目标：订阅者按各自格式取 len 或 len + stampLen，再受 MTU - 3 限制；返回目标数。
+  // 时间戳尾部放不下时整段不发（只发基础负载），不发截断的尾部：客户端按长度判断有无尾部，截断后无法识别
+  uint8_t targets(uint8_t kind, size_t len, size_t stampLen, ClientTarget* out) const {
+    if (kind >= CLIENT_EVENT_KINDS) return 0;
+    uint8_t n = 0;
+    for (uint8_t mask = subscribers_[kind]; mask; mask &= (uint8_t)(mask - 1)) {
+      const uint8_t i = (uint8_t)__builtin_ctz(mask);
+      const bool stamped = slots_[i].extended && stampLen && len + stampLen <= capacity(slots_[i]);
+      out[n++] = { slots_[i].conn, i, clamp(slots_[i], stamped ? len + stampLen : len) };
+    }
+    return n;
+  }
+
+  // 单播应答（TIME_PONG/CAPS/续传/角色/拒绝）：该连接须已订阅 kind
+  bool target(uint16_t conn, uint8_t kind, size_t len, ClientTarget& out) const {
+    const int i = find(conn);
+    if (i < 0 || kind >= CLIENT_EVENT_KINDS || !(subscribers_[kind] & (1u << i))) return false;
+    out = { conn, (uint8_t)i, clamp(slots_[i], len) };
+    return true;
+  }
+
+  // 发送结果回填统计；槽位期间被其他连接复用则忽略
+  void noteSent(const ClientTarget& t, bool ok) {
+    ClientSlot& s = slots_[t.slot];
+    if (!s.active || s.conn != t.conn) return;
+    if (ok) s.sent++;
+    else s.dropped++;
+  }
+
+  // 取目标、发送、回填一次完成（主机侧用；固件需在取目标与回填时加锁，分开调用）
+  template <class Send>
+  uint8_t fanout(uint8_t kind, const uint8_t* data, size_t len, size_t stampLen, Send&& send) {
+    ClientTarget t[N];
+    const uint8_t n = targets(kind, len, stampLen, t);
+    for (uint8_t i = 0; i < n; i++) noteSent(t[i], send(t[i].conn, data, t[i].len));
+    return n;
+  }
+
+  uint8_t count() const { return count_; }
+  uint16_t owner() const { return owner_; }
+  uint16_t otaOwner() const { return otaConn_; }
+  bool held(uint32_t nowMs) const { return heldFor(nowMs); }  // 所有者断线、归属仍保留
+  bool isOwner(uint16_t conn) const { return owner_ == conn; }
+  uint16_t mtu(uint16_t conn) const {
+    const int i = find(conn);
+    return i < 0 ? 23 : slots_[i].mtu;
+  }
+  bool paired(uint16_t conn) const {
+    const int i = find(conn);
+    return i >= 0 && slots_[i].paired;
+  }
+  uint8_t role(uint16_t conn) const {
+    const int i = find(conn);
+    return i < 0 ? CLIENT_ROLE_PLAYER : slots_[i].role;
+  }
+  uint8_t subscribers(uint8_t kind) const { return kind < CLIENT_EVENT_KINDS ? subscribers_[kind] : 0; }
+  const ClientSlot& slot(uint8_t i) const { return slots_[i]; }
+
+ private:
+  int find(uint16_t conn) const {
+    for (uint8_t i = 0; i < N; i++) {
+      if (slots_[i].active && slots_[i].conn == conn) return i;
+    }
+    return -1;
+  }
+
+  bool heldFor(uint32_t nowMs) const { return held_ && (uint32_t)(nowMs - heldMs_) < CLIENT_OWNER_HOLD_MS; }
+
+  static bool sameAddr(const uint8_t* a, const uint8_t* b) {
+    static const uint8_t kUnknown[6] = {};
+    return memcmp(a, kUnknown, 6) != 0 && memcmp(a, b, 6) == 0;
+  }
+
+  static size_t capacity(const ClientSlot& s) { return s.mtu > 3 ? s.mtu - 3 : 20; }
+
+  static uint16_t clamp(const ClientSlot& s, size_t len) {
+    const size_t cap = capacity(s);
+    return (uint16_t)(len < cap ? len : cap);
+  }
+
+  ClientSlot slots_[N] = {};
+  uint8_t subscribers_[CLIENT_EVENT_KINDS] = {};
+  uint8_t  count_  = 0;
+  uint16_t owner_  = CLIENT_NONE;
+  bool     held_   = false;  // 所有者断线，归属保留到 heldMs_ + CLIENT_OWNER_HOLD_MS
+  uint32_t heldMs_ = 0;
+  uint8_t  heldAddr_[6] = {};  // 断线所有者的地址：只有它重连可接回
+  uint16_t otaConn_ = CLIENT_NONE;  // 正在升级的连接
+};
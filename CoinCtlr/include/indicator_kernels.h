@@ -0,0 +1,194 @@
+// 指标批量内核：由 indicators.h 在各指令集的编译选项下各包含一次（故无 #pragma once）。
+// 包含前须定义 TA_KERNEL_NS（命名空间），并在该命名空间内定义向量类型 Vec（接口同 TaScalarVec）。
+// 每个内核的浮点运算顺序与 tools/ta_bench 中的标量参考实现逐元素一致，结果按位相同：
+//   - SMA / 布林带：窗口和由相邻差前缀和（scan）得到，输入为定点整数，和在 2^53 内精确，与求和顺序无关
+//   - EMA / RSI / 回测：逐根递推，不能沿时间向量化；改为一次处理 W 条序列（随机窗口），每条内部顺序不变
+
+namespace TA_KERNEL_NS {
+
+// 前 period - 1 项为 NaN
+inline void sma(const int32_t* x, size_t n, uint16_t period, double* out) {
+  if (!period || n < period) {
+    for (size_t i = 0; i < n; i++) out[i] = taNan();
+    return;
+  }
+  double s = 0;
+  for (size_t i = 0; i < period; i++) {
+    s += x[i];
+    out[i] = taNan();
+  }
+  const double p = period;
+  out[period - 1] = s / p;
+  size_t i = period;
+  const Vec vp = Vec::set1(p);
+  Vec carry = Vec::set1(s);
+  for (; i + Vec::W <= n; i += Vec::W) {
+    const Vec d = Vec::sub(Vec::loadInt(x + i), Vec::loadInt(x + i - period));
+    const Vec sum = Vec::add(carry, Vec::scan(d));
+    Vec::store(out + i, Vec::div(sum, vp));
+    carry = Vec::last(sum);
+  }
+  s = Vec::lane0(carry);
+  for (; i < n; i++) {
+    s += (double)x[i] - (double)x[i - period];
+    out[i] = s / p;
+  }
+}
+
+// 中轨 = SMA，上/下轨 = 中轨 ± k·总体标准差；前 period - 1 项为 NaN
+inline void bollinger(const int32_t* x, size_t n, uint16_t period, double k, double* mid, double* upper,
+                      double* lower) {
+  if (!period || n < period) {
+    for (size_t i = 0; i < n; i++) mid[i] = upper[i] = lower[i] = taNan();
+    return;
+  }
+  double s = 0, q = 0;
+  for (size_t i = 0; i < period; i++) {
+    const double v = x[i];
+    s += v;
+    q += v * v;
+    mid[i] = upper[i] = lower[i] = taNan();
+  }
+  const double p = period;
+  size_t i = period - 1;
+  {
+    const double m = s / p;
+    const double var = taMax0(q / p - m * m);
+    const double sd = sqrt(var);
+    mid[i] = m;
+    upper[i] = m + k * sd;
+    lower[i] = m - k * sd;
+  }
+  i++;
+  const Vec vp = Vec::set1(p), vk = Vec::set1(k), zero = Vec::set1(0);
+  Vec cs = Vec::set1(s), cq = Vec::set1(q);
+  for (; i + Vec::W <= n; i += Vec::W) {
+    const Vec a = Vec::loadInt(x + i), b = Vec::loadInt(x + i - period);
+    const Vec sum = Vec::add(cs, Vec::scan(Vec::sub(a, b)));
+    const Vec sq = Vec::add(cq, Vec::scan(Vec::sub(Vec::mul(a, a), Vec::mul(b, b))));
+    const Vec m = Vec::div(sum, vp);
+    const Vec var = Vec::max(Vec::sub(Vec::div(sq, vp), Vec::mul(m, m)), zero);
+    const Vec kd = Vec::mul(vk, Vec::sqrt(var));
+    Vec::store(mid + i, m);
+    Vec::store(upper + i, Vec::add(m, kd));
+    Vec::store(lower + i, Vec::sub(m, kd));
+    cs = Vec::last(sum);
+    cq = Vec::last(sq);
+  }
+  s = Vec::lane0(cs);
+  q = Vec::lane0(cq);
+  for (; i < n; i++) {
+    const double a = x[i], b = x[i - period];
+    s += a - b;
+    q += a * a - b * b;
+    const double m = s / p;
+    const double var = taMax0(q / p - m * m);
+    const double sd = sqrt(var);
+    mid[i] = m;
+    upper[i] = m + k * sd;
+    lower[i] = m - k * sd;
+  }
+}
+
+// 一组 V::W 条序列：以前 period 根的 SMA 为种子，之后 e += α(x - e)，α = 2 / (period + 1)
+template <class V>
+inline void emaLanes(const int32_t* const* x, size_t n, uint16_t period, double* const* out) {
+  const V nan = V::set1(taNan());
+  size_t t = 0;
+  V s = V::set1(0);
+  for (; t < period && t < n; t++) {
+    s = V::add(s, V::gather(x, t));
+    if (t + 1 < period) V::scatter(out, t, nan);
+  }
+  if (t < period) return;
+  V e = V::div(s, V::set1(period));
+  V::scatter(out, period - 1, e);
+  const V a = V::set1(2.0 / (period + 1));
+  for (; t < n; t++) {
+    e = V::add(e, V::mul(a, V::sub(V::gather(x, t), e)));
+    V::scatter(out, t, e);
+  }
+}
+
+// Wilder RSI：前 period 个涨跌幅取均值为种子，之后 avg = (avg·(period - 1) + 当根) / period；
+// 第 0..period - 1 项为 NaN，平均跌幅为 0 时取 100
+template <class V>
+inline void rsiLanes(const int32_t* const* x, size_t n, uint16_t period, double* const* out) {
+  const V nan = V::set1(taNan()), zero = V::set1(0), hundred = V::set1(100), one = V::set1(1);
+  if (n) V::scatter(out, 0, nan);
+  V g = zero, l = zero;
+  size_t t = 1;
+  for (; t <= period && t < n; t++) {
+    const V d = V::sub(V::gather(x, t), V::gather(x, t - 1));
+    g = V::add(g, V::max(d, zero));
+    l = V::add(l, V::max(V::sub(zero, d), zero));
+    if (t < period) V::scatter(out, t, nan);
+  }
+  if (t <= period) return;
+  const V p = V::set1(period), pm1 = V::set1(period - 1);
+  g = V::div(g, p);
+  l = V::div(l, p);
+  for (t = period;; t++) {
+    const V r = V::sub(hundred, V::div(hundred, V::add(one, V::div(g, l))));
+    V::scatter(out, t, V::select(V::eq(l, zero), hundred, r));
+    if (t + 1 >= n) break;
+    const V d = V::sub(V::gather(x, t + 1), V::gather(x, t));
+    g = V::div(V::add(V::mul(g, pm1), V::max(d, zero)), p);
+    l = V::div(V::add(V::mul(l, pm1), V::max(V::sub(zero, d), zero)), p);
+  }
+}
+
+// 每条序列持仓 pos[t]（-1/0/1，收盘时决定）吃下一根涨跌：权益 += pos[t]·(close[t+1] - close[t])；
+// 输出期末权益与最大回撤（定点价格单位，整数运算，精确）
+template <class V>
+inline void backtestLanes(const int32_t* const* close, const int8_t* const* pos, uint32_t len, double* pnl,
+                          double* drawdown) {
+  V eq = V::set1(0), peak = eq, dd = eq;
+  if (len) {
+    V c0 = V::gather(close, 0);
+    for (uint32_t t = 0; t + 1 < len; t++) {
+      const V c1 = V::gather(close, t + 1);
+      eq = V::add(eq, V::mul(V::gather(pos, t), V::sub(c1, c0)));
+      peak = V::max(peak, eq);
+      dd = V::max(dd, V::sub(peak, eq));
+      c0 = c1;
+    }
+  }
+  V::store(pnl, eq);
+  V::store(drawdown, dd);
+}
+
+inline void ema(const int32_t* const* x, size_t lanes, size_t n, uint16_t period, double* const* out) {
+  if (!period) return;
+  size_t l = 0;
+  for (; l + Vec::W <= lanes; l += Vec::W) emaLanes<Vec>(x + l, n, period, out + l);
+  for (; l < lanes; l++) emaLanes<TaScalarVec>(x + l, n, period, out + l);
+}
+
+inline void rsi(const int32_t* const* x, size_t lanes, size_t n, uint16_t period, double* const* out) {
+  if (!period) return;
+  size_t l = 0;
+  for (; l + Vec::W <= lanes; l += Vec::W) rsiLanes<Vec>(x + l, n, period, out + l);
+  for (; l < lanes; l++) rsiLanes<TaScalarVec>(x + l, n, period, out + l);
+}
+
+inline void backtest(const int32_t* close, const int8_t* pos, const uint32_t* starts, size_t windows, uint32_t len,
+                     double* pnl, double* drawdown) {
+  const int32_t* c[Vec::W];
+  const int8_t* p[Vec::W];
+  size_t w = 0;
+  for (; w + Vec::W <= windows; w += Vec::W) {
+    for (size_t j = 0; j < Vec::W; j++) {
+      c[j] = close + starts[w + j];
+      p[j] = pos + starts[w + j];
+    }
+    backtestLanes<Vec>(c, p, len, pnl + w, drawdown + w);
+  }
+  for (; w < windows; w++) {
+    c[0] = close + starts[w];
+    p[0] = pos + starts[w];
+    backtestLanes<TaScalarVec>(c, p, len, pnl + w, drawdown + w);
+  }
+}
+
+}  // namespace TA_KERNEL_NS
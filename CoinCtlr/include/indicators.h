@@ -0,0 +1,409 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// ==== 技术指标（SMA / EMA / RSI / 布林带 / 随机窗口回测） ====
+// 输入为结构数组的定点收盘价列（int32，KLinePack::read 直接读出，价格 = 值 / 10^priceDigits），输出 double，单位同输入。
+// 两种用法：
+//   - 批量：taSma / taBollinger 沿时间向量化；taEma / taRsi / taBacktest 是逐根递推，按多条序列（如一批随机窗口）并行
+//   - 增量：TaSma / TaEma / TaRsi / TaBollinger / TaBacktest 每来一根 O(1) 更新，不分配内存，固件可直接用
+// 批量内核（indicator_kernels.h）在主机上按运行时 CPU 选 AVX2 / SSE2，其他平台（ESP32）用标量版本；
+// 各版本与增量版本的结果按位相同。前提是窗口内的和精确：period · max|x|² < 2^53（布林带）；SMA 只需 period · max|x| < 2^53。
+// 上限取决于定点最大值，tools/ta_bench 启动时按数据包逐币种打印（内置数据中最紧的是 4 位小数的 BNB，
+// 最高 9027700 → period ≤ 111；DOGE 最高 6898200 → period ≤ 189），超出时告警。
+// ESP32 的 FPU 只有单精度，double 走软件运算，增量版本每根约数微秒。
+// 不依赖 Arduino。
+
+enum TaIsa : uint8_t {
+  TA_ISA_SCALAR = 0,
+  TA_ISA_SSE2,
+  TA_ISA_AVX2,
+};
+
+inline double taNan() { return __builtin_nan(""); }
+
+// 与 maxpd 相同语义（a > b ? a : b），保证标量与向量结果一致
+inline double taMax(double a, double b) { return a > b ? a : b; }
+inline double taMax0(double v) { return taMax(v, 0); }
+
+// 单通道“向量”：标量版本内核及各版本处理余数时使用
+struct TaScalarVec {
+  static constexpr size_t W = 1;
+  typedef bool Mask;
+  double v;
+
+  static TaScalarVec set1(double a) { return { a }; }
+  static TaScalarVec loadInt(const int32_t* p) { return { (double)p[0] }; }
+  static void store(double* p, TaScalarVec a) { p[0] = a.v; }
+  static TaScalarVec add(TaScalarVec a, TaScalarVec b) { return { a.v + b.v }; }
+  static TaScalarVec sub(TaScalarVec a, TaScalarVec b) { return { a.v - b.v }; }
+  static TaScalarVec mul(TaScalarVec a, TaScalarVec b) { return { a.v * b.v }; }
+  static TaScalarVec div(TaScalarVec a, TaScalarVec b) { return { a.v / b.v }; }
+  static TaScalarVec max(TaScalarVec a, TaScalarVec b) { return { taMax(a.v, b.v) }; }
+  static TaScalarVec sqrt(TaScalarVec a) { return { ::sqrt(a.v) }; }
+  static Mask eq(TaScalarVec a, TaScalarVec b) { return a.v == b.v; }
+  static TaScalarVec select(Mask m, TaScalarVec a, TaScalarVec b) { return m ? a : b; }
+  static TaScalarVec scan(TaScalarVec a) { return a; }   // 前缀和
+  static TaScalarVec last(TaScalarVec a) { return a; }   // 末通道广播
+  static double lane0(TaScalarVec a) { return a.v; }
+  template <class T>
+  static TaScalarVec gather(const T* const* p, size_t t) { return { (double)p[0][t] }; }
+  static void scatter(double* const* p, size_t t, TaScalarVec a) { p[0][t] = a.v; }
+};
+
+namespace ta_scalar {
+typedef TaScalarVec Vec;
+}
+#define TA_KERNEL_NS ta_scalar
+#include "indicator_kernels.h"
+#undef TA_KERNEL_NS
+
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define TA_HAVE_X86 1
+#include <immintrin.h>
+
+namespace ta_sse2 {
+struct Vec {
+  static constexpr size_t W = 2;
+  typedef __m128d Mask;
+  __m128d v;
+
+  static Vec set1(double a) { return { _mm_set1_pd(a) }; }
+  static Vec loadInt(const int32_t* p) { return { _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)p)) }; }
+  static void store(double* p, Vec a) { _mm_storeu_pd(p, a.v); }
+  static Vec add(Vec a, Vec b) { return { _mm_add_pd(a.v, b.v) }; }
+  static Vec sub(Vec a, Vec b) { return { _mm_sub_pd(a.v, b.v) }; }
+  static Vec mul(Vec a, Vec b) { return { _mm_mul_pd(a.v, b.v) }; }
+  static Vec div(Vec a, Vec b) { return { _mm_div_pd(a.v, b.v) }; }
+  static Vec max(Vec a, Vec b) { return { _mm_max_pd(a.v, b.v) }; }
+  static Vec sqrt(Vec a) { return { _mm_sqrt_pd(a.v) }; }
+  static Mask eq(Vec a, Vec b) { return _mm_cmpeq_pd(a.v, b.v); }
+  static Vec select(Mask m, Vec a, Vec b) { return { _mm_or_pd(_mm_and_pd(m, a.v), _mm_andnot_pd(m, b.v)) }; }
+  static Vec scan(Vec a) { return { _mm_add_pd(a.v, _mm_unpacklo_pd(_mm_setzero_pd(), a.v)) }; }
+  static Vec last(Vec a) { return { _mm_unpackhi_pd(a.v, a.v) }; }
+  static double lane0(Vec a) { return _mm_cvtsd_f64(a.v); }
+  template <class T>
+  static Vec gather(const T* const* p, size_t t) { return { _mm_set_pd((double)p[1][t], (double)p[0][t]) }; }
+  static void scatter(double* const* p, size_t t, Vec a) {
+    _mm_storel_pd(p[0] + t, a.v);
+    _mm_storeh_pd(p[1] + t, a.v);
+  }
+};
+}  // namespace ta_sse2
+#define TA_KERNEL_NS ta_sse2
+#include "indicator_kernels.h"
+#undef TA_KERNEL_NS
+
+// AVX2 版本只在本段按 avx2 编译（不含 FMA，乘加分两步舍入，与标量一致），运行时确认 CPU 支持后才调用
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+namespace ta_avx2 {
+struct Vec {
+  static constexpr size_t W = 4;
+  typedef __m256d Mask;
+  __m256d v;
+
+  static Vec set1(double a) { return { _mm256_set1_pd(a) }; }
+  static Vec loadInt(const int32_t* p) { return { _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)p)) }; }
+  static void store(double* p, Vec a) { _mm256_storeu_pd(p, a.v); }
+  static Vec add(Vec a, Vec b) { return { _mm256_add_pd(a.v, b.v) }; }
+  static Vec sub(Vec a, Vec b) { return { _mm256_sub_pd(a.v, b.v) }; }
+  static Vec mul(Vec a, Vec b) { return { _mm256_mul_pd(a.v, b.v) }; }
+  static Vec div(Vec a, Vec b) { return { _mm256_div_pd(a.v, b.v) }; }
+  static Vec max(Vec a, Vec b) { return { _mm256_max_pd(a.v, b.v) }; }
+  static Vec sqrt(Vec a) { return { _mm256_sqrt_pd(a.v) }; }
+  static Mask eq(Vec a, Vec b) { return _mm256_cmp_pd(a.v, b.v, _CMP_EQ_OQ); }
+  static Vec select(Mask m, Vec a, Vec b) { return { _mm256_blendv_pd(b.v, a.v, m) }; }
+  // [a b c d] → [a a+b a+b+c a+b+c+d]：先错 1 个通道相加，再错 2 个通道相加
+  static Vec scan(Vec a) {
+    const __m256d z = _mm256_setzero_pd();
+    __m256d s = _mm256_add_pd(a.v, _mm256_blend_pd(_mm256_permute4x64_pd(a.v, 0x90), z, 0x1));
+    s = _mm256_add_pd(s, _mm256_permute2f128_pd(s, s, 0x08));
+    return { s };
+  }
+  static Vec last(Vec a) { return { _mm256_permute4x64_pd(a.v, 0xFF) }; }
+  static double lane0(Vec a) { return _mm256_cvtsd_f64(a.v); }
+  template <class T>
+  static Vec gather(const T* const* p, size_t t) {
+    return { _mm256_set_pd((double)p[3][t], (double)p[2][t], (double)p[1][t], (double)p[0][t]) };
+  }
+  static void scatter(double* const* p, size_t t, Vec a) {
+    const __m128d lo = _mm256_castpd256_pd128(a.v), hi = _mm256_extractf128_pd(a.v, 1);
+    _mm_storel_pd(p[0] + t, lo);
+    _mm_storeh_pd(p[1] + t, lo);
+    _mm_storel_pd(p[2] + t, hi);
+    _mm_storeh_pd(p[3] + t, hi);
+  }
+};
+}  // namespace ta_avx2
+#define TA_KERNEL_NS ta_avx2
+#include "indicator_kernels.h"
+#undef TA_KERNEL_NS
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif  // __SSE2__
+
+inline bool taIsaSupported(TaIsa isa) {
+  switch (isa) {
+    case TA_ISA_SCALAR:
+      return true;
+#ifdef TA_HAVE_X86
+    case TA_ISA_SSE2:
+      return true;
+    case TA_ISA_AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+inline TaIsa taBestIsa() {
+  static const TaIsa best = taIsaSupported(TA_ISA_AVX2) ? TA_ISA_AVX2
+                            : taIsaSupported(TA_ISA_SSE2) ? TA_ISA_SSE2
+                                                          : TA_ISA_SCALAR;
+  return best;
+}
+
+inline const char* taIsaName(TaIsa isa) {
+  static const char* const kNames[] = { "scalar", "sse2", "avx2" };
+  return isa <= TA_ISA_AVX2 ? kNames[isa] : "?";
+}
+
+// 不支持的指令集退回标量版本
+#ifdef TA_HAVE_X86
+#define TA_DISPATCH(isa, call)                                    \
+  switch (taIsaSupported(isa) ? isa : TA_ISA_SCALAR) {            \
+    case TA_ISA_AVX2: ta_avx2::call; break;                       \
+    case TA_ISA_SSE2: ta_sse2::call; break;                       \
+    default:          ta_scalar::call; break;                     \
+  }
+#else
+#define TA_DISPATCH(isa, call) ((void)(isa), ta_scalar::call)
+#endif
+
+// 简单移动平均；out[0..period-2] 为 NaN
+inline void taSma(const int32_t* x, size_t n, uint16_t period, double* out, TaIsa isa = taBestIsa()) {
+  TA_DISPATCH(isa, sma(x, n, period, out));
+}
+
+// 布林带：中轨 SMA，上/下轨 ± k 倍总体标准差；前 period - 1 项为 NaN
+inline void taBollinger(const int32_t* x, size_t n, uint16_t period, double k, double* mid, double* upper,
+                        double* lower, TaIsa isa = taBestIsa()) {
+  TA_DISPATCH(isa, bollinger(x, n, period, k, mid, upper, lower));
+}
+
+// lanes 条等长序列（x[j][0..n)）各算一遍 EMA，种子为前 period 根的 SMA；out[j][0..period-2] 为 NaN
+inline void taEma(const int32_t* const* x, size_t lanes, size_t n, uint16_t period, double* const* out,
+                  TaIsa isa = taBestIsa()) {
+  TA_DISPATCH(isa, ema(x, lanes, n, period, out));
+}
+
+// lanes 条等长序列各算一遍 Wilder RSI（0..100）；out[j][0..period-1] 为 NaN
+inline void taRsi(const int32_t* const* x, size_t lanes, size_t n, uint16_t period, double* const* out,
+                  TaIsa isa = taBestIsa()) {
+  TA_DISPATCH(isa, rsi(x, lanes, n, period, out));
+}
+
+// 随机窗口回测：第 w 个窗口为 [starts[w], starts[w] + len)，持仓 pos（-1/0/1，第 t 根收盘时决定，吃第 t+1 根涨跌）
+// 输出每个窗口的期末盈亏与最大回撤（定点价格单位）
+inline void taBacktest(const int32_t* close, const int8_t* pos, const uint32_t* starts, size_t windows, uint32_t len,
+                       double* pnl, double* drawdown, TaIsa isa = taBestIsa()) {
+  TA_DISPATCH(isa, backtest(close, pos, starts, windows, len, pnl, drawdown));
+}
+
+// ==== 增量版本：每根 O(1)，结果与批量版本按位相同 ====
+
+// N 为最大周期（环形缓冲容量）
+template <uint16_t N>
+class TaSma {
+ public:
+  explicit TaSma(uint16_t period = N) : period_(period && period <= N ? period : N) {}
+
+  void reset() {
+    count_ = head_ = 0;
+    sum_ = 0;
+  }
+
+  // 收入一根（定点）；返回当前值，不足 period 根时为 NaN
+  double update(int32_t x) {
+    if (count_ == period_) {
+      sum_ -= buf_[head_];
+    } else {
+      count_++;
+    }
+    buf_[head_] = x;
+    sum_ += x;
+    head_ = (uint16_t)((head_ + 1) % period_);
+    return value();
+  }
+
+  bool ready() const { return count_ == period_; }
+  double value() const { return ready() ? (double)sum_ / period_ : taNan(); }
+
+ private:
+  int32_t  buf_[N];
+  uint16_t period_, count_ = 0, head_ = 0;
+  int64_t  sum_ = 0;
+};
+
+template <uint16_t N>
+class TaBollinger {
+ public:
+  explicit TaBollinger(uint16_t period = N, double k = 2) : period_(period && period <= N ? period : N), k_(k) {}
+
+  void reset() {
+    count_ = head_ = 0;
+    sum_ = sq_ = 0;
+  }
+
+  // 收入一根；返回是否已满 period 根（之后 mid/upper/lower 有效）
+  bool update(int32_t x) {
+    if (count_ == period_) {
+      const int64_t old = buf_[head_];
+      sum_ -= old;
+      sq_ -= old * old;
+    } else {
+      count_++;
+    }
+    buf_[head_] = x;
+    sum_ += x;
+    sq_ += (int64_t)x * x;
+    head_ = (uint16_t)((head_ + 1) % period_);
+    if (!ready()) {
+      mid_ = upper_ = lower_ = taNan();
+      return false;
+    }
+    const double p = period_;
+    const double m = (double)sum_ / p;
+    const double var = taMax0((double)sq_ / p - m * m);
+    const double sd = sqrt(var);
+    mid_ = m;
+    upper_ = m + k_ * sd;
+    lower_ = m - k_ * sd;
+    return true;
+  }
+
+  bool ready() const { return count_ == period_; }
+  double mid() const { return mid_; }
+  double upper() const { return upper_; }
+  double lower() const { return lower_; }
+
+ private:
+  int32_t  buf_[N];
+  uint16_t period_, count_ = 0, head_ = 0;
+  double   k_;
+  int64_t  sum_ = 0, sq_ = 0;
+  double   mid_ = taNan(), upper_ = taNan(), lower_ = taNan();
+};
+
+class TaEma {
+ public:
+  explicit TaEma(uint16_t period) : period_(period ? period : 1), alpha_(2.0 / (period_ + 1)) {}
+
+  void reset() {
+    count_ = 0;
+    sum_ = 0;
+    ema_ = taNan();
+  }
+
+  double update(int32_t x) {
+    if (count_ < period_) {
+      sum_ += x;
+      if (++count_ == period_) ema_ = (double)sum_ / period_;
+    } else {
+      ema_ = ema_ + alpha_ * ((double)x - ema_);
+    }
+    return ema_;
+  }
+
+  bool ready() const { return count_ == period_; }
+  double value() const { return ema_; }
+
+ private:
+  uint16_t period_, count_ = 0;
+  double   alpha_;
+  int64_t  sum_ = 0;
+  double   ema_ = taNan();
+};
+
+class TaRsi {
+ public:
+  explicit TaRsi(uint16_t period) : period_(period ? period : 1) {}
+
+  void reset() {
+    count_ = 0;
+    sumGain_ = sumLoss_ = 0;
+    rsi_ = taNan();
+  }
+
+  // 第 period + 1 根起有值（需要 period 个涨跌幅）
+  double update(int32_t x) {
+    const double p = period_;
+    if (count_ > 0) {
+      const double d = (double)x - (double)prev_;
+      const double g = taMax0(d), l = taMax0(0 - d);
+      if (count_ <= period_) {
+        sumGain_ += g;
+        sumLoss_ += l;
+        if (count_ == period_) {
+          gain_ = sumGain_ / p;
+          loss_ = sumLoss_ / p;
+        }
+      } else {
+        gain_ = (gain_ * (p - 1) + g) / p;
+        loss_ = (loss_ * (p - 1) + l) / p;
+      }
+      if (count_ >= period_) rsi_ = loss_ == 0 ? 100 : 100 - 100 / (1 + gain_ / loss_);
+    }
+    prev_ = x;
+    if (count_ <= period_) count_++;
+    return rsi_;
+  }
+
+  bool ready() const { return count_ > period_; }
+  double value() const { return rsi_; }
+
+ private:
+  uint16_t period_, count_ = 0;
+  int32_t  prev_ = 0;
+  double   sumGain_ = 0, sumLoss_ = 0;   // 整数涨跌幅之和，精确
+  double   gain_ = 0, loss_ = 0;
+  double   rsi_ = taNan();
+};
+
+// 持仓回测：update(收盘, 本根收盘后的持仓)；盈亏按上一根的持仓计
+class TaBacktest {
+ public:
+  void reset() { *this = TaBacktest(); }
+
+  void update(int32_t close, int8_t pos) {
+    if (started_) {
+      pnl_ = pnl_ + (double)pos_ * ((double)close - (double)prev_);
+      peak_ = taMax(peak_, pnl_);
+      drawdown_ = taMax(drawdown_, peak_ - pnl_);
+    }
+    started_ = true;
+    prev_ = close;
+    pos_ = pos;
+  }
+
+  double pnl() const { return pnl_; }
+  double drawdown() const { return drawdown_; }
+
+ private:
+  bool    started_ = false;
+  int32_t prev_ = 0;
+  int8_t  pos_ = 0;
+  double  pnl_ = 0, peak_ = 0, drawdown_ = 0;
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "event_stamp.h"
+#include "session_log.h"
+
+// ==== K 线数据包（列式二进制，可直接 mmap / 从 flash 读取） ====
+// 由 tools/kline_pack 从 KLineSwift/Resources/*.csv（time,open,high,low,close,volume）生成，读取时不解析文本、不分配内存。
+// 布局：文件头 | 币种目录（每币种 KLP_SYMBOL_ENTRY_LEN）| 各币种段索引 | 各币种段数据；多字节字段小端，偏移为文件内绝对偏移。
+// 每个币种按 segmentBars 根 K 线分段，段索引定长，第 i 根所在段 = i >> log2(segmentBars)，随机取窗口 O(1)：
+//   - 时间：段首绝对时间记在索引里，段内存 zigzag(相邻差 - 周期)，无缺口的日线宽度为 0
+//   - 价格：定点整数（币种的 priceDigits 位小数），按段减去段内最小值后位压缩（frame of reference）
+//   - 成交量：定点整数（volumeDigits 位小数），同上
+// 段数据内按列存放：列 c 第 k 根位于 bit (segLen * 前几列宽度之和 + k * 宽度[c])，LSB 优先；只读需要的列即可。
+// 只做字节读取（ESP32 上 esp_partition_mmap 映射的数据区可按字节访问）；open() 校验全部偏移，verify() 校验整包。
+
+#define KLP_MAGIC                   "KLPK"
+#define KLP_FORMAT_VERSION          1
+#define KLP_HEADER_LEN              32
+#define KLP_SYMBOL_ENTRY_LEN        64
+#define KLP_SEGMENT_ENTRY_LEN       40
+#define KLP_SYMBOL_LEN              16    // 含结尾 0，如 "ETHUSDT"
+#define KLP_NAME_LEN                24    // UTF-8，含结尾 0，如 "以太坊"
+#define KLP_MAX_SEGMENT_BARS        4096
+#define KLP_MAX_DIGITS              9
+
+enum KlpColumn : uint8_t {
+  KLP_COL_TIME = 0,
+  KLP_COL_OPEN,
+  KLP_COL_HIGH,
+  KLP_COL_LOW,
+  KLP_COL_CLOSE,
+  KLP_COL_VOLUME,
+  KLP_COLUMN_COUNT,
+};
+
+// 文件头：[magic 4][版本 u8][币种数 u8][段长 u16][总根数 u32][文件长度 u32][校验 u32（FNV-1a，文件头之后全部字节）][保留 12]
+// 币种目录：[代码 16][名称 24][首根时间 u32][根数 u32][周期 s u32][价格小数位 u8][成交量小数位 u8][段数 u16]
+//          [段索引偏移 u32][段数据偏移 u32]
+// 段索引：[数据偏移 u32（相对币种段数据）][段首时间 u32][开/高/低/收基准 i32 ×4][成交量基准 u64][各列位宽 u8 ×6][保留 2]
+
+struct KLineSymbol {
+  const char* symbol;       // 指向包内，以 0 结尾
+  const char* name;
+  uint32_t    firstTime;    // unix 秒
+  uint32_t    bars;
+  uint32_t    interval;     // 主周期（秒），时间列按此预测
+  uint8_t     priceDigits;
+  uint8_t     volumeDigits;
+  uint16_t    segments;
+};
+
+// 单根 K 线（定点）
+struct KLineBar {
+  uint32_t time;
+  int32_t  open, high, low, close;
+  uint64_t volume;
+};
+
+// 列式读出目标（结构数组）；为 nullptr 的列不解码
+struct KLineColumns {
+  uint32_t* time   = nullptr;
+  int32_t*  open   = nullptr;
+  int32_t*  high   = nullptr;
+  int32_t*  low    = nullptr;
+  int32_t*  close  = nullptr;
+  uint64_t* volume = nullptr;
+};
+
+inline uint64_t getLe64(const uint8_t* p) { return getLe32(p) | ((uint64_t)getLe32(p + 4) << 32); }
+
+inline void putLe64(uint8_t* p, uint64_t v) {
+  putLe32(p, (uint32_t)v);
+  putLe32(p + 4, (uint32_t)(v >> 32));
+}
+
+// 从 bit 偏移读 w（0..64）位，LSB 优先
+inline uint64_t klpGetBits(const uint8_t* p, uint32_t bit, uint8_t w) {
+  if (!w) return 0;
+  const uint8_t* q = p + (bit >> 3);
+  const unsigned sh = bit & 7;
+  uint64_t v = q[0] >> sh;
+  for (unsigned have = 8 - sh, i = 1; have < w; have += 8, i++) v |= (uint64_t)q[i] << have;
+  return w < 64 ? v & ((1ull << w) - 1) : v;
+}
+
+// 定点值 → 浮点
+inline double klpToDouble(int64_t v, uint8_t digits) {
+  static const double kScale[KLP_MAX_DIGITS + 1] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+  return (double)v / kScale[digits <= KLP_MAX_DIGITS ? digits : KLP_MAX_DIGITS];
+}
+
+class KLinePack {
+ public:
+  // 数据须在 KLinePack 使用期间保持有效（mmap、flash 映射或常量数组）
+  bool open(const uint8_t* data, size_t len) {
+    data_ = nullptr;
+    if (!data || len < KLP_HEADER_LEN || memcmp(data, KLP_MAGIC, 4) != 0 || data[4] != KLP_FORMAT_VERSION) return false;
+    const uint16_t segBars = getLe16(data + 6);
+    if (!segBars || segBars > KLP_MAX_SEGMENT_BARS || (segBars & (segBars - 1)) || getLe32(data + 12) != len) return false;
+    count_ = data[5];
+    segBars_ = segBars;
+    segShift_ = 0;
+    while ((1u << segShift_) < segBars) segShift_++;
+    len_ = len;
+    if (KLP_HEADER_LEN + (size_t)count_ * KLP_SYMBOL_ENTRY_LEN > len) return false;
+    data_ = data;
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < count_; i++) {
+      if (!checkSymbol(i)) return (data_ = nullptr), false;
+      total += getLe32(entry(i) + 44);
+    }
+    if (total != getLe32(data + 8)) return (data_ = nullptr), false;
+    return true;
+  }
+
+  // 整包校验（需遍历全部字节，flash 上约几毫秒）；open() 只校验结构
+  bool verify() const {
+    return data_ && fnv1a32(data_ + KLP_HEADER_LEN, len_ - KLP_HEADER_LEN) == getLe32(data_ + 16);
+  }
+
+  bool     valid() const { return data_ != nullptr; }
+  uint8_t  symbolCount() const { return data_ ? count_ : 0; }
+  uint16_t segmentBars() const { return segBars_; }
+  uint32_t totalBars() const { return data_ ? getLe32(data_ + 8) : 0; }
+  size_t   size() const { return len_; }
+
+  bool symbol(uint8_t i, KLineSymbol& s) const {
+    if (!data_ || i >= count_) return false;
+    const uint8_t* e = entry(i);
+    s.symbol       = (const char*)e;
+    s.name         = (const char*)e + KLP_SYMBOL_LEN;
+    s.firstTime    = getLe32(e + 40);
+    s.bars         = getLe32(e + 44);
+    s.interval     = getLe32(e + 48);
+    s.priceDigits  = e[52];
+    s.volumeDigits = e[53];
+    s.segments     = getLe16(e + 54);
+    return true;
+  }
+
+  // 按代码查找（如 "ETHUSDT"）；找不到返回 -1
+  int find(const char* symbol) const {
+    for (uint8_t i = 0; i < symbolCount(); i++)
+      if (!strncmp((const char*)entry(i), symbol, KLP_SYMBOL_LEN)) return i;
+    return -1;
+  }
+
+  uint32_t bars(uint8_t sym) const { return data_ && sym < count_ ? getLe32(entry(sym) + 44) : 0; }
+
+  // 随机窗口起点：在 [lead, bars - tail] 内按 r 均匀取（与 App 选币时的随机起点规则一致）；根数不足时返回 lead 或 0
+  uint32_t randomStart(uint8_t sym, uint32_t lead, uint32_t tail, uint32_t r) const {
+    const uint32_t n = bars(sym);
+    if (n <= lead + tail) return n > lead ? lead : 0;
+    return lead + r % (n - tail - lead + 1);
+  }
+
+  bool bar(uint8_t sym, uint32_t i, KLineBar& b) const {
+    KLineColumns c;
+    c.time = &b.time;
+    c.open = &b.open;
+    c.high = &b.high;
+    c.low = &b.low;
+    c.close = &b.close;
+    c.volume = &b.volume;
+    return read(sym, i, 1, c) == 1;
+  }
+
+  // 读出 [start, start + count) 到列数组；返回实际读出的根数（超出末尾时截断）
+  uint32_t read(uint8_t sym, uint32_t start, uint32_t count, const KLineColumns& out) const {
+    const uint32_t n = bars(sym);
+    if (start >= n) return 0;
+    if (count > n - start) count = n - start;
+    const uint8_t* e = entry(sym);
+    const uint32_t interval = getLe32(e + 48);
+    const uint8_t* index = data_ + getLe32(e + 56);
+    const uint8_t* data = data_ + getLe32(e + 60);
+    uint32_t done = 0;
+    while (done < count) {
+      const uint32_t i = start + done;
+      const uint32_t seg = i >> segShift_;
+      const uint32_t k0 = i & (segBars_ - 1);
+      const uint32_t segLen = (seg + 1) << segShift_ <= n ? segBars_ : n - (seg << segShift_);
+      const uint32_t take = segLen - k0 < count - done ? segLen - k0 : count - done;
+      const uint8_t* s = index + (size_t)seg * KLP_SEGMENT_ENTRY_LEN;
+      const uint8_t* d = data + getLe32(s);
+      const uint8_t* w = s + 32;
+      uint32_t bit = 0;
+      // 时间：段内差分，从段首累加到 k0
+      if (out.time) {
+        const uint8_t wc = w[KLP_COL_TIME];
+        uint32_t t = getLe32(s + 4);
+        for (uint32_t k = 1; k < k0 + take; k++) {
+          const uint64_t z = klpGetBits(d, k * wc, wc);
+          t += interval + (uint32_t)((int64_t)(z >> 1) ^ -(int64_t)(z & 1));
+          if (k >= k0) out.time[done + k - k0] = t;
+        }
+        if (k0 == 0) out.time[done] = getLe32(s + 4);
+      }
+      bit += segLen * w[KLP_COL_TIME];
+      int32_t* const price[4] = { out.open, out.high, out.low, out.close };
+      for (int c = 0; c < 4; c++) {
+        const uint8_t wc = w[KLP_COL_OPEN + c];
+        if (price[c]) {
+          const int32_t base = (int32_t)getLe32(s + 8 + 4 * c);
+          for (uint32_t k = 0; k < take; k++)
+            price[c][done + k] = base + (int32_t)klpGetBits(d, bit + (k0 + k) * wc, wc);
+        }
+        bit += segLen * wc;
+      }
+      if (out.volume) {
+        const uint8_t wc = w[KLP_COL_VOLUME];
+        const uint64_t base = getLe64(s + 24);
+        for (uint32_t k = 0; k < take; k++) out.volume[done + k] = base + klpGetBits(d, bit + (k0 + k) * wc, wc);
+      }
+      done += take;
+    }
+    return count;
+  }
+
+ private:
+  const uint8_t* entry(uint8_t i) const { return data_ + KLP_HEADER_LEN + (size_t)i * KLP_SYMBOL_ENTRY_LEN; }
+
+  // 名称以 0 结尾、段数与根数相符、段索引与每段数据都在文件内、位宽合法
+  bool checkSymbol(uint8_t i) const {
+    const uint8_t* e = entry(i);
+    if (memchr(e, 0, KLP_SYMBOL_LEN) == nullptr || memchr(e + KLP_SYMBOL_LEN, 0, KLP_NAME_LEN) == nullptr) return false;
+    const uint32_t n = getLe32(e + 44);
+    const uint16_t segs = getLe16(e + 54);
+    if (e[52] > KLP_MAX_DIGITS || e[53] > KLP_MAX_DIGITS || segs != (n + segBars_ - 1) >> segShift_) return false;
+    const uint32_t indexOff = getLe32(e + 56), dataOff = getLe32(e + 60);
+    if (indexOff > len_ || (size_t)segs * KLP_SEGMENT_ENTRY_LEN > len_ - indexOff || dataOff > len_) return false;
+    for (uint32_t seg = 0; seg < segs; seg++) {
+      const uint8_t* s = data_ + indexOff + (size_t)seg * KLP_SEGMENT_ENTRY_LEN;
+      const uint8_t* w = s + 32;
+      uint32_t bits = 0;
+      for (int c = 0; c < KLP_COLUMN_COUNT; c++) {
+        if (w[c] > (c == KLP_COL_VOLUME ? 64 : 32)) return false;
+        bits += w[c];
+      }
+      const uint32_t segLen = (seg + 1) << segShift_ <= n ? segBars_ : n - (seg << segShift_);
+      const uint64_t end = (uint64_t)dataOff + getLe32(s) + ((uint64_t)segLen * bits + 7) / 8;
+      if (end > len_) return false;
+    }
+    return true;
+  }
+
+  const uint8_t* data_ = nullptr;
+  size_t   len_ = 0;
+  uint8_t  count_ = 0;
+  uint16_t segBars_ = 0;
+  uint8_t  segShift_ = 0;
+};
+
+#if !defined(ARDUINO) && (defined(__unix__) || defined(__APPLE__))
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 主机侧：只读 mmap 整个包文件，按需分页，不读入内存
+class KLinePackFile : public KLinePack {
+ public:
+  KLinePackFile() = default;
+  KLinePackFile(const KLinePackFile&) = delete;
+  KLinePackFile& operator=(const KLinePackFile&) = delete;
+  ~KLinePackFile() { close(); }
+
+  bool map(const char* path) {
+    close();
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED) {
+        map_ = p;
+        mapLen_ = (size_t)st.st_size;
+      }
+    }
+    ::close(fd);
+    if (!map_) return false;
+    if (open((const uint8_t*)map_, mapLen_)) return true;
+    close();
+    return false;
+  }
+
+  void close() {
+    open(nullptr, 0);
+    if (map_) munmap(map_, mapLen_);
+    map_ = nullptr;
+    mapLen_ = 0;
+  }
+
+ private:
+  void*  map_ = nullptr;
+  size_t mapLen_ = 0;
+};
+#endif
@@ -0,0 +1,535 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include "event_stamp.h"
+#include "sha256.h"
+
+// ==== BLE 固件升级（OTA） ====
+// 升级包（tools/ota_sim pack 生成）= 包头 + 数据流；数据流为原始镜像，或 LZSS 压缩（heatshrink 风格位流，见 OtaLzDecoder）。
+// App 经 UUID_CHAR_OTA 写入（Write Without Response）：
+//   OTA_OP_BEGIN + 包头；随后按 MTU 切片发 OTA_OP_CHUNK + 数据流偏移 u32 + 片 CRC16 + 数据，最多 window 片未确认
+// 设备边收边解压，写入未运行的 app 分区；每 ackEvery 片回一条 OTA_EVT_STATUS（已写入的数据流偏移）。
+// 片 CRC 错或偏移不连续（队列满丢片）时回 NACK（期望偏移），之后的乱序片静默丢弃，App 从该偏移重发（go-back-N）。
+// 断线后升级状态保留：重连后以同一包头再发 BEGIN，应答 OTA_RESUMED 与续传偏移（按字节，与新连接的 MTU 无关）。
+// 连接鉴权在接收端之外：特征要求 MITM 加密配对写入，且只接受运维角色连接，同一时刻只有发出 BEGIN 的连接可继续（gatt_clients.h）。
+// 镜像鉴权在接收端：包头带 HMAC-SHA256 标签（每台设备一把密钥，OTA_AUTH_KEY），配对码泄露也无法写入伪造镜像。
+// 收完后回读分区校验整镜像 CRC32 与标签，都通过才进入 OTA_STATE_VERIFIED，App 才能发 OTA_OP_APPLY 切换启动分区并重启；
+// 新镜像首次启动的试运行与回滚见文件末尾。
+// 不依赖 Arduino：固件实现 OtaFlash（esp_partition_*），主机侧 tools/ota_sim 用仿真分区。
+
+#define OTA_MAGIC                   "CBOT"
+#define OTA_FORMAT_VERSION          2     // 2：包头追加 HMAC 标签（版本 1 的包不再接受）
+#define OTA_HEADER_LEN              56
+#define OTA_HEADER_SIGNED_LEN       24    // 标签覆盖的包头前缀（标签之前的全部字段）
+#define OTA_KEY_LEN                 32
+#define OTA_CHUNK_HEADER_LEN        7     // [op][偏移 u32][CRC16]
+#define OTA_STATUS_LEN              8     // [OTA_EVT_STATUS][状态][结果][偏移 u32][window]
+#define OTA_FLASH_SECTOR            4096  // 擦除粒度，写入缓冲按扇区攒满再写
+#define OTA_LZ_MIN_MATCH            2     // 回溯长度 = 编码值 + OTA_LZ_MIN_MATCH
+
+enum OtaOp : uint8_t {
+  OTA_OP_BEGIN = 0x01,  // + 包头（OTA_HEADER_LEN）
+  OTA_OP_CHUNK = 0x02,  // + 偏移 u32 + CRC16 + 数据
+  OTA_OP_APPLY = 0x03,  // 切换启动分区并重启（仅 OTA_STATE_VERIFIED）
+  OTA_OP_ABORT = 0x04,
+};
+#define OTA_EVT_STATUS              0x81
+
+enum OtaMethod : uint8_t {
+  OTA_METHOD_STORED = 0,
+  OTA_METHOD_LZSS   = 1,
+};
+
+enum OtaState : uint8_t {
+  OTA_STATE_IDLE = 0,
+  OTA_STATE_RECEIVING,
+  OTA_STATE_VERIFIED,   // 整镜像已写入并回读校验通过，等待 APPLY
+  OTA_STATE_FAILED,
+};
+
+enum OtaResult : uint8_t {
+  OTA_OK = 0,           // 确认：偏移之前的数据流已写入
+  OTA_RESUMED,          // BEGIN 与进行中的升级一致，从偏移续传
+  OTA_ERR_CRC,          // 片 CRC 错，从偏移重发
+  OTA_ERR_SEQUENCE,     // 偏移不连续（丢片），从偏移重发
+  OTA_ERR_HEADER,       // 包头无效或压缩参数不支持
+  OTA_ERR_TOO_LARGE,    // 镜像大于分区
+  OTA_ERR_STREAM,       // 数据流与包头不符（解压出错、长度不符）
+  OTA_ERR_FLASH,        // 擦写失败
+  OTA_ERR_VERIFY,       // 整镜像 CRC 不符，或启动分区切换时镜像校验失败
+  OTA_ERR_STATE,        // 当前状态不接受该操作（如未校验完就 APPLY）
+  OTA_ERR_DENIED,       // 连接无权升级（须为运维角色且持有本次升级，见 GattClients::authorizeOta）
+  OTA_ERR_AUTH,         // 镜像标签不符（不是用本机密钥打包的，或包头/镜像被改动），或设备未设密钥
+};
+
+// 包头：[magic 4][版本 u8][压缩 u8][窗口位数 u8][长度位数 u8][镜像长度 u32][镜像 CRC32 u32][数据流长度 u32][保留 u32]
+//       [标签 32]；标签 = HMAC-SHA256(密钥, 包头前 OTA_HEADER_SIGNED_LEN 字节 + 解压后的镜像)
+struct OtaImageHeader {
+  uint8_t  method;
+  uint8_t  windowBits;     // LZSS：回溯距离位数（解压窗口 1 << windowBits 字节）
+  uint8_t  lookaheadBits;  // LZSS：回溯长度位数
+  uint32_t imageSize;
+  uint32_t imageCrc;
+  uint32_t streamSize;
+  uint8_t  tag[SHA256_LEN];
+
+  bool operator==(const OtaImageHeader& o) const {
+    return method == o.method && windowBits == o.windowBits && lookaheadBits == o.lookaheadBits &&
+           imageSize == o.imageSize && imageCrc == o.imageCrc && streamSize == o.streamSize &&
+           memcmp(tag, o.tag, SHA256_LEN) == 0;
+  }
+};
+
+inline size_t otaPutHeader(uint8_t* out, const OtaImageHeader& h) {
+  memset(out, 0, OTA_HEADER_LEN);
+  memcpy(out, OTA_MAGIC, 4);
+  out[4] = OTA_FORMAT_VERSION;
+  out[5] = h.method;
+  out[6] = h.windowBits;
+  out[7] = h.lookaheadBits;
+  putLe32(out + 8, h.imageSize);
+  putLe32(out + 12, h.imageCrc);
+  putLe32(out + 16, h.streamSize);
+  memcpy(out + OTA_HEADER_SIGNED_LEN, h.tag, SHA256_LEN);
+  return OTA_HEADER_LEN;
+}
+
+inline bool otaParseHeader(const uint8_t* p, size_t len, OtaImageHeader& h) {
+  if (len < OTA_HEADER_LEN || memcmp(p, OTA_MAGIC, 4) != 0 || p[4] != OTA_FORMAT_VERSION) return false;
+  h.method        = p[5];
+  h.windowBits    = p[6];
+  h.lookaheadBits = p[7];
+  h.imageSize     = getLe32(p + 8);
+  h.imageCrc      = getLe32(p + 12);
+  h.streamSize    = getLe32(p + 16);
+  memcpy(h.tag, p + OTA_HEADER_SIGNED_LEN, SHA256_LEN);
+  if (getLe32(p + 20) != 0) return false;  // 保留字段须为 0：接收端按解析结果重建标签覆盖的前缀
+  if (h.method == OTA_METHOD_STORED) return h.streamSize == h.imageSize;
+  return h.method == OTA_METHOD_LZSS && h.windowBits >= 4 && h.windowBits <= OTA_LZ_MAX_WINDOW_BITS &&
+         h.lookaheadBits >= 2 && h.lookaheadBits <= 8 && h.streamSize > 0;
+}
+
+// ==== 镜像鉴权 ====
+// 密钥以 64 位十六进制串给出（构建参数 OTA_AUTH_KEY，打包工具 -a）；编译期可用 otaKeyValid 检查格式
+constexpr int otaHexDigit(char c) {
+  return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+constexpr bool otaKeyValid(const char* hex) {
+  for (int i = 0; i < 2 * OTA_KEY_LEN; i++) {
+    if (otaHexDigit(hex[i]) < 0) return false;
+  }
+  return hex[2 * OTA_KEY_LEN] == '\0';
+}
+
+inline bool otaParseKey(const char* hex, uint8_t key[OTA_KEY_LEN]) {
+  if (!otaKeyValid(hex)) return false;
+  for (int i = 0; i < OTA_KEY_LEN; i++) key[i] = (uint8_t)(otaHexDigit(hex[2 * i]) << 4 | otaHexDigit(hex[2 * i + 1]));
+  return true;
+}
+
+// 打包用：按 h 的其余字段与镜像计算 h.tag
+inline void otaSignHeader(OtaImageHeader& h, const uint8_t key[OTA_KEY_LEN], const uint8_t* image, size_t n) {
+  uint8_t prefix[OTA_HEADER_LEN];
+  otaPutHeader(prefix, h);
+  HmacSha256 mac;
+  mac.begin(key, OTA_KEY_LEN);
+  mac.update(prefix, OTA_HEADER_SIGNED_LEN);
+  mac.update(image, n);
+  mac.final(h.tag);
+}
+
+// ==== 校验：CRC-32（IEEE，整镜像）与 CRC-16/CCITT-FALSE（分片），查表在编译期生成 ====
+struct OtaCrcTables {
+  uint32_t crc32[256];
+  uint16_t crc16[256];
+
+  constexpr OtaCrcTables() : crc32(), crc16() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (uint8_t k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ 0xEDB88320u : c >> 1;
+      crc32[i] = c;
+      uint16_t d = (uint16_t)(i << 8);
+      for (uint8_t k = 0; k < 8; k++) d = (uint16_t)((d & 0x8000) ? (d << 1) ^ 0x1021 : d << 1);
+      crc16[i] = d;
+    }
+  }
+};
+static constexpr OtaCrcTables kOtaCrc;
+
+// crc 传入上一段的结果可分段计算
+inline uint32_t otaCrc32(const uint8_t* p, size_t n, uint32_t crc = 0) {
+  crc = ~crc;
+  for (size_t i = 0; i < n; i++) crc = kOtaCrc.crc32[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+inline uint16_t otaCrc16(const uint8_t* p, size_t n) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < n; i++) crc = (uint16_t)((crc << 8) ^ kOtaCrc.crc16[((crc >> 8) ^ p[i]) & 0xFF]);
+  return crc;
+}
+
+// 分片帧：返回帧长（OTA_CHUNK_HEADER_LEN + len），out 至少这么长
+inline size_t otaPutChunk(uint8_t* out, uint32_t offset, const uint8_t* data, size_t len) {
+  out[0] = OTA_OP_CHUNK;
+  putLe32(out + 1, offset);
+  putLe16(out + 5, otaCrc16(data, len));
+  memcpy(out + OTA_CHUNK_HEADER_LEN, data, len);
+  return OTA_CHUNK_HEADER_LEN + len;
+}
+
+inline size_t otaPutStatus(uint8_t* out, uint8_t state, uint8_t result, uint32_t offset, uint8_t window) {
+  out[0] = OTA_EVT_STATUS;
+  out[1] = state;
+  out[2] = result;
+  putLe32(out + 3, offset);
+  out[7] = window;
+  return OTA_STATUS_LEN;
+}
+
+// ==== LZSS 流式解压（heatshrink 风格位流，高位在前） ====
+// 标志位 1：字面量，随后 8 位；标志位 0：回溯，随后 windowBits 位（距离 - 1）与 lookaheadBits 位（长度 - OTA_LZ_MIN_MATCH）。
+// 输入可在任意字节处切开分次喂入（分片边界与记号边界无关）；输出满 limit 字节即停止，末尾补齐位忽略。
+// 只占 1 << OTA_LZ_MAX_WINDOW_BITS 字节窗口，不需要整块输入/输出缓冲。
+class OtaLzDecoder {
+ public:
+  void begin(uint8_t windowBits, uint8_t lookaheadBits, uint32_t limit) {
+    windowBits_    = windowBits;
+    lookaheadBits_ = lookaheadBits;
+    mask_          = (1u << windowBits) - 1;
+    remaining_     = limit;
+    produced_      = 0;
+    bits_          = 0;
+    nbits_         = 0;
+  }
+
+  // 喂入一段压缩数据，每个输出字节调用 sink(b)；sink 返回 false 或引用了窗口外的数据时返回 false
+  template <typename Sink>
+  bool feed(const uint8_t* in, size_t n, Sink&& sink) {
+    const uint8_t refBits = (uint8_t)(1 + windowBits_ + lookaheadBits_);
+    for (size_t i = 0; i < n && remaining_; i++) {
+      bits_ = (bits_ << 8) | in[i];
+      nbits_ += 8;
+      while (remaining_ && nbits_) {
+        if ((bits_ >> (nbits_ - 1)) & 1) {
+          if (nbits_ < 9) break;
+          nbits_ -= 9;
+          if (!emit((uint8_t)(bits_ >> nbits_), sink)) return false;
+        } else {
+          if (nbits_ < refBits) break;
+          nbits_ -= refBits;
+          const uint32_t v    = bits_ >> nbits_;
+          const uint32_t dist = ((v >> lookaheadBits_) & mask_) + 1;
+          uint32_t len        = (v & ((1u << lookaheadBits_) - 1)) + OTA_LZ_MIN_MATCH;
+          if (dist > produced_) return false;
+          while (len-- && remaining_) {
+            if (!emit(window_[(pos_ - dist) & mask_], sink)) return false;
+          }
+        }
+        bits_ &= (1u << nbits_) - 1;
+      }
+    }
+    return true;
+  }
+
+  uint32_t remaining() const { return remaining_; }
+
+ private:
+  template <typename Sink>
+  bool emit(uint8_t b, Sink& sink) {
+    window_[pos_++ & mask_] = b;
+    remaining_--;
+    produced_++;
+    return sink(b);
+  }
+
+  uint8_t  window_[1u << OTA_LZ_MAX_WINDOW_BITS];
+  uint32_t pos_ = 0, mask_ = 0;
+  uint32_t remaining_ = 0, produced_ = 0;
+  uint32_t bits_ = 0;
+  uint8_t  nbits_ = 0;
+  uint8_t  windowBits_ = 0, lookaheadBits_ = 0;
+};
+
+// ==== 目标分区 ====
+// offset 相对分区起点；erase 的 offset/len 按 OTA_FLASH_SECTOR 对齐
+class OtaFlash {
+ public:
+  virtual ~OtaFlash() {}
+  virtual uint32_t size() = 0;
+  virtual bool erase(uint32_t offset, uint32_t len) = 0;
+  virtual bool write(uint32_t offset, const uint8_t* data, size_t len) = 0;
+  virtual bool read(uint32_t offset, uint8_t* data, size_t len) = 0;
+};
+
+struct OtaStats {
+  uint32_t chunks;          // 接受的分片
+  uint32_t crcErrors;
+  uint32_t sequenceErrors;  // 偏移不连续（含 NACK 后静默丢弃的乱序片）
+  uint32_t duplicates;      // 偏移已确认过的重发片
+  uint32_t resumes;
+  uint32_t erases;
+};
+
+// ==== 接收端：分片校验、顺序、解压与写入 ====
+// 单任务调用 handle()；window 为接收队列长度（写入 BEGIN 应答告知 App），每 window/2 片确认一次。
+// eraseBlock：每次擦除长度（OTA_FLASH_SECTOR 的倍数）。擦除期间两核 cache 关闭，长度越大单次停顿越长、总擦除时间越短。
+class OtaReceiver {
+ public:
+  OtaReceiver(OtaFlash& flash, uint8_t window, uint32_t eraseBlock = OTA_ERASE_BLOCK)
+      : flash_(flash), window_(window), ackEvery_(window > 1 ? window / 2 : 1), eraseBlock_(eraseBlock) {}
+
+  // 设备密钥（OTA_KEY_LEN 字节）；未设密钥时拒绝一切升级
+  void setKey(const uint8_t* key) {
+    memcpy(key_, key, OTA_KEY_LEN);
+    hasKey_ = true;
+  }
+
+  // 处理 App 写入的一帧；需要应答时写入 resp（至少 OTA_STATUS_LEN）并返回长度，不应答返回 0
+  size_t handle(const uint8_t* frame, size_t len, uint8_t* resp) {
+    if (!len) return 0;
+    switch (frame[0]) {
+      case OTA_OP_BEGIN: return begin(frame + 1, len - 1, resp);
+      case OTA_OP_CHUNK: return chunk(frame, len, resp);
+      case OTA_OP_APPLY: return status(resp, state_ == OTA_STATE_VERIFIED ? OTA_OK : OTA_ERR_STATE);
+      case OTA_OP_ABORT:
+        state_ = OTA_STATE_IDLE;
+        return status(resp, OTA_OK);
+    }
+    return 0;
+  }
+
+  // 升级失败（如切换启动分区时镜像校验不通过）：丢弃已接收内容，返回应答
+  size_t fail(uint8_t result, uint8_t* resp) {
+    state_ = OTA_STATE_FAILED;
+    return status(resp, result);
+  }
+
+  uint8_t state() const { return state_; }
+  const OtaImageHeader& header() const { return header_; }
+  uint32_t streamOffset() const { return next_; }
+  uint32_t written() const { return written_; }  // 已解压的镜像字节数（含未刷入的写入缓冲）
+  const OtaStats& stats() const { return stats_; }
+
+ private:
+  size_t status(uint8_t* resp, uint8_t result) {
+    sinceAck_ = 0;
+    return otaPutStatus(resp, state_, result, next_, window_);
+  }
+
+  size_t begin(const uint8_t* p, size_t len, uint8_t* resp) {
+    OtaImageHeader h;
+    if (!otaParseHeader(p, len, h)) {
+      state_ = OTA_STATE_IDLE;
+      return status(resp, OTA_ERR_HEADER);
+    }
+    if (!hasKey_) {
+      state_ = OTA_STATE_IDLE;
+      return status(resp, OTA_ERR_AUTH);
+    }
+    if ((state_ == OTA_STATE_RECEIVING || state_ == OTA_STATE_VERIFIED) && h == header_) {
+      stats_.resumes++;
+      nackSent_ = false;
+      return status(resp, OTA_RESUMED);
+    }
+    header_ = h;
+    next_   = 0;
+    if (h.imageSize > flash_.size()) {
+      state_ = OTA_STATE_IDLE;
+      return status(resp, OTA_ERR_TOO_LARGE);
+    }
+    if (h.method == OTA_METHOD_LZSS) lz_.begin(h.windowBits, h.lookaheadBits, h.imageSize);
+    written_   = 0;
+    erasedTo_  = 0;
+    pageLen_   = 0;
+    crc_       = 0;
+    nackSent_  = false;
+    flashError_ = false;
+    stats_     = OtaStats();
+    state_     = OTA_STATE_RECEIVING;
+    return status(resp, OTA_OK);
+  }
+
+  size_t chunk(const uint8_t* frame, size_t len, uint8_t* resp) {
+    if (state_ == OTA_STATE_VERIFIED) return 0;  // 收完后的重发片
+    if (state_ != OTA_STATE_RECEIVING) return status(resp, OTA_ERR_STATE);
+    if (len <= OTA_CHUNK_HEADER_LEN) return 0;
+    const uint32_t offset = getLe32(frame + 1);
+    const uint8_t* data   = frame + OTA_CHUNK_HEADER_LEN;
+    const size_t n        = len - OTA_CHUNK_HEADER_LEN;
+    if (offset < next_) {
+      stats_.duplicates++;
+      return 0;
+    }
+    if (offset > next_) {
+      // 只对第一处缺口 NACK；App 回退前已发出的后续片静默丢弃
+      stats_.sequenceErrors++;
+      if (nackSent_) return 0;
+      nackSent_ = true;
+      return status(resp, OTA_ERR_SEQUENCE);
+    }
+    if (otaCrc16(data, n) != getLe16(frame + 5)) {
+      stats_.crcErrors++;
+      nackSent_ = true;
+      return status(resp, OTA_ERR_CRC);
+    }
+    if (n > header_.streamSize - next_) return fail(OTA_ERR_STREAM, resp);
+
+    nackSent_ = false;
+    bool ok;
+    if (header_.method == OTA_METHOD_LZSS) {
+      ok = lz_.feed(data, n, [this](uint8_t b) { return put(b); });
+    } else {
+      ok = true;
+      for (size_t i = 0; i < n && ok; i++) ok = put(data[i]);
+    }
+    if (!ok) return fail(flashError_ ? OTA_ERR_FLASH : OTA_ERR_STREAM, resp);
+    next_ += (uint32_t)n;
+    stats_.chunks++;
+    sinceAck_++;
+
+    if (next_ == header_.streamSize) return finish(resp);
+    return sinceAck_ >= ackEvery_ ? status(resp, OTA_OK) : 0;
+  }
+
+  // 收完：刷入写入缓冲，核对长度与解压时累计的 CRC，再回读分区核对实际写入的内容。
+  // 标签按回读内容计算：校验的就是将要启动的字节，而不是解压时经过内存的那一份
+  size_t finish(uint8_t* resp) {
+    if (!flushPage()) return fail(OTA_ERR_FLASH, resp);
+    if (written_ != header_.imageSize) return fail(OTA_ERR_STREAM, resp);
+    if (crc_ != header_.imageCrc) return fail(OTA_ERR_VERIFY, resp);
+    uint8_t prefix[OTA_HEADER_LEN];
+    otaPutHeader(prefix, header_);
+    HmacSha256 mac;
+    mac.begin(key_, OTA_KEY_LEN);
+    mac.update(prefix, OTA_HEADER_SIGNED_LEN);
+    uint32_t crc = 0;
+    for (uint32_t off = 0; off < written_; off += OTA_FLASH_SECTOR) {
+      const size_t n = written_ - off < OTA_FLASH_SECTOR ? written_ - off : OTA_FLASH_SECTOR;
+      if (!flash_.read(off, page_, n)) return fail(OTA_ERR_FLASH, resp);
+      crc = otaCrc32(page_, n, crc);
+      mac.update(page_, n);
+    }
+    if (crc != header_.imageCrc) return fail(OTA_ERR_VERIFY, resp);
+    uint8_t tag[SHA256_LEN];
+    mac.final(tag);
+    if (!sha256Equal(tag, header_.tag)) return fail(OTA_ERR_AUTH, resp);
+    state_ = OTA_STATE_VERIFIED;
+    return status(resp, OTA_OK);
+  }
+
+  bool put(uint8_t b) {
+    if (written_ >= header_.imageSize) return false;
+    page_[pageLen_++] = b;
+    written_++;
+    if (pageLen_ == OTA_FLASH_SECTOR) return flushPage();
+    return true;
+  }
+
+  // 写入缓冲刷入分区；按 eraseBlock 提前擦除，不超过镜像末尾所在扇区
+  bool flushPage() {
+    if (!pageLen_) return true;
+    const uint32_t at  = written_ - pageLen_;
+    const uint32_t end = at + pageLen_;
+    const uint32_t imageEnd = (header_.imageSize + OTA_FLASH_SECTOR - 1) / OTA_FLASH_SECTOR * OTA_FLASH_SECTOR;
+    while (erasedTo_ < end) {
+      uint32_t n = eraseBlock_ - erasedTo_ % eraseBlock_;
+      if (n > imageEnd - erasedTo_) n = imageEnd - erasedTo_;
+      if (!flash_.erase(erasedTo_, n)) return flashFailed();
+      stats_.erases++;
+      erasedTo_ += n;
+    }
+    if (!flash_.write(at, page_, pageLen_)) return flashFailed();
+    crc_     = otaCrc32(page_, pageLen_, crc_);
+    pageLen_ = 0;
+    return true;
+  }
+
+  bool flashFailed() {
+    flashError_ = true;
+    return false;
+  }
+
+  OtaFlash&      flash_;
+  const uint8_t  window_;
+  const uint8_t  ackEvery_;
+  const uint32_t eraseBlock_;
+  OtaLzDecoder   lz_;
+  OtaImageHeader header_ = {};
+  OtaStats       stats_  = {};
+  uint8_t  state_    = OTA_STATE_IDLE;
+  uint32_t next_     = 0;  // 已接受的数据流字节数
+  uint32_t written_  = 0;
+  uint32_t erasedTo_ = 0;
+  uint32_t crc_      = 0;  // 已刷入分区部分的 CRC32
+  uint8_t  sinceAck_ = 0;
+  bool     nackSent_ = false;
+  bool     flashError_ = false;
+  bool     hasKey_   = false;
+  uint8_t  key_[OTA_KEY_LEN];
+  uint8_t  page_[OTA_FLASH_SECTOR];
+  uint16_t pageLen_ = 0;
+};
+
+// ==== 新镜像首次启动：试运行与回滚 ====
+// APPLY 时写入记录（试运行、切换前后的分区）；此后每次启动调用 otaBootDecide 并持久化记录：
+// - 运行的不是新分区：引导程序已拒绝新镜像，记录清除并报告
+// - 试运行启动次数超过 OTA_MAX_TRIAL_BOOTS（自检前崩溃/看门狗重启）：回滚
+// - 否则运行自检，otaBootFinish 按结果确认或回滚
+// 回滚 = 启动分区切回 previousApp 并重启；旧镜像原样保留在原分区，无需重写。
+// 分区以 app 子类型标识（ota_0/ota_1/factory），不依赖引导程序是否打开回滚支持。
+enum OtaBootState : uint8_t {
+  OTA_BOOT_CONFIRMED = 0,
+  OTA_BOOT_TRIAL     = 1,
+};
+
+enum OtaBootAction : uint8_t {
+  OTA_BOOT_NORMAL,        // 正常运行
+  OTA_BOOT_SELF_CHECK,    // 试运行：自检后调用 otaBootFinish
+  OTA_BOOT_ROLLBACK,      // 切回 previousApp 并重启
+  OTA_BOOT_REJECTED,      // 新镜像未能启动，已在旧镜像上运行
+};
+
+struct OtaBootRecord {
+  uint8_t  state;
+  uint8_t  trialBoots;
+  uint8_t  previousApp;
+  uint8_t  targetApp;
+  uint8_t  rolledBack;   // 最近一次升级是否回滚（诊断用）
+  uint8_t  reserved[3];
+  uint32_t imageCrc;
+};
+
+inline void otaBootArm(OtaBootRecord& rec, uint8_t previousApp, uint8_t targetApp, uint32_t imageCrc) {
+  rec             = OtaBootRecord();
+  rec.state       = OTA_BOOT_TRIAL;
+  rec.previousApp = previousApp;
+  rec.targetApp   = targetApp;
+  rec.imageCrc    = imageCrc;
+}
+
+inline OtaBootAction otaBootDecide(OtaBootRecord& rec, uint8_t runningApp) {
+  if (rec.state != OTA_BOOT_TRIAL) return OTA_BOOT_NORMAL;
+  if (runningApp != rec.targetApp) {
+    rec.state      = OTA_BOOT_CONFIRMED;
+    rec.rolledBack = 1;
+    return OTA_BOOT_REJECTED;
+  }
+  if (++rec.trialBoots > OTA_MAX_TRIAL_BOOTS) {
+    rec.state      = OTA_BOOT_CONFIRMED;
+    rec.rolledBack = 1;
+    return OTA_BOOT_ROLLBACK;
+  }
+  return OTA_BOOT_SELF_CHECK;
+}
+
+inline OtaBootAction otaBootFinish(OtaBootRecord& rec, bool selfCheckOk) {
+  rec.state      = OTA_BOOT_CONFIRMED;
+  rec.rolledBack = selfCheckOk ? 0 : 1;
+  return selfCheckOk ? OTA_BOOT_NORMAL : OTA_BOOT_ROLLBACK;
+}
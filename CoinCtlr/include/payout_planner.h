@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+
+// ==== 多料斗并行吐币规划 ====
+// 每个料斗有独立继电器、标定速率与面值。规划器把目标面值拆到各料斗同时出币，
+// 使最慢料斗的导通时长（整体耗时）最短：
+// - 二分整体时长 t，各料斗在 t 内最多出 floor(t * rate) 枚
+// - 按面值从大到小贪心填充，小面值料斗负责找零
+// 面值需为规整体系（如 1/5/10）以保证贪心可行性随 t 单调。
+// 不依赖 Arduino，可在主机侧直接编译。
+
+#define PAYOUT_MAX_HOPPERS          8
+
+struct HopperSpec {
+  uint8_t  relayPin;      // 继电器引脚（规划器不使用）
+  float    coinsPerSec;   // 标定出币速率（枚/秒）
+  uint16_t denomination;  // 每枚面值
+};
+
+struct PayoutPlan {
+  uint8_t  hopperCount;
+  uint16_t coins[PAYOUT_MAX_HOPPERS];     // 各料斗出币枚数
+  uint64_t onTimeUs[PAYOUT_MAX_HOPPERS];  // 各料斗继电器导通时长
+  uint64_t makespanUs;                    // 并行整体耗时 = max(onTimeUs)
+  uint32_t value;                         // 计划出币面值合计（目标无法凑齐时小于目标）
+};
+
+namespace payout_detail {
+
+// 面值大者优先，同面值速率快者优先
+inline void sortHoppers(const HopperSpec* hoppers, uint8_t n, uint8_t* order) {
+  for (uint8_t i = 0; i < n; i++) order[i] = i;
+  for (uint8_t i = 1; i < n; i++) {
+    const uint8_t k = order[i];
+    uint8_t j = i;
+    while (j > 0) {
+      const HopperSpec& a = hoppers[order[j - 1]];
+      const HopperSpec& b = hoppers[k];
+      const bool before = b.denomination > a.denomination ||
+                          (b.denomination == a.denomination && b.coinsPerSec > a.coinsPerSec);
+      if (!before) break;
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = k;
+  }
+}
+
+// 在时长 tUs 内按贪心填充，返回未能凑齐的剩余面值；tUs = UINT64_MAX 表示不限时
+inline uint32_t fill(const HopperSpec* hoppers, const uint8_t* order, uint8_t n,
+                     uint32_t target, uint64_t tUs, uint16_t* coins) {
+  uint32_t remaining = target;
+  for (uint8_t i = 0; i < n; i++) {
+    const uint8_t h = order[i];
+    const HopperSpec& spec = hoppers[h];
+    coins[h] = 0;
+    if (!spec.denomination || spec.coinsPerSec <= 0.0f) continue;
+    uint64_t want = remaining / spec.denomination;
+    if (tUs != UINT64_MAX) {
+      const uint64_t cap = (uint64_t)((double)tUs * spec.coinsPerSec / 1000000.0);
+      if (want > cap) want = cap;
+    }
+    if (want > UINT16_MAX) want = UINT16_MAX;
+    coins[h] = (uint16_t)want;
+    remaining -= (uint32_t)want * spec.denomination;
+  }
+  return remaining;
+}
+
+}  // namespace payout_detail
+
+// 规划一次吐币；hopperCount 超过 PAYOUT_MAX_HOPPERS 的部分忽略。返回计划是否恰好凑齐目标
+inline bool planPayout(const HopperSpec* hoppers, uint8_t hopperCount, uint32_t targetValue,
+                       PayoutPlan& plan) {
+  const uint8_t n = hopperCount < PAYOUT_MAX_HOPPERS ? hopperCount : PAYOUT_MAX_HOPPERS;
+  plan.hopperCount = n;
+  plan.makespanUs  = 0;
+  plan.value       = 0;
+  for (uint8_t i = 0; i < PAYOUT_MAX_HOPPERS; i++) {
+    plan.coins[i]    = 0;
+    plan.onTimeUs[i] = 0;
+  }
+
+  uint8_t order[PAYOUT_MAX_HOPPERS];
+  payout_detail::sortHoppers(hoppers, n, order);
+
+  // 不限时仍凑不齐（无小面值找零）时，退而求其次：能凑出的最大面值
+  const uint32_t shortfall = payout_detail::fill(hoppers, order, n, targetValue, UINT64_MAX, plan.coins);
+  const uint32_t target = targetValue - shortfall;
+  if (target == 0) return shortfall == 0;
+
+  float minRate = 0.0f;
+  for (uint8_t i = 0; i < n; i++) {
+    const float r = hoppers[i].coinsPerSec;
+    if (hoppers[i].denomination && r > 0.0f && (minRate == 0.0f || r < minRate)) minRate = r;
+  }
+
+  // 二分最短整体时长：上界为最慢料斗单独出完全部面值的时长
+  uint64_t lo = 0;
+  uint64_t hi = (uint64_t)((double)target * 1000000.0 / minRate) + 1000000;
+  while (lo < hi) {
+    const uint64_t mid = lo + (hi - lo) / 2;
+    if (payout_detail::fill(hoppers, order, n, target, mid, plan.coins) == 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  payout_detail::fill(hoppers, order, n, target, lo, plan.coins);
+
+  for (uint8_t i = 0; i < n; i++) {
+    if (!plan.coins[i]) continue;
+    plan.onTimeUs[i] = (uint64_t)((double)plan.coins[i] * 1000000.0 / hoppers[i].coinsPerSec + 0.5);
+    if (plan.onTimeUs[i] > plan.makespanUs) plan.makespanUs = plan.onTimeUs[i];
+    plan.value += (uint32_t)plan.coins[i] * hoppers[i].denomination;
+  }
+  return shortfall == 0;
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include "payout_planner.h"
+
+// ==== 吐币调度：合并、流水线与中途取消 ====
+// - 空闲时收到的吐币立即启动；运行中到达的后续请求并入同一次连续运行
+// - 运行中收到新请求/取消：按已出币进度重新规划剩余部分，正在转的料斗不停机
+// - 出币计数只有一条规则：导通已开始出的那枚计为已出（committedCoins），部分取消与全部取消一致
+// - 各料斗从本次连续导通的起点计时（startUs），重规划不累计误差
+// - 运行结束后按先到先得把实际出币面值分摊到各请求并上报
+// 时间由调用方注入（us），不依赖 Arduino，可在主机侧直接编译。
+
+#define PAYOUT_MAX_REQUESTS         8     // 单次运行可合并的请求数
+#define PAYOUT_TAG_ALL              0xFF  // 取消全部
+
+enum PayoutStatus : uint8_t {
+  PAYOUT_STATUS_DONE      = 0,  // 足额吐出
+  PAYOUT_STATUS_CANCELLED = 1,  // 被取消（paid 为取消前已吐出的部分）
+  PAYOUT_STATUS_SHORT     = 2,  // 无法找零，少于请求
+  PAYOUT_STATUS_REJECTED  = 3,  // 合并队列已满，未执行
+};
+
+struct PayoutRequestResult {
+  uint8_t  tag;
+  uint16_t requested;
+  uint16_t paid;
+  uint8_t  status;
+  uint32_t originUs;  // 请求起点（由调用方给出，通常为收到指令的时刻）
+};
+
+// 一次连续运行的结果
+struct PayoutCompletion {
+  uint8_t             hopperCount;
+  uint16_t            coins[PAYOUT_MAX_HOPPERS];  // 各料斗实际出币枚数
+  uint32_t            value;                      // 面值合计
+  uint64_t            finishUs;                   // 运行结束时刻
+  uint8_t             requestCount;
+  PayoutRequestResult requests[PAYOUT_MAX_REQUESTS];
+};
+
+class PayoutScheduler {
+ public:
+  PayoutScheduler(const HopperSpec* hoppers, uint8_t hopperCount)
+      : hoppers_(hoppers), hopperCount_(hopperCount < PAYOUT_MAX_HOPPERS ? hopperCount : PAYOUT_MAX_HOPPERS) {}
+
+  // 提交一笔吐币；合并队列已满返回 false。originUs 原样带回结果，用于端到端时延
+  bool submit(uint8_t tag, uint16_t value, uint64_t nowUs, uint32_t originUs = 0) {
+    if (state_ == COMPLETE || requestCount_ >= PAYOUT_MAX_REQUESTS) return false;
+    Request& r  = requests_[requestCount_++];
+    r.tag       = tag;
+    r.requested = value;
+    r.target    = value;
+    r.cancelled = false;
+    r.originUs  = originUs;
+    state_      = RUNNING;
+    replan(nowUs);
+    return true;
+  }
+
+  // 取消指定请求（未吐出部分）或全部（PAYOUT_TAG_ALL，立即停机）；无匹配返回 false
+  bool cancel(uint8_t tag, uint64_t nowUs) {
+    if (state_ != RUNNING) return false;
+    if (tag == PAYOUT_TAG_ALL) {
+      for (uint8_t i = 0; i < requestCount_; i++) requests_[i].cancelled = true;
+      for (uint8_t h = 0; h < hopperCount_; h++) {
+        doneCoins_[h] += committedCoins(h, nowUs);
+        stretchCoins_[h] = 0;
+      }
+      relayMask_ = 0;
+      finish(nowUs);
+      return true;
+    }
+
+    for (uint8_t i = 0; i < requestCount_; i++) {
+      Request& r = requests_[i];
+      if (r.tag != tag || r.cancelled) continue;
+      r.cancelled = true;
+      // 先到先得：该请求保留已确定会吐出的部分
+      uint32_t before = 0;
+      for (uint8_t k = 0; k < i; k++) before += requests_[k].target;
+      const uint32_t committed = committedValue(nowUs);
+      const uint32_t kept = committed > before ? committed - before : 0;
+      if (kept < r.target) r.target = (uint16_t)kept;
+      replan(nowUs);
+      return true;
+    }
+    return false;
+  }
+
+  // 推进到 nowUs：处理已到截止时刻的料斗
+  void tick(uint64_t nowUs) {
+    if (state_ != RUNNING) return;
+    for (uint8_t h = 0; h < hopperCount_; h++) {
+      if ((relayMask_ & (1u << h)) && nowUs >= deadlineUs_[h]) {
+        relayMask_ &= (uint8_t)~(1u << h);
+        doneCoins_[h] += stretchCoins_[h];
+        stretchCoins_[h] = 0;
+      }
+    }
+    if (!relayMask_) finish(nowUs);
+  }
+
+  // 下一次需要 tick 的时刻；无待处理事件返回 UINT64_MAX
+  uint64_t nextEventUs() const {
+    if (state_ != RUNNING) return UINT64_MAX;
+    uint64_t next = UINT64_MAX;
+    for (uint8_t h = 0; h < hopperCount_; h++) {
+      if ((relayMask_ & (1u << h)) && deadlineUs_[h] < next) next = deadlineUs_[h];
+    }
+    return next;
+  }
+
+  uint8_t relayMask() const { return relayMask_; }
+  bool busy() const { return state_ != IDLE; }
+
+  // 运行结束后取出结果（仅一次），之后调度器回到空闲
+  bool takeCompletion(PayoutCompletion& out) {
+    if (state_ != COMPLETE) return false;
+    out   = completion_;
+    state_ = IDLE;
+    return true;
+  }
+
+ private:
+  enum State : uint8_t { IDLE, RUNNING, COMPLETE };
+
+  struct Request {
+    uint8_t  tag;
+    uint16_t requested;
+    uint16_t target;     // 取消后缩减为保留部分
+    bool     cancelled;
+    uint32_t originUs;
+  };
+
+  // 本次连续导通已出的枚数（含正在出的那枚的小数部分）
+  double progress(uint8_t h, uint64_t nowUs) const {
+    return (double)(nowUs - startUs_[h]) * hoppers_[h].coinsPerSec / 1000000.0;
+  }
+
+  // 已开始出的那枚计为已出（停机时已在出币口，运行中必然出完）：进度向上取整
+  uint32_t committedCoins(uint8_t h, uint64_t nowUs) const {
+    if (!(relayMask_ & (1u << h))) return 0;
+    uint32_t c = (uint32_t)ceil(progress(h, nowUs) - 1e-9);
+    return c < stretchCoins_[h] ? c : stretchCoins_[h];
+  }
+
+  uint32_t committedValue(uint64_t nowUs) const {
+    uint32_t v = 0;
+    for (uint8_t h = 0; h < hopperCount_; h++) {
+      v += (doneCoins_[h] + committedCoins(h, nowUs)) * hoppers_[h].denomination;
+    }
+    return v;
+  }
+
+  void replan(uint64_t nowUs) {
+    uint32_t target = 0;
+    for (uint8_t i = 0; i < requestCount_; i++) target += requests_[i].target;
+    const uint32_t committed = committedValue(nowUs);
+    const uint32_t remaining = target > committed ? target - committed : 0;
+
+    PayoutPlan plan;
+    planPayout(hoppers_, hopperCount_, remaining, plan);
+
+    for (uint8_t h = 0; h < hopperCount_; h++) {
+      const bool on = relayMask_ & (1u << h);
+      if (on) {
+        stretchCoins_[h] = committedCoins(h, nowUs) + plan.coins[h];
+      } else if (plan.coins[h]) {
+        startUs_[h]      = nowUs;
+        stretchCoins_[h] = plan.coins[h];
+      } else {
+        continue;
+      }
+      deadlineUs_[h] = startUs_[h] +
+                       (uint64_t)((double)stretchCoins_[h] * 1000000.0 / hoppers_[h].coinsPerSec + 0.5);
+      relayMask_ |= (uint8_t)(1u << h);
+    }
+    if (!relayMask_) finish(nowUs);
+  }
+
+  void finish(uint64_t nowUs) {
+    PayoutCompletion& c = completion_;
+    c.hopperCount = hopperCount_;
+    c.value       = 0;
+    c.finishUs    = nowUs;
+    for (uint8_t h = 0; h < PAYOUT_MAX_HOPPERS; h++) {
+      c.coins[h] = h < hopperCount_ ? (uint16_t)doneCoins_[h] : 0;
+      c.value += (uint32_t)c.coins[h] * (h < hopperCount_ ? hoppers_[h].denomination : 0);
+    }
+
+    // 先到先得分摊；因面值取整多出的部分计入最后一笔
+    uint32_t left = c.value;
+    c.requestCount = requestCount_;
+    for (uint8_t i = 0; i < requestCount_; i++) {
+      const Request& r = requests_[i];
+      PayoutRequestResult& out = c.requests[i];
+      const uint32_t paid = left < r.target ? left : r.target;
+      left -= paid;
+      out.tag       = r.tag;
+      out.requested = r.requested;
+      out.paid      = (uint16_t)paid;
+      out.originUs  = r.originUs;
+      out.status    = r.cancelled ? PAYOUT_STATUS_CANCELLED
+                    : (paid < r.requested ? PAYOUT_STATUS_SHORT : PAYOUT_STATUS_DONE);
+    }
+    if (left && requestCount_) {
+      PayoutRequestResult& last = c.requests[requestCount_ - 1];
+      last.paid = (uint16_t)(last.paid + left > UINT16_MAX ? UINT16_MAX : last.paid + left);
+    }
+
+    for (uint8_t h = 0; h < PAYOUT_MAX_HOPPERS; h++) {
+      doneCoins_[h]    = 0;
+      stretchCoins_[h] = 0;
+    }
+    relayMask_    = 0;
+    requestCount_ = 0;
+    state_        = COMPLETE;
+  }
+
+  const HopperSpec* hoppers_;
+  uint8_t  hopperCount_;
+
+  State    state_        = IDLE;
+  uint8_t  relayMask_    = 0;
+  uint8_t  requestCount_ = 0;
+  Request  requests_[PAYOUT_MAX_REQUESTS] = {};
+
+  uint64_t startUs_[PAYOUT_MAX_HOPPERS]      = {};  // 本次连续导通起点
+  uint64_t deadlineUs_[PAYOUT_MAX_HOPPERS]   = {};
+  uint32_t stretchCoins_[PAYOUT_MAX_HOPPERS] = {};  // 本次连续导通计划枚数
+  uint32_t doneCoins_[PAYOUT_MAX_HOPPERS]    = {};  // 已结束导通段累计枚数
+
+  PayoutCompletion completion_ = {};
+};
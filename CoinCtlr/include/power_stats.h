@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+
+// ==== 低功耗：保持唤醒的原因与唤醒占比统计 ====
+// 固件只在需要时持有 PM 锁（吐币定时、脉冲串进行中、指令处理、打印、串口诊断输出、固件升级），
+// 其余时间交给 esp_pm 自动降频并进入浅睡。本文件记录各原因的持有时长、
+// 持有区间的并集（= 固件要求保持唤醒的时间）与唤醒次数，并按两档电流的模型给出窗口内平均电流。
+// 模型值不是测量值：两档电流取自 config.h 的标定常数，BLE 协议栈自身的唤醒（广播/连接事件）不在统计内，
+// 且假定 esp_pm 确实在无人持锁时降频/浅睡（配置失败时固件不输出模型值）；实测以串联电流表为准。
+// 每个原因只由一个任务持有/释放，调用方负责跨任务互斥；不依赖 Arduino，可在主机侧直接编译。
+
+enum AwakeReason : uint8_t {
+  AWAKE_PAYOUT = 0,  // 吐币运行：全速，保证继电器定时
+  AWAKE_COIN,        // 脉冲串未结束：禁浅睡，保证后续脉冲时间戳精度
+  AWAKE_IO,          // I/O 任务处理一条消息：全速
+  AWAKE_PRINT,       // 打印任务执行作业：禁浅睡（UART 持续发送）
+  AWAKE_DIAG,        // 诊断输出：禁浅睡，直到串口发送完
+  AWAKE_OTA,         // 固件升级处理一帧（解压、擦写）：全速
+  AWAKE_REASON_COUNT
+};
+
+struct AwakeReport {
+  uint64_t windowUs;
+  uint64_t awakeUs;                          // 各原因持有区间的并集
+  uint32_t wakes;                            // 从无人持有到有人持有的次数
+  uint64_t reasonUs[AWAKE_REASON_COUNT];
+  float    modelMa;                          // 模型平均电流（两档加权，非实测）
+};
+
+class AwakeMeter {
+ public:
+  AwakeMeter(float awakeMa, float sleepMa) : awakeMa_(awakeMa), sleepMa_(sleepMa) {}
+
+  // 开始持有；已持有时不重复计数。返回是否为新持有（调用方据此获取 PM 锁）
+  bool hold(uint8_t reason, uint64_t nowUs) {
+    const uint8_t bit = (uint8_t)(1u << reason);
+    if (mask_ & bit) return false;
+    if (!mask_) {
+      awakeSinceUs_ = nowUs;
+      wakes_++;
+    }
+    mask_ |= bit;
+    sinceUs_[reason] = nowUs;
+    return true;
+  }
+
+  // 结束持有；未持有时忽略。返回是否确实释放（调用方据此释放 PM 锁）
+  bool release(uint8_t reason, uint64_t nowUs) {
+    const uint8_t bit = (uint8_t)(1u << reason);
+    if (!(mask_ & bit)) return false;
+    reasonUs_[reason] += nowUs - sinceUs_[reason];
+    mask_ &= (uint8_t)~bit;
+    if (!mask_) awakeUs_ += nowUs - awakeSinceUs_;
+    return true;
+  }
+
+  bool held(uint8_t reason) const { return mask_ & (1u << reason); }
+
+  // 结束当前统计窗口并开始下一个；仍在持有的区间按 nowUs 切开
+  AwakeReport take(uint64_t nowUs) {
+    AwakeReport r = {};
+    r.windowUs = nowUs - windowStartUs_;
+    r.awakeUs  = awakeUs_ + (mask_ ? nowUs - awakeSinceUs_ : 0);
+    r.wakes    = wakes_;
+    for (uint8_t i = 0; i < AWAKE_REASON_COUNT; i++) {
+      r.reasonUs[i] = reasonUs_[i] + ((mask_ & (1u << i)) ? nowUs - sinceUs_[i] : 0);
+      reasonUs_[i]  = 0;
+      sinceUs_[i]   = nowUs;
+    }
+    if (r.awakeUs > r.windowUs) r.awakeUs = r.windowUs;
+    // 两档模型：持锁时间按 awakeMa_，其余按 sleepMa_
+    const float awakeFrac = r.windowUs ? (float)r.awakeUs / (float)r.windowUs : 1.0f;
+    r.modelMa = sleepMa_ + (awakeMa_ - sleepMa_) * awakeFrac;
+
+    windowStartUs_ = nowUs;
+    awakeSinceUs_  = nowUs;
+    awakeUs_       = 0;
+    wakes_         = 0;
+    return r;
+  }
+
+ private:
+  float    awakeMa_;
+  float    sleepMa_;
+  uint8_t  mask_          = 0;
+  uint32_t wakes_         = 0;
+  uint64_t windowStartUs_ = 0;
+  uint64_t awakeSinceUs_  = 0;
+  uint64_t awakeUs_       = 0;
+  uint64_t sinceUs_[AWAKE_REASON_COUNT]  = {};
+  uint64_t reasonUs_[AWAKE_REASON_COUNT] = {};
+};
+
+static_assert(AWAKE_REASON_COUNT <= 8, "AwakeMeter mask is 8 bits");
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "event_stamp.h"
+
+// ==== 指令表（编译期） ====
+// 每个指令一行：X(操作码, 名称, 负载最小长度, 负载最大长度, 负载布局)；长度不含操作码字节。
+// 固件用同一张表展开处理函数（handle##名称），主机侧编解码工具展开名称/布局，二者不会不一致。
+// 新增指令：在 config.h 定义操作码，在此追加一行，固件实现 handle##名称，并视情况提升 PROTOCOL_VERSION。
+#define PROTOCOL_VERSION            5     // 5：续传回放改为紧凑帧（event_backlog.h）
+
+#define PROTOCOL_COMMANDS(X)                                                                      \
+  X(CMD_START_SESSION,    StartSession,   0, 3,                         LAYOUT_NONE)              \
+  X(CMD_PAYOUT,           Payout,         2, 3,                         LAYOUT_U16_OPT_U8)        \
+  X(CMD_PRINT_RECEIPT,    PrintReceipt,   1, PRINT_JOB_MAX_BYTES,       LAYOUT_TEXT)              \
+  X(CMD_DEBUG_PRINTER,    DebugPrinter,   0, 0,                         LAYOUT_NONE)              \
+  X(CMD_PAYOUT_CANCEL,    PayoutCancel,   0, 1,                         LAYOUT_OPT_U8)            \
+  X(CMD_SET_EVENT_FORMAT, SetEventFormat, 1, 1,                         LAYOUT_U8)                \
+  X(CMD_TIME_PING,        TimePing,       4, 4,                         LAYOUT_U32)               \
+  X(CMD_RESUME,           Resume,         6, 6,                         LAYOUT_U32_U16)           \
+  X(CMD_GET_CAPS,         GetCaps,        0, 0,                         LAYOUT_NONE)              \
+  X(CMD_SET_ROLE,         SetRole,        1, 1,                         LAYOUT_U8)                \
+  X(CMD_PRINT_RASTER,     PrintRaster,    4, 4 + PRINT_JOB_MAX_BYTES,   LAYOUT_U32_BYTES)         \
+  X(CMD_PRINT_QR,         PrintQr,        2, 1 + QR_MAX_TEXT_BYTES,     LAYOUT_U8_BYTES)
+
+// 负载布局（多字节字段均为 LE）
+enum PayloadLayout : uint8_t {
+  LAYOUT_NONE,        // 无负载（多余字节忽略，兼容旧版 App 的填充）
+  LAYOUT_U8,          // a = u8
+  LAYOUT_OPT_U8,      // [a = u8]
+  LAYOUT_U16_OPT_U8,  // a = u16 [, b = u8]
+  LAYOUT_U32,         // a = u32
+  LAYOUT_U32_U16,     // a = u32, b = u16
+  LAYOUT_TEXT,        // data/dataLen = 原始字节
+  LAYOUT_U8_BYTES,    // a = u8, data/dataLen = 其余字节
+  LAYOUT_U32_BYTES,   // a = u32, data/dataLen = 其余字节
+};
+
+struct OpcodeSpec {
+  uint8_t       op;
+  uint16_t      minLen;
+  uint16_t      maxLen;
+  PayloadLayout layout;
+  const char*   name;
+};
+
+#define PROTOCOL_SPEC_ENTRY(op, name, minLen, maxLen, layout) { op, minLen, maxLen, layout, #name },
+constexpr OpcodeSpec kOpcodeSpecs[] = { PROTOCOL_COMMANDS(PROTOCOL_SPEC_ENTRY) };
+#undef PROTOCOL_SPEC_ENTRY
+
+constexpr size_t kOpcodeCount = sizeof(kOpcodeSpecs) / sizeof(kOpcodeSpecs[0]);
+
+// 操作码 → 表内下标 + 1（0 = 不支持），分发时一次查表
+struct OpcodeIndex {
+  uint8_t slot[256];
+};
+
+constexpr OpcodeIndex buildOpcodeIndex() {
+  OpcodeIndex ix = {};
+  for (size_t i = 0; i < kOpcodeCount; i++) ix.slot[kOpcodeSpecs[i].op] = (uint8_t)(i + 1);
+  return ix;
+}
+
+constexpr OpcodeIndex kOpcodeIndex = buildOpcodeIndex();
+
+constexpr bool opcodesUnique() {
+  for (size_t i = 0; i < kOpcodeCount; i++) {
+    if (kOpcodeIndex.slot[kOpcodeSpecs[i].op] != i + 1) return false;
+  }
+  return true;
+}
+
+constexpr bool layoutsConsistent() {
+  for (size_t i = 0; i < kOpcodeCount; i++) {
+    const OpcodeSpec& s = kOpcodeSpecs[i];
+    if (s.minLen > s.maxLen) return false;
+    switch (s.layout) {
+      case LAYOUT_U8:         if (s.minLen < 1) return false; break;
+      case LAYOUT_U16_OPT_U8: if (s.minLen < 2 || s.maxLen > 3) return false; break;
+      case LAYOUT_U32:        if (s.minLen < 4) return false; break;
+      case LAYOUT_U32_U16:    if (s.minLen < 6) return false; break;
+      case LAYOUT_OPT_U8:     if (s.maxLen > 1) return false; break;
+      case LAYOUT_U8_BYTES:   if (s.minLen < 1) return false; break;
+      case LAYOUT_U32_BYTES:  if (s.minLen < 4) return false; break;
+      default: break;
+    }
+  }
+  return true;
+}
+
+static_assert(kOpcodeCount < 255, "too many opcodes");
+static_assert(opcodesUnique(), "duplicate opcode in PROTOCOL_COMMANDS");
+static_assert(layoutsConsistent(), "opcode length bounds do not match its payload layout");
+
+// ==== 编解码（固件与主机侧共用） ====
+enum CommandError : uint8_t {
+  CMD_OK = 0,
+  CMD_ERR_EMPTY,
+  CMD_ERR_UNKNOWN,
+  CMD_ERR_LENGTH,
+};
+
+struct CommandFrame {
+  uint8_t        op;
+  uint8_t        index;    // kOpcodeSpecs 下标
+  uint8_t        argCount; // 实际携带的数值字段数（可选字段据此判断）
+  uint32_t       a;
+  uint32_t       b;
+  const uint8_t* data;     // LAYOUT_TEXT / LAYOUT_*_BYTES
+  size_t         dataLen;
+  uint16_t       client;   // 发出指令的连接（固件填 BLE conn_id，应答只发给它；解码后为 0）
+};
+
+inline CommandError decodeCommand(const uint8_t* frame, size_t len, CommandFrame& out) {
+  if (len < 1) return CMD_ERR_EMPTY;
+  out = {};
+  out.op = frame[0];
+  const uint8_t slot = kOpcodeIndex.slot[out.op];
+  if (!slot) return CMD_ERR_UNKNOWN;
+  out.index = (uint8_t)(slot - 1);
+  const OpcodeSpec& spec = kOpcodeSpecs[out.index];
+  const uint8_t* p = frame + 1;
+  const size_t n = len - 1;
+  if (n < spec.minLen || (n > spec.maxLen && spec.layout != LAYOUT_NONE)) return CMD_ERR_LENGTH;
+
+  switch (spec.layout) {
+    case LAYOUT_NONE:
+      break;
+    case LAYOUT_U8:
+      out.a = p[0];
+      out.argCount = 1;
+      break;
+    case LAYOUT_OPT_U8:
+      if (n >= 1) {
+        out.a = p[0];
+        out.argCount = 1;
+      }
+      break;
+    case LAYOUT_U16_OPT_U8:
+      out.a = getLe16(p);
+      out.argCount = 1;
+      if (n >= 3) {
+        out.b = p[2];
+        out.argCount = 2;
+      }
+      break;
+    case LAYOUT_U32:
+      out.a = getLe32(p);
+      out.argCount = 1;
+      break;
+    case LAYOUT_U32_U16:
+      out.a = getLe32(p);
+      out.b = getLe16(p + 4);
+      out.argCount = 2;
+      break;
+    case LAYOUT_TEXT:
+      out.data    = p;
+      out.dataLen = n;
+      break;
+    case LAYOUT_U8_BYTES:
+      out.a        = p[0];
+      out.argCount = 1;
+      out.data     = p + 1;
+      out.dataLen  = n - 1;
+      break;
+    case LAYOUT_U32_BYTES:
+      out.a        = getLe32(p);
+      out.argCount = 1;
+      out.data     = p + 4;
+      out.dataLen  = n - 4;
+      break;
+  }
+  return CMD_OK;
+}
+
+// 按表编码一条指令，返回帧长；参数与布局不符或缓冲不足返回 0
+inline size_t encodeCommand(const CommandFrame& cmd, uint8_t* out, size_t cap) {
+  const uint8_t slot = kOpcodeIndex.slot[cmd.op];
+  if (!slot || cap < 1) return 0;
+  const OpcodeSpec& spec = kOpcodeSpecs[slot - 1];
+  const uint8_t required = spec.layout == LAYOUT_U32_U16 ? 2
+                         : (spec.layout == LAYOUT_U8 || spec.layout == LAYOUT_U16_OPT_U8 ||
+                            spec.layout == LAYOUT_U32 || spec.layout == LAYOUT_U8_BYTES ||
+                            spec.layout == LAYOUT_U32_BYTES) ? 1 : 0;
+  if (cmd.argCount < required) return 0;
+  size_t len = 0;
+  out[len++] = cmd.op;
+
+  auto put = [&](uint32_t v, uint8_t width) {
+    if (len + width > cap) return false;
+    if (width == 1) out[len] = (uint8_t)v;
+    else if (width == 2) putLe16(out + len, (uint16_t)v);
+    else putLe32(out + len, v);
+    len += width;
+    return true;
+  };
+
+  auto putBytes = [&]() {
+    if (len + cmd.dataLen > cap) return false;
+    for (size_t i = 0; i < cmd.dataLen; i++) out[len++] = cmd.data[i];
+    return true;
+  };
+
+  bool ok = true;
+  switch (spec.layout) {
+    case LAYOUT_NONE:       break;
+    case LAYOUT_U8:         ok = put(cmd.a, 1); break;
+    case LAYOUT_OPT_U8:     if (cmd.argCount >= 1) ok = put(cmd.a, 1); break;
+    case LAYOUT_U16_OPT_U8: ok = put(cmd.a, 2) && (cmd.argCount < 2 || put(cmd.b, 1)); break;
+    case LAYOUT_U32:        ok = put(cmd.a, 4); break;
+    case LAYOUT_U32_U16:    ok = put(cmd.a, 4) && put(cmd.b, 2); break;
+    case LAYOUT_TEXT:       ok = putBytes(); break;
+    case LAYOUT_U8_BYTES:   ok = put(cmd.a, 1) && putBytes(); break;
+    case LAYOUT_U32_BYTES:  ok = put(cmd.a, 4) && putBytes(); break;
+  }
+  if (!ok) return 0;
+  const size_t n = len - 1;
+  return (n >= spec.minLen && n <= spec.maxLen) ? len : 0;
+}
+
+// ==== 能力发现 ====
+// CMD_GET_CAPS → [EVT_CAPS, PROTOCOL_VERSION, 指令数, 操作码...]
+struct CapabilitiesFrame {
+  uint8_t bytes[3 + kOpcodeCount];
+};
+
+constexpr CapabilitiesFrame buildCapabilities() {
+  CapabilitiesFrame f = {};
+  f.bytes[0] = EVT_CAPS;
+  f.bytes[1] = PROTOCOL_VERSION;
+  f.bytes[2] = (uint8_t)kOpcodeCount;
+  for (size_t i = 0; i < kOpcodeCount; i++) f.bytes[3 + i] = kOpcodeSpecs[i].op;
+  return f;
+}
+
+constexpr CapabilitiesFrame kCapabilities = buildCapabilities();
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+
+// ==== 二维码编码（ISO/IEC 18004，字节模式，版本 1..QR_MAX_VERSION） ====
+// 小票上的链接/兑奖码由设备现场生成：App 只发几十字节文本，不再发上万字节的位图。
+// 流程：选最小可容纳的版本 → 数据码字（模式 + 长度 + 数据 + 填充）→ 分块 Reed-Solomon → 交织 →
+// 功能图形 + 之字形放置 → 8 种掩膜按规范罚分取最小。模块与"功能区"标记各占一位，版本 10 共约 0.8KB。
+// 不依赖 Arduino；tools/raster_print 用同一份编码器生成测试图样，并按标准流程回读校验。
+
+static_assert(QR_MAX_VERSION >= 1 && QR_MAX_VERSION <= 10, "QR tables cover versions 1..10");
+
+#define QR_MAX_SIZE                 (4 * QR_MAX_VERSION + 17)
+#define QR_MAX_CODEWORDS            346  // 版本 10 的总码字数（数据 + 纠错）
+
+// 纠错级别（按强度排列，与格式信息中的编码不同，见 formatBits()）
+enum QrEcc : uint8_t { QR_ECC_L = 0, QR_ECC_M, QR_ECC_Q, QR_ECC_H };
+
+class QrCode {
+ public:
+  // 生成二维码；文本超出 QR_MAX_VERSION 在该纠错级别的容量或参数无效返回 false。
+  // mask < 0 时自动选择罚分最小的掩膜（主机侧比对可指定）
+  bool encode(const uint8_t* text, size_t len, uint8_t ecc, int mask = -1) {
+    if (ecc > QR_ECC_H || mask > 7) return false;
+    version_ = 0;
+    for (uint8_t v = 1; v <= QR_MAX_VERSION; v++) {
+      if (4 + countBits(v) + 8 * len <= (size_t)dataCodewords(v, ecc) * 8) {
+        version_ = v;
+        break;
+      }
+    }
+    if (!version_) return false;
+    ecc_  = ecc;
+    size_ = (uint8_t)(4 * version_ + 17);
+    memset(modules_, 0, sizeof(modules_));
+    memset(function_, 0, sizeof(function_));
+
+    buildCodewords(text, len);
+    drawFunctionPatterns();
+    drawCodewords();
+
+    if (mask < 0) {
+      long best = -1;
+      for (uint8_t m = 0; m < 8; m++) {
+        applyMask(m);
+        drawFormatBits(m);
+        const long p = penalty();
+        if (best < 0 || p < best) {
+          best = p;
+          mask = m;
+        }
+        applyMask(m);  // 异或掩膜，再做一次即还原
+      }
+    }
+    mask_ = (uint8_t)mask;
+    applyMask(mask_);
+    drawFormatBits(mask_);
+    return true;
+  }
+
+  uint8_t size() const { return size_; }
+  uint8_t version() const { return version_; }
+  uint8_t ecc() const { return ecc_; }
+  uint8_t mask() const { return mask_; }
+  bool module(uint8_t x, uint8_t y) const { return get(modules_, x, y); }
+  bool isFunction(uint8_t x, uint8_t y) const { return get(function_, x, y); }
+
+  // ==== 规范常量（主机侧回读校验共用） ====
+  static uint16_t rawCodewords(uint8_t v) {
+    uint32_t bits = (16u * v + 128) * v + 64;
+    if (v >= 2) {
+      const uint32_t align = v / 7u + 2;
+      bits -= (25 * align - 10) * align - 55;
+      if (v >= 7) bits -= 36;
+    }
+    return (uint16_t)(bits / 8);
+  }
+  static uint8_t eccPerBlock(uint8_t v, uint8_t ecc) { return kEccPerBlock[ecc][v - 1]; }
+  static uint8_t blockCount(uint8_t v, uint8_t ecc) { return kBlocks[ecc][v - 1]; }
+  static uint16_t dataCodewords(uint8_t v, uint8_t ecc) {
+    return (uint16_t)(rawCodewords(v) - eccPerBlock(v, ecc) * blockCount(v, ecc));
+  }
+  static uint8_t countBits(uint8_t v) { return v <= 9 ? 8 : 16; }
+
+  // 15 位格式信息（纠错级别 + 掩膜，BCH(15,5) 后异或 0x5412）
+  static uint16_t formatBits(uint8_t ecc, uint8_t mask) {
+    static const uint8_t kEccBits[4] = { 1, 0, 3, 2 };  // L M Q H
+    const uint16_t data = (uint16_t)(kEccBits[ecc] << 3 | mask);
+    uint16_t rem = data;
+    for (uint8_t i = 0; i < 10; i++) rem = (uint16_t)((rem << 1) ^ ((rem >> 9) * 0x537));
+    return (uint16_t)((data << 10 | rem) ^ 0x5412);
+  }
+
+  static bool maskBit(uint8_t mask, uint8_t x, uint8_t y) {
+    switch (mask) {
+      case 0:  return (x + y) % 2 == 0;
+      case 1:  return y % 2 == 0;
+      case 2:  return x % 3 == 0;
+      case 3:  return (x + y) % 3 == 0;
+      case 4:  return (x / 3 + y / 2) % 2 == 0;
+      case 5:  return x * y % 2 + x * y % 3 == 0;
+      case 6:  return (x * y % 2 + x * y % 3) % 2 == 0;
+      default: return ((x + y) % 2 + x * y % 3) % 2 == 0;
+    }
+  }
+
+  // GF(256)（本原多项式 0x11D）上的 Reed-Solomon：生成多项式（degree 项，首项系数 1 省略）与余式
+  static uint8_t gfMul(uint8_t a, uint8_t b) {
+    uint16_t z = 0;
+    for (int i = 7; i >= 0; i--) {
+      z = (uint16_t)((z << 1) ^ ((z >> 7) * 0x11D));
+      z ^= (uint16_t)(((b >> i) & 1) * a);
+    }
+    return (uint8_t)z;
+  }
+  static void rsDivisor(uint8_t degree, uint8_t* out) {
+    memset(out, 0, degree);
+    out[degree - 1] = 1;
+    uint8_t root = 1;
+    for (uint8_t i = 0; i < degree; i++) {
+      for (uint8_t j = 0; j < degree; j++) {
+        out[j] = gfMul(out[j], root);
+        if (j + 1 < degree) out[j] ^= out[j + 1];
+      }
+      root = gfMul(root, 0x02);
+    }
+  }
+  static void rsRemainder(const uint8_t* data, size_t len, const uint8_t* divisor, uint8_t degree, uint8_t* out) {
+    memset(out, 0, degree);
+    for (size_t i = 0; i < len; i++) {
+      const uint8_t factor = data[i] ^ out[0];
+      memmove(out, out + 1, degree - 1);
+      out[degree - 1] = 0;
+      for (uint8_t j = 0; j < degree; j++) out[j] ^= gfMul(divisor[j], factor);
+    }
+  }
+
+ private:
+  static constexpr size_t kBits = (QR_MAX_SIZE * QR_MAX_SIZE + 7) / 8;
+
+  bool get(const uint8_t* bits, uint8_t x, uint8_t y) const {
+    const size_t i = (size_t)y * size_ + x;
+    return (bits[i >> 3] >> (i & 7)) & 1;
+  }
+  void put(uint8_t* bits, uint8_t x, uint8_t y, bool on) {
+    const size_t i = (size_t)y * size_ + x;
+    if (on) bits[i >> 3] |= (uint8_t)(1u << (i & 7));
+    else bits[i >> 3] &= (uint8_t)~(1u << (i & 7));
+  }
+  void setFunction(int x, int y, bool on) {
+    put(modules_, (uint8_t)x, (uint8_t)y, on);
+    put(function_, (uint8_t)x, (uint8_t)y, true);
+  }
+
+  // 数据码字按块计算纠错码字，再逐列交织写入 codewords_
+  void buildCodewords(const uint8_t* text, size_t len) {
+    const uint16_t capacity = dataCodewords(version_, ecc_);
+    memset(data_, 0, sizeof(data_));
+    size_t bit = 0;
+    auto append = [&](uint32_t v, uint8_t n) {
+      for (int i = n - 1; i >= 0; i--, bit++) {
+        if ((v >> i) & 1) data_[bit >> 3] |= (uint8_t)(0x80 >> (bit & 7));
+      }
+    };
+    append(0x4, 4);  // 字节模式
+    append((uint32_t)len, countBits(version_));
+    for (size_t i = 0; i < len; i++) append(text[i], 8);
+    const size_t capBits = (size_t)capacity * 8;
+    bit += capBits - bit < 4 ? capBits - bit : 4;  // 终止符
+    bit = (bit + 7) & ~(size_t)7;
+    for (uint8_t pad = 0xEC; bit < capBits; bit += 8, pad ^= 0xEC ^ 0x11) data_[bit >> 3] = pad;
+
+    const uint8_t blocks = blockCount(version_, ecc_);
+    const uint8_t eccLen = eccPerBlock(version_, ecc_);
+    const uint16_t raw   = rawCodewords(version_);
+    const uint8_t shortBlocks = (uint8_t)(blocks - raw % blocks);
+    const uint8_t shortData   = (uint8_t)(raw / blocks - eccLen);
+    uint8_t divisor[30];
+    rsDivisor(eccLen, divisor);
+    size_t start = 0;
+    for (uint8_t b = 0; b < blocks; b++) {
+      const uint8_t n = (uint8_t)(shortData + (b < shortBlocks ? 0 : 1));
+      rsRemainder(data_ + start, n, divisor, eccLen, eccBytes_ + (size_t)b * eccLen);
+      start += n;
+    }
+
+    size_t k = 0;
+    for (uint8_t i = 0; i <= shortData; i++) {
+      start = 0;
+      for (uint8_t b = 0; b < blocks; b++) {
+        const uint8_t n = (uint8_t)(shortData + (b < shortBlocks ? 0 : 1));
+        if (i < n) codewords_[k++] = data_[start + i];
+        start += n;
+      }
+    }
+    for (uint8_t i = 0; i < eccLen; i++) {
+      for (uint8_t b = 0; b < blocks; b++) codewords_[k++] = eccBytes_[(size_t)b * eccLen + i];
+    }
+    codewordCount_ = (uint16_t)k;
+  }
+
+  void drawFunctionPatterns() {
+    for (int i = 0; i < size_; i++) {
+      setFunction(6, i, i % 2 == 0);
+      setFunction(i, 6, i % 2 == 0);
+    }
+    drawFinder(3, 3);
+    drawFinder(size_ - 4, 3);
+    drawFinder(3, size_ - 4);
+
+    uint8_t pos[7];
+    const uint8_t n = alignmentPositions(pos);
+    for (uint8_t i = 0; i < n; i++) {
+      for (uint8_t j = 0; j < n; j++) {
+        if ((i == 0 && j == 0) || (i == 0 && j == n - 1) || (i == n - 1 && j == 0)) continue;
+        for (int dy = -2; dy <= 2; dy++) {
+          for (int dx = -2; dx <= 2; dx++) {
+            setFunction(pos[i] + dx, pos[j] + dy, maxAbs(dx, dy) != 1);
+          }
+        }
+      }
+    }
+
+    drawFormatBits(0);  // 先占位，选定掩膜后重画
+    if (version_ >= 7) {
+      uint32_t rem = version_;
+      for (uint8_t i = 0; i < 12; i++) rem = (rem << 1) ^ ((rem >> 11) * 0x1F25);
+      const uint32_t bits = (uint32_t)version_ << 12 | rem;
+      for (uint8_t i = 0; i < 18; i++) {
+        const bool on = (bits >> i) & 1;
+        const int a = size_ - 11 + i % 3, b = i / 3;
+        setFunction(a, b, on);
+        setFunction(b, a, on);
+      }
+    }
+  }
+
+  void drawFinder(int cx, int cy) {
+    for (int dy = -4; dy <= 4; dy++) {
+      for (int dx = -4; dx <= 4; dx++) {
+        const int x = cx + dx, y = cy + dy;
+        if (x < 0 || y < 0 || x >= size_ || y >= size_) continue;
+        const int d = maxAbs(dx, dy);
+        setFunction(x, y, d != 2 && d != 4);
+      }
+    }
+  }
+
+  uint8_t alignmentPositions(uint8_t* out) const {
+    if (version_ == 1) return 0;
+    const uint8_t n = (uint8_t)(version_ / 7 + 2);
+    const uint8_t step = (uint8_t)((version_ * 4 + n * 2 + 1) / (n * 2 - 2) * 2);
+    out[0] = 6;
+    for (uint8_t i = n - 1, p = (uint8_t)(size_ - 7); i >= 1; i--, p = (uint8_t)(p - step)) out[i] = p;
+    return n;
+  }
+
+  void drawFormatBits(uint8_t mask) {
+    const uint16_t bits = formatBits(ecc_, mask);
+    auto bit = [&](int i) { return ((bits >> i) & 1) != 0; };
+    for (int i = 0; i <= 5; i++) setFunction(8, i, bit(i));
+    setFunction(8, 7, bit(6));
+    setFunction(8, 8, bit(7));
+    setFunction(7, 8, bit(8));
+    for (int i = 9; i < 15; i++) setFunction(14 - i, 8, bit(i));
+    for (int i = 0; i < 8; i++) setFunction(size_ - 1 - i, 8, bit(i));
+    for (int i = 8; i < 15; i++) setFunction(8, size_ - 15 + i, bit(i));
+    setFunction(8, size_ - 8, true);  // 固定暗模块
+  }
+
+  // 自右下角起两列一组之字形放置，跳过功能区与第 6 列（竖向定时图形）；剩余位为 0
+  void drawCodewords() {
+    size_t i = 0;
+    const size_t total = (size_t)codewordCount_ * 8;
+    for (int right = size_ - 1; right >= 1; right -= 2) {
+      if (right == 6) right = 5;
+      const bool upward = ((right + 1) & 2) == 0;
+      for (int vert = 0; vert < size_; vert++) {
+        for (int j = 0; j < 2; j++) {
+          const uint8_t x = (uint8_t)(right - j);
+          const uint8_t y = (uint8_t)(upward ? size_ - 1 - vert : vert);
+          if (get(function_, x, y) || i >= total) continue;
+          put(modules_, x, y, (codewords_[i >> 3] >> (7 - (i & 7))) & 1);
+          i++;
+        }
+      }
+    }
+  }
+
+  void applyMask(uint8_t mask) {
+    for (uint8_t y = 0; y < size_; y++) {
+      for (uint8_t x = 0; x < size_; x++) {
+        if (!get(function_, x, y) && maskBit(mask, x, y)) put(modules_, x, y, !get(modules_, x, y));
+      }
+    }
+  }
+
+  // 规范罚分：同色连续段、2×2 同色块、1:1:3:1:1 类定位图形、深色比例
+  long penalty() const {
+    long score = 0;
+    for (uint8_t pass = 0; pass < 2; pass++) {
+      for (uint8_t a = 0; a < size_; a++) {
+        bool color = false;
+        int run = 0;
+        int history[7] = {};
+        for (uint8_t b = 0; b < size_; b++) {
+          const bool m = pass ? module(a, b) : module(b, a);
+          if (m == color) {
+            run++;
+            if (run == 5) score += 3;
+            else if (run > 5) score++;
+          } else {
+            addHistory(run, history);
+            if (!color) score += finderPatterns(history) * 40;
+            color = m;
+            run = 1;
+          }
+        }
+        if (color) {
+          addHistory(run, history);
+          run = 0;
+        }
+        addHistory(run + size_, history);
+        score += finderPatterns(history) * 40;
+      }
+    }
+    long dark = 0;
+    for (uint8_t y = 0; y < size_; y++) {
+      for (uint8_t x = 0; x < size_; x++) {
+        const bool c = module(x, y);
+        dark += c;
+        if (x + 1 < size_ && y + 1 < size_ && c == module(x + 1, y) && c == module(x, y + 1) &&
+            c == module(x + 1, y + 1)) {
+          score += 3;
+        }
+      }
+    }
+    const long total = (long)size_ * size_;
+    const long diff  = dark * 20 - total * 10;
+    const long k = ((diff < 0 ? -diff : diff) + total - 1) / total - 1;
+    return score + k * 10;
+  }
+
+  void addHistory(int run, int* history) const {
+    if (!history[0]) run += size_;  // 首段前视为有一段浅色静区
+    memmove(history + 1, history, 6 * sizeof(int));
+    history[0] = run;
+  }
+
+  static int finderPatterns(const int* h) {
+    const int n = h[1];
+    const bool core = n > 0 && h[2] == n && h[3] == n * 3 && h[4] == n && h[5] == n;
+    return (core && h[0] >= n * 4 && h[6] >= n ? 1 : 0) + (core && h[6] >= n * 4 && h[0] >= n ? 1 : 0);
+  }
+
+  static int maxAbs(int a, int b) {
+    a = a < 0 ? -a : a;
+    b = b < 0 ? -b : b;
+    return a > b ? a : b;
+  }
+
+  // [纠错级别][版本 - 1]
+  static constexpr uint8_t kEccPerBlock[4][10] = {
+    { 7, 10, 15, 20, 26, 18, 20, 24, 30, 18 },
+    { 10, 16, 26, 18, 24, 16, 18, 22, 22, 26 },
+    { 13, 22, 18, 26, 18, 24, 18, 22, 20, 24 },
+    { 17, 28, 22, 16, 22, 28, 26, 26, 24, 28 },
+  };
+  static constexpr uint8_t kBlocks[4][10] = {
+    { 1, 1, 1, 1, 1, 2, 2, 2, 2, 4 },
+    { 1, 1, 1, 2, 2, 4, 4, 4, 5, 5 },
+    { 1, 1, 2, 2, 4, 4, 6, 6, 8, 8 },
+    { 1, 1, 2, 4, 4, 4, 5, 6, 8, 8 },
+  };
+
+  uint8_t  modules_[kBits]                = {};
+  uint8_t  function_[kBits]               = {};
+  uint8_t  data_[QR_MAX_CODEWORDS]        = {};
+  uint8_t  eccBytes_[QR_MAX_CODEWORDS]    = {};
+  uint8_t  codewords_[QR_MAX_CODEWORDS]   = {};
+  uint16_t codewordCount_                 = 0;
+  uint8_t  version_                       = 0;
+  uint8_t  ecc_                           = 0;
+  uint8_t  size_                          = 0;
+  uint8_t  mask_                          = 0;
+};
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include "event_stamp.h"
+#include "qr_code.h"
+
+// ==== 光栅图像打印：压缩位图边收边解压，按条带写打印机 ====
+// CMD_PRINT_RASTER 按偏移传一条字节流：[u8 图像号, u8 宽度字节, u16 行数, u8 编码] + 编码后的 1bpp 行
+// （高位在左，1 = 黑）。图像号由 App 每幅递增，用来区分"新图像"与"应答丢失后重发的首片"。
+// 编码：
+//   RAW            逐行原样
+//   PACKBITS       整幅行数据连成一串做 PackBits（控制字节 n：0..127 后跟 n+1 个字面字节，-1..-127 后跟
+//                  1 个字节重复 1-n 次，-128 跳过）；连续段可以跨行、跨分片
+//   PACKBITS_DELTA 每行先与上一行异或（首行与全 0 异或）再 PackBits：logo/二维码相邻行多半相同，异或后整行为 0
+// 打印任务逐字节解码到当前行，满 RASTER_BAND_ROWS 行即以 GS v 0 写串口；只保留一条带与上一行，不缓存整幅图。
+// 图像左对齐：条带右侧空白裁掉，整条空白带改为走纸（RASTER_TRIM_BANDS）。
+// 流控同 OTA：每个分片应答 EVT_RASTER_ACK（下一偏移）；偏移有缺口回 RASTER_GAP，App 从应答偏移重发；
+// 重叠部分（应答丢失后的重发）跳过已收字节。未确认分片数不超过打印队列长度（PRINT_QUEUE_LEN）。
+// 偏移 0 的分片只有在整个 5 字节头与当前（或刚完成的）图像一致、且落在已收范围内时才算重发，否则开始新图像
+// （丢弃未完成的图像）；已完成图像的记录在开局与换连接时清除（forgetDone），App 重启后图像号重复也不会被吞掉。
+// 只带偏移不带数据的分片用于查询进度（断线重连后续传）。
+// CMD_PRINT_QR：设备用 qr_code.h 生成二维码，按模块放大后走同一条带输出，上下静区用 ESC J 走纸。
+// 不依赖 Arduino；输出经回调写出（固件/重放为打印机串口，tools/raster_print 为模拟打印机）。
+
+#define RASTER_HEADER_LEN           5
+#define RASTER_ACK_LEN              8   // EVT_RASTER_ACK 帧长
+
+enum RasterEncoding : uint8_t {
+  RASTER_ENC_RAW = 0,
+  RASTER_ENC_PACKBITS,
+  RASTER_ENC_PACKBITS_DELTA,
+};
+
+enum RasterStatus : uint8_t {
+  RASTER_OK = 0,      // 已接收，继续发送
+  RASTER_DONE,        // 整幅图像（或二维码）已写出
+  RASTER_GAP,         // 偏移不连续：从应答中的偏移重发
+  RASTER_ERR_HEADER,  // 宽度/行数/编码无效（二维码：纠错级别无效）
+  RASTER_ERR_DATA,    // 压缩流解出的数据超过声明的行数，图像已丢弃
+  RASTER_ERR_IDLE,    // 没有进行中的图像（非 0 偏移）
+  RASTER_ERR_QR,      // 文本超出 QR_MAX_VERSION 在该纠错级别的容量
+};
+
+struct RasterAck {
+  uint8_t  status;
+  uint32_t next;  // 下一个期望的流偏移
+  uint16_t rows;  // 已写出的行数
+};
+
+struct RasterStats {
+  uint32_t starts;     // 开始接收的光栅图像
+  uint32_t images;     // 完成的图像（含二维码）
+  uint32_t qrCodes;
+  uint32_t aborted;    // 未完成即被新图像取代或出错
+  uint32_t gaps;
+  uint32_t bytesIn;    // 经 BLE 收到并解码的流字节（不含重复部分）
+  uint32_t bytesOut;   // 写打印机串口的字节（GS v 0 头 + 行数据 + 走纸）
+  uint32_t bands;      // GS v 0 条带（不含改为走纸的空白带）
+};
+
+inline size_t encodeRasterAck(const RasterAck& ack, uint8_t* out) {
+  out[0] = EVT_RASTER_ACK;
+  out[1] = ack.status;
+  putLe32(out + 2, ack.next);
+  putLe16(out + 6, ack.rows);
+  return RASTER_ACK_LEN;
+}
+
+class RasterPrinter {
+ public:
+  // 处理一个分片；out(const uint8_t*, size_t) 写打印机
+  template <class Out>
+  RasterAck feed(uint32_t offset, const uint8_t* data, size_t len, Out&& out) {
+    if (offset == 0 && len && !isResend(data, len)) {
+      if (state_ != STATE_IDLE) abort();
+      start();
+    }
+    if (state_ == STATE_IDLE) {
+      // 已完成图像的末片重发（应答丢失）或进度查询
+      if (doneEnd_ && offset <= doneEnd_) return { RASTER_DONE, doneEnd_, doneRows_ };
+      return { RASTER_ERR_IDLE, 0, 0 };
+    }
+    if (offset > received_) {
+      stats_.gaps++;
+      return ack(RASTER_GAP);
+    }
+    const uint32_t skip = received_ - offset;
+    if (skip >= len) return ack(RASTER_OK);
+    data += skip;
+    len -= skip;
+    stats_.bytesIn += (uint32_t)len;
+
+    for (size_t i = 0; i < len; i++) {
+      received_++;
+      const RasterStatus st = step(data[i], out);
+      if (st == RASTER_OK) continue;
+      if (st == RASTER_DONE) {
+        if (i + 1 < len) return fail(RASTER_ERR_DATA);  // 声明的行数之后还有数据
+        return finish(out);
+      }
+      return fail(st);
+    }
+    return ack(RASTER_OK);
+  }
+
+  // 生成并打印二维码：ecc = 纠错级别（低 2 位）| 模块点数 << 4（0 = 不超过 QR_MODULE_DOTS_MAX 的最大尺寸）
+  template <class Out>
+  RasterAck printQr(uint8_t options, const uint8_t* text, size_t len, Out&& out) {
+    if (state_ != STATE_IDLE) abort();
+    const uint8_t ecc = options & 0x0F;
+    if (ecc > QR_ECC_H) return { RASTER_ERR_HEADER, 0, 0 };
+    if (!qr_.encode(text, len, ecc)) return { RASTER_ERR_QR, 0, 0 };
+
+    const uint16_t paperDots = RASTER_MAX_WIDTH_BYTES * 8;
+    const uint8_t size = qr_.size();
+    uint16_t dots = (uint16_t)(paperDots / (size + 2 * QR_QUIET_MODULES));
+    if (dots > QR_MODULE_DOTS_MAX) dots = QR_MODULE_DOTS_MAX;
+    if ((options >> 4) && (options >> 4) < dots) dots = options >> 4;
+    const uint16_t left  = (uint16_t)((paperDots - size * dots) / 2);  // 居中；右侧空白不发送
+    width_  = (uint8_t)((left + size * dots + 7) / 8);
+    height_ = (uint16_t)(size * dots);
+    rows_     = 0;
+    bandRows_ = 0;
+    imageOut_ = 0;
+
+    feedDots(QR_QUIET_MODULES * dots, out);
+    for (uint8_t my = 0; my < size; my++) {
+      uint8_t* row = prev_;
+      memset(row, 0, width_);
+      for (uint8_t mx = 0; mx < size; mx++) {
+        if (!qr_.module(mx, my)) continue;
+        for (uint16_t d = 0, x = (uint16_t)(left + mx * dots); d < dots; d++, x++) {
+          row[x >> 3] |= (uint8_t)(0x80 >> (x & 7));
+        }
+      }
+      for (uint16_t r = 0; r < dots; r++) commitRow(out);
+    }
+    flushBand(out);
+    feedDots(QR_QUIET_MODULES * dots, out);
+    stats_.images++;
+    stats_.qrCodes++;
+    doneEnd_  = 0;
+    doneRows_ = rows_;
+    return { RASTER_DONE, 0, rows_ };
+  }
+
+  // 忘记已完成的图像：之后偏移 0 的分片一律开始新图像（开局、发图连接变化时调用）
+  void forgetDone() { doneEnd_ = 0; }
+
+  bool active() const { return state_ != STATE_IDLE; }
+  uint8_t width() const { return width_; }
+  uint16_t height() const { return height_; }
+  uint8_t encoding() const { return encoding_; }
+  const RasterStats& stats() const { return stats_; }
+  const QrCode& qr() const { return qr_; }
+  uint32_t lastOutBytes() const { return imageOut_; }  // 最近一幅图像写串口的字节数
+
+ private:
+  enum State : uint8_t { STATE_IDLE, STATE_HEADER, STATE_CONTROL, STATE_LITERAL, STATE_REPEAT };
+
+  // 偏移 0 的分片是否为当前/刚完成图像的重发：已收到的头字节全部一致，且完成后的重发不超出原流长度
+  bool isResend(const uint8_t* data, size_t len) const {
+    uint32_t known;
+    if (state_ != STATE_IDLE) {
+      known = received_;
+    } else if (doneEnd_ && len <= doneEnd_) {
+      known = doneEnd_;
+    } else {
+      return false;
+    }
+    size_t n = len < RASTER_HEADER_LEN ? len : RASTER_HEADER_LEN;
+    if (n > known) n = known;
+    return n && memcmp(data, header_, n) == 0;
+  }
+
+  void start() {
+    state_    = STATE_HEADER;
+    received_ = 0;
+    rows_     = 0;
+    col_      = 0;
+    bandRows_ = 0;
+    doneEnd_  = 0;
+    imageOut_ = 0;
+    stats_.starts++;
+  }
+
+  void abort() {
+    state_ = STATE_IDLE;
+    stats_.aborted++;
+  }
+
+  RasterAck ack(uint8_t status) const { return { status, received_, rows_ }; }
+
+  RasterAck fail(uint8_t status) {
+    const RasterAck a = { status, received_, rows_ };
+    abort();
+    doneEnd_ = 0;
+    return a;
+  }
+
+  template <class Out>
+  RasterAck finish(Out& out) {
+    flushBand(out);
+    state_    = STATE_IDLE;
+    doneEnd_  = received_;
+    doneRows_ = rows_;
+    stats_.images++;
+    return { RASTER_DONE, received_, rows_ };
+  }
+
+  // 一个流字节；返回 RASTER_OK 继续、RASTER_DONE 已满行数、其余为错误
+  template <class Out>
+  RasterStatus step(uint8_t b, Out& out) {
+    switch (state_) {
+      case STATE_HEADER:
+        header_[received_ - 1] = b;
+        if (received_ < RASTER_HEADER_LEN) return RASTER_OK;
+        width_    = header_[1];
+        height_   = getLe16(header_ + 2);
+        encoding_ = header_[4];
+        if (!width_ || width_ > RASTER_MAX_WIDTH_BYTES || !height_ || height_ > RASTER_MAX_HEIGHT ||
+            encoding_ > RASTER_ENC_PACKBITS_DELTA) {
+          return RASTER_ERR_HEADER;
+        }
+        memset(prev_, 0, sizeof(prev_));
+        state_ = encoding_ == RASTER_ENC_RAW ? STATE_LITERAL : STATE_CONTROL;
+        run_   = 0;
+        return RASTER_OK;
+      case STATE_CONTROL:
+        if (b == 0x80) return RASTER_OK;
+        if (b < 0x80) {
+          state_ = STATE_LITERAL;
+          run_   = (uint16_t)(b + 1);
+        } else {
+          state_ = STATE_REPEAT;
+          run_   = (uint16_t)(257 - b);
+        }
+        return RASTER_OK;
+      case STATE_LITERAL:
+        if (encoding_ != RASTER_ENC_RAW && --run_ == 0) state_ = STATE_CONTROL;
+        return put(b, 1, out);
+      case STATE_REPEAT:
+        state_ = STATE_CONTROL;
+        return put(b, run_, out);
+      default:
+        return RASTER_ERR_IDLE;
+    }
+  }
+
+  // 写入 count 个相同字节（跨行时逐行提交）
+  template <class Out>
+  RasterStatus put(uint8_t b, uint16_t count, Out& out) {
+    const bool delta = encoding_ == RASTER_ENC_PACKBITS_DELTA;
+    while (count) {
+      if (rows_ >= height_) return RASTER_ERR_DATA;
+      uint16_t n = (uint16_t)(width_ - col_);
+      if (n > count) n = count;
+      if (delta) {
+        for (uint16_t i = 0; i < n; i++) prev_[col_ + i] ^= b;
+      } else {
+        memset(prev_ + col_, b, n);
+      }
+      col_ = (uint8_t)(col_ + n);
+      count = (uint16_t)(count - n);
+      if (col_ < width_) break;
+      col_ = 0;
+      commitRow(out);
+    }
+    return rows_ >= height_ && col_ == 0 && !count ? RASTER_DONE : RASTER_OK;
+  }
+
+  // 当前行（prev_，差分解码时即下一行的参照）进条带，满带写出
+  template <class Out>
+  void commitRow(Out& out) {
+    memcpy(band_ + 8 + (size_t)bandRows_ * width_, prev_, width_);
+    bandRows_++;
+    rows_++;
+    if (bandRows_ == RASTER_BAND_ROWS) flushBand(out);
+  }
+
+  // GS v 0 m xL xH yL yH：头与行数据连续存放，一次写出。
+  // 串口（115200 约 240 行/秒满宽）才是瓶颈：条带右侧整列空白不发，整条空白改为 ESC J 走纸
+  template <class Out>
+  void flushBand(Out& out) {
+    if (!bandRows_) return;
+    uint8_t w = width_;
+#if RASTER_TRIM_BANDS
+    w = 0;
+    for (uint8_t r = 0; r < bandRows_; r++) {
+      const uint8_t* row = band_ + 8 + (size_t)r * width_;
+      for (uint8_t c = width_; c > w; c--) {
+        if (row[c - 1]) {
+          w = c;
+          break;
+        }
+      }
+    }
+    if (!w) {
+      feedDots(bandRows_, out);
+      bandRows_ = 0;
+      return;
+    }
+    for (uint8_t r = 1; w < width_ && r < bandRows_; r++) {
+      memmove(band_ + 8 + (size_t)r * w, band_ + 8 + (size_t)r * width_, w);
+    }
+#endif
+    band_[0] = 0x1D;
+    band_[1] = 'v';
+    band_[2] = '0';
+    band_[3] = 0;
+    putLe16(band_ + 4, w);
+    putLe16(band_ + 6, bandRows_);
+    const size_t n = 8 + (size_t)bandRows_ * w;
+    out(band_, n);
+    stats_.bytesOut += (uint32_t)n;
+    imageOut_ += (uint32_t)n;
+    stats_.bands++;
+    bandRows_ = 0;
+  }
+
+  // ESC J n：走纸 n 点（静区不发空白行）
+  template <class Out>
+  void feedDots(uint16_t dots, Out& out) {
+    while (dots) {
+      const uint8_t n = (uint8_t)(dots > 255 ? 255 : dots);
+      const uint8_t cmd[3] = { 0x1B, 'J', n };
+      out(cmd, sizeof(cmd));
+      stats_.bytesOut += sizeof(cmd);
+      imageOut_ += sizeof(cmd);
+      dots = (uint16_t)(dots - n);
+    }
+  }
+
+  uint8_t  band_[8 + RASTER_BAND_ROWS * RASTER_MAX_WIDTH_BYTES] = {};
+  uint8_t  prev_[RASTER_MAX_WIDTH_BYTES]                        = {};
+  uint8_t  header_[RASTER_HEADER_LEN]                           = {};
+  QrCode   qr_;
+  RasterStats stats_ = {};
+  uint32_t received_ = 0;   // 已接收的流字节数（= 下一个期望偏移）
+  uint32_t doneEnd_  = 0;   // 上一幅完成图像的流长度（0 = 无）
+  uint32_t imageOut_ = 0;
+  uint16_t doneRows_ = 0;
+  uint16_t height_   = 0;
+  uint16_t rows_     = 0;
+  uint16_t run_      = 0;
+  uint8_t  width_    = 0;
+  uint8_t  encoding_ = 0;
+  uint8_t  col_      = 0;
+  uint8_t  bandRows_ = 0;
+  uint8_t  state_    = STATE_IDLE;
+};
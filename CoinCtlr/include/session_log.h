@@ -0,0 +1,287 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include "event_stamp.h"
+
+// ==== 现场会话录制（二进制日志） ====
+// 记录 coinbox_core.h 的全部输入与输出，供主机侧 tools/session_replay 在虚拟时钟下重放并与录制比对：
+// - 输入：投币器边沿（ISR 时间戳）、收到的指令帧、断线、平台返回值（random32 / peerMtu）
+// - 输出：coin/status 通知、继电器通断、打印机串口写入（只记长度与 FNV-1a 校验）
+// 格式：文件头 + 记录流。记录 = [类型 u8][时间差 varint（zigzag，相对上一条记录，us）][负载]
+// 时间为设备 64 位单调时钟（us）；不同上下文写入的记录时间可能略有倒序，因此差值带符号。
+// 不依赖 Arduino，固件写入、主机侧读取共用本文件。
+
+#define SESSION_LOG_MAGIC           "CBLG"
+#define SESSION_LOG_VERSION         2
+#define SESSION_LOG_HEADER_LEN      24
+
+enum SessionLogType : uint8_t {
+  LOG_PULSE      = 1,   // 投币器边沿（时间 = ISR 时间戳）
+  LOG_COMMAND    = 2,   // 收到的指令帧（时间 = 收到时刻）：[长度 varint][帧]
+  LOG_CONNECT    = 3,
+  LOG_DISCONNECT = 4,
+  LOG_RANDOM     = 5,   // random32() 返回值：[u32]
+  LOG_MTU        = 6,   // peerMtu() 返回值：[u16]
+  LOG_NOTIFY     = 7,   // 通知：[通道 u8][长度 varint][负载]
+  LOG_RELAY      = 8,   // 继电器：[料斗 << 1 | 通断]
+  LOG_UART       = 9,   // 打印机串口写入：[来源 u8][长度 varint][FNV-1a u32]
+  LOG_DROPPED    = 10,  // 此前因缓冲满丢弃的记录数：[varint]
+};
+
+enum UartSource : uint8_t {
+  UART_SOURCE_CORE  = 0,  // coinbox_core.h 直发（重放可复现）
+  UART_SOURCE_OTHER = 1,  // 打印机库、自检等（只统计）
+};
+
+// 文件头：[magic 4][版本 u8][料斗数 u8][保留 u16][脉冲串间隔 us u32][起始时间 u64][保留 u32]
+// 版本 2：吐币不再等待合并窗口，原合并窗口字段保留为 0
+// 记录录制时的关键配置，重放时与当前编译配置不一致会给出提示
+struct SessionLogHeader {
+  uint8_t  version;
+  uint8_t  hopperCount;
+  uint32_t coinTrainGapUs;
+  uint64_t startUs;
+};
+
+inline uint32_t fnv1a32(const uint8_t* p, size_t n, uint32_t h = 2166136261u) {
+  for (size_t i = 0; i < n; i++) h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+inline size_t putVarint(uint8_t* out, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+// 单生产者环形缓冲（多上下文写入时由调用方加锁）；读出方取走整字节流，记录不会被截断
+template <size_t N>
+class SessionLogWriter {
+ public:
+  void begin(uint64_t startUs) {
+    uint8_t h[SESSION_LOG_HEADER_LEN] = {};
+    memcpy(h, SESSION_LOG_MAGIC, 4);
+    h[4] = SESSION_LOG_VERSION;
+    h[5] = HOPPER_COUNT;
+    putLe32(h + 8, COIN_TRAIN_GAP_US);
+    putLe32(h + 12, (uint32_t)startUs);
+    putLe32(h + 16, (uint32_t)(startUs >> 32));
+    head_ = tail_ = 0;
+    dropped_ = 0;
+    lastUs_  = startUs;
+    put(h, sizeof(h));
+  }
+
+  void pulse(uint64_t t) { record(LOG_PULSE, t, nullptr, 0, nullptr, 0); }
+  void connect(uint64_t t) { record(LOG_CONNECT, t, nullptr, 0, nullptr, 0); }
+  void disconnect(uint64_t t) { record(LOG_DISCONNECT, t, nullptr, 0, nullptr, 0); }
+
+  void command(uint64_t t, const uint8_t* frame, size_t len) {
+    uint8_t hdr[10];
+    record(LOG_COMMAND, t, hdr, putVarint(hdr, len), frame, len);
+  }
+
+  void random(uint64_t t, uint32_t v) {
+    uint8_t p[4];
+    putLe32(p, v);
+    record(LOG_RANDOM, t, p, sizeof(p), nullptr, 0);
+  }
+
+  void mtu(uint64_t t, uint16_t v) {
+    uint8_t p[2];
+    putLe16(p, v);
+    record(LOG_MTU, t, p, sizeof(p), nullptr, 0);
+  }
+
+  void notify(uint64_t t, uint8_t kind, const uint8_t* data, size_t len) {
+    uint8_t hdr[11] = { kind };
+    record(LOG_NOTIFY, t, hdr, 1 + putVarint(hdr + 1, len), data, len);
+  }
+
+  void relay(uint64_t t, uint8_t hopper, bool on) {
+    const uint8_t p = (uint8_t)((hopper << 1) | (on ? 1 : 0));
+    record(LOG_RELAY, t, &p, 1, nullptr, 0);
+  }
+
+  void uart(uint64_t t, uint8_t source, const uint8_t* data, size_t len) {
+    uint8_t p[15] = { source };
+    size_t n = 1 + putVarint(p + 1, len);
+    putLe32(p + n, fnv1a32(data, len));
+    record(LOG_UART, t, p, n + 4, nullptr, 0);
+  }
+
+  // 取出最多 cap 字节；返回取出的字节数
+  size_t read(uint8_t* out, size_t cap) {
+    size_t n = 0;
+    while (n < cap && tail_ != head_) {
+      out[n++] = buf_[tail_];
+      tail_ = (tail_ + 1) % N;
+    }
+    return n;
+  }
+
+  size_t used() const { return (head_ + N - tail_) % N; }
+  uint32_t dropped() const { return droppedTotal_; }
+
+ private:
+  static constexpr size_t kMaxOverhead = 1 + 10 + 11;  // 类型 + 时间差 + LOG_DROPPED 记录
+
+  void put(const uint8_t* p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      buf_[head_] = p[i];
+      head_ = (head_ + 1) % N;
+    }
+  }
+
+  bool fits(size_t n) const { return N - 1 - used() >= n; }
+
+  void header(uint8_t type, uint64_t t) {
+    const int64_t delta = (int64_t)(t - lastUs_);
+    uint8_t h[11] = { type };
+    const size_t n = 1 + putVarint(h + 1, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    put(h, n);
+    lastUs_ = t;
+  }
+
+  void record(uint8_t type, uint64_t t, const uint8_t* a, size_t aLen, const uint8_t* b, size_t bLen) {
+    if (!fits(kMaxOverhead + aLen + bLen)) {
+      dropped_++;
+      droppedTotal_++;
+      return;
+    }
+    if (dropped_) {
+      uint8_t p[10];
+      header(LOG_DROPPED, t);
+      put(p, putVarint(p, dropped_));
+      dropped_ = 0;
+    }
+    header(type, t);
+    if (aLen) put(a, aLen);
+    if (bLen) put(b, bLen);
+  }
+
+  uint8_t  buf_[N];
+  size_t   head_ = 0, tail_ = 0;
+  uint64_t lastUs_ = 0;
+  uint32_t dropped_ = 0, droppedTotal_ = 0;
+};
+
+// 解析出的一条记录；payload 指向日志缓冲内部
+struct SessionLogRecord {
+  uint8_t        type;
+  uint64_t       t;
+  const uint8_t* payload;  // LOG_COMMAND / LOG_NOTIFY：帧或负载
+  size_t         len;
+  uint8_t        kind;     // LOG_NOTIFY：通道；LOG_RELAY：料斗；LOG_UART：来源
+  uint32_t       value;    // LOG_RANDOM / LOG_MTU / LOG_DROPPED：值；LOG_RELAY：通断；LOG_UART：FNV-1a
+};
+
+class SessionLogReader {
+ public:
+  SessionLogReader(const uint8_t* data, size_t len) : p_(data), end_(data + len) {}
+
+  bool header(SessionLogHeader& h) {
+    if (end_ - p_ < SESSION_LOG_HEADER_LEN || memcmp(p_, SESSION_LOG_MAGIC, 4) != 0) return false;
+    h.version          = p_[4];
+    h.hopperCount      = p_[5];
+    h.coinTrainGapUs   = getLe32(p_ + 8);
+    h.startUs          = getLe32(p_ + 12) | ((uint64_t)getLe32(p_ + 16) << 32);
+    lastUs_ = h.startUs;
+    p_ += SESSION_LOG_HEADER_LEN;
+    return h.version == SESSION_LOG_VERSION;
+  }
+
+  // 读下一条；结束或数据损坏时返回 false（损坏时 corrupt() 为真）
+  bool next(SessionLogRecord& r) {
+    if (p_ >= end_) return false;
+    r = SessionLogRecord();
+    r.type = *p_++;
+    uint64_t zz;
+    if (!varint(zz)) return fail();
+    lastUs_ += (uint64_t)((int64_t)(zz >> 1) ^ -(int64_t)(zz & 1));
+    r.t = lastUs_;
+    uint64_t n;
+    switch (r.type) {
+      case LOG_PULSE:
+      case LOG_CONNECT:
+      case LOG_DISCONNECT:
+        return true;
+      case LOG_COMMAND:
+        if (!varint(n) || !bytes(r, n)) return fail();
+        return true;
+      case LOG_RANDOM:
+        if (end_ - p_ < 4) return fail();
+        r.value = getLe32(p_);
+        p_ += 4;
+        return true;
+      case LOG_MTU:
+        if (end_ - p_ < 2) return fail();
+        r.value = getLe16(p_);
+        p_ += 2;
+        return true;
+      case LOG_NOTIFY:
+        if (p_ >= end_) return fail();
+        r.kind = *p_++;
+        if (!varint(n) || !bytes(r, n)) return fail();
+        return true;
+      case LOG_RELAY:
+        if (p_ >= end_) return fail();
+        r.kind  = (uint8_t)(*p_ >> 1);
+        r.value = *p_++ & 1;
+        return true;
+      case LOG_UART:
+        if (p_ >= end_) return fail();
+        r.kind = *p_++;
+        if (!varint(n) || end_ - p_ < 4) return fail();
+        r.len   = (size_t)n;
+        r.value = getLe32(p_);
+        p_ += 4;
+        return true;
+      case LOG_DROPPED:
+        if (!varint(n)) return fail();
+        r.value = (uint32_t)n;
+        return true;
+    }
+    return fail();
+  }
+
+  bool corrupt() const { return corrupt_; }
+
+ private:
+  bool varint(uint64_t& v) {
+    v = 0;
+    for (int shift = 0; p_ < end_ && shift < 64; shift += 7) {
+      const uint8_t b = *p_++;
+      v |= (uint64_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+  }
+
+  bool bytes(SessionLogRecord& r, uint64_t n) {
+    if ((uint64_t)(end_ - p_) < n) return false;
+    r.payload = p_;
+    r.len     = (size_t)n;
+    p_ += n;
+    return true;
+  }
+
+  bool fail() {
+    corrupt_ = true;
+    p_       = end_;
+    return false;
+  }
+
+  const uint8_t* p_;
+  const uint8_t* end_;
+  uint64_t lastUs_ = 0;
+  bool corrupt_ = false;
+};
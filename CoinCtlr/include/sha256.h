@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// ==== SHA-256 与 HMAC-SHA256（FIPS 180-4 / RFC 2104） ====
+// 用于升级包鉴权（ota_update.h）：可分段 update，适合边回读分区边计算。
+// 纯软件实现，不依赖 Arduino/mbedtls，主机侧工具共用；ESP32 上约 1MB 镜像耗时 1 秒量级，只在收完后算一次。
+
+#define SHA256_LEN                  32
+#define SHA256_BLOCK_LEN            64
+
+class Sha256 {
+ public:
+  Sha256() { reset(); }
+
+  void reset() {
+    static const uint32_t kInit[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                       0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    memcpy(h_, kInit, sizeof(h_));
+    total_  = 0;
+    bufLen_ = 0;
+  }
+
+  void update(const uint8_t* p, size_t n) {
+    total_ += n;
+    if (bufLen_) {
+      const size_t take = n < SHA256_BLOCK_LEN - bufLen_ ? n : SHA256_BLOCK_LEN - bufLen_;
+      memcpy(buf_ + bufLen_, p, take);
+      bufLen_ += take;
+      p += take;
+      n -= take;
+      if (bufLen_ < SHA256_BLOCK_LEN) return;
+      block(buf_);
+      bufLen_ = 0;
+    }
+    for (; n >= SHA256_BLOCK_LEN; p += SHA256_BLOCK_LEN, n -= SHA256_BLOCK_LEN) block(p);
+    memcpy(buf_, p, n);
+    bufLen_ = n;
+  }
+
+  void final(uint8_t out[SHA256_LEN]) {
+    const uint64_t bits = total_ * 8;
+    uint8_t pad[SHA256_BLOCK_LEN + 8] = { 0x80 };
+    const size_t padLen = (bufLen_ < 56 ? 56 : 120) - bufLen_;
+    for (uint8_t i = 0; i < 8; i++) pad[padLen + i] = (uint8_t)(bits >> (56 - 8 * i));
+    update(pad, padLen + 8);
+    for (uint8_t i = 0; i < 8; i++) {
+      for (uint8_t k = 0; k < 4; k++) out[4 * i + k] = (uint8_t)(h_[i] >> (24 - 8 * k));
+    }
+  }
+
+ private:
+  static uint32_t rotr(uint32_t x, uint8_t n) { return (x >> n) | (x << (32 - n)); }
+
+  void block(const uint8_t* p) {
+    static const uint32_t kK[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+    uint32_t w[64];
+    for (uint8_t i = 0; i < 16; i++) {
+      w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (uint8_t i = 16; i < 64; i++) {
+      const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+    for (uint8_t i = 0; i < 64; i++) {
+      const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + kK[i] + w[i];
+      const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    h_[0] += a; h_[1] += b; h_[2] += c; h_[3] += d;
+    h_[4] += e; h_[5] += f; h_[6] += g; h_[7] += h;
+  }
+
+  uint32_t h_[8];
+  uint64_t total_;
+  uint8_t  buf_[SHA256_BLOCK_LEN];
+  size_t   bufLen_;
+};
+
+// 密钥长度 ≤ SHA256_BLOCK_LEN（本项目固定 32 字节）
+class HmacSha256 {
+ public:
+  void begin(const uint8_t* key, size_t keyLen) {
+    uint8_t pad[SHA256_BLOCK_LEN] = {};
+    memcpy(pad, key, keyLen < SHA256_BLOCK_LEN ? keyLen : SHA256_BLOCK_LEN);
+    for (uint8_t i = 0; i < SHA256_BLOCK_LEN; i++) {
+      opad_[i] = pad[i] ^ 0x5c;
+      pad[i] ^= 0x36;
+    }
+    inner_.reset();
+    inner_.update(pad, SHA256_BLOCK_LEN);
+  }
+
+  void update(const uint8_t* p, size_t n) { inner_.update(p, n); }
+
+  void final(uint8_t out[SHA256_LEN]) {
+    uint8_t digest[SHA256_LEN];
+    inner_.final(digest);
+    Sha256 outer;
+    outer.update(opad_, SHA256_BLOCK_LEN);
+    outer.update(digest, SHA256_LEN);
+    outer.final(out);
+  }
+
+ private:
+  Sha256  inner_;
+  uint8_t opad_[SHA256_BLOCK_LEN];
+};
+
+// 比较耗时与首个不同字节的位置无关
+inline bool sha256Equal(const uint8_t* a, const uint8_t* b) {
+  uint8_t diff = 0;
+  for (uint8_t i = 0; i < SHA256_LEN; i++) diff |= a[i] ^ b[i];
+  return diff == 0;
+}
@@ -3,9 +3,27 @@
 #include <BLEUtils.h>
 #include <BLEServer.h>
 #include <BLE2902.h>
+#include <BLESecurity.h>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+#include <soc/gpio_struct.h>
 #include "config.h"
+#include "coin_pulse.h"
+#include "coinbox_core.h"
+#include "cp936.h"
+#include "gatt_clients.h"
+#include "ota_update.h"
+#include "payout_scheduler.h"
+#include "power_stats.h"
 #include "printer_lib.h"
 #include "printer_type.h"
+#include "protocol.h"
+#include "session_log.h"
 
 // 打印机库需要的宏定义
 #define ENABLE  1
@@ -16,24 +34,104 @@ static BLEUUID SERVICE_UUID(UUID_SERVICE);
 static BLEUUID CHAR_COIN_UUID(UUID_CHAR_COIN);
 static BLEUUID CHAR_CMD_UUID(UUID_CHAR_CMD);
 static BLEUUID CHAR_STATUS_UUID(UUID_CHAR_STATUS);
+static BLEUUID CHAR_OTA_UUID(UUID_CHAR_OTA);
 
 // === BLE 对象 ===
 BLEServer* server                   = nullptr;
 BLECharacteristic* coinChar         = nullptr;  // Notify 总投币数
 BLECharacteristic* cmdChar          = nullptr;  // Write 指令
 BLECharacteristic* statusChar       = nullptr;  // Notify 事件
+BLECharacteristic* otaChar          = nullptr;  // Write/Notify 固件升级
+
+// === 多连接（见 gatt_clients.h）：BLE 回调改表，I/O 任务取发送目标，临界区内只读写表 ===
+static GattClients<BLE_MAX_CONNECTIONS> clients;
+static portMUX_TYPE clientsMux      = portMUX_INITIALIZER_UNLOCKED;
+static uint16_t coinCccdHandle      = 0;  // 各连接的订阅写入在 onGattsEvent() 中按 conn_id 记录
+static uint16_t statusCccdHandle    = 0;
+
+// === 任务与队列（core1：I/O 高优先级，打印低优先级；BLE 回调只入队） ===
+enum IoMsgType : uint8_t { IO_COIN, IO_COMMAND };
+struct IoMsg {
+  uint8_t      type;
+  uint32_t     rxUs;  // 收到指令的时刻（事件时间戳起点）
+  CommandFrame cmd;   // IO_COMMAND：已解码的指令（不含变长数据）
+};
+enum PrintJobType : uint8_t { PRINT_JOB_RECEIPT, PRINT_JOB_DEBUG, PRINT_JOB_IMAGE };
+struct PrintJob {
+  uint8_t  type;
+  uint16_t len;
+  uint16_t client;  // PRINT_JOB_IMAGE：应答发给该连接
+  uint32_t rxUs;
+  char     text[1 + 4 + PRINT_JOB_MAX_BYTES];  // 小票：文本；图像：指令帧原样（光栅分片/二维码，打印任务内解码）
+};
+struct OtaFrame {
+  uint16_t conn;    // 应答只发给该连接
+  uint16_t len;
+  uint8_t  data[OTA_FRAME_MAX];
+};
+static QueueHandle_t ioQueue        = nullptr;
+static QueueHandle_t printQueue     = nullptr;
+static TaskHandle_t ioTaskHandle    = nullptr;
+static TaskHandle_t printTaskHandle = nullptr;
+static QueueHandle_t otaQueue       = nullptr;
+static TaskHandle_t otaTaskHandle   = nullptr;
+
+#if defined(CONFIG_BT_BLUEDROID_PINNED_TO_CORE) && (CONFIG_BT_BLUEDROID_PINNED_TO_CORE != BLE_CORE)
+#error "BLE host must be pinned to BLE_CORE (see sdkconfig CONFIG_BT_BLUEDROID_PINNED_TO_CORE)"
+#endif
+#if IO_TASK_CORE == BLE_CORE
+#error "IO_TASK_CORE must differ from BLE_CORE"
+#endif
+#if defined(CONFIG_BTDM_CTRL_BLE_MAX_CONN) && (BLE_MAX_CONNECTIONS > CONFIG_BTDM_CTRL_BLE_MAX_CONN)
+#error "BLE_MAX_CONNECTIONS exceeds the controller limit (see sdkconfig CONFIG_BTDM_CTRL_BLE_MAX_CONN)"
+#endif
+#if OTA_PAIRING_PIN < 100000 || OTA_PAIRING_PIN > 999999 || OTA_PAIRING_PIN == 246810
+#error "set a per-device 6-digit OTA_PAIRING_PIN in build_flags (the old default 246810 is refused)"
+#endif
+static_assert(otaKeyValid(OTA_AUTH_KEY), "set a per-device OTA_AUTH_KEY (64 hex digits) in build_flags");
 
 // === 打印机 ===
 static printer_t* printer           = nullptr;
 static uint8_t print_buffer[2048];
 
 // === 调试/状态 ===
-static volatile bool bleConnected   = false;
 static uint32_t lastDebugMs         = 0;
+static TaskHandle_t loopTaskHandle  = nullptr;  // Arduino loop()，诊断输出
+
+// === 低功耗（见 power_stats.h） ===
+static esp_pm_lock_handle_t pmLocks[AWAKE_REASON_COUNT] = {};
+static AwakeMeter awakeMeter(POWER_AWAKE_MA, POWER_SLEEP_MA);
+static bool pmActive = false;  // esp_pm_configure 成功：无人持锁时确实降频/浅睡，电流模型才成立
+static portMUX_TYPE awakeMux        = portMUX_INITIALIZER_UNLOCKED;
+
+// === 现场录制（见 session_log.h） ===
+// BLE 回调、I/O 任务、打印任务都会写入：临界区内只做内存拷贝，缓冲过半时唤醒 loop() 导出
+#if CAPTURE_ENABLE
+static SessionLogWriter<CAPTURE_BUFFER_BYTES> sessionLog;
+static portMUX_TYPE captureMux      = portMUX_INITIALIZER_UNLOCKED;
+#define CAPTURE(call)                                                         \
+  do {                                                                        \
+    portENTER_CRITICAL(&captureMux);                                          \
+    sessionLog.call;                                                          \
+    const bool captureHalf = sessionLog.used() > CAPTURE_BUFFER_BYTES / 2;    \
+    portEXIT_CRITICAL(&captureMux);                                           \
+    if (captureHalf) requestDiag();                                           \
+  } while (0)
+#else
+#define CAPTURE(call) do {} while (0)
+#endif
+
+// micros() 时间戳展开为 64 位单调时钟（录制用）
+static inline uint64_t widenUs(uint32_t us) {
+  const uint64_t now = (uint64_t)esp_timer_get_time();
+  return now - (uint32_t)((uint32_t)now - us);
+}
+static void requestDiag();
 
 // UART 发送/延时桥接
 int printer_uart_send(const uint8_t *data, uint16_t size, uint32_t timeout) {
   (void)timeout;
+  CAPTURE(uart((uint64_t)esp_timer_get_time(), UART_SOURCE_OTHER, data, size));
   Serial.print("[UART] Sending "); Serial.print(size); Serial.println(" bytes to printer");
   
   // 打印十六进制数据用于调试
@@ -57,219 +155,835 @@ static void printer_delay_ms(uint32_t ms) {
   delay(ms);
 }
 
-// === 投币会话累计（来自投币器脉冲） ===
-volatile uint16_t coinTotal         = 0;
-volatile uint32_t lastAcceptorUs    = 0;
+// === 投币器脉冲（ISR 记录时间戳，I/O 任务交给核心逻辑分组） ===
+static PulseDebounce acceptorDebounce(COIN_ACCEPTOR_DEBOUNCE_US);  // ISR 去抖
+
+static const CoinDenomination coinDenominations[] = COIN_DENOMINATIONS;
+static PulseRing<COIN_PULSE_RING_SIZE> pulseRing;
 
 
+// === 料斗 ===
+static const HopperSpec hoppers[] = HOPPERS;
+static_assert(sizeof(hoppers) / sizeof(hoppers[0]) == HOPPER_COUNT, "HOPPERS must list HOPPER_COUNT entries");
+static_assert(HOPPER_COUNT <= PAYOUT_MAX_HOPPERS, "too many hoppers");
+
 // 继电器控制
-static inline void relayOn()  { digitalWrite(PIN_DISPENSE_RELAY, HIGH); }
-static inline void relayOff() { digitalWrite(PIN_DISPENSE_RELAY, LOW);  }
-static void notifyCoinTotal();
-static void handlePayout(uint16_t count);
+static inline void relayOn(uint8_t h)  { digitalWrite(hoppers[h].relayPin, HIGH); }
+static inline void relayOff(uint8_t h) { digitalWrite(hoppers[h].relayPin, LOW);  }
+static void dispatchIo(const CommandFrame& cmd, uint32_t rxUs);
+static void dispatchPrint(uint8_t type, const uint8_t* data, size_t len);
+static void dispatchPrintCommand(const CommandFrame& cmd, uint32_t rxUs);
 // 传感器读取
 // 取消传感器逻辑
 
+// 逐个连接发送通知（不经 BLECharacteristic::notify()：那会发给所有连接且共用一份 CCCD）；
+// 协议栈拷贝负载后即返回，发送缓冲满时拒收并计入该连接的 dropped
+static void sendNotifications(BLECharacteristic* ch, const ClientTarget* targets, uint8_t n, const uint8_t* data) {
+  if (!server || !n) return;
+  const esp_gatt_if_t gattsIf = (esp_gatt_if_t)server->getGattsIf();
+  const uint16_t handle = ch->getHandle();
+  for (uint8_t i = 0; i < n; i++) {
+    const bool ok = esp_ble_gatts_send_indicate(gattsIf, targets[i].conn, handle, targets[i].len,
+                                                const_cast<uint8_t*>(data), false) == ESP_OK;
+    portENTER_CRITICAL(&clientsMux);
+    clients.noteSent(targets[i], ok);
+    portEXIT_CRITICAL(&clientsMux);
+  }
+}
+
+// 应答只发给发出指令的连接（须已订阅 status）
+static void replyTo(uint16_t client, const uint8_t* data, size_t len) {
+  if (!statusChar) return;
+  ClientTarget target;
+  portENTER_CRITICAL(&clientsMux);
+  const bool subscribed = clients.target(client, EVENT_KIND_STATUS, len, target);
+  portEXIT_CRITICAL(&clientsMux);
+  if (subscribed) sendNotifications(statusChar, &target, 1, data);
+}
+
+// === 会话、计数、吐币、事件与续传（见 coinbox_core.h），这里只提供 ESP32 侧的时钟/BLE/引脚/串口 ===
+class FirmwarePlatform : public CoinBoxPlatform {
+ public:
+  uint64_t nowUs() override { return (uint64_t)esp_timer_get_time(); }
+
+  void notify(uint8_t kind, const uint8_t* data, size_t len) override { publish(kind, data, len, 0); }
+
+  // 事件只发给订阅了该特征的连接；时间戳尾部只发给要求扩展格式的连接（负载共用一份）
+  void publish(uint8_t kind, const uint8_t* data, size_t len, size_t stampLen) override {
+    CAPTURE(notify(nowUs(), kind, data, len + stampLen));
+    BLECharacteristic* ch = kind == EVENT_KIND_COIN ? coinChar : statusChar;
+    if (!ch) return;
+    ClientTarget targets[BLE_MAX_CONNECTIONS];
+    portENTER_CRITICAL(&clientsMux);
+    const uint8_t n = clients.targets(kind, len, stampLen, targets);
+    portEXIT_CRITICAL(&clientsMux);
+    sendNotifications(ch, targets, n, data);
+  }
+
+  void reply(uint16_t client, const uint8_t* data, size_t len) override {
+    CAPTURE(notify(nowUs(), EVENT_KIND_STATUS, data, len));
+    replyTo(client, data, len);
+  }
+
+  void setRelay(uint8_t hopper, bool on) override {
+    CAPTURE(relay(nowUs(), hopper, on));
+    if (on) {
+      relayOn(hopper);
+    } else {
+      relayOff(hopper);
+    }
+  }
+
+  void printerWrite(const uint8_t* data, size_t len) override {
+    CAPTURE(uart(nowUs(), UART_SOURCE_CORE, data, len));
+    Serial2.write(data, len);
+  }
+
+  uint32_t random32() override {
+    const uint32_t v = esp_random();
+    CAPTURE(random(nowUs(), v));
+    return v;
+  }
+
+  uint16_t peerMtu(uint16_t client) override {
+    portENTER_CRITICAL(&clientsMux);
+    const uint16_t mtu = clients.mtu(client);
+    portEXIT_CRITICAL(&clientsMux);
+    CAPTURE(mtu(nowUs(), mtu));
+    return mtu;
+  }
+
+  void discardPendingPulses() override {
+    uint32_t ts;
+    while (pulseRing.pop(ts)) {
+    }
+    acceptorDebounce.reset();
+  }
+
+  void onActivity() override { requestDiag(); }
+
+  void vlog(const char* fmt, va_list ap) override {
+    char line[160];  // BLE 回调与 I/O 任务都会写日志，用栈上缓冲
+    vsnprintf(line, sizeof(line), fmt, ap);
+    Serial.println(line);
+  }
+};
+static FirmwarePlatform platform;
+static CoinBoxCore coinBox(platform, hoppers, HOPPER_COUNT, coinDenominations,
+                           sizeof(coinDenominations) / sizeof(coinDenominations[0]));
+
+// === 固件升级（见 ota_update.h）：BLE 回调只入队，OTA 任务解压写入未运行的 app 分区 ===
+class PartitionFlash : public OtaFlash {
+ public:
+  void select(const esp_partition_t* part) { part_ = part; }
+
+  uint32_t size() override { return part_ ? part_->size : 0; }
+
+  bool erase(uint32_t offset, uint32_t len) override {
+    return part_ && esp_partition_erase_range(part_, offset, len) == ESP_OK;
+  }
+
+  bool write(uint32_t offset, const uint8_t* data, size_t len) override {
+    return part_ && esp_partition_write(part_, offset, data, len) == ESP_OK;
+  }
+
+  bool read(uint32_t offset, uint8_t* data, size_t len) override {
+    return part_ && esp_partition_read(part_, offset, data, len) == ESP_OK;
+  }
+
+ private:
+  const esp_partition_t* part_ = nullptr;
+};
+static PartitionFlash otaFlash;
+static OtaReceiver otaReceiver(otaFlash, OTA_WINDOW);
+static bool otaTrial                = false;  // 新镜像试运行中，loop() 到时自检
+
 // ==== BLE 回调 ====
+// 核心逻辑只有一份事件格式：有连接要求扩展就生成尾部，发送时按连接截掉（录制的是核心实际收到的指令）
+static void syncEventFormat(bool extended, uint32_t rxUs) {
+  const uint8_t frame[2] = { CMD_SET_EVENT_FORMAT, (uint8_t)(extended ? EVENT_FORMAT_EXTENDED : 0) };
+  CommandFrame cmd;
+  if (decodeCommand(frame, sizeof(frame), cmd) != CMD_OK) return;
+  CAPTURE(command(widenUs(rxUs), frame, sizeof(frame)));
+  coinBox.execute(cmd, rxUs);
+}
+
 class ServerCallbacks : public BLEServerCallbacks {
-  void onConnect(BLEServer* pServer) override {
-    bleConnected = true;
-    Serial.println("[BLE] Connected");
+  void onConnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) override {
+    const uint16_t conn = param->connect.conn_id;
+    portENTER_CRITICAL(&clientsMux);
+    const int slot = clients.connect(conn, param->connect.remote_bda);
+    const uint8_t count = clients.count();
+    portEXIT_CRITICAL(&clientsMux);
+    if (slot < 0) {
+      Serial.print("[BLE] WARNING: connection limit reached, dropping conn "); Serial.println(conn);
+      pServer->disconnect(conn);
+      return;
+    }
+    if (count == 1) CAPTURE(connect((uint64_t)esp_timer_get_time()));
+    Serial.print("[BLE] Connected: conn="); Serial.print(conn);
+    Serial.print(", clients="); Serial.println(count);
+    // 协议栈连上即停止广播；未满时继续广播，运维终端可与玩家同时在线
+    if (count < BLE_MAX_CONNECTIONS) BLEDevice::startAdvertising();
+    requestDiag();
   }
-  void onDisconnect(BLEServer* pServer) override {
-    bleConnected = false;
+  void onDisconnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) override {
+    const uint16_t conn = param->disconnect.conn_id;
+    portENTER_CRITICAL(&clientsMux);
+    const bool wasOwner = clients.disconnect(conn, millis());
+    const uint8_t count = clients.count();
+    const bool extended = clients.anyExtended();
+    portEXIT_CRITICAL(&clientsMux);
+    // 会话、计数与事件序号保留，客户端重连后用 CMD_RESUME 补齐；事件格式按连接重新协商
+    if (!count) {
+      CAPTURE(disconnect((uint64_t)esp_timer_get_time()));
+      coinBox.onDisconnect();
+    } else if (extended != coinBox.extendedEvents()) {
+      syncEventFormat(extended, micros());
+    }
     pServer->getAdvertising()->start();
-    Serial.println("[BLE] Disconnected -> Advertising restarted");
+    Serial.print("[BLE] Disconnected: conn="); Serial.print(conn);
+    Serial.print(", clients="); Serial.print(count);
+    Serial.println(wasOwner ? ", owner away (session held for resume)" : ", session kept");
+    requestDiag();
   }
 };
 
+// 订阅按连接记录：Arduino 的 BLE2902 只存一份 CCCD 值，这里拦截写入按 conn_id 入表；MTU 同理
+static void onGattsEvent(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t* param) {
+  (void)gattsIf;
+  if (event == ESP_GATTS_WRITE_EVT) {
+    const uint16_t handle = param->write.handle;
+    if (param->write.len < 2 || (handle != coinCccdHandle && handle != statusCccdHandle)) return;
+    const uint8_t kind = handle == coinCccdHandle ? EVENT_KIND_COIN : EVENT_KIND_STATUS;
+    const bool on = (param->write.value[0] & 0x01) != 0;
+    portENTER_CRITICAL(&clientsMux);
+    clients.setSubscribed(param->write.conn_id, kind, on);
+    portEXIT_CRITICAL(&clientsMux);
+  } else if (event == ESP_GATTS_MTU_EVT) {
+    portENTER_CRITICAL(&clientsMux);
+    clients.setMtu(param->mtu.conn_id, param->mtu.mtu);
+    portEXIT_CRITICAL(&clientsMux);
+  }
+}
+
+// 配对完成：MITM 加密配对成功的连接才可声明运维（见 gatt_clients.h）；GAP 事件只带对端地址
+static void onGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+  if (event != ESP_GAP_BLE_AUTH_CMPL_EVT) return;
+  const esp_ble_auth_cmpl_t& auth = param->ble_security.auth_cmpl;
+  const bool mitm = auth.success && (auth.auth_mode & ESP_LE_AUTH_REQ_MITM);
+  portENTER_CRITICAL(&clientsMux);
+  const bool found = clients.setPaired(auth.bd_addr, mitm);
+  portEXIT_CRITICAL(&clientsMux);
+  Serial.print("[BLE] pairing "); Serial.print(mitm ? "ok (MITM)" : "failed or unauthenticated");
+  Serial.println(found ? "" : ", no matching connection");
+}
+
+// ==== 指令处理（BLE 回调上下文，只做解析与入队） ====
+// 负载已按 protocol.h 的指令表校验长度并解出字段；会话/吐币/续传交给 I/O 任务执行
+static void handleStartSession(const CommandFrame& cmd, uint32_t rxUs) {
+  dispatchIo(cmd, rxUs);
+}
+
+static void handlePayout(const CommandFrame& cmd, uint32_t rxUs) {
+  dispatchIo(cmd, rxUs);
+}
+
+static void handlePrintReceipt(const CommandFrame& cmd, uint32_t rxUs) {
+  // 解析 iPad 发来的打印数据，仅打印文本
+  Serial.print("[CMD] PRINT_RECEIPT received, payload size="); Serial.println((int)cmd.dataLen);
+  dispatchPrint(PRINT_JOB_RECEIPT, cmd.data, cmd.dataLen);
+}
+
+static void handleDebugPrinter(const CommandFrame& cmd, uint32_t rxUs) {
+  dispatchPrint(PRINT_JOB_DEBUG, nullptr, 0);
+}
+
+// 光栅分片与二维码在打印任务内解压/生成并写串口，应答 EVT_RASTER_ACK（见 raster_print.h）
+static void handlePrintRaster(const CommandFrame& cmd, uint32_t rxUs) {
+  dispatchPrintCommand(cmd, rxUs);
+}
+
+static void handlePrintQr(const CommandFrame& cmd, uint32_t rxUs) {
+  dispatchPrintCommand(cmd, rxUs);
+}
+
+static void handlePayoutCancel(const CommandFrame& cmd, uint32_t rxUs) {
+  dispatchIo(cmd, rxUs);
+}
+
+static void handleSetEventFormat(const CommandFrame& cmd, uint32_t rxUs) {
+  portENTER_CRITICAL(&clientsMux);
+  clients.setExtended(cmd.client, (cmd.a & EVENT_FORMAT_EXTENDED) != 0);
+  const bool extended = clients.anyExtended();
+  portEXIT_CRITICAL(&clientsMux);
+  syncEventFormat(extended, rxUs);
+}
+
+// 时钟同步直接在回调内应答，避免排队引入不对称时延
+static void handleTimePing(const CommandFrame& cmd, uint32_t rxUs) {
+  coinBox.execute(cmd, rxUs);
+}
+
+static void handleResume(const CommandFrame& cmd, uint32_t rxUs) {
+  dispatchIo(cmd, rxUs);
+}
+
+static void handleGetCaps(const CommandFrame& cmd, uint32_t rxUs) {
+  coinBox.execute(cmd, rxUs);
+}
+
+// 角色只影响连接层鉴权，不进入核心逻辑（不录制）
+static void handleSetRole(const CommandFrame& cmd, uint32_t rxUs) {
+  portENTER_CRITICAL(&clientsMux);
+  const bool ok = clients.setRole(cmd.client, (uint8_t)cmd.a);
+  const uint8_t reply[4] = { EVT_ROLE, clients.role(cmd.client), (uint8_t)clients.isOwner(cmd.client),
+                             clients.count() };
+  portEXIT_CRITICAL(&clientsMux);
+  if (ok) {
+    replyTo(cmd.client, reply, sizeof(reply));
+    return;
+  }
+  if (cmd.a == CLIENT_ROLE_OPERATOR) {
+    Serial.print("[BLE] operator role refused for conn "); Serial.print(cmd.client);
+    Serial.println(" (link not MITM-paired)");
+  }
+  const uint8_t rejected[3] = { EVT_REJECTED, CMD_SET_ROLE, REJECT_ROLE };
+  replyTo(cmd.client, rejected, sizeof(rejected));
+}
+
+typedef void (*CommandHandler)(const CommandFrame& cmd, uint32_t rxUs);
+
+#define PROTOCOL_HANDLER_ENTRY(op, name, minLen, maxLen, layout) handle##name,
+static constexpr CommandHandler kCommandHandlers[] = { PROTOCOL_COMMANDS(PROTOCOL_HANDLER_ENTRY) };
+#undef PROTOCOL_HANDLER_ENTRY
+static_assert(sizeof(kCommandHandlers) / sizeof(kCommandHandlers[0]) == kOpcodeCount,
+              "every opcode in PROTOCOL_COMMANDS needs a handler");
+
 class CmdCallbacks : public BLECharacteristicCallbacks {
-  void onWrite(BLECharacteristic* ch) override {
+  void onWrite(BLECharacteristic* ch, esp_ble_gatts_cb_param_t* param) override {
+    const uint32_t rxUs = micros();
+    std::string v = ch->getValue();
+    const uint8_t* frame = reinterpret_cast<const uint8_t*>(v.data());
+    CommandFrame cmd;
+    const CommandError err = decodeCommand(frame, v.size(), cmd);
+    if (err != CMD_OK) {
+      CAPTURE(command(widenUs(rxUs), frame, v.size()));
+      if (err == CMD_ERR_EMPTY) return;
+      Serial.print("[BLE] CMD rejected: 0x"); Serial.print((uint8_t)v[0], HEX);
+      Serial.print(err == CMD_ERR_UNKNOWN ? " unknown opcode" : " bad length ");
+      if (err == CMD_ERR_LENGTH) Serial.print((int)v.size() - 1);
+      Serial.println();
+      return;
+    }
+    cmd.client = param->write.conn_id;
+
+    // 会话归属与角色鉴权（见 gatt_clients.h）；被拒的指令不进入核心逻辑、不录制，只回给发出方
+    portENTER_CRITICAL(&clientsMux);
+    const uint8_t reason = clients.authorize(cmd.client, cmd.op, millis());
+    portEXIT_CRITICAL(&clientsMux);
+    if (reason) {
+      Serial.print("[BLE] CMD denied: "); Serial.print(kOpcodeSpecs[cmd.index].name);
+      Serial.print(" from conn "); Serial.print(cmd.client);
+      Serial.println(reason == REJECT_ROLE ? " (role)" : " (not session owner)");
+      const uint8_t reply[3] = { EVT_REJECTED, cmd.op, reason };
+      replyTo(cmd.client, reply, sizeof(reply));
+      return;
+    }
+    // 图像指令在打印任务实际执行时录制（队列满丢弃的分片不进入核心逻辑）
+    if (cmd.op != CMD_SET_ROLE && cmd.op != CMD_SET_EVENT_FORMAT && cmd.op != CMD_PRINT_RASTER &&
+        cmd.op != CMD_PRINT_QR) {
+      CAPTURE(command(widenUs(rxUs), frame, v.size()));
+    }
+
+    if (cmd.op != CMD_TIME_PING && cmd.op != CMD_PRINT_RASTER) {
+      Serial.print("[BLE] CMD recv: "); Serial.print(kOpcodeSpecs[cmd.index].name);
+      Serial.print(" (conn "); Serial.print(cmd.client); Serial.println(")");
+    }
+    kCommandHandlers[cmd.index](cmd, rxUs);
+  }
+};
+
+// 升级应答单播给一个连接（同 sendNotifications，不经 notify()：那会把升级进度发给所有连接）
+static void sendOtaStatus(uint16_t conn, const uint8_t* resp, size_t n) {
+  if (!server || !otaChar || !n) return;
+  esp_ble_gatts_send_indicate((esp_gatt_if_t)server->getGattsIf(), conn, otaChar->getHandle(), (uint16_t)n,
+                              const_cast<uint8_t*>(resp), false);
+}
+
+// 固件升级帧原样交给 OTA 任务（擦写耗时，不在 BLE 回调内执行）。
+// 协议栈已拒绝未经 MITM 加密配对的写入；这里再要求运维角色且持有本次升级（见 gatt_clients.h），被拒只回发出方
+class OtaCallbacks : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic* ch, esp_ble_gatts_cb_param_t* param) override {
+    static OtaFrame frame;  // 仅在 BLE 回调上下文使用，避免占用回调栈
     std::string v = ch->getValue();
-    if (v.size() < 1) return;
-    const uint8_t cmd = v[0];
-    Serial.print("[BLE] CMD recv: 0x"); Serial.println(cmd, HEX);
-
-    if (cmd == CMD_START_SESSION) {
-      coinTotal = 0;
-      lastAcceptorUs = 0;
-      notifyCoinTotal();
-      Serial.println("[CMD] START_SESSION -> counters reset");
-    } else if (cmd == CMD_PAYOUT) {
-      if (v.size() < 3) return;
-      const uint16_t target = (uint16_t)((uint8_t)v[1] | ((uint16_t)(uint8_t)v[2] << 8));
-      Serial.print("[CMD] PAYOUT -> target: "); Serial.println(target);
-      handlePayout(target);
-    } else if (cmd == CMD_PRINT_RECEIPT) {
-      // 解析 iPad 发来的打印数据，仅打印文本
-      Serial.print("[CMD] PRINT_RECEIPT received, payload size="); Serial.println(v.size());
-      
-      if (v.size() <= 1) {
-        Serial.println("[CMD] PRINT_RECEIPT: No payload data");
-        return;
-      }
-      
-      const uint8_t* text = reinterpret_cast<const uint8_t*>(&v[1]);
-      const size_t len = v.size() - 1;
-      // 保证以\0 结尾
-      static char line[512];
-      size_t copyLen = len < sizeof(line) - 1 ? len : sizeof(line) - 1;
-      memcpy(line, text, copyLen);
-      line[copyLen] = '\0';
-      Serial.print("[CMD] PRINT_RECEIPT len="); Serial.println((int)copyLen);
-      Serial.print("[CMD] PRINT_RECEIPT text: "); Serial.println(line);
-
-      // 先直接通过串口发送测试
-      Serial.println("[PRN] Sending direct to UART...");
-      Serial2.print("=== 交易小票 ===\n");
-      Serial2.print(line);
-      Serial2.print("\n\n\n");
-      Serial2.flush();
-      Serial.println("[PRN] Direct UART print completed");
-      
-      // 使用正确的链式调用方法
-      if (printer != nullptr && printer->text() != nullptr) {
-        Serial.println("[PRN] Starting library print job...");
-        
-        // 分别调用每个部分，确保每次都调用print()
-        int result1 = printer->text()
-          ->align(ALIGN_CENTER)
-          ->bold(ENABLE)
-          ->utf8_text((uint8_t*)"交易小票")
-          ->newline()
-          ->print();
-        Serial.print("[PRN] Header result: "); Serial.println(result1);
-        
-        int result2 = printer->text()
-          ->bold(DISABLE)
-          ->align(ALIGN_LEFT)
-          ->utf8_text((uint8_t*)line)
-          ->newline()
-          ->print();
-        Serial.print("[PRN] Content result: "); Serial.println(result2);
-        
-        int result3 = printer->text()
-          ->feed_lines(3)
-          ->print();
-        Serial.print("[PRN] Footer result: "); Serial.println(result3);
-        
-      } else {
-        Serial.println("[PRN] WARNING: Printer library not available, used direct UART only");
-      }
-      
-      Serial.println("[PRN] receipt printed");
-    } else if (cmd == CMD_DEBUG_PRINTER) {
-      Serial.println("[DEBUG] Printer debug command received");
-      
-      // 测试1: 原始文本
-      Serial.println("[DEBUG] Test 1: Raw text");
-      Serial2.print("RAW TEXT TEST\r\n");
-      Serial2.flush();
-      delay(500);
-      
-      // 测试2: 不同波特率测试（重新初始化串口）
-      Serial.println("[DEBUG] Test 2: Different baud rates");
-      int baud_rates[] = {9600, 19200, 38400, 57600, 115200};
-      for (int i = 0; i < 5; i++) {
-        Serial.print("[DEBUG] Testing baud rate: "); Serial.println(baud_rates[i]);
-        Serial2.end();
-        Serial2.begin(baud_rates[i], SERIAL_8N1, PRINTER_UART_RX_PIN, PRINTER_UART_TX_PIN);
-        delay(100);
-        Serial2.print("BAUD TEST ");
-        Serial2.print(baud_rates[i]);
-        Serial2.print("\r\n");
-        Serial2.flush();
-        delay(1000);
-      }
-      
-      // 恢复默认波特率
-      Serial2.end();
-      Serial2.begin(PRINTER_UART_BAUD, SERIAL_8N1, PRINTER_UART_RX_PIN, PRINTER_UART_TX_PIN);
-      delay(100);
-      
-      // 测试3: ESC/POS命令
-      Serial.println("[DEBUG] Test 3: ESC/POS commands");
-      uint8_t esc_pos_test[] = {
-        0x1B, 0x40,        // ESC @ (初始化打印机)
-        'T', 'E', 'S', 'T', '\n',
-        0x1B, 0x45, 0x01,  // ESC E (加粗开)
-        'B', 'O', 'L', 'D', '\n',
-        0x1B, 0x45, 0x00,  // ESC E (加粗关)
-        0x1B, 0x64, 0x03   // ESC d (走纸3行)
-      };
-      Serial2.write(esc_pos_test, sizeof(esc_pos_test));
-      Serial2.flush();
-      
-      Serial.println("[DEBUG] All printer tests completed");
+    if (v.empty() || v.size() > OTA_FRAME_MAX) {
+      Serial.print("[OTA] WARNING: frame length "); Serial.println((int)v.size());
+      return;
+    }
+    const uint16_t conn = param->write.conn_id;
+    portENTER_CRITICAL(&clientsMux);
+    const uint8_t reason = clients.authorizeOta(conn, (uint8_t)v[0]);
+    portEXIT_CRITICAL(&clientsMux);
+    if (reason) {
+      Serial.print("[OTA] denied: op=0x"); Serial.print((uint8_t)v[0], HEX);
+      Serial.print(" from conn "); Serial.print(conn);
+      Serial.println(reason == REJECT_ROLE ? " (not operator)" : " (another connection is updating)");
+      uint8_t resp[OTA_STATUS_LEN];
+      otaPutStatus(resp, OTA_STATE_IDLE, OTA_ERR_DENIED, 0, 0);  // 不透露进行中升级的状态
+      sendOtaStatus(conn, resp, sizeof(resp));
+      return;
     }
+    frame.conn = conn;
+    frame.len  = (uint16_t)v.size();
+    memcpy(frame.data, v.data(), v.size());
+    // 队列满时丢帧：OTA 任务见到偏移缺口回 NACK，App 从确认处重发
+    if (otaQueue && xQueueSend(otaQueue, &frame, 0) == pdTRUE) return;
+    Serial.println("[TASK] WARNING: ota queue full, frame dropped");
   }
 };
 
+// ==== 打印（打印任务内执行） ====
+// 打印机按 CP936 解码：App 发来的 UTF-8 先转码（汉字 3 字节 → 2 字节），固定文案在编译期转好
+static constexpr auto kReceiptTitle     = cp936Literal("交易小票");
+static constexpr auto kPrinterReady     = cp936Literal("[Printer] Ready");
+
+static void printReceipt(const char* text, size_t len) {
+  // 先直接通过串口发送测试（转码与直发在 coinbox_core.h）
+  Serial.println("[PRN] Sending direct to UART...");
+  coinBox.printReceipt(reinterpret_cast<const uint8_t*>(text), len);
+  uint8_t* line = coinBox.receiptText();
+  Serial2.flush();
+  Serial.println("[PRN] Direct UART print completed");
+  
+  // 使用正确的链式调用方法
+  if (printer != nullptr && printer->text() != nullptr) {
+    Serial.println("[PRN] Starting library print job...");
+    
+    // 分别调用每个部分，确保每次都调用print()
+    int result1 = printer->text()
+      ->encoding(ENCODING_CP936)
+      ->align(ALIGN_CENTER)
+      ->bold(ENABLE)
+      ->add_raw(const_cast<uint8_t*>(kReceiptTitle.bytes))
+      ->newline()
+      ->print();
+    Serial.print("[PRN] Header result: "); Serial.println(result1);
+    
+    int result2 = printer->text()
+      ->bold(DISABLE)
+      ->align(ALIGN_LEFT)
+      ->add_raw(line)
+      ->newline()
+      ->print();
+    Serial.print("[PRN] Content result: "); Serial.println(result2);
+    
+    int result3 = printer->text()
+      ->feed_lines(3)
+      ->print();
+    Serial.print("[PRN] Footer result: "); Serial.println(result3);
+    
+  } else {
+    Serial.println("[PRN] WARNING: Printer library not available, used direct UART only");
+  }
+  
+  Serial.println("[PRN] receipt printed");
+}
+
+static void runPrinterDebug() {
+  Serial.println("[DEBUG] Printer debug command received");
+  
+  // 测试1: 原始文本
+  Serial.println("[DEBUG] Test 1: Raw text");
+  Serial2.print("RAW TEXT TEST\r\n");
+  Serial2.flush();
+  delay(500);
+  
+  // 测试2: 不同波特率测试（重新初始化串口）
+  Serial.println("[DEBUG] Test 2: Different baud rates");
+  int baud_rates[] = {9600, 19200, 38400, 57600, 115200};
+  for (int i = 0; i < 5; i++) {
+    Serial.print("[DEBUG] Testing baud rate: "); Serial.println(baud_rates[i]);
+    Serial2.end();
+    Serial2.begin(baud_rates[i], SERIAL_8N1, PRINTER_UART_RX_PIN, PRINTER_UART_TX_PIN);
+    delay(100);
+    Serial2.print("BAUD TEST ");
+    Serial2.print(baud_rates[i]);
+    Serial2.print("\r\n");
+    Serial2.flush();
+    delay(1000);
+  }
+  
+  // 恢复默认波特率
+  Serial2.end();
+  Serial2.begin(PRINTER_UART_BAUD, SERIAL_8N1, PRINTER_UART_RX_PIN, PRINTER_UART_TX_PIN);
+  delay(100);
+  
+  // 测试3: ESC/POS命令
+  Serial.println("[DEBUG] Test 3: ESC/POS commands");
+  uint8_t esc_pos_test[] = {
+    0x1B, 0x40,        // ESC @ (初始化打印机)
+    'T', 'E', 'S', 'T', '\n',
+    0x1B, 0x45, 0x01,  // ESC E (加粗开)
+    'B', 'O', 'L', 'D', '\n',
+    0x1B, 0x45, 0x00,  // ESC E (加粗关)
+    0x1B, 0x64, 0x03   // ESC d (走纸3行)
+  };
+  Serial2.write(esc_pos_test, sizeof(esc_pos_test));
+  Serial2.flush();
+  
+  Serial.println("[DEBUG] All printer tests completed");
+}
+
 // ==== 中断（投币器） ====
+// 浅睡唤醒只认电平，且 gpio_wakeup_enable 与中断共用同一个中断类型寄存器：边沿中断会覆盖唤醒配置。
+// 因此用电平中断乒乓检出上升沿：等高电平触发 = 上升沿，随即改等低电平；低电平触发后改回等高电平。
+// 浅睡只发生在脉冲串之间（脉冲串未结束时持 AWAKE_COIN），此时脚为低、寄存器为高电平，正好就是唤醒条件
 void IRAM_ATTR isrAcceptor() {
+  const bool rising = GPIO.pin[PIN_COIN_ACCEPTOR].int_type == GPIO_INTR_HIGH_LEVEL;
+  GPIO.pin[PIN_COIN_ACCEPTOR].int_type = rising ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL;
+  if (!rising) return;
   const uint32_t now = micros();
-  if (now - lastAcceptorUs < COIN_ACCEPTOR_DEBOUNCE_US) return;
-  lastAcceptorUs = now;
-  coinTotal++;
-  // 立即上报总币数
-  if (coinChar) {
-    uint8_t buf[2] = { (uint8_t)(coinTotal & 0xFF), (uint8_t)((coinTotal >> 8) & 0xFF) };
-    coinChar->setValue(buf, 2);
-    coinChar->notify();
+  if (!acceptorDebounce.accept(now)) return;
+  pulseRing.push(now);
+  // 分组与通知交给 I/O 任务，ISR 内不调用 BLE 协议栈
+  if (ioQueue) {
+    const IoMsg msg = { IO_COIN, now, {} };
+    BaseType_t woken = pdFALSE;
+    xQueueSendFromISR(ioQueue, &msg, &woken);
+    if (woken) portYIELD_FROM_ISR();
   }
 }
 
 // 无传感器中断
 
-// ==== 辅助通知 ====
-static void notifyCoinTotal() {
-  if (!coinChar) return;
-  uint8_t buf[2] = { (uint8_t)(coinTotal & 0xFF), (uint8_t)((coinTotal >> 8) & 0xFF) };
-  coinChar->setValue(buf, 2);
-  coinChar->notify();
+// ==== 投币 ====
+// 取出 ISR 记录的脉冲交给核心逻辑分组；有新币时上报一次
+static void drainCoinPulses() {
+  uint32_t ts;
+  while (pulseRing.pop(ts)) {
+    CAPTURE(pulse(widenUs(ts)));
+    coinBox.feedPulse(ts);
+  }
+  coinBox.flushCoins();
+}
+
+// ==== 吐币定时 ====
+// 先让出 CPU 到截止前 PAYOUT_SPIN_US，再忙等到截止时刻；I/O 任务优先级最高，醒来不会被打印/loop 抢占
+static void waitUntilUs(int64_t deadlineUs) {
+  const int64_t remainUs = deadlineUs - esp_timer_get_time();
+  if (remainUs > PAYOUT_SPIN_US) {
+    vTaskDelay(pdMS_TO_TICKS((uint32_t)((remainUs - PAYOUT_SPIN_US) / 1000)));
+  }
+  while (esp_timer_get_time() < deadlineUs) {
+  }
 }
 
-static void notifyPayoutDone(uint16_t dispensed) {
-  if (!statusChar) return;
-  uint8_t payload[3] = {
-    EVT_PAYOUT_DONE,
-    (uint8_t)(dispensed & 0xFF),
-    (uint8_t)((dispensed >> 8) & 0xFF)
+// ==== 低功耗 ====
+// 持锁期间 esp_pm 不降频（CPU_FREQ_MAX）或不浅睡（NO_LIGHT_SLEEP）；无人持锁时自动浅睡
+static void stayAwake(AwakeReason reason) {
+  portENTER_CRITICAL(&awakeMux);
+  const bool first = awakeMeter.hold(reason, (uint64_t)esp_timer_get_time());
+  portEXIT_CRITICAL(&awakeMux);
+  if (first && pmLocks[reason]) esp_pm_lock_acquire(pmLocks[reason]);
+}
+
+static void allowSleep(AwakeReason reason) {
+  portENTER_CRITICAL(&awakeMux);
+  const bool last = awakeMeter.release(reason, (uint64_t)esp_timer_get_time());
+  portEXIT_CRITICAL(&awakeMux);
+  if (last && pmLocks[reason]) esp_pm_lock_release(pmLocks[reason]);
+}
+
+static void setupPower() {
+#if POWER_SAVE_ENABLE
+  esp_pm_config_esp32_t pm = {};
+  pm.max_freq_mhz       = POWER_MAX_FREQ_MHZ;
+  pm.min_freq_mhz       = POWER_MIN_FREQ_MHZ;
+  pm.light_sleep_enable = POWER_LIGHT_SLEEP;
+  const esp_err_t err = esp_pm_configure(&pm);
+  if (err != ESP_OK) {
+    Serial.print("[PWR] WARNING: esp_pm_configure failed ("); Serial.print(err);
+    Serial.println("), running at full clock");
+    return;
+  }
+  pmActive = true;
+
+  static const struct { esp_pm_lock_type_t type; const char* name; } kLocks[AWAKE_REASON_COUNT] = {
+    { ESP_PM_CPU_FREQ_MAX,   "payout" },
+    { ESP_PM_NO_LIGHT_SLEEP, "coin" },
+    { ESP_PM_CPU_FREQ_MAX,   "io" },
+    { ESP_PM_NO_LIGHT_SLEEP, "print" },
+    { ESP_PM_NO_LIGHT_SLEEP, "diag" },
+    { ESP_PM_CPU_FREQ_MAX,   "ota" },
   };
-  statusChar->setValue(payload, 3);
-  statusChar->notify();
-}
-
-// ==== 吐币核心逻辑（继电器启停 + 传感器确认） ====
-// 基本策略：一枚一控
-// - 记录基线dispensedBaseline
-// - 启动继电器，等待 coinDispensed == baseline+1（有超时保护）
-// - 成功则停止继电器，间隔后继续；超时则停止继电器并中止
-static void handlePayout(uint16_t targetCount) {
-  // 改为按时间控制吐币（不使用出币传感器）
-  // 速率：DISPENSE_COINS_PER_SEC 枚/秒
-  if (targetCount == 0) {
-    notifyPayoutDone(0);
+  for (uint8_t i = 0; i < AWAKE_REASON_COUNT; i++) {
+    if (esp_pm_lock_create(kLocks[i].type, 0, kLocks[i].name, &pmLocks[i]) != ESP_OK) pmLocks[i] = nullptr;
+  }
+  Serial.print("[PWR] DFS "); Serial.print(POWER_MIN_FREQ_MHZ);
+  Serial.print("-"); Serial.print(POWER_MAX_FREQ_MHZ);
+  Serial.print(" MHz, light sleep="); Serial.println(POWER_LIGHT_SLEEP);
+#endif
+}
+
+// ==== 固件升级 ====
+static OtaBootRecord loadBootRecord() {
+  OtaBootRecord rec = {};
+  Preferences prefs;
+  if (prefs.begin("ota", true)) {
+    prefs.getBytes("boot", &rec, sizeof(rec));
+    prefs.end();
+  }
+  return rec;
+}
+
+static void saveBootRecord(const OtaBootRecord& rec) {
+  Preferences prefs;
+  prefs.begin("ota", false);
+  prefs.putBytes("boot", &rec, sizeof(rec));
+  prefs.end();
+}
+
+// 启动分区切回升级前的分区并重启；旧镜像原样保留在该分区
+static void otaRollback(const OtaBootRecord& rec) {
+  const esp_partition_t* prev =
+      esp_partition_find_first(ESP_PARTITION_TYPE_APP, (esp_partition_subtype_t)rec.previousApp, nullptr);
+  if (!prev || esp_ota_set_boot_partition(prev) != ESP_OK) {
+    Serial.println("[OTA] ERROR: rollback partition unusable, staying on new image");
+    return;
+  }
+  Serial.print("[OTA] rolling back to "); Serial.println(prev->label);
+  Serial.flush();
+  esp_restart();
+}
+
+// 启动时调用（先于任务与 BLE）：新镜像的试运行计数，自检前反复重启则直接回滚
+static void otaBootCheck() {
+  OtaBootRecord rec = loadBootRecord();
+  const OtaBootAction action = otaBootDecide(rec, (uint8_t)esp_ota_get_running_partition()->subtype);
+  if (action == OTA_BOOT_NORMAL) return;
+  saveBootRecord(rec);
+  if (action == OTA_BOOT_SELF_CHECK) {
+    otaTrial = true;
+    Serial.print("[OTA] trial boot "); Serial.print(rec.trialBoots);
+    Serial.print("/"); Serial.print(OTA_MAX_TRIAL_BOOTS);
+    Serial.print(", self-check in "); Serial.print(OTA_SELF_CHECK_MS); Serial.println(" ms");
+  } else if (action == OTA_BOOT_REJECTED) {
+    Serial.println("[OTA] WARNING: new image did not boot, running previous image");
+  } else {
+    Serial.println("[OTA] WARNING: new image restarted before self-check");
+    otaRollback(rec);
+  }
+}
+
+// 新镜像自检：各任务、GATT 特征与打印机实例就绪，堆余量正常
+static bool otaSelfCheck() {
+  return ioTaskHandle && printTaskHandle && otaTaskHandle && server && coinChar && cmdChar && statusChar &&
+         otaChar && printer && esp_get_free_heap_size() > OTA_SELF_CHECK_MIN_HEAP;
+}
+
+// loop() 调用：试运行满 OTA_SELF_CHECK_MS 后自检，通过则确认，否则回滚
+static void otaFinishTrial() {
+  if (!otaTrial || millis() < OTA_SELF_CHECK_MS) return;
+  otaTrial = false;
+  OtaBootRecord rec = loadBootRecord();
+  const bool ok = otaSelfCheck();
+  const OtaBootAction action = otaBootFinish(rec, ok);
+  saveBootRecord(rec);
+  if (action == OTA_BOOT_ROLLBACK) {
+    Serial.println("[OTA] self-check FAILED");
+    otaRollback(rec);
     return;
   }
+#if defined(CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE)
+  esp_ota_mark_app_valid_cancel_rollback();
+#endif
+  Serial.println("[OTA] self-check passed, new image confirmed");
+}
+
+// 引导程序打开回滚支持时，Arduino 核心默认启动即确认新镜像；改由 otaFinishTrial 决定
+extern "C" bool verifyRollbackLater() { return true; }
+
+// 切换启动分区（esp_ota_set_boot_partition 同时校验镜像格式）并记录试运行
+static bool applyOta() {
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  const esp_partition_t* target  = esp_ota_get_next_update_partition(nullptr);
+  if (!target || esp_ota_set_boot_partition(target) != ESP_OK) return false;
+  OtaBootRecord rec;
+  otaBootArm(rec, (uint8_t)running->subtype, (uint8_t)target->subtype, otaReceiver.header().imageCrc);
+  saveBootRecord(rec);
+  return true;
+}
+
+// 常规确认不输出；开始/续传、出错与校验完成各一行
+static void logOta(uint8_t op, uint8_t stateBefore, const uint8_t* resp, size_t n) {
+  if (!n) return;
+  const uint8_t result = resp[2];
+  if (op == OTA_OP_BEGIN) {
+    const OtaImageHeader& h = otaReceiver.header();
+    Serial.print("[OTA] begin image="); Serial.print(h.imageSize);
+    Serial.print(" stream="); Serial.print(h.streamSize);
+    Serial.print(h.method == OTA_METHOD_LZSS ? " lzss" : " stored");
+    Serial.print(", result="); Serial.print(result);
+    Serial.print(", offset="); Serial.println(getLe32(resp + 3));
+  } else if (result != OTA_OK) {
+    Serial.print("[OTA] WARNING: result="); Serial.print(result);
+    Serial.print(" at offset "); Serial.println(getLe32(resp + 3));
+  } else if (stateBefore != OTA_STATE_VERIFIED && resp[1] == OTA_STATE_VERIFIED) {
+    const OtaStats& st = otaReceiver.stats();
+    Serial.print("[OTA] image verified: chunks="); Serial.print(st.chunks);
+    Serial.print(", crcErrors="); Serial.print(st.crcErrors);
+    Serial.print(", gaps="); Serial.print(st.sequenceErrors);
+    Serial.print(", resumes="); Serial.println(st.resumes);
+  }
+}
+
+// ==== 任务 ====
+static void runIo(const IoMsg& msg) {
+  switch (msg.type) {
+    case IO_COIN:    drainCoinPulses();                   break;
+    case IO_COMMAND: coinBox.execute(msg.cmd, msg.rxUs);  break;
+  }
+}
+
+static void runPrintJob(const PrintJob& job) {
+  if (job.type == PRINT_JOB_RECEIPT) {
+    printReceipt(job.text, job.len);
+  } else if (job.type == PRINT_JOB_DEBUG) {
+    runPrinterDebug();
+  } else if (job.type == PRINT_JOB_IMAGE) {
+    const uint8_t* frame = reinterpret_cast<const uint8_t*>(job.text);
+    CommandFrame cmd;
+    if (decodeCommand(frame, job.len, cmd) != CMD_OK) return;
+    cmd.client = job.client;
+    CAPTURE(command(widenUs(job.rxUs), frame, job.len));
+    coinBox.execute(cmd, job.rxUs);
+  }
+}
+
+// BLE 回调 → I/O 任务（队列满时丢弃并告警，回调不阻塞）
+static void dispatchIo(const CommandFrame& cmd, uint32_t rxUs) {
+  IoMsg msg = { IO_COMMAND, rxUs, cmd };
+  msg.cmd.data    = nullptr;  // 指向 BLE 缓冲，出回调即失效；这些指令也不带变长数据
+  msg.cmd.dataLen = 0;
+  if (ioQueue && xQueueSend(ioQueue, &msg, 0) == pdTRUE) return;
+  Serial.println("[TASK] WARNING: io queue full, command dropped");
+}
+
+static void dispatchPrint(uint8_t type, const uint8_t* data, size_t len) {
+  static PrintJob job;  // 仅在 BLE 回调上下文使用，避免占用回调栈
+  job.type = type;
+  job.len  = (uint16_t)(len < PRINT_JOB_MAX_BYTES ? len : PRINT_JOB_MAX_BYTES);
+  if (data && job.len) memcpy(job.text, data, job.len);
+  if (printQueue && xQueueSend(printQueue, &job, 0) == pdTRUE) return;
+  Serial.println("[TASK] WARNING: print queue full, job dropped");
+}
+
+// 图像指令整帧入队（数据指向 BLE 缓冲，出回调即失效）；队列满时丢弃，光栅分片由 App 按应答偏移重发
+static void dispatchPrintCommand(const CommandFrame& cmd, uint32_t rxUs) {
+  static PrintJob job;  // 仅在 BLE 回调上下文使用，避免占用回调栈
+  job.type   = PRINT_JOB_IMAGE;
+  job.client = cmd.client;
+  job.rxUs   = rxUs;
+  job.len    = (uint16_t)encodeCommand(cmd, reinterpret_cast<uint8_t*>(job.text), sizeof(job.text));
+  if (!job.len) return;
+  if (printQueue && xQueueSend(printQueue, &job, 0) == pdTRUE) return;
+  Serial.println("[TASK] WARNING: print queue full, image command dropped");
+}
 
-  const float secondsNeeded = ((float)targetCount) / DISPENSE_COINS_PER_SEC;
-  const uint32_t durationMs = (uint32_t)(secondsNeeded * 1000.0f);
+static void ioTask(void*) {
+  IoMsg msg;
+  for (;;) {
+    // 最多等到下一个吐币截止时刻前 PAYOUT_SPIN_US，或未结束脉冲串的判定时刻
+    TickType_t wait = portMAX_DELAY;
+    const int64_t nowUs = esp_timer_get_time();
+    const uint64_t payoutDueUs = coinBox.nextPayoutUs();
+    if (payoutDueUs != UINT64_MAX) {
+      const int64_t leadUs = (int64_t)payoutDueUs - PAYOUT_SPIN_US - nowUs;
+      wait = leadUs > 0 ? pdMS_TO_TICKS((uint32_t)(leadUs / 1000)) : 0;
+    }
+    const uint32_t coinDueUs = coinBox.coinDueInUs(micros());
+    if (coinDueUs != UINT32_MAX) {
+      const TickType_t coinWait = pdMS_TO_TICKS(coinDueUs / 1000 + 1);
+      if (coinWait < wait) wait = coinWait;
+    }
+
+    if (xQueueReceive(ioQueue, &msg, wait) == pdTRUE) {
+      stayAwake(AWAKE_IO);
+      runIo(msg);
+    } else if (payoutDueUs != UINT64_MAX &&
+               (int64_t)payoutDueUs - esp_timer_get_time() <= PAYOUT_SPIN_US + 1000 * portTICK_PERIOD_MS) {
+      waitUntilUs((int64_t)payoutDueUs);  // 临近截止：忙等保证继电器动作精度
+    }
+    coinBox.servicePayout();
+    drainCoinPulses();
+
+    // 吐币运行中保持全速；脉冲串未结束时禁浅睡，后续脉冲不受唤醒延迟影响
+    if (coinBox.payoutBusy()) stayAwake(AWAKE_PAYOUT); else allowSleep(AWAKE_PAYOUT);
+    if (coinBox.coinPending()) stayAwake(AWAKE_COIN); else allowSleep(AWAKE_COIN);
+    allowSleep(AWAKE_IO);
+  }
+}
 
-  Serial.print("[PAYOUT] time-based start, target="); Serial.print(targetCount);
-  Serial.print(", durationMs="); Serial.println(durationMs);
+static void printerTask(void*) {
+  static PrintJob job;
+  for (;;) {
+    if (xQueueReceive(printQueue, &job, portMAX_DELAY) != pdTRUE) continue;
+    stayAwake(AWAKE_PRINT);
+    runPrintJob(job);
+    Serial2.flush();
+    allowSleep(AWAKE_PRINT);
+  }
+}
 
-  // 启动继电器，持续给定时长
-  relayOn();
-  const uint32_t startMs = millis();
-  while ((millis() - startMs) < durationMs) {
-    delay(1);
+static void otaTask(void*) {
+  static OtaFrame frame;
+  uint8_t resp[OTA_STATUS_LEN];
+  for (;;) {
+    if (xQueueReceive(otaQueue, &frame, portMAX_DELAY) != pdTRUE) continue;
+    // 擦写期间两核 cache 关闭：等吐币运行与脉冲串结束，继电器定时与脉冲时间戳不受影响
+    while (coinBox.payoutBusy() || coinBox.coinPending()) vTaskDelay(pdMS_TO_TICKS(OTA_DEFER_MS));
+    stayAwake(AWAKE_OTA);
+    const uint8_t before = otaReceiver.state();
+    size_t n = otaReceiver.handle(frame.data, frame.len, resp);
+    bool restart = false;
+    if (frame.data[0] == OTA_OP_APPLY && n && resp[2] == OTA_OK) {
+      restart = applyOta();
+      if (!restart) n = otaReceiver.fail(OTA_ERR_VERIFY, resp);
+    }
+    // 只回发出该帧、且仍持有本次升级的连接（ABORT 已释放，仍回给发出它的运维连接）；其间断开或被夺走则不发
+    portENTER_CRITICAL(&clientsMux);
+    const bool holder = clients.otaOwner() == frame.conn ||
+                        (frame.data[0] == OTA_OP_ABORT && clients.role(frame.conn) == CLIENT_ROLE_OPERATOR);
+    portEXIT_CRITICAL(&clientsMux);
+    if (holder) sendOtaStatus(frame.conn, resp, n);
+    logOta(frame.data[0], before, resp, n);
+    allowSleep(AWAKE_OTA);
+    if (restart) {
+      Serial.println("[OTA] applied, restarting");
+      Serial.flush();
+      vTaskDelay(pdMS_TO_TICKS(OTA_RESTART_DELAY_MS));  // 让应答通知发出
+      esp_restart();
+    }
   }
-  relayOff();
+}
 
-  // 直接按目标值上报
-  notifyPayoutDone(targetCount);
-  Serial.println("[PAYOUT] time-based done");
+static void startTasks() {
+  ioQueue    = xQueueCreate(IO_QUEUE_LEN, sizeof(IoMsg));
+  printQueue = xQueueCreate(PRINT_QUEUE_LEN, sizeof(PrintJob));
+  otaQueue   = xQueueCreate(OTA_WINDOW, sizeof(OtaFrame));
+  xTaskCreatePinnedToCore(ioTask, "coin_io", IO_TASK_STACK, nullptr, IO_TASK_PRIO,
+                          &ioTaskHandle, IO_TASK_CORE);
+  xTaskCreatePinnedToCore(printerTask, "printer", PRINTER_TASK_STACK, nullptr, PRINTER_TASK_PRIO,
+                          &printTaskHandle, PRINTER_TASK_CORE);
+  xTaskCreatePinnedToCore(otaTask, "ota", OTA_TASK_STACK, nullptr, OTA_TASK_PRIO,
+                          &otaTaskHandle, OTA_TASK_CORE);
+  Serial.print("[TASK] io@core"); Serial.print(IO_TASK_CORE);
+  Serial.print(" prio="); Serial.print(IO_TASK_PRIO);
+  Serial.print(", printer@core"); Serial.print(PRINTER_TASK_CORE);
+  Serial.print(" prio="); Serial.print(PRINTER_TASK_PRIO);
+  Serial.print(", ota@core"); Serial.print(OTA_TASK_CORE);
+  Serial.print(" prio="); Serial.println(OTA_TASK_PRIO);
 }
 
 // ==== 初始化与主循环 ====
@@ -279,15 +993,50 @@ void setup() {
 
   // 硬件引脚
   pinMode(PIN_COIN_ACCEPTOR, INPUT);  // 投币机输出0V-5V，不需要上拉
-  pinMode(PIN_DISPENSE_RELAY, OUTPUT);
-  relayOff();
+  for (uint8_t h = 0; h < HOPPER_COUNT; h++) {
+    pinMode(hoppers[h].relayPin, OUTPUT);
+    relayOff(h);
+  }
+
+  // 新镜像试运行计数（继电器已断开，回滚重启安全）；升级写入未运行的 app 分区
+  otaBootCheck();
+  const esp_partition_t* otaTarget = esp_ota_get_next_update_partition(nullptr);
+  otaFlash.select(otaTarget);
+  uint8_t otaKey[OTA_KEY_LEN];
+  if (otaParseKey(OTA_AUTH_KEY, otaKey)) otaReceiver.setKey(otaKey);  // 格式已在编译期检查
+  if (otaTarget) {
+    Serial.print("[OTA] update partition "); Serial.print(otaTarget->label);
+    Serial.print(", "); Serial.print(otaTarget->size); Serial.println(" bytes");
+  } else {
+    Serial.println("[OTA] WARNING: no OTA partition, updates disabled");
+  }
+
+  // 低功耗（PM 锁须先于任务创建）；setup() 运行在 loop 任务内
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  setupPower();
+
+#if CAPTURE_ENABLE
+  sessionLog.begin((uint64_t)esp_timer_get_time());
+  Serial.print("[CAP] recording, buffer="); Serial.println(CAPTURE_BUFFER_BYTES);
+#endif
+
+  // I/O 与打印任务（须先于中断与 BLE 回调就绪）
+  startTasks();
 
   // 中断
-  attachInterrupt(digitalPinToInterrupt(PIN_COIN_ACCEPTOR), isrAcceptor, RISING);  // 0V→5V上升沿
+  attachInterrupt(digitalPinToInterrupt(PIN_COIN_ACCEPTOR), isrAcceptor, ONHIGH);  // 0V→5V上升沿（电平乒乓，见 isrAcceptor）
+  // 唤醒须在挂中断之后设置：attachInterrupt 会重写中断类型。高电平唤醒与 ISR 等待的电平一致，两者不再互相覆盖
+  if (pmActive) {
+    gpio_wakeup_enable((gpio_num_t)PIN_COIN_ACCEPTOR, GPIO_INTR_HIGH_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+  }
   // 无出币传感器中断
 
   // BLE
   BLEDevice::init(BLE_DEVICE_NAME);
+  BLEDevice::setMTU(BLE_LOCAL_MTU);
+  BLEDevice::setCustomGattsHandler(onGattsEvent);
+  BLEDevice::setCustomGapHandler(onGapEvent);
   server = BLEDevice::createServer();
   server->setCallbacks(new ServerCallbacks());
 
@@ -295,17 +1044,36 @@ void setup() {
 
   // 总投币数 Notify
   coinChar = service->createCharacteristic(CHAR_COIN_UUID, BLECharacteristic::PROPERTY_NOTIFY);
-  coinChar->addDescriptor(new BLE2902());
+  BLE2902* coinCccd = new BLE2902();
+  coinChar->addDescriptor(coinCccd);
 
-  // 指令 Write
-  cmdChar = service->createCharacteristic(CHAR_CMD_UUID, BLECharacteristic::PROPERTY_WRITE);
+  // 指令 Write/Write Without Response（光栅分片按应答窗口流控，可用无应答写入提高吞吐）
+  cmdChar = service->createCharacteristic(CHAR_CMD_UUID, BLECharacteristic::PROPERTY_WRITE |
+                                                         BLECharacteristic::PROPERTY_WRITE_NR);
   cmdChar->setCallbacks(new CmdCallbacks());
 
   // 事件 Notify
   statusChar = service->createCharacteristic(CHAR_STATUS_UUID, BLECharacteristic::PROPERTY_NOTIFY);
-  statusChar->addDescriptor(new BLE2902());
+  BLE2902* statusCccd = new BLE2902();
+  statusChar->addDescriptor(statusCccd);
+
+  // 固件升级 Write/Write Without Response + Notify 应答；写入与订阅都要求 MITM 加密配对（静态配对码），
+  // 其余特征不受影响：App 首次访问升级特征时系统弹出配对，输入 OTA_PAIRING_PIN 后绑定。运维角色同样以此配对为前提
+  BLESecurity* security = new BLESecurity();
+  security->setStaticPIN(OTA_PAIRING_PIN);
+  security->setAuthenticationMode(ESP_LE_AUTH_REQ_SC_MITM_BOND);  // 静态配对码须走带 MITM 的口令输入
+  otaChar = service->createCharacteristic(CHAR_OTA_UUID, BLECharacteristic::PROPERTY_WRITE |
+                                                         BLECharacteristic::PROPERTY_WRITE_NR |
+                                                         BLECharacteristic::PROPERTY_NOTIFY);
+  otaChar->setAccessPermissions(ESP_GATT_PERM_WRITE_ENC_MITM);
+  BLE2902* otaCccd = new BLE2902();
+  otaCccd->setAccessPermissions(ESP_GATT_PERM_READ_ENC_MITM | ESP_GATT_PERM_WRITE_ENC_MITM);
+  otaChar->addDescriptor(otaCccd);
+  otaChar->setCallbacks(new OtaCallbacks());
 
   service->start();
+  coinCccdHandle   = coinCccd->getHandle();
+  statusCccdHandle = statusCccd->getHandle();
 
   BLEAdvertising* adv = BLEDevice::getAdvertising();
   adv->addServiceUUID(SERVICE_UUID);
@@ -373,7 +1141,8 @@ void setup() {
     Serial.println("[PRN] Testing library print...");
     
     int result = printer->text()
-      ->utf8_text((uint8_t*)"[Printer] Ready")
+      ->encoding(ENCODING_CP936)
+      ->add_raw(const_cast<uint8_t*>(kPrinterReady.bytes))
       ->newline()
       ->print();
     
@@ -391,20 +1160,112 @@ void setup() {
   Serial.println("[PRN] initialized on UART2 115200");
 }
 
-void loop() {
-  // 主要由中断与BLE回调驱动
-  // 周期性诊断输出
+// ==== 诊断（Arduino loop 任务） ====
+// 投币、吐币完成、连接变化时唤醒 loop() 输出一行；空闲时每 DIAG_IDLE_INTERVAL_MS 一行
+static void requestDiag() {
+  if (loopTaskHandle) xTaskNotifyGive(loopTaskHandle);
+}
+
+static void printDiag() {
+  stayAwake(AWAKE_DIAG);
   const uint32_t nowMs = millis();
-  if (nowMs - lastDebugMs >= 1000) {
-    lastDebugMs = nowMs;
-    int pinCoinIn = digitalRead(PIN_COIN_ACCEPTOR);
-    int pinOutSensor = -1;
-    Serial.print("[DBG] t="); Serial.print(nowMs);
-    Serial.print("ms, BLE="); Serial.print(bleConnected ? "ON" : "OFF");
-    Serial.print(", coinTotal="); Serial.print(coinTotal);
-    Serial.print(", dispensed(time-based)");
-    Serial.print(", IN14="); Serial.print(pinCoinIn);
-    Serial.print(", OUT27="); Serial.println(pinOutSensor);
-  }
-  delay(20);
-}
\ No newline at end of file
+  lastDebugMs = nowMs;
+  portENTER_CRITICAL(&awakeMux);
+  const AwakeReport power = awakeMeter.take((uint64_t)esp_timer_get_time());
+  portEXIT_CRITICAL(&awakeMux);
+
+  const PayoutTiming& payoutTiming = coinBox.payoutTiming();
+
+  int pinCoinIn = digitalRead(PIN_COIN_ACCEPTOR);
+  int pinOutSensor = -1;
+  Serial.print("[DBG] t="); Serial.print(nowMs);
+  portENTER_CRITICAL(&clientsMux);
+  const uint8_t bleClients = clients.count();
+  const uint16_t bleOwner = clients.owner();
+  portEXIT_CRITICAL(&clientsMux);
+  Serial.print("ms, BLE="); Serial.print(bleClients); Serial.print("/"); Serial.print(BLE_MAX_CONNECTIONS);
+  if (bleOwner != CLIENT_NONE) { Serial.print(", owner="); Serial.print(bleOwner); }
+  Serial.print(", coinTotal="); Serial.print(coinBox.coinTotal());
+  Serial.print(", coinValue="); Serial.print(coinBox.coinValue());
+  Serial.print(", pulseDrops="); Serial.print(pulseRing.dropped());
+  Serial.print(", payoutRuns="); Serial.print(payoutTiming.runs);
+  if (payoutTiming.runs) {
+    Serial.print(", payoutErrUs(min/avgAbs/max)="); Serial.print(payoutTiming.minErrUs);
+    Serial.print("/"); Serial.print((uint32_t)(payoutTiming.sumAbsErrUs / payoutTiming.runs));
+    Serial.print("/"); Serial.print(payoutTiming.maxErrUs);
+  }
+#if CAPTURE_ENABLE
+  Serial.print(", capDrops="); Serial.print(sessionLog.dropped());
+#endif
+  const RasterStats& raster = coinBox.rasterStats();
+  if (raster.starts || raster.qrCodes) {
+    Serial.print(", raster(img/qr/gap/abort)="); Serial.print(raster.images);
+    Serial.print("/"); Serial.print(raster.qrCodes);
+    Serial.print("/"); Serial.print(raster.gaps);
+    Serial.print("/"); Serial.print(raster.aborted);
+    Serial.print(", rasterBytes(in/out)="); Serial.print(raster.bytesIn);
+    Serial.print("/"); Serial.print(raster.bytesOut);
+  }
+  if (otaReceiver.state() != OTA_STATE_IDLE) {
+    Serial.print(", ota="); Serial.print(otaReceiver.state());
+    Serial.print(":"); Serial.print(otaReceiver.streamOffset());
+    Serial.print("/"); Serial.print(otaReceiver.header().streamSize);
+  }
+  Serial.print(", IN14="); Serial.print(pinCoinIn);
+  Serial.print(", OUT27="); Serial.println(pinOutSensor);
+
+  // 上一行以来的窗口：唤醒次数、固件持锁占比、各原因持锁时长与模型平均电流（esp_pm 未生效时只标 pm off）
+  Serial.print("[PWR] windowMs="); Serial.print((uint32_t)(power.windowUs / 1000));
+  Serial.print(", wakes="); Serial.print(power.wakes);
+  Serial.print(", awake="); Serial.print(power.windowUs ? 100.0f * power.awakeUs / power.windowUs : 100.0f, 2);
+  Serial.print("%, heldMs(pay/coin/io/prn/diag/ota)=");
+  for (uint8_t i = 0; i < AWAKE_REASON_COUNT; i++) {
+    Serial.print((uint32_t)(power.reasonUs[i] / 1000));
+    if (i + 1 < AWAKE_REASON_COUNT) Serial.print("/");
+  }
+  if (pmActive) {
+    Serial.print(", modelMa="); Serial.println(power.modelMa, 2);
+  } else {
+    Serial.println(", pm off");
+  }
+  Serial.flush();
+  allowSleep(AWAKE_DIAG);
+}
+
+// 录制数据导出为 "[CAP] <hex>" 行（tools/session_replay 直接读取串口日志）
+static void flushCapture() {
+#if CAPTURE_ENABLE
+  uint8_t chunk[CAPTURE_LINE_BYTES];
+  stayAwake(AWAKE_DIAG);
+  for (;;) {
+    portENTER_CRITICAL(&captureMux);
+    const size_t n = sessionLog.read(chunk, sizeof(chunk));
+    portEXIT_CRITICAL(&captureMux);
+    if (!n) break;
+    Serial.print("[CAP] ");
+    for (size_t i = 0; i < n; i++) {
+      if (chunk[i] < 0x10) Serial.print("0");
+      Serial.print(chunk[i], HEX);
+    }
+    Serial.println();
+  }
+  Serial.flush();
+  allowSleep(AWAKE_DIAG);
+#endif
+}
+
+// 事件驱动：无事件时阻塞在任务通知上，不再周期轮询；DFS/浅睡由 esp_pm 在空闲时自动进入
+void loop() {
+  uint32_t waitMs = DIAG_IDLE_INTERVAL_MS;
+  if (otaTrial) {
+    const uint32_t nowMs = millis();
+    const uint32_t dueMs = nowMs < OTA_SELF_CHECK_MS ? OTA_SELF_CHECK_MS - nowMs : 0;
+    if (dueMs < waitMs) waitMs = dueMs;
+  }
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+  const uint32_t sinceMs = millis() - lastDebugMs;
+  if (sinceMs < DIAG_MIN_INTERVAL_MS) vTaskDelay(pdMS_TO_TICKS(DIAG_MIN_INTERVAL_MS - sinceMs));
+  printDiag();
+  flushCapture();
+  otaFinishTrial();
+}
@@ -0,0 +1,282 @@
+// 投币脉冲解码自检：按投币器输出波形生成上升沿（多脉冲串 + 触点抖动），经 ISR 同款去抖、环形缓冲与
+// CoinPulseDecoder 分组，比对识别出的币种、面值、时间戳与上报时刻（include/coin_pulse.h）
+// 用法：
+//   coin_pulse [-n 随机币数] [-s 种子]
+//
+// 上报时刻按固件 I/O 任务的等待方式计算：每个沿送入解码器后，按 usUntilDue() 睡到期再 poll()，
+// 因此每枚币在最后一个脉冲之后 COIN_TRAIN_GAP_US 才上报；脉冲数达到面值表最大值的币在末脉冲送入时即上报。
+// 任一检查失败时退出码为 1。
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "coin_pulse.h"
+#include "config.h"
+
+static int failures = 0;
+
+static void check(const char* name, bool ok, const std::string& detail) {
+  printf("%-28s %s  %s\n", name, ok ? "PASS" : "FAIL", detail.c_str());
+  failures += !ok;
+}
+
+static std::string fmt(const char* f, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, f);
+  vsnprintf(buf, sizeof(buf), f, ap);
+  va_end(ap);
+  return buf;
+}
+
+// 测试用面值表（固件默认只有 1 脉冲）；4 脉冲故意不列出
+static const CoinDenomination kTable[] = { { 1, 1 }, { 2, 5 }, { 3, 10 }, { 5, 25 }, { 10, 100 } };
+static const uint8_t kTableLen = sizeof(kTable) / sizeof(kTable[0]);
+static const uint8_t kMaxPulses = 10;  // kTable 中最长的脉冲串
+
+// 期望的一枚币
+struct Coin {
+  uint8_t  pulses;
+  uint32_t firstUs;
+  uint32_t lastUs;
+};
+
+// 识别结果：解码器输出与上报时刻
+struct Reported {
+  DecodedCoin coin;
+  uint32_t    atUs;
+};
+
+// 投币器波形：每枚币 pulses 个上升沿，周期 periodUs；bounce 时每个沿后跟 1–3 个抖动沿（< 去抖窗口）
+static void addTrain(std::vector<uint32_t>& edges, std::vector<Coin>& want, uint32_t startUs, uint8_t pulses,
+                     uint32_t periodUs, std::mt19937* bounce) {
+  for (uint8_t i = 0; i < pulses; i++) {
+    const uint32_t t = startUs + i * periodUs;
+    edges.push_back(t);
+    if (!bounce) continue;
+    std::uniform_int_distribution<uint32_t> count(1, 3), after(50, COIN_ACCEPTOR_DEBOUNCE_US - 1);
+    uint32_t prev = 0;
+    for (uint32_t k = count(*bounce); k; k--) {
+      const uint32_t d = std::max(prev + 1, after(*bounce));
+      if (d >= COIN_ACCEPTOR_DEBOUNCE_US) break;
+      edges.push_back(t + d);
+      prev = d;
+    }
+  }
+  want.push_back({ pulses, startUs, startUs + (pulses - 1) * periodUs });
+}
+
+// 固件路径：ISR（去抖 + 入环）→ I/O 任务（出环 feed，空闲时睡到 usUntilDue 再 poll）
+static std::vector<Reported> runFirmware(const std::vector<uint32_t>& edges, bool debounce, uint32_t* dropped) {
+  PulseDebounce filter(COIN_ACCEPTOR_DEBOUNCE_US);
+  PulseRing<COIN_PULSE_RING_SIZE> ring;
+  CoinPulseDecoder decoder(kTable, kTableLen, COIN_TRAIN_GAP_US);
+  std::vector<Reported> out;
+  DecodedCoin coin;
+  uint32_t nowUs = edges.empty() ? 0 : edges[0];
+  // 下一个沿到来前已到期的脉冲串由定时唤醒上报（last：之后没有沿）
+  auto sleepUntil = [&](uint32_t nextEdgeUs, bool last) {
+    if (!decoder.pending()) return;
+    const uint32_t wake = nowUs + decoder.usUntilDue(nowUs);
+    if (!last && (int32_t)(wake - nextEdgeUs) >= 0) return;
+    if (decoder.poll(wake, coin)) out.push_back({ coin, wake });
+  };
+  for (const uint32_t t : edges) {
+    sleepUntil(t, false);
+    nowUs = t;
+    if (debounce && !filter.accept(t)) continue;
+    ring.push(t);
+    uint32_t ts;
+    while (ring.pop(ts)) {
+      if (decoder.feed(ts, coin)) out.push_back({ coin, ts });
+    }
+  }
+  sleepUntil(0, true);
+  if (dropped) *dropped = ring.dropped();
+  return out;
+}
+
+static uint16_t valueOf(uint8_t pulses, bool* known) {
+  for (uint8_t i = 0; i < kTableLen; i++) {
+    if (kTable[i].pulses == pulses) {
+      *known = true;
+      return kTable[i].value;
+    }
+  }
+  *known = false;
+  return pulses;
+}
+
+// 逐枚比对：脉冲数、面值、首末时间戳；上报时刻 = 末脉冲 + 分组间隔 + 1us（最长的脉冲串 = 末脉冲）
+static bool matches(const std::vector<Reported>& got, const std::vector<Coin>& want, std::string& why) {
+  if (got.size() != want.size()) {
+    why = fmt("%zu coins, want %zu", got.size(), want.size());
+    return false;
+  }
+  for (size_t i = 0; i < want.size(); i++) {
+    const DecodedCoin& c = got[i].coin;
+    bool known;
+    const uint16_t value = valueOf(want[i].pulses, &known);
+    if (c.pulses != want[i].pulses || c.value != value || c.known != known || c.firstUs != want[i].firstUs ||
+        c.lastUs != want[i].lastUs ||
+        got[i].atUs != want[i].lastUs + (want[i].pulses == kMaxPulses ? 0 : COIN_TRAIN_GAP_US + 1)) {
+      why = fmt("coin %zu: %u pulses value %u at +%u us, want %u pulses value %u", i, c.pulses, c.value,
+                got[i].atUs - c.lastUs, want[i].pulses, value);
+      return false;
+    }
+  }
+  why = fmt("%zu coins", want.size());
+  return true;
+}
+
+int main(int argc, char** argv) {
+  int randomCoins = 2000;
+  uint32_t seed   = 1;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      randomCoins = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      seed = (uint32_t)strtoul(argv[++i], nullptr, 0);
+    } else {
+      fprintf(stderr, "usage: coin_pulse [-n random_coins] [-s seed]\n");
+      return 2;
+    }
+  }
+  printf("debounce %u us, train gap %u us, ring %u\n\n", COIN_ACCEPTOR_DEBOUNCE_US, COIN_TRAIN_GAP_US,
+         COIN_PULSE_RING_SIZE);
+  std::string why;
+
+  // 各面值的多脉冲串，币间隔恰好大于分组间隔
+  {
+    std::vector<uint32_t> edges;
+    std::vector<Coin> want;
+    uint32_t t = 1000000;
+    for (uint8_t pulses : { 1, 2, 3, 4, 5, 10 }) {
+      addTrain(edges, want, t, pulses, 50000, nullptr);
+      t = want.back().lastUs + COIN_TRAIN_GAP_US + 1;
+    }
+    const bool ok = matches(runFirmware(edges, true, nullptr), want, why);
+    check("multi-pulse trains", ok, why);
+  }
+
+  // 分组边界：脉冲间隔 = gap 仍属同一枚，gap + 1 拆成两枚
+  {
+    std::vector<uint32_t> edges;
+    std::vector<Coin> want;
+    addTrain(edges, want, 1000000, 3, COIN_TRAIN_GAP_US, nullptr);
+    const std::vector<Reported> same = runFirmware(edges, true, nullptr);
+    edges.clear();
+    want.clear();
+    addTrain(edges, want, 1000000, 1, 0, nullptr);
+    addTrain(edges, want, 1000000 + COIN_TRAIN_GAP_US + 1, 1, 0, nullptr);
+    const bool split = matches(runFirmware(edges, true, nullptr), want, why);
+    check("gap boundary", same.size() == 1 && same[0].coin.pulses == 3 && split,
+          fmt("period = gap -> %zu coin(s); gap + 1 -> %s", same.size(), why.c_str()));
+  }
+
+  // 触点抖动：去抖后与无抖动结果一致；不去抖时多计脉冲（说明本用例确实产生了抖动）
+  {
+    std::mt19937 rng(seed);
+    std::vector<uint32_t> edges;
+    std::vector<Coin> want;
+    uint32_t t = 1000000;
+    for (uint8_t pulses : { 1, 2, 3, 5, 10, 2, 1 }) {
+      addTrain(edges, want, t, pulses, 3 * COIN_ACCEPTOR_DEBOUNCE_US, &rng);
+      t = want.back().lastUs + COIN_TRAIN_GAP_US + COIN_ACCEPTOR_DEBOUNCE_US;
+    }
+    const std::vector<Reported> raw = runFirmware(edges, false, nullptr);
+    uint32_t rawPulses = 0, wantPulses = 0;
+    for (const Reported& r : raw) rawPulses += r.coin.pulses;
+    for (const Coin& c : want) wantPulses += c.pulses;
+    const bool ok = matches(runFirmware(edges, true, nullptr), want, why);
+    check("bounce filtered", ok && rawPulses > wantPulses,
+          fmt("%s; %zu edges, %u pulses without debounce vs %u", why.c_str(), edges.size(), rawPulses, wantPulses));
+  }
+
+  // micros() 约 71.6 分钟回绕：跨回绕的脉冲串与上报时刻
+  {
+    std::vector<uint32_t> edges;
+    std::vector<Coin> want;
+    addTrain(edges, want, UINT32_MAX - 60000, 3, 50000, nullptr);
+    addTrain(edges, want, want.back().lastUs + COIN_TRAIN_GAP_US + 1, 2, 50000, nullptr);
+    const bool ok = matches(runFirmware(edges, true, nullptr), want, why);
+    check("micros wrap", ok, why);
+  }
+
+  // 上报时延：末脉冲后 gap 内不结束，gap + 1us 结束
+  {
+    CoinPulseDecoder decoder(kTable, kTableLen, COIN_TRAIN_GAP_US);
+    DecodedCoin coin;
+    decoder.feed(0, coin);
+    decoder.feed(40000, coin);
+    const uint32_t due = decoder.usUntilDue(40000);
+    const bool early = decoder.poll(40000 + COIN_TRAIN_GAP_US, coin);
+    const bool onTime = decoder.poll(40000 + COIN_TRAIN_GAP_US + 1, coin);
+    check("report latency", due == COIN_TRAIN_GAP_US + 1 && !early && onTime && coin.pulses == 2 && coin.value == 5 &&
+                                !decoder.pending() && decoder.usUntilDue(0) == UINT32_MAX,
+          fmt("reported %u us after the last pulse", due));
+  }
+
+  // 最长的脉冲串不等分组间隔；只有 1 脉冲面值（固件默认表）时每个脉冲即一枚币，紧挨着的脉冲也不合并
+  {
+    CoinPulseDecoder decoder(kTable, kTableLen, COIN_TRAIN_GAP_US);
+    DecodedCoin coin;
+    bool early = false;
+    for (uint32_t i = 0; i < kMaxPulses - 1; i++) early |= decoder.feed(i * 20000, coin);
+    const bool atLast = decoder.feed((kMaxPulses - 1) * 20000, coin);
+    const bool longest = !early && atLast && coin.pulses == kMaxPulses && coin.value == 100 && !decoder.pending();
+
+    static const CoinDenomination kSingle[] = { { 1, 1 } };
+    CoinPulseDecoder single(kSingle, 1, COIN_TRAIN_GAP_US);
+    DecodedCoin a, b;
+    const bool first  = single.feed(0, a);
+    const bool second = single.feed(COIN_ACCEPTOR_DEBOUNCE_US, b);
+    check("longest train at once",
+          longest && first && second && a.pulses == 1 && b.pulses == 1 && b.firstUs == COIN_ACCEPTOR_DEBOUNCE_US &&
+              !single.pending() && single.usUntilDue(0) == UINT32_MAX,
+          fmt("%u pulses reported on the last pulse; {1,1} table: two coins %u us apart", coin.pulses,
+              COIN_ACCEPTOR_DEBOUNCE_US));
+  }
+
+  // 环形缓冲：满时丢弃并计数，不覆盖未取出的时间戳
+  {
+    PulseRing<8> ring;
+    bool pushed = true;
+    for (uint32_t i = 0; i < 8; i++) pushed &= ring.push(i);
+    const bool full = !ring.push(99);
+    uint32_t ts, expect = 0;
+    bool order = true;
+    while (ring.pop(ts)) order &= ts == expect++;
+    check("ring overflow", pushed && full && order && expect == 8 && ring.dropped() == 1,
+          fmt("%u popped, %u dropped", expect, ring.dropped()));
+  }
+
+  // 随机：面值、脉冲周期（去抖窗口的 2 倍到 gap）、抖动与币间隔（> gap）随机
+  {
+    std::mt19937 rng(seed ^ 0x9E3779B9u);
+    std::uniform_int_distribution<int> pick(0, kTableLen);
+    std::uniform_int_distribution<uint32_t> period(2 * COIN_ACCEPTOR_DEBOUNCE_US, COIN_TRAIN_GAP_US);
+    std::uniform_int_distribution<uint32_t> idle(COIN_TRAIN_GAP_US + COIN_ACCEPTOR_DEBOUNCE_US, 4 * COIN_TRAIN_GAP_US);
+    std::vector<uint32_t> edges;
+    std::vector<Coin> want;
+    uint32_t t = 0xFFF00000u;  // 中途经过 micros() 回绕
+    for (int i = 0; i < randomCoins; i++) {
+      const int k = pick(rng);
+      const uint8_t pulses = k < kTableLen ? kTable[k].pulses : 4;
+      addTrain(edges, want, t, pulses, period(rng), &rng);
+      t = want.back().lastUs + idle(rng);
+    }
+    uint32_t dropped = 0;
+    const bool ok = matches(runFirmware(edges, true, &dropped), want, why);
+    check("random trains", ok && dropped == 0,
+          fmt("%s, seed %u, %u dropped", why.c_str(), seed, dropped));
+  }
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,1073 @@
+// 虚拟投币盒农场：一个进程内运行 N 台投币盒（include/coinbox_core.h，与固件同一份逻辑），
+// 每台在本地 UNIX/TCP 套接字上提供 coin/cmd/status 三个通道，按脚本投币、驱动打印机，并统计指令时延
+// 用法：coinbox_farm [-n 台数] [-j 线程数] [-t 秒] [-u 目录 | -p 起始端口] [-s 脚本] [-c 0|1] [-i ping 间隔 ms]
+//                     [-r 录制目录] [-q] [-v]
+//   -r：每台按 include/session_log.h 格式写 box-<i>.cblg，可用 tools/session_replay 重放比对
+//   默认 -n 64 -j <CPU 数> -t 10 -u /tmp/coinbox_farm.<pid> -c 1 -i 100
+//
+// 套接字帧（两个方向相同）：[负载长度 u16 LE][通道 u8][负载]
+//   通道 0x03 = cmd（负载即 BLE 写入的指令帧），0x02 = coin / 0x04 = status（负载即 BLE 通知）
+//   每台同时只接受一个连接（与 BLE 单连接一致），新连接顶替旧连接；断开时会话保留，可用 CMD_RESUME 续传
+// 调度：每个线程一个 epoll 事件循环，投币盒按编号静态分片（i % 线程数）；timerfd 定到分片内最早的
+//   吐币截止 / 脉冲串判定 / 脚本事件。同一台的全部逻辑只在一个线程上运行，核心逻辑无需加锁
+//
+// 脚本（每行一条，# 开头为注释）：<起始 ms>[/<周期 ms>[x<次数>]] <编号|*> <动作> [参数]
+//   coin <脉冲数>                   投币器送出一枚币的脉冲串（脉冲间隔 COIN_PULSE_SPACING_US；不超过面值表最长的脉冲串）
+//   printer <波特率>|offline|online  打印机速率；脱机时写入的字节丢弃并计数
+//   payout <面值>                   客户端发送 CMD_PAYOUT
+//   receipt <文本>                  客户端发送 CMD_PRINT_RECEIPT（文本中 \n 为换行）
+//   reconnect                       客户端断开后立即重连，重新协商事件格式并 CMD_RESUME
+// 各台的时间线按编号错开 0–1 s；-t 到期后停止脚本与 ping，再留 kDrainUs 让未完成的币/吐币上报完。
+// 内置客户端（-c 1）经真实套接字连接每一台，按 -i 间隔发送 CMD_TIME_PING 统计往返时延，并核对
+// 投入枚数 = 客户端收到的枚数 = 设备计数；-c 0 只提供套接字供外部客户端连接（-t 0 一直运行）。
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "coinbox_core.h"
+#include "session_log.h"
+
+#define COIN_PULSE_SPACING_US       50000   // 同一枚币内的脉冲间隔（小于 COIN_TRAIN_GAP_US）
+#define FARM_FRAME_HEADER           3
+#define FARM_CHANNEL_CMD            0x03    // 与特征 UUID 末段一致（coin/status 见 EVENT_KIND_*）
+
+static const uint64_t kSettleUs = 500000;    // 客户端建连、开启会话后脚本才开始
+static const uint64_t kDrainUs  = 2000000;   // 脚本结束后的收尾时间
+
+static const char* const kDefaultScript =
+    "0/700      *  coin 1\n"
+    "1000/2500  *  payout 2\n"
+    "2000/6000  *  receipt 交易小票\\n币种: ETHUSDT 以太坊\\n收益率: +18.95%\\n吐币数量: 2\n"
+    "3000/4000  *  reconnect\n"
+    "5000       *  printer 9600\n";
+
+// ==== 公共 ====
+static uint64_t gStartNs = 0;
+
+static uint64_t monoUs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec - gStartNs) / 1000;
+}
+
+static std::atomic<bool> gStop(false);
+static uint64_t gScriptEndUs = UINT64_MAX;  // 之后不再触发脚本与 ping
+static bool gVerbose = false;
+
+static void setNonBlocking(int fd) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+
+// 把 us 级绝对时刻设到 timerfd（0 = 尽快）
+static void armTimer(int tfd, uint64_t atUs) {
+  itimerspec its = {};
+  const uint64_t ns = gStartNs + atUs * 1000;
+  its.it_value.tv_sec  = (time_t)(ns / 1000000000ull);
+  its.it_value.tv_nsec = (long)(ns % 1000000000ull);
+  if (!its.it_value.tv_sec && !its.it_value.tv_nsec) its.it_value.tv_nsec = 1;
+  timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, nullptr);
+}
+
+static void appendFrame(std::string& out, uint8_t channel, const uint8_t* data, size_t len) {
+  const uint8_t hdr[FARM_FRAME_HEADER] = { (uint8_t)len, (uint8_t)(len >> 8), channel };
+  out.append(reinterpret_cast<const char*>(hdr), sizeof(hdr));
+  out.append(reinterpret_cast<const char*>(data), len);
+}
+
+// 写出缓冲；返回 false 表示连接已断
+static bool flushOut(int fd, std::string& out) {
+  while (!out.empty()) {
+    const ssize_t n = send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+    if (n > 0) {
+      out.erase(0, (size_t)n);
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// 读入缓冲；返回 false 表示对端关闭或出错
+static bool readIn(int fd, std::string& in) {
+  char buf[4096];
+  for (;;) {
+    const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+      in.append(buf, (size_t)n);
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    } else {
+      return false;
+    }
+  }
+}
+
+// 从缓冲取出一帧
+static bool takeFrame(std::string& in, uint8_t& channel, std::string& payload) {
+  if (in.size() < FARM_FRAME_HEADER) return false;
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(in.data());
+  const size_t len = getLe16(p);
+  if (in.size() < FARM_FRAME_HEADER + len) return false;
+  channel = p[2];
+  payload.assign(in, FARM_FRAME_HEADER, len);
+  in.erase(0, FARM_FRAME_HEADER + len);
+  return true;
+}
+
+// ==== 脚本 ====
+enum ActionKind : uint8_t { ACT_COIN, ACT_PRINTER, ACT_PAYOUT, ACT_RECEIPT, ACT_RECONNECT };
+
+struct Action {
+  uint64_t    startUs;
+  uint64_t    periodUs;   // 0 = 只触发一次
+  uint32_t    count;      // 0 = 不限次数（有周期时）
+  int         target;     // -1 = 全部
+  ActionKind  kind;
+  uint32_t    arg;        // 脉冲数 / 波特率（0 = 脱机，1 = 恢复）/ 面值
+  std::string text;
+};
+
+static bool boxSide(ActionKind k) { return k == ACT_COIN || k == ACT_PRINTER; }
+
+static const CoinDenomination kDenominations[] = COIN_DENOMINATIONS;
+
+// 解码器在面值表最长的脉冲串处立即结束一枚币，更长的脉冲串会被拆开，投币器不会发出
+static uint32_t longestTrain() {
+  uint32_t n = 0;
+  for (const CoinDenomination& d : kDenominations) n = std::max<uint32_t>(n, d.pulses);
+  return n;
+}
+
+static bool parseScript(const std::string& src, std::vector<Action>& out) {
+  size_t pos = 0;
+  int lineNo = 0;
+  while (pos < src.size()) {
+    size_t end = src.find('\n', pos);
+    if (end == std::string::npos) end = src.size();
+    std::string line = src.substr(pos, end - pos);
+    pos = end + 1;
+    lineNo++;
+    const size_t hash = line.find('#');
+    if (hash != std::string::npos) line.erase(hash);
+
+    char when[64], target[16], verb[16];
+    int used = 0;
+    if (sscanf(line.c_str(), " %63s %15s %15s %n", when, target, verb, &used) < 3) {
+      if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+      fprintf(stderr, "script line %d: expected <ms>[/<period>[x<n>]] <box|*> <action>\n", lineNo);
+      return false;
+    }
+    std::string rest = line.substr((size_t)used);
+    while (!rest.empty() && (rest.back() == '\r' || rest.back() == ' ')) rest.pop_back();
+
+    Action a = {};
+    char* p = when;
+    a.startUs = strtoull(p, &p, 10) * 1000;
+    if (*p == '/') a.periodUs = strtoull(p + 1, &p, 10) * 1000;
+    if (*p == 'x') a.count = (uint32_t)strtoul(p + 1, &p, 10);
+    a.target = strcmp(target, "*") ? atoi(target) : -1;
+
+    if (!strcmp(verb, "coin")) {
+      a.kind = ACT_COIN;
+      a.arg  = rest.empty() ? 1 : (uint32_t)atoi(rest.c_str());
+      if (a.arg < 1 || a.arg > longestTrain()) {
+        fprintf(stderr, "script line %d: coin takes 1..%u pulses (longest train in COIN_DENOMINATIONS)\n", lineNo,
+                longestTrain());
+        return false;
+      }
+    } else if (!strcmp(verb, "printer")) {
+      a.kind = ACT_PRINTER;
+      a.arg  = rest == "offline" ? 0 : rest == "online" ? 1 : (uint32_t)atoi(rest.c_str());
+    } else if (!strcmp(verb, "payout")) {
+      a.kind = ACT_PAYOUT;
+      a.arg  = (uint32_t)atoi(rest.c_str());
+    } else if (!strcmp(verb, "receipt")) {
+      a.kind = ACT_RECEIPT;
+      for (size_t i = 0; i < rest.size(); i++) {
+        if (rest[i] == '\\' && i + 1 < rest.size() && rest[i + 1] == 'n') {
+          a.text += '\n';
+          i++;
+        } else {
+          a.text += rest[i];
+        }
+      }
+    } else if (!strcmp(verb, "reconnect")) {
+      a.kind = ACT_RECONNECT;
+    } else {
+      fprintf(stderr, "script line %d: unknown action '%s'\n", lineNo, verb);
+      return false;
+    }
+    out.push_back(a);
+  }
+  return true;
+}
+
+// 单台（或单个客户端）的时间线：每条动作的下次触发时刻与剩余次数
+class Timeline {
+ public:
+  void init(const std::vector<Action>& all, int id, bool wantBoxSide, uint64_t offsetUs) {
+    for (const Action& a : all) {
+      if (boxSide(a.kind) != wantBoxSide || (a.target >= 0 && a.target != id)) continue;
+      entries_.push_back({ &a, kSettleUs + offsetUs + a.startUs, a.periodUs && !a.count ? UINT32_MAX : std::max(a.count, 1u) });
+    }
+  }
+
+  uint64_t nextUs() const {
+    uint64_t t = UINT64_MAX;
+    for (const Entry& e : entries_) {
+      if (e.remaining && e.dueUs < gScriptEndUs) t = std::min(t, e.dueUs);
+    }
+    return t;
+  }
+
+  // 依次取出到期的动作（一次一条），并安排下次触发
+  const Action* take(uint64_t nowUs, uint64_t& dueUs) {
+    for (Entry& e : entries_) {
+      if (!e.remaining || e.dueUs > nowUs || e.dueUs >= gScriptEndUs) continue;
+      dueUs = e.dueUs;
+      if (e.remaining != UINT32_MAX) e.remaining--;
+      e.dueUs += e.action->periodUs;
+      if (!e.action->periodUs) e.remaining = 0;
+      return e.action;
+    }
+    return nullptr;
+  }
+
+ private:
+  struct Entry {
+    const Action* action;
+    uint64_t      dueUs;
+    uint32_t      remaining;
+  };
+  std::vector<Entry> entries_;
+};
+
+static uint64_t staggerUs(int id) { return (uint64_t)(id * 37 % 1000) * 1000; }
+
+// ==== 虚拟投币盒 ====
+static const HopperSpec kHoppers[] = HOPPERS;
+
+// 打印机：按波特率（8N1，每字节 10 位）累计打印耗时
+struct VirtualPrinter {
+  uint32_t baud        = PRINTER_UART_BAUD;
+  bool     online      = true;
+  uint64_t bytes       = 0;
+  uint64_t dropped     = 0;
+  uint64_t busyUntilUs = 0;
+  uint64_t busyUs      = 0;
+
+  void write(uint64_t nowUs, size_t len) {
+    if (!online) {
+      dropped += len;
+      return;
+    }
+    const uint64_t txUs = (uint64_t)len * 10 * 1000000 / baud;
+    busyUntilUs = std::max(busyUntilUs, nowUs) + txUs;
+    busyUs += txUs;
+    bytes  += len;
+  }
+};
+
+class VirtualBox : public CoinBoxPlatform {
+ public:
+  explicit VirtualBox(int id)
+      : id_(id),
+        rng_(0x9E3779B9u * (uint32_t)(id + 1)),
+        core_(*this, kHoppers, HOPPER_COUNT, kDenominations, sizeof(kDenominations) / sizeof(kDenominations[0])) {}
+
+  // ---- CoinBoxPlatform ----
+  uint64_t nowUs() override { return monoUs(); }
+
+  void notify(uint8_t kind, const uint8_t* data, size_t len) override {
+    if (log_) log_->notify(monoUs(), kind, data, len);
+    if (clientFd_ < 0) {
+      notifyDropped_++;
+      return;
+    }
+    appendFrame(out_, kind, data, len);
+    notifies_++;
+  }
+
+  void setRelay(uint8_t hopper, bool on) override {
+    if (log_) log_->relay(monoUs(), hopper, on);
+    relaySwitches_++;
+  }
+
+  void printerWrite(const uint8_t* data, size_t len) override {
+    if (log_) log_->uart(monoUs(), UART_SOURCE_CORE, data, len);
+    printer_.write(monoUs(), len);
+  }
+
+  uint32_t random32() override {
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 17;
+    rng_ ^= rng_ << 5;
+    if (log_) log_->random(monoUs(), rng_);
+    return rng_;
+  }
+
+  uint16_t peerMtu(uint16_t) override {
+    const uint16_t mtu = 185;  // iOS 常见协商值
+    if (log_) log_->mtu(monoUs(), mtu);
+    return mtu;
+  }
+  void discardPendingPulses() override { pulses_.clear(); }
+
+  void vlog(const char* fmt, va_list ap) override {
+    if (!gVerbose) return;
+    char line[200];
+    vsnprintf(line, sizeof(line), fmt, ap);
+    fprintf(stderr, "[box %d] %s\n", id_, line);
+  }
+
+  // ---- 农场 ----
+  int  id() const { return id_; }
+  int  listenFd() const { return listenFd_; }
+  int  clientFd() const { return clientFd_; }
+  void setListenFd(int fd) { listenFd_ = fd; }
+  void initTimeline(const std::vector<Action>& script) { timeline_.init(script, id_, true, staggerUs(id_)); }
+
+  bool startRecording(const std::string& path) {
+    file_ = fopen(path.c_str(), "wb");
+    if (!file_) return false;
+    log_.reset(new FarmLogWriter);
+    log_->begin(monoUs());
+    drainLog();
+    return true;
+  }
+
+  void stopRecording() {
+    if (!file_) return;
+    drainLog();
+    fclose(file_);
+    file_ = nullptr;
+  }
+  // 新连接顶替旧连接（与 BLE 断开后重连等价）
+  void attach(int fd, int epfd) {
+    if (clientFd_ >= 0) detach(epfd);
+    if (log_) log_->connect(monoUs());
+    clientFd_ = fd;
+    out_.clear();
+    in_.clear();
+    connects_++;
+  }
+
+  void detach(int epfd) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, clientFd_, nullptr);
+    close(clientFd_);
+    clientFd_ = -1;
+    if (log_) log_->disconnect(monoUs());
+    core_.onDisconnect();
+  }
+
+  // 收取并执行指令；连接断开时返回 false
+  bool onReadable() {
+    const bool alive = readIn(clientFd_, in_);
+    uint8_t channel;
+    std::string payload;
+    while (takeFrame(in_, channel, payload)) {
+      const uint64_t rxUs = monoUs();
+      if (channel != FARM_CHANNEL_CMD) continue;
+      if (log_) log_->command(rxUs, reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+      CommandFrame cmd;
+      const CommandError err =
+          decodeCommand(reinterpret_cast<const uint8_t*>(payload.data()), payload.size(), cmd);
+      if (err != CMD_OK) {
+        rejected_++;
+        continue;
+      }
+      commands_++;
+      if (cmd.op == CMD_DEBUG_PRINTER) {
+        static const char kRawTest[] = "RAW TEXT TEST\r\n";
+        if (log_) log_->uart(rxUs, UART_SOURCE_OTHER, reinterpret_cast<const uint8_t*>(kRawTest), sizeof(kRawTest) - 1);
+        printer_.write(rxUs, sizeof(kRawTest) - 1);
+      } else {
+        core_.execute(cmd, (uint32_t)rxUs);
+      }
+    }
+    return alive;
+  }
+
+  // 触发到期脚本、送入到期脉冲、推进吐币；返回连接是否仍可写
+  bool service(uint64_t nowUs) {
+    uint64_t dueUs;
+    while (const Action* a = timeline_.take(nowUs, dueUs)) {
+      if (a->kind == ACT_COIN) {
+        for (uint32_t i = 0; i < a->arg; i++) pulses_.push_back(dueUs + (uint64_t)i * COIN_PULSE_SPACING_US);
+        coinsFed_++;
+      } else if (a->arg == 0) {
+        printer_.online = false;
+      } else if (a->arg == 1) {
+        printer_.online = true;
+      } else {
+        printer_.baud = a->arg;
+      }
+    }
+    while (!pulses_.empty() && pulses_.front() <= nowUs) {
+      if (log_) log_->pulse(pulses_.front());
+      core_.feedPulse((uint32_t)pulses_.front());
+      pulses_.pop_front();
+    }
+    core_.flushCoins();
+    while (core_.servicePayout()) {
+    }
+    if (log_) drainLog();
+    return clientFd_ < 0 || flushOut(clientFd_, out_);
+  }
+
+  bool wantsWrite() const { return !out_.empty(); }
+
+  uint64_t nextWakeUs(uint64_t nowUs) const {
+    uint64_t t = std::min(core_.nextPayoutUs(), timeline_.nextUs());
+    if (!pulses_.empty()) t = std::min(t, pulses_.front());
+    const uint32_t coinDue = core_.coinDueInUs((uint32_t)nowUs);
+    if (coinDue != UINT32_MAX) t = std::min(t, nowUs + coinDue);
+    return t;
+  }
+
+  const CoinBoxCore&    core() const { return core_; }
+  const VirtualPrinter& printer() const { return printer_; }
+  uint32_t coinsFed() const { return coinsFed_; }
+  uint32_t commands() const { return commands_; }
+  uint32_t rejected() const { return rejected_; }
+  uint32_t notifies() const { return notifies_; }
+  uint32_t notifyDropped() const { return notifyDropped_; }
+  uint32_t relaySwitches() const { return relaySwitches_; }
+  uint32_t connects() const { return connects_; }
+
+ private:
+  typedef SessionLogWriter<1 << 16> FarmLogWriter;  // 每次 service() 后写入文件
+
+  void drainLog() {
+    uint8_t chunk[4096];
+    while (size_t n = log_->read(chunk, sizeof(chunk))) fwrite(chunk, 1, n, file_);
+  }
+
+  int id_;
+  uint32_t rng_;
+  CoinBoxCore core_;
+  VirtualPrinter printer_;
+  Timeline timeline_;
+  std::deque<uint64_t> pulses_;
+  int listenFd_ = -1;
+  int clientFd_ = -1;
+  std::string in_, out_;
+  uint32_t coinsFed_ = 0, commands_ = 0, rejected_ = 0, notifies_ = 0, notifyDropped_ = 0;
+  uint32_t relaySwitches_ = 0, connects_ = 0;
+  std::unique_ptr<FarmLogWriter> log_;
+  FILE* file_ = nullptr;
+};
+
+// ==== 套接字 ====
+struct Endpoint {
+  bool        tcp;
+  std::string dir;
+  uint16_t    basePort;
+};
+
+static socklen_t makeAddr(const Endpoint& ep, int id, sockaddr_storage& ss) {
+  memset(&ss, 0, sizeof(ss));
+  if (ep.tcp) {
+    sockaddr_in* in = reinterpret_cast<sockaddr_in*>(&ss);
+    in->sin_family      = AF_INET;
+    in->sin_port        = htons((uint16_t)(ep.basePort + id));
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return sizeof(*in);
+  }
+  sockaddr_un* un = reinterpret_cast<sockaddr_un*>(&ss);
+  un->sun_family = AF_UNIX;
+  snprintf(un->sun_path, sizeof(un->sun_path), "%s/box-%d.sock", ep.dir.c_str(), id);
+  return sizeof(*un);
+}
+
+static int openListener(const Endpoint& ep, int id) {
+  sockaddr_storage ss;
+  const socklen_t len = makeAddr(ep, id, ss);
+  const int fd = socket(ss.ss_family, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  const int one = 1;
+  if (ep.tcp) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (!ep.tcp) unlink(reinterpret_cast<sockaddr_un*>(&ss)->sun_path);
+  if (bind(fd, reinterpret_cast<sockaddr*>(&ss), len) < 0 || listen(fd, 4) < 0) {
+    close(fd);
+    return -1;
+  }
+  setNonBlocking(fd);
+  return fd;
+}
+
+static int connectTo(const Endpoint& ep, int id) {
+  sockaddr_storage ss;
+  const socklen_t len = makeAddr(ep, id, ss);
+  const int fd = socket(ss.ss_family, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, reinterpret_cast<sockaddr*>(&ss), len) < 0) {
+    close(fd);
+    return -1;
+  }
+  const int one = 1;
+  if (ep.tcp) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  setNonBlocking(fd);
+  return fd;
+}
+
+// epoll 用户数据：[编号 << 2 | 类型]
+enum FdKind : uint64_t { FD_TIMER = 0, FD_LISTEN = 1, FD_CONN = 2 };
+static uint64_t tagOf(int id, FdKind kind) { return ((uint64_t)id << 2) | kind; }
+
+struct LoopStats {
+  uint64_t wakes  = 0;
+  uint64_t busyUs = 0;
+};
+
+// ==== 设备侧工作线程 ====
+static void runBoxWorker(std::vector<VirtualBox*> boxes, LoopStats* stats) {
+  const int epfd = epoll_create1(0);
+  const int tfd  = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  epoll_event ev = {};
+  ev.events   = EPOLLIN;
+  ev.data.u64 = tagOf(0, FD_TIMER);
+  epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+  for (size_t i = 0; i < boxes.size(); i++) {
+    ev.data.u64 = tagOf((int)i, FD_LISTEN);
+    epoll_ctl(epfd, EPOLL_CTL_ADD, boxes[i]->listenFd(), &ev);
+  }
+
+  epoll_event events[64];
+  while (!gStop.load(std::memory_order_relaxed)) {
+    uint64_t now = monoUs();
+    uint64_t wake = now + 100000;  // 至少每 100 ms 检查一次停止标志
+    for (VirtualBox* b : boxes) wake = std::min(wake, b->nextWakeUs(now));
+    armTimer(tfd, wake);
+
+    const int n = epoll_wait(epfd, events, 64, -1);
+    const uint64_t t0 = monoUs();
+    stats->wakes++;
+    for (int i = 0; i < n; i++) {
+      const uint64_t tag = events[i].data.u64;
+      VirtualBox* box = boxes[tag >> 2];
+      switch ((FdKind)(tag & 3)) {
+        case FD_TIMER: {
+          uint64_t expirations;
+          if (read(tfd, &expirations, sizeof(expirations)) < 0) {
+          }
+          break;
+        }
+        case FD_LISTEN: {
+          const int fd = accept(box->listenFd(), nullptr, nullptr);
+          if (fd < 0) break;
+          setNonBlocking(fd);
+          box->attach(fd, epfd);
+          epoll_event cev = {};
+          cev.events   = EPOLLIN;
+          cev.data.u64 = tagOf((int)(tag >> 2), FD_CONN);
+          epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &cev);
+          break;
+        }
+        case FD_CONN:
+          // 同一批事件里旧连接可能已被顶替：只在确实读到 EOF 时断开
+          if (box->clientFd() >= 0 && !box->onReadable()) box->detach(epfd);
+          break;
+      }
+    }
+
+    now = monoUs();
+    for (size_t i = 0; i < boxes.size(); i++) {
+      VirtualBox* b = boxes[i];
+      const bool hadOut = b->wantsWrite();
+      if (!b->service(now)) {
+        b->detach(epfd);
+        continue;
+      }
+      if (b->clientFd() >= 0 && hadOut != b->wantsWrite()) {
+        epoll_event cev = {};
+        cev.events   = EPOLLIN | (b->wantsWrite() ? (uint32_t)EPOLLOUT : 0u);
+        cev.data.u64 = tagOf((int)i, FD_CONN);
+        epoll_ctl(epfd, EPOLL_CTL_MOD, b->clientFd(), &cev);
+      }
+    }
+    stats->busyUs += monoUs() - t0;
+  }
+  close(tfd);
+  close(epfd);
+}
+
+// ==== 客户端（模拟 App） ====
+struct ClientStats {
+  std::vector<uint32_t> rttUs;       // CMD_TIME_PING 往返
+  std::vector<uint32_t> payoutMs;    // CMD_PAYOUT → EVT_PAYOUT_REQUEST_DONE（含出币时间）
+  uint32_t pingsSent = 0, payoutsSent = 0, payoutsDone = 0, receipts = 0;
+  uint32_t resumes[4] = {};          // RESUME_STATUS_OK / PARTIAL / UNKNOWN / MTU
+  uint16_t coinTotal = 0;            // 最新一次 coin 通知 / 续传快照
+  bool     capsOk = false;
+};
+
+class Client {
+ public:
+  Client(int id, const Endpoint& ep, const std::vector<Action>& script, uint64_t pingUs)
+      : id_(id), ep_(ep), pingUs_(pingUs) {
+    timeline_.init(script, id, false, staggerUs(id));
+    nextPingUs_ = kSettleUs + (pingUs ? (uint64_t)id * 997 % pingUs : 0);
+  }
+
+  int fd() const { return fd_; }
+
+  bool connect(bool resume) {
+    for (int attempt = 0; attempt < 200 && fd_ < 0; attempt++) {
+      fd_ = connectTo(ep_, id_);
+      if (fd_ < 0) usleep(5000);
+    }
+    if (fd_ < 0) return false;
+    in_.clear();
+    sendCmd(CMD_SET_EVENT_FORMAT, EVENT_FORMAT_EXTENDED);
+    if (resume) {
+      uint8_t frame[7] = { CMD_RESUME };
+      putLe32(frame + 1, sessionId_);
+      putLe16(frame + 5, lastSeq_);
+      sendRaw(frame, sizeof(frame));
+    } else {
+      sendRaw(&kGetCaps, 1);
+      sendRaw(&kStartSession, 1);
+    }
+    return true;
+  }
+
+  void disconnect(int epfd) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd_, nullptr);
+    close(fd_);
+    fd_ = -1;
+  }
+
+  bool onReadable() {
+    const bool alive = readIn(fd_, in_);
+    uint8_t channel;
+    std::string payload;
+    while (takeFrame(in_, channel, payload)) {
+      handleEvent(channel, reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+    }
+    return alive;
+  }
+
+  // 返回 true 表示脚本要求重连
+  bool service(uint64_t nowUs) {
+    bool reconnect = false;
+    uint64_t dueUs;
+    while (const Action* a = timeline_.take(nowUs, dueUs)) {
+      if (a->kind == ACT_PAYOUT) {
+        uint8_t frame[4] = { CMD_PAYOUT, 0, 0, nextTag_ };
+        putLe16(frame + 1, (uint16_t)a->arg);
+        payoutSentUs_[nextTag_] = nowUs;
+        nextTag_ = (uint8_t)((nextTag_ + 1) % PAYOUT_TAG_ALL);
+        sendRaw(frame, sizeof(frame));
+        stats_.payoutsSent++;
+      } else if (a->kind == ACT_RECEIPT) {
+        std::string frame(1, (char)CMD_PRINT_RECEIPT);
+        frame += a->text;
+        sendRaw(reinterpret_cast<const uint8_t*>(frame.data()), std::min(frame.size(), (size_t)1 + PRINT_JOB_MAX_BYTES));
+        stats_.receipts++;
+      } else if (a->kind == ACT_RECONNECT) {
+        reconnect = true;
+      }
+    }
+    if (pingUs_ && nowUs >= nextPingUs_ && nowUs < gScriptEndUs) {
+      uint8_t frame[5] = { CMD_TIME_PING };
+      putLe32(frame + 1, (uint32_t)nowUs);  // nonce = 发送时刻
+      sendRaw(frame, sizeof(frame));
+      stats_.pingsSent++;
+      nextPingUs_ += pingUs_;
+      if (nextPingUs_ < nowUs) nextPingUs_ = nowUs + pingUs_;
+    }
+    return reconnect;
+  }
+
+  bool flush() { return flushOut(fd_, out_); }
+  bool wantsWrite() const { return !out_.empty(); }
+
+  uint64_t nextWakeUs() const {
+    uint64_t t = timeline_.nextUs();
+    if (pingUs_ && nextPingUs_ < gScriptEndUs) t = std::min(t, nextPingUs_);
+    return t;
+  }
+
+  ClientStats& stats() { return stats_; }
+
+ private:
+  static constexpr uint8_t kGetCaps      = CMD_GET_CAPS;
+  static constexpr uint8_t kStartSession = CMD_START_SESSION;
+
+  void sendCmd(uint8_t op, uint8_t arg) {
+    const uint8_t frame[2] = { op, arg };
+    sendRaw(frame, sizeof(frame));
+  }
+
+  void sendRaw(const uint8_t* data, size_t len) { appendFrame(out_, FARM_CHANNEL_CMD, data, len); }
+
+  // 扩展格式的 coin/status 事件末尾带 seq，用于续传
+  void trackSeq(const uint8_t* p, size_t len) {
+    EventStamp s;
+    if (decodeEventStamp(p, len, s)) lastSeq_ = s.seq;
+  }
+
+  void handleEvent(uint8_t channel, const uint8_t* p, size_t len) {
+    const uint64_t nowUs = monoUs();
+    if (channel == EVENT_KIND_COIN) {
+      if (len >= 2) stats_.coinTotal = getLe16(p);
+      trackSeq(p, len);
+      return;
+    }
+    if (channel != EVENT_KIND_STATUS || !len) return;
+    switch (p[0]) {
+      case EVT_TIME_PONG:
+        if (len >= EVENT_TIME_PONG_LEN) stats_.rttUs.push_back((uint32_t)nowUs - getLe32(p + 1));
+        break;
+      case EVT_SESSION_STARTED:
+        if (len >= 5) sessionId_ = getLe32(p + 1);
+        trackSeq(p, len);
+        break;
+      case EVT_PAYOUT_REQUEST_DONE:
+        if (len >= 7 && p[6] != PAYOUT_STATUS_REJECTED) {
+          stats_.payoutsDone++;
+          stats_.payoutMs.push_back((uint32_t)((nowUs - payoutSentUs_[p[1]]) / 1000));
+        }
+        trackSeq(p, len);
+        break;
+      case EVT_PAYOUT_DONE:
+        trackSeq(p, len);
+        break;
+      case EVT_RESUME_BATCH: {
+        // 回放断线期间的事件（不带时间戳尾部）；收完末帧后枚数与 seq 以首帧快照为准
+        if (!parseResumeFrame(p, len, resume_, [this](uint8_t kind, uint16_t seq, const uint8_t* e, size_t n) {
+              handleEvent(kind, e, n);
+              lastSeq_ = seq;
+            })) {
+          break;
+        }
+        if (p[1] & RESUME_FLAG_MORE) break;
+        stats_.coinTotal = resume_.coinTotal;
+        if (resume_.status != RESUME_STATUS_MTU) lastSeq_ = resume_.headSeq;  // MTU：从最后收到的条目再续
+        stats_.resumes[resume_.status]++;
+        break;
+      }
+      case EVT_CAPS:
+        stats_.capsOk = len == sizeof(kCapabilities.bytes) && !memcmp(p, kCapabilities.bytes, len);
+        break;
+    }
+  }
+
+  int id_;
+  Endpoint ep_;
+  uint64_t pingUs_;
+  uint64_t nextPingUs_;
+  Timeline timeline_;
+  int fd_ = -1;
+  std::string in_, out_;
+  uint32_t sessionId_ = 0;
+  uint16_t lastSeq_   = 0;
+  ResumeSnapshot resume_ = {};  // 进行中的续传回放（快照在首帧）
+  uint8_t  nextTag_   = 0;
+  uint64_t payoutSentUs_[256] = {};
+  ClientStats stats_;
+};
+
+static void registerClient(int epfd, Client* c, int index) {
+  epoll_event ev = {};
+  ev.events   = EPOLLIN;  // 指令帧很小，写不完的部分下次唤醒时再写
+  ev.data.u64 = tagOf(index, FD_CONN);
+  epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd(), &ev);
+}
+
+static void runClientWorker(std::vector<Client*> clients, LoopStats* stats) {
+  const int epfd = epoll_create1(0);
+  const int tfd  = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  epoll_event ev = {};
+  ev.events   = EPOLLIN;
+  ev.data.u64 = tagOf(0, FD_TIMER);
+  epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+  for (size_t i = 0; i < clients.size(); i++) {
+    if (clients[i]->connect(false)) registerClient(epfd, clients[i], (int)i);
+  }
+
+  epoll_event events[64];
+  while (!gStop.load(std::memory_order_relaxed)) {
+    uint64_t wake = monoUs() + 100000;
+    for (Client* c : clients) wake = std::min(wake, c->nextWakeUs());
+    armTimer(tfd, wake);
+
+    const int n = epoll_wait(epfd, events, 64, -1);
+    const uint64_t t0 = monoUs();
+    stats->wakes++;
+    for (int i = 0; i < n; i++) {
+      const uint64_t tag = events[i].data.u64;
+      if ((tag & 3) == FD_TIMER) {
+        uint64_t expirations;
+        if (read(tfd, &expirations, sizeof(expirations)) < 0) {
+        }
+        continue;
+      }
+      Client* c = clients[tag >> 2];
+      if (c->fd() >= 0 && !c->onReadable()) c->disconnect(epfd);
+    }
+
+    const uint64_t now = monoUs();
+    for (size_t i = 0; i < clients.size(); i++) {
+      Client* c = clients[i];
+      if (c->fd() < 0) continue;
+      if (c->service(now)) {
+        c->flush();
+        c->disconnect(epfd);
+        if (c->connect(true)) registerClient(epfd, c, (int)i);
+        continue;
+      }
+      if (!c->flush()) c->disconnect(epfd);
+    }
+    stats->busyUs += monoUs() - t0;
+  }
+  for (Client* c : clients) {
+    if (c->fd() >= 0) c->disconnect(epfd);
+  }
+  close(tfd);
+  close(epfd);
+}
+
+// ==== 报告 ====
+static uint32_t percentile(std::vector<uint32_t>& v, double p) {
+  if (v.empty()) return 0;
+  const size_t k = std::min(v.size() - 1, (size_t)(p * (double)(v.size() - 1) + 0.5));
+  std::nth_element(v.begin(), v.begin() + (long)k, v.end());
+  return v[k];
+}
+
+static uint32_t maxOf(const std::vector<uint32_t>& v) {
+  return v.empty() ? 0 : *std::max_element(v.begin(), v.end());
+}
+
+static double meanOf(const std::vector<uint32_t>& v) {
+  if (v.empty()) return 0;
+  double s = 0;
+  for (uint32_t x : v) s += x;
+  return s / (double)v.size();
+}
+
+static volatile sig_atomic_t gInterrupted = 0;
+static void onInterrupt(int) { gInterrupted = 1; }
+
+static void usage() {
+  fprintf(stderr,
+          "usage: coinbox_farm [-n boxes] [-j threads] [-t seconds] [-u dir | -p base_port]\n"
+          "                    [-s script] [-c 0|1] [-i ping_ms] [-r record_dir] [-q] [-v]\n");
+}
+
+int main(int argc, char** argv) {
+  int boxCount = 64;
+  int threads  = (int)std::max(1u, std::thread::hardware_concurrency());
+  double seconds = 10;
+  Endpoint ep = { false, "", 0 };
+  const char* scriptPath = nullptr;
+  const char* recordDir  = nullptr;
+  bool clients = true, quiet = false;
+  uint64_t pingUs = 100000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:j:t:u:p:s:c:i:r:qv")) != -1) {
+    switch (opt) {
+      case 'n': boxCount = atoi(optarg); break;
+      case 'j': threads = atoi(optarg); break;
+      case 't': seconds = atof(optarg); break;
+      case 'u': ep.dir = optarg; break;
+      case 'p': ep.tcp = true; ep.basePort = (uint16_t)atoi(optarg); break;
+      case 's': scriptPath = optarg; break;
+      case 'c': clients = atoi(optarg) != 0; break;
+      case 'i': pingUs = (uint64_t)(atof(optarg) * 1000); break;
+      case 'q': quiet = true; break;
+      case 'r': recordDir = optarg; break;
+      case 'v': gVerbose = true; break;
+      default: usage(); return 2;
+    }
+  }
+  if (boxCount < 1 || threads < 1) {
+    usage();
+    return 2;
+  }
+  threads = std::min(threads, boxCount);
+
+  std::string scriptText = kDefaultScript;
+  if (scriptPath) {
+    FILE* f = fopen(scriptPath, "r");
+    if (!f) {
+      perror(scriptPath);
+      return 1;
+    }
+    scriptText.clear();
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) scriptText.append(buf, n);
+    fclose(f);
+  }
+  std::vector<Action> script;
+  if (!parseScript(scriptText, script)) return 1;
+
+  // 每台 1 个监听 + 1 个连接，内置客户端再占 1 个
+  rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  gStartNs = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+  if (seconds > 0) gScriptEndUs = kSettleUs + (uint64_t)(seconds * 1e6);
+
+  if (!ep.tcp) {
+    if (ep.dir.empty()) ep.dir = "/tmp/coinbox_farm." + std::to_string(getpid());
+    mkdir(ep.dir.c_str(), 0755);
+  }
+
+  std::vector<std::unique_ptr<VirtualBox>> boxes;
+  for (int i = 0; i < boxCount; i++) {
+    boxes.emplace_back(new VirtualBox(i));
+    const int fd = openListener(ep, i);
+    if (fd < 0) {
+      fprintf(stderr, "box %d: cannot listen (%s)\n", i, strerror(errno));
+      return 1;
+    }
+    boxes.back()->setListenFd(fd);
+    boxes.back()->initTimeline(script);
+    if (recordDir) {
+      mkdir(recordDir, 0755);
+      const std::string path = std::string(recordDir) + "/box-" + std::to_string(i) + ".cblg";
+      if (!boxes.back()->startRecording(path)) {
+        perror(path.c_str());
+        return 1;
+      }
+    }
+  }
+  const std::string where = ep.tcp ? "tcp 127.0.0.1:" + std::to_string(ep.basePort) + "+i" : "unix " + ep.dir + "/box-<i>.sock";
+  printf("coinbox_farm: %d boxes on %d threads, %s, script %zu actions, %s\n", boxCount, threads, where.c_str(),
+         script.size(), clients ? "built-in clients" : "external clients");
+  fflush(stdout);
+
+  std::vector<LoopStats> boxLoops(threads), clientLoops(threads);
+  std::vector<std::thread> workers;
+  for (int w = 0; w < threads; w++) {
+    std::vector<VirtualBox*> shard;
+    for (int i = w; i < boxCount; i += threads) shard.push_back(boxes[i].get());
+    workers.emplace_back(runBoxWorker, shard, &boxLoops[w]);
+  }
+
+  std::vector<std::unique_ptr<Client>> clientList;
+  if (clients) {
+    for (int i = 0; i < boxCount; i++) clientList.emplace_back(new Client(i, ep, script, pingUs));
+    for (int w = 0; w < threads; w++) {
+      std::vector<Client*> shard;
+      for (int i = w; i < boxCount; i += threads) shard.push_back(clientList[i].get());
+      workers.emplace_back(runClientWorker, shard, &clientLoops[w]);
+    }
+  }
+
+  signal(SIGINT, onInterrupt);
+  signal(SIGTERM, onInterrupt);
+  const uint64_t endUs = seconds > 0 ? gScriptEndUs + kDrainUs : UINT64_MAX;
+  while (!gInterrupted && monoUs() < endUs) std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  const uint64_t elapsedUs = monoUs();
+  gStop = true;
+  for (std::thread& t : workers) t.join();
+
+  // ---- 逐台 ----
+  std::vector<uint32_t> allRtt, allPayout;
+  uint64_t commands = 0, printerBytes = 0, printerDropped = 0, printerUs = 0, notifies = 0, dropped = 0;
+  uint32_t coinMismatch = 0, coinsFed = 0, capsBad = 0, resumes[4] = {};
+  if (!quiet) {
+    printf("\n%5s %6s %7s %7s %7s %9s %11s %12s %8s %10s %9s\n", "box", "cmds", "rtt50", "rtt99", "rttMax",
+           "payout", "payoutMs", "coins", "resume", "printB", "printMs");
+  }
+  for (int i = 0; i < boxCount; i++) {
+    const VirtualBox& b = *boxes[i];
+    commands += b.commands();
+    printerBytes += b.printer().bytes;
+    printerDropped += b.printer().dropped;
+    printerUs += b.printer().busyUs;
+    notifies += b.notifies();
+    dropped += b.notifyDropped();
+    coinsFed += b.coinsFed();
+    ClientStats empty;
+    ClientStats& cs = clients ? clientList[i]->stats() : empty;
+    const bool coinsOk = !clients || (cs.coinTotal == b.coinsFed() && b.core().coinTotal() == b.coinsFed());
+    coinMismatch += !coinsOk;
+    capsBad += clients && !cs.capsOk;
+    for (int k = 0; k < 4; k++) resumes[k] += cs.resumes[k];
+    allRtt.insert(allRtt.end(), cs.rttUs.begin(), cs.rttUs.end());
+    allPayout.insert(allPayout.end(), cs.payoutMs.begin(), cs.payoutMs.end());
+    if (quiet) continue;
+    char payout[16], coins[16], resume[16];
+    snprintf(payout, sizeof(payout), "%u/%u", cs.payoutsDone, cs.payoutsSent);
+    snprintf(coins, sizeof(coins), "%u/%u/%u%s", b.coinsFed(), cs.coinTotal, b.core().coinTotal(), coinsOk ? "" : "!");
+    snprintf(resume, sizeof(resume), "%u/%u/%u/%u", cs.resumes[0], cs.resumes[1], cs.resumes[2], cs.resumes[3]);
+    printf("%5d %6u %7u %7u %7u %9s %11.0f %12s %8s %10llu %9llu\n", i, b.commands(), percentile(cs.rttUs, 0.5),
+           percentile(cs.rttUs, 0.99), maxOf(cs.rttUs), payout, meanOf(cs.payoutMs), coins, resume,
+           (unsigned long long)b.printer().bytes, (unsigned long long)(b.printer().busyUs / 1000));
+  }
+  if (!quiet) {
+    printf("(rtt: CMD_TIME_PING round trip us; payoutMs: mean CMD_PAYOUT -> request done incl. dispensing;\n"
+           " coins: fed/seen by client/counted by box; resume: ok/partial/unknown/mtu; print: bytes/ms at script baud)\n");
+  }
+
+  // ---- 汇总 ----
+  printf("\n== summary: %d boxes, %.1f s ==\n", boxCount, elapsedUs / 1e6);
+  printf("commands      %llu (%.0f/s), notifications %llu, dropped while disconnected %llu\n",
+         (unsigned long long)commands, commands / (elapsedUs / 1e6), (unsigned long long)notifies,
+         (unsigned long long)dropped);
+  if (clients) {
+    printf("ping rtt us   p50 %u, p90 %u, p99 %u, max %u (%zu samples)\n", percentile(allRtt, 0.5),
+           percentile(allRtt, 0.9), percentile(allRtt, 0.99), maxOf(allRtt), allRtt.size());
+    printf("payout ms     p50 %u, p99 %u, max %u (%zu requests)\n", percentile(allPayout, 0.5),
+           percentile(allPayout, 0.99), maxOf(allPayout), allPayout.size());
+    printf("resume        ok %u, partial %u, unknown %u, mtu %u\n", resumes[0], resumes[1], resumes[2], resumes[3]);
+    printf("coins         fed %u, boxes with mismatch %u, caps mismatch %u\n", coinsFed, coinMismatch, capsBad);
+  }
+  printf("printer       %llu bytes, %.1f s simulated print time, %llu bytes dropped while offline\n",
+         (unsigned long long)printerBytes, printerUs / 1e6, (unsigned long long)printerDropped);
+  for (int w = 0; w < threads; w++) {
+    printf("thread %-3d    boxes: %llu wakes, %.1f%% busy", w, (unsigned long long)boxLoops[w].wakes,
+           100.0 * boxLoops[w].busyUs / elapsedUs);
+    if (clients) {
+      printf("; clients: %llu wakes, %.1f%% busy", (unsigned long long)clientLoops[w].wakes,
+             100.0 * clientLoops[w].busyUs / elapsedUs);
+    }
+    printf("\n");
+  }
+
+  for (int i = 0; i < boxCount; i++) {
+    close(boxes[i]->listenFd());
+    boxes[i]->stopRecording();
+  }
+  if (!ep.tcp) {
+    for (int i = 0; i < boxCount; i++) unlink((ep.dir + "/box-" + std::to_string(i) + ".sock").c_str());
+    rmdir(ep.dir.c_str());
+  }
+  return coinMismatch || capsBad ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+// 校验 include/cp936.h 的转码结果并测吞吐
+// 用法：cp936_check [语料 MB]   （默认 4）
+// 1. 逐个比对 U+0080–U+FFFF 与系统 iconv（CP936）的结果，两边都无法转换也算一致
+// 2. 整串转换（全部可转字符 + 小票样例 + 非法 UTF-8）与 iconv 比对
+// 3. 吞吐：小票样例（字集小，缓存命中高）与均匀随机汉字（缓存几乎不命中）两种语料，
+//    对比 Cp936Transcoder、无缓存直接查表与 iconv
+#include <iconv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "cp936.h"
+
+static double nowSec() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void appendUtf8(std::string& s, uint32_t u) {
+  if (u < 0x80) {
+    s += (char)u;
+  } else if (u < 0x800) {
+    s += (char)(0xC0 | (u >> 6));
+    s += (char)(0x80 | (u & 0x3F));
+  } else {
+    s += (char)(0xE0 | (u >> 12));
+    s += (char)(0x80 | ((u >> 6) & 0x3F));
+    s += (char)(0x80 | (u & 0x3F));
+  }
+}
+
+// iconv 参考转换；不可转换的字符（或非法字节）按 '?' 并跳过 1 个输入单位，与固件约定一致
+class Reference {
+ public:
+  Reference(const char* from) : cd_(iconv_open("CP936", from)) {}
+  ~Reference() { iconv_close(cd_); }
+  bool ok() const { return cd_ != (iconv_t)-1; }
+
+  std::string convert(const char* in, size_t len, size_t unit) {
+    std::string out;
+    out.resize(len * 2 + 16);
+    char* ip = const_cast<char*>(in);
+    size_t il = len;
+    char* op = &out[0];
+    size_t ol = out.size();
+    iconv(cd_, nullptr, nullptr, nullptr, nullptr);
+    while (il) {
+      if (iconv(cd_, &ip, &il, &op, &ol) != (size_t)-1) break;
+      // UTF-8 输入时非法/不可转换：跳过整个字符（可解出时）或 1 字节
+      size_t skip = unit;
+      if (unit == 1) {
+        uint32_t ucs = 0;
+        skip = decodeUtf8(reinterpret_cast<const uint8_t*>(ip), il, ucs);
+      }
+      *op++ = CP936_UNMAPPED;
+      ol--;
+      ip += skip;
+      il -= skip;
+    }
+    out.resize(out.size() - ol);
+    return out;
+  }
+
+ private:
+  iconv_t cd_;
+};
+
+static int checkCodepoints(Reference& ref) {
+  int mismatches = 0;
+  uint32_t mapped = 0;
+  for (uint32_t u = 0x80; u <= 0xFFFF; u++) {
+    if (u >= 0xD800 && u < 0xE000) continue;
+    const std::string want = ref.convert(reinterpret_cast<const char*>(&u), 4, 4);
+    uint8_t got[2];
+    const uint16_t code = cp936Lookup(u);
+    const size_t n = code ? putCp936(code, got) : putCp936(CP936_UNMAPPED, got);
+    if (want.size() != n || memcmp(want.data(), got, n) != 0) {
+      if (mismatches < 10) printf("  MISMATCH U+%04X: ours %04X\n", u, code);
+      mismatches++;
+    }
+    mapped += code != 0;
+  }
+  printf("codepoints: %u mapped, %d mismatches vs iconv\n", mapped, mismatches);
+  return mismatches;
+}
+
+static const char* const kReceiptSample =
+    "交易小票\n"
+    "币种: ETHUSDT 以太坊\n开盘价: 3521.40\n收盘价: 3588.12\n杠杆率: 10x\n本金: 100\n收益率: +18.95%\n吐币数量: 19\n"
+    "币种: DOGEUSDT 狗狗币\n开盘价: 0.1623\n收盘价: 0.1587\n杠杆率: 5x\n本金: 50\n收益率: -11.09%\n吐币数量: 0\n"
+    "艾达币 雪崩 币安币 波卡 索拉纳 瑞波币 Polygon — 谢谢惠顾！（￥）\n";
+
+static int checkStrings(Reference& ref, const std::string& all) {
+  int failures = 0;
+  const std::string invalid = std::string("ok\xE4\xBA") + "\xFF" + "\xC0\xAF" + "中" + "\xED\xA0\x80" + "end";
+  const std::string cases[] = { all, kReceiptSample, invalid };
+  for (const std::string& s : cases) {
+    Cp936Transcoder tc;
+    std::vector<uint8_t> out(s.size());
+    const size_t n = tc.convert(reinterpret_cast<const uint8_t*>(s.data()), s.size(), out.data(), out.size());
+    const std::string want = ref.convert(s.data(), s.size(), 1);
+    const bool same = want.size() == n && memcmp(want.data(), out.data(), n) == 0;
+    printf("string %6zu bytes utf-8 -> %6zu bytes cp936: %s\n", s.size(), n, same ? "ok" : "MISMATCH");
+    failures += !same;
+  }
+  return failures;
+}
+
+struct Bench {
+  double mbPerSec;
+  double charsPerSec;
+};
+
+template <typename Fn>
+static Bench bench(const std::string& corpus, size_t chars, Fn fn) {
+  int reps = 0;
+  const double t0 = nowSec();
+  double t;
+  do {
+    fn();
+    reps++;
+    t = nowSec() - t0;
+  } while (t < 0.5);
+  return { corpus.size() * (double)reps / t / 1e6, chars * (double)reps / t };
+}
+
+static size_t countChars(const std::string& s) {
+  size_t n = 0;
+  for (unsigned char c : s) n += (c & 0xC0) != 0x80;
+  return n;
+}
+
+static void runBench(const char* name, const std::string& corpus) {
+  const size_t chars = countChars(corpus);
+  std::vector<uint8_t> out(corpus.size());
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(corpus.data());
+  volatile size_t sink = 0;
+
+  Cp936Transcoder tc;
+  size_t outLen = 0;
+  const Bench cached = bench(corpus, chars, [&] { outLen = tc.convert(in, corpus.size(), out.data(), out.size()); });
+  const double hitRate = 100.0 * tc.hits() / (double)(tc.hits() + tc.misses());
+
+  const Bench direct = bench(corpus, chars, [&] {
+    size_t i = 0, o = 0;
+    while (i < corpus.size()) {
+      uint32_t ucs = 0;
+      i += decodeUtf8(in + i, corpus.size() - i, ucs);
+      const uint16_t code = ucs == UINT32_MAX ? 0 : cp936Lookup(ucs);
+      o += putCp936(code || !ucs ? code : (uint16_t)CP936_UNMAPPED, out.data() + o);
+    }
+    sink = sink + o;
+  });
+
+  iconv_t cd = iconv_open("CP936", "UTF-8");
+  std::vector<char> iout(corpus.size());
+  const Bench sys = bench(corpus, chars, [&] {
+    char* ip = const_cast<char*>(corpus.data());
+    size_t il = corpus.size();
+    char* op = iout.data();
+    size_t ol = iout.size();
+    iconv(cd, nullptr, nullptr, nullptr, nullptr);
+    iconv(cd, &ip, &il, &op, &ol);
+    sink = sink + ol;
+  });
+  iconv_close(cd);
+
+  printf("== %s: %.2f MB utf-8, %zu chars -> %.2f MB cp936 (%.1f%%) ==\n", name, corpus.size() / 1e6,
+         chars, outLen / 1e6, 100.0 * outLen / corpus.size());
+  printf("  %-22s %9.1f MB/s %9.2f Mchar/s  cache hit %.1f%%\n", "Cp936Transcoder", cached.mbPerSec,
+         cached.charsPerSec / 1e6, hitRate);
+  printf("  %-22s %9.1f MB/s %9.2f Mchar/s\n", "cp936Lookup (no cache)", direct.mbPerSec, direct.charsPerSec / 1e6);
+  printf("  %-22s %9.1f MB/s %9.2f Mchar/s\n", "iconv", sys.mbPerSec, sys.charsPerSec / 1e6);
+}
+
+int main(int argc, char** argv) {
+  const double corpusMb = argc > 1 ? atof(argv[1]) : 4.0;
+  Reference ucs4("UTF-32LE");
+  Reference utf8("UTF-8");
+  if (!ucs4.ok() || !utf8.ok()) {
+    fprintf(stderr, "iconv does not support CP936 on this system\n");
+    return 2;
+  }
+
+  printf("tables: hanzi %zu bytes, symbols %zu bytes, cache %u entries\n", sizeof(kCp936Hanzi),
+         sizeof(kCp936Symbols), (unsigned)CP936_CACHE_SIZE);
+
+  int failures = checkCodepoints(ucs4);
+  std::string all;
+  for (uint32_t u = 0x80; u <= 0xFFFF; u++) {
+    if ((u < 0xD800 || u >= 0xE000) && cp936Lookup(u)) appendUtf8(all, u);
+  }
+  failures += checkStrings(utf8, all);
+
+  const size_t target = (size_t)(corpusMb * 1e6);
+  std::string receipts;
+  while (receipts.size() < target) receipts += kReceiptSample;
+  std::string random;
+  srand(936);
+  while (random.size() < target) appendUtf8(random, 0x4E00 + (uint32_t)rand() % (0x9FA5 - 0x4E00 + 1));
+  printf("\n");
+  runBench("receipts", receipts);
+  runBench("random hanzi", random);
+
+  printf("\n%s\n", failures ? "FAILED" : "all conversions match iconv");
+  return failures ? 1 : 0;
+}
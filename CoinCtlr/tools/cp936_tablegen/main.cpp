@@ -0,0 +1,116 @@
+// 生成 include/cp936_data.h：以系统 iconv 的 CP936 为准导出码表原始数据
+// 用法：cp936_tablegen > ../include/cp936_data.h
+//
+// 只导出无法推算的部分，压缩后的查找表由 include/cp936.h 在编译期（constexpr）构建：
+// - GB2312 汉字区（B0A1–F7FE）码位 → Unicode
+// - 其余非汉字字符（符号、全角、假名、俄文等）的 (Unicode, CP936) 对，按 Unicode 排序
+// 不在 GB2312 中的 CJK 统一汉字（U+4E00–U+9FA5）按 Unicode 顺序依次占用 GBK/3（8140–A0FE）
+// 与 GBK/4（AA40–FEA0）码位，无需存表；生成时逐字校验该规律，不成立则报错退出。
+#include <iconv.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+static const uint32_t kCjkFirst = 0x4E00;
+static const uint32_t kCjkLast  = 0x9FA5;
+
+// 单个 Unicode 码位 → CP936 字节；不可转换返回 0
+static int encodeOne(iconv_t cd, uint32_t ucs, uint8_t out[4]) {
+  uint32_t in = ucs;
+  char* ip = reinterpret_cast<char*>(&in);
+  size_t il = sizeof(in);
+  char* op = reinterpret_cast<char*>(out);
+  size_t ol = 4;
+  iconv(cd, nullptr, nullptr, nullptr, nullptr);
+  if (iconv(cd, &ip, &il, &op, &ol) == (size_t)-1) return 0;
+  return (int)(4 - ol);
+}
+
+static bool isGb2312Hanzi(uint8_t lead, uint8_t trail) {
+  return lead >= 0xB0 && lead <= 0xF7 && trail >= 0xA1 && trail <= 0xFE;
+}
+
+// GBK/3、GBK/4 中第 k 个码位
+static uint16_t extensionCode(uint32_t k) {
+  uint8_t lead, t;
+  if (k < 32 * 190) {
+    lead = (uint8_t)(0x81 + k / 190);
+    t    = (uint8_t)(k % 190);
+  } else {
+    k -= 32 * 190;
+    lead = (uint8_t)(0xAA + k / 96);
+    t    = (uint8_t)(k % 96);
+  }
+  const uint8_t trail = (uint8_t)(0x40 + t + (t >= 0x3F ? 1 : 0));
+  return (uint16_t)(lead << 8 | trail);
+}
+
+int main() {
+  iconv_t cd = iconv_open("CP936", "UTF-32LE");
+  if (cd == (iconv_t)-1) {
+    perror("iconv_open");
+    return 1;
+  }
+
+  static uint16_t hanzi[72 * 94] = {};  // B0–F7 × A1–FE
+  std::vector<std::pair<uint16_t, uint16_t>> symbols;
+  uint32_t extension = 0;
+
+  for (uint32_t u = 0x80; u <= 0xFFFF; u++) {
+    if (u >= 0xD800 && u < 0xE000) continue;
+    uint8_t b[4];
+    const int n = encodeOne(cd, u, b);
+    if (!n) continue;
+    const uint16_t code = n == 1 ? b[0] : (uint16_t)(b[0] << 8 | b[1]);
+    if (n > 2) {
+      fprintf(stderr, "U+%04X: unexpected %d-byte sequence\n", u, n);
+      return 1;
+    }
+    if (u >= kCjkFirst && u <= kCjkLast) {
+      if (n == 2 && isGb2312Hanzi(b[0], b[1])) {
+        hanzi[(b[0] - 0xB0) * 94 + (b[1] - 0xA1)] = (uint16_t)u;
+      } else if (code == extensionCode(extension)) {
+        extension++;
+      } else {
+        fprintf(stderr, "U+%04X -> %04X breaks the GBK/3-4 ordering (expected %04X)\n",
+                u, code, extensionCode(extension));
+        return 1;
+      }
+    } else {
+      symbols.push_back({ (uint16_t)u, code });
+    }
+  }
+  iconv_close(cd);
+
+  uint32_t hanziCount = 0;
+  for (uint16_t u : hanzi) hanziCount += u != 0;
+
+  printf("#pragma once\n\n");
+  printf("#include <stdint.h>\n\n");
+  printf("// 由 tools/cp936_tablegen 根据系统 iconv 生成，请勿手工修改。\n");
+  printf("// GB2312 汉字 %u 个，GBK 扩展汉字 %u 个（按规律推算，不存表），其他字符 %zu 个。\n\n",
+         hanziCount, extension, symbols.size());
+
+  printf("#define CP936_HANZI_EXTENSION_COUNT %u\n\n", extension);
+
+  printf("// GB2312 汉字区：[(区 - 0xB0) * 94 + (位 - 0xA1)] → Unicode，0 = 空位\n");
+  printf("constexpr uint16_t kCp936Gb2312Hanzi[72 * 94] = {\n");
+  for (int row = 0; row < 72; row++) {
+    printf("  // %02X\n", 0xB0 + row);
+    for (int col = 0; col < 94; col++) {
+      printf("%s0x%04X,", col % 12 == 0 ? "  " : " ", hanzi[row * 94 + col]);
+      if (col % 12 == 11 || col == 93) printf("\n");
+    }
+  }
+  printf("};\n\n");
+
+  printf("// 其他字符：{ Unicode, CP936 }，按 Unicode 升序\n");
+  printf("constexpr uint16_t kCp936Symbols[][2] = {\n");
+  for (size_t i = 0; i < symbols.size(); i++) {
+    printf("%s{0x%04X,0x%04X},", i % 6 == 0 ? "  " : " ", symbols[i].first, symbols[i].second);
+    if (i % 6 == 5 || i + 1 == symbols.size()) printf("\n");
+  }
+  printf("};\n");
+  return 0;
+}
@@ -0,0 +1,621 @@
+// 多连接通知扇出：验证连接表的归属/角色/订阅规则，并测量连接数增加时的扇出开销与空口送达时延（include/gatt_clients.h）
+// 用法：
+//   gatt_fanout [-n 最大连接数] [-i 连接间隔ms] [-c 每次发送的协议栈开销us] [-r 事件/秒] [-d LL 负载上限]
+//               [-k 每连接事件包数上限] [-q 每连接发送缓冲] [-t 仿真秒数]
+//
+// 规则检查：核心逻辑 + 连接表 + 每连接收件箱，按固件 CmdCallbacks 的顺序鉴权后执行指令，逐条核对收件内容。
+// 扫描 1..n 个连接（玩家 + 若干运维终端，订阅组合不同）：
+//   - 发送次数：连接表只发给订阅者；对照 BLECharacteristic::notify() 对每个连接都发（不看订阅）
+//   - 主机开销：GattClients::fanout() 取目标 + 每订阅者一次拷贝的实测耗时；协议栈发送按每次 -c us 计
+// 空口时延：事件按泊松过程产生，扇出在主机上逐个调用发送（每次 -c us，后面的连接晚入队）；
+//   控制器把 n 个连接的连接事件均匀错开在同一连接间隔内，每个连接事件的时长不超过 间隔/n，
+//   且最多 -k 个包；包长按 1M PHY 计（前导 + 接入地址 + 头 + 负载 + CRC，分片与空 ACK 及两个 T_IFS）。
+//   时延 = 送达对端的时刻 - 核心产生事件的时刻；发送缓冲满时丢弃（计入 drops）。
+// 任一规则检查失败时退出码为 1。
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "coinbox_core.h"
+#include "gatt_clients.h"
+
+#define FANOUT_MAX_CONNS 8  // 主机侧扫描上限（固件上限为 BLE_MAX_CONNECTIONS）
+
+static const CoinDenomination kDenominations[] = COIN_DENOMINATIONS;
+static const HopperSpec kHoppers[] = HOPPERS;
+
+static double nowSec() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double percentile(std::vector<double>& v, double p) {
+  if (v.empty()) return 0;
+  const size_t k = std::min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5));
+  std::nth_element(v.begin(), v.begin() + k, v.end());
+  return v[k];
+}
+
+// ==== 仿真平台：事件经连接表扇出到每连接收件箱 ====
+struct Received {
+  uint8_t kind;
+  std::vector<uint8_t> data;
+};
+
+class FanoutPlatform : public CoinBoxPlatform {
+ public:
+  GattClients<FANOUT_MAX_CONNS> clients;
+  std::vector<Received> inbox[FANOUT_MAX_CONNS];  // 下标为 conn（仿真里 conn 取 0..7）
+  uint64_t now = 1000000;
+
+  uint64_t nowUs() override { return now; }
+  void notify(uint8_t kind, const uint8_t* data, size_t len) override { publish(kind, data, len, 0); }
+  void publish(uint8_t kind, const uint8_t* data, size_t len, size_t stampLen) override {
+    clients.fanout(kind, data, len, stampLen, [&](uint16_t conn, const uint8_t* d, uint16_t n) {
+      inbox[conn].push_back({ kind, std::vector<uint8_t>(d, d + n) });
+      return true;
+    });
+  }
+  void reply(uint16_t client, const uint8_t* data, size_t len) override {
+    ClientTarget t;
+    if (!clients.target(client, EVENT_KIND_STATUS, len, t)) return;
+    inbox[client].push_back({ EVENT_KIND_STATUS, std::vector<uint8_t>(data, data + t.len) });
+    clients.noteSent(t, true);
+  }
+  void setRelay(uint8_t, bool) override {}
+  void printerWrite(const uint8_t*, size_t) override {}
+  uint32_t random32() override { return 0x5EED1234u; }
+  uint16_t peerMtu(uint16_t client) override { return clients.mtu(client); }
+};
+
+// ==== 规则检查 ====
+static int failures = 0;
+
+static void check(const char* name, bool ok, const std::string& detail) {
+  printf("%-34s %s  %s\n", name, ok ? "PASS" : "FAIL", detail.c_str());
+  failures += !ok;
+}
+
+static std::string fmt(const char* f, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, f);
+  vsnprintf(buf, sizeof(buf), f, ap);
+  va_end(ap);
+  return buf;
+}
+
+class PolicyRig {
+ public:
+  PolicyRig() : core(io, kHoppers, HOPPER_COUNT, kDenominations, sizeof(kDenominations) / sizeof(kDenominations[0])) {}
+
+  // peer：对端地址末字节（缺省按 conn 区分；同一设备重连时传原值）
+  void connect(uint16_t conn, uint8_t subscriptions, uint16_t mtu, int peer = -1) {
+    io.clients.connect(conn, peerAddr(peer < 0 ? conn + 1 : peer).data());
+    io.clients.setMtu(conn, mtu);
+    if (subscriptions & (1u << EVENT_KIND_COIN)) io.clients.setSubscribed(conn, EVENT_KIND_COIN, true);
+    if (subscriptions & (1u << EVENT_KIND_STATUS)) io.clients.setSubscribed(conn, EVENT_KIND_STATUS, true);
+  }
+
+  // 与固件 onGapEvent 相同：MITM 配对完成按地址标记连接
+  void pair(uint16_t conn, int peer = -1) { io.clients.setPaired(peerAddr(peer < 0 ? conn + 1 : peer).data(), true); }
+
+  static std::array<uint8_t, 6> peerAddr(int peer) { return { 0xC0, 0x11, 0x22, 0x33, 0x44, (uint8_t)peer }; }
+
+  // 与固件 onDisconnect 相同：最后一个连接断开才通知核心，否则按剩余连接同步事件格式
+  void disconnect(uint16_t conn) {
+    io.clients.disconnect(conn, (uint32_t)(io.now / 1000));
+    if (!io.clients.count()) {
+      core.onDisconnect();
+    } else if (io.clients.anyExtended() != core.extendedEvents()) {
+      syncFormat();
+    }
+  }
+
+  // 与固件 CmdCallbacks::onWrite 相同的顺序：解码 → 鉴权（被拒只回发出方）→ 连接层指令 / 核心逻辑；返回拒绝原因
+  uint8_t command(uint16_t conn, std::initializer_list<uint8_t> bytes) { return command(conn, std::vector<uint8_t>(bytes)); }
+  uint8_t command(uint16_t conn, const std::vector<uint8_t>& frame) {
+    CommandFrame cmd;
+    if (decodeCommand(frame.data(), frame.size(), cmd) != CMD_OK) return 0xFF;
+    cmd.client = conn;
+    const uint8_t reason = io.clients.authorize(conn, cmd.op, (uint32_t)(io.now / 1000));
+    if (reason) return reject(conn, cmd.op, reason);
+    if (cmd.op == CMD_SET_ROLE) {
+      if (!io.clients.setRole(conn, (uint8_t)cmd.a)) return reject(conn, cmd.op, REJECT_ROLE);
+    } else if (cmd.op == CMD_SET_EVENT_FORMAT) {
+      io.clients.setExtended(conn, (cmd.a & EVENT_FORMAT_EXTENDED) != 0);
+      syncFormat();
+    } else {
+      core.execute(cmd, (uint32_t)io.now);
+      while (core.servicePayout()) {
+      }
+    }
+    return 0;
+  }
+
+  void insertCoin() {
+    core.feedPulse((uint32_t)io.now);
+    io.now += COIN_TRAIN_GAP_US * 2;
+    core.flushCoins();
+  }
+
+  void runPayout() {
+    for (int i = 0; i < 2000 && core.payoutBusy(); i++) {
+      const uint64_t due = core.nextPayoutUs();
+      if (due != UINT64_MAX && due > io.now) io.now = due;
+      core.servicePayout();
+    }
+  }
+
+  size_t count(uint16_t conn, uint8_t kind) const {
+    size_t n = 0;
+    for (const Received& r : io.inbox[conn]) n += r.kind == kind;
+    return n;
+  }
+  const Received* last(uint16_t conn) const { return io.inbox[conn].empty() ? nullptr : &io.inbox[conn].back(); }
+  void clearInbox() {
+    for (auto& box : io.inbox) box.clear();
+  }
+
+  FanoutPlatform io;
+  CoinBoxCore core;
+
+ private:
+  uint8_t reject(uint16_t conn, uint8_t op, uint8_t reason) {
+    const uint8_t reply[3] = { EVT_REJECTED, op, reason };
+    io.reply(conn, reply, sizeof(reply));
+    return reason;
+  }
+
+  void syncFormat() {
+    CommandFrame cmd = {};
+    const uint8_t frame[2] = { CMD_SET_EVENT_FORMAT, (uint8_t)(io.clients.anyExtended() ? EVENT_FORMAT_EXTENDED : 0) };
+    decodeCommand(frame, sizeof(frame), cmd);
+    core.execute(cmd, (uint32_t)io.now);
+  }
+};
+
+static void runPolicyChecks() {
+  const uint8_t both = (1u << EVENT_KIND_COIN) | (1u << EVENT_KIND_STATUS);
+  const uint16_t ipad = 0, staff = 1, guest = 2;
+  PolicyRig rig;
+  rig.connect(ipad, both, 185);
+  rig.connect(staff, both, 23);
+  rig.connect(guest, 1u << EVENT_KIND_STATUS, 23);
+
+  // 运维须 MITM 配对：未配对的中心声明运维被拒，仍是玩家
+  const uint8_t unpaired = rig.command(staff, { CMD_SET_ROLE, CLIENT_ROLE_OPERATOR });
+  check("operator needs pairing", unpaired == REJECT_ROLE && rig.io.clients.role(staff) == CLIENT_ROLE_PLAYER,
+        "SET_ROLE(operator) on an unpaired link -> EVT_REJECTED(role)");
+  rig.pair(staff);
+  uint8_t r = rig.command(staff, { CMD_SET_ROLE, CLIENT_ROLE_OPERATOR });
+  const uint8_t denied = rig.command(staff, { CMD_START_SESSION });
+  const Received* rep = rig.last(staff);
+  check("operator cannot start session", !r && denied == REJECT_ROLE && rep && rep->data.size() == 3 &&
+                                             rep->data[0] == EVT_REJECTED && rep->data[2] == REJECT_ROLE,
+        "EVT_REJECTED(role) to the operator only");
+
+  rig.clearInbox();
+  r = rig.command(ipad, { CMD_START_SESSION });
+  check("first player claims session", !r && rig.io.clients.owner() == ipad && rig.count(staff, EVENT_KIND_STATUS) == 1 &&
+                                           rig.count(guest, EVENT_KIND_STATUS) == 1,
+        fmt("owner=%u, started event fanned out to %u subscribers", rig.io.clients.owner(),
+            (unsigned)(rig.count(ipad, EVENT_KIND_STATUS) + rig.count(staff, EVENT_KIND_STATUS) +
+                       rig.count(guest, EVENT_KIND_STATUS))));
+
+  rig.clearInbox();
+  r = rig.command(guest, { CMD_PAYOUT, 3, 0 });
+  check("second player cannot pay out", r == REJECT_NOT_OWNER && !rig.core.payoutBusy() && rig.io.inbox[ipad].empty(),
+        "not owner, nothing dispensed");
+  r = rig.command(staff, { CMD_PAYOUT, 3, 0 });
+  check("operator cannot pay out", r == REJECT_ROLE && !rig.core.payoutBusy(), "role");
+
+  rig.clearInbox();
+  rig.insertCoin();
+  check("coin events only to subscribers", rig.count(ipad, EVENT_KIND_COIN) == 1 && rig.count(staff, EVENT_KIND_COIN) == 1 &&
+                                               rig.io.inbox[guest].empty(),
+        "guest subscribed to status only");
+
+  rig.clearInbox();
+  r = rig.command(ipad, { CMD_SET_EVENT_FORMAT, EVENT_FORMAT_EXTENDED });
+  rig.insertCoin();
+  const Received* a = rig.last(ipad);
+  const Received* b = rig.last(staff);
+  EventStamp stamp = {};
+  check("event format per connection", !r && rig.core.extendedEvents() && a && b && a->data.size() == 4 + EVENT_STAMP_LEN &&
+                                           b->data.size() == 4 && decodeEventStamp(a->data.data(), a->data.size(), stamp) &&
+                                           !memcmp(a->data.data(), b->data.data(), 4),
+        fmt("extended %zu bytes (seq %u), basic %zu bytes", a ? a->data.size() : 0, stamp.seq, b ? b->data.size() : 0));
+
+  rig.clearInbox();
+  rig.command(staff, { CMD_SET_EVENT_FORMAT, EVENT_FORMAT_EXTENDED });
+  r = rig.command(ipad, { CMD_PAYOUT, 2, 0, 7 });
+  rig.runPayout();
+  const Received* done = rig.last(staff);
+  check("owner pays out, all see result", !r && done && done->data[0] == EVT_PAYOUT_DONE && rig.count(guest, EVENT_KIND_STATUS) == 2,
+        fmt("request + run events: ipad %zu, staff %zu, guest %zu", rig.count(ipad, EVENT_KIND_STATUS),
+            rig.count(staff, EVENT_KIND_STATUS), rig.count(guest, EVENT_KIND_STATUS)));
+  // 单笔结果 7 字节 + 尾部 14 字节：MTU 23 的连接放不下尾部，只收基础 7 字节（不收截断的尾部）
+  const Received* big = &rig.io.inbox[ipad][0];
+  const Received* cut = &rig.io.inbox[staff][0];
+  EventStamp tail = {};
+  check("MTU drops stamp, not cuts it", big->data.size() == 7 + EVENT_STAMP_LEN && cut->data.size() == 7 &&
+                                            decodeEventStamp(big->data.data(), big->data.size(), tail) &&
+                                            !memcmp(big->data.data(), cut->data.data(), 7),
+        fmt("extended request result: ipad (MTU 185) %zu bytes, staff (MTU 23) %zu bytes", big->data.size(),
+            cut->data.size()));
+  rig.command(staff, { CMD_SET_EVENT_FORMAT, 0 });
+
+  rig.clearInbox();
+  r = rig.command(staff, { CMD_TIME_PING, 1, 2, 3, 4 });
+  check("replies are unicast", !r && rig.io.inbox[ipad].empty() && rig.io.inbox[guest].empty() && rig.last(staff) &&
+                                   rig.last(staff)->data[0] == EVT_TIME_PONG,
+        "TIME_PONG only to the pinging connection");
+
+  r = rig.command(staff, { CMD_PAYOUT_CANCEL });
+  const uint8_t guestCancel = rig.command(guest, { CMD_PAYOUT_CANCEL });
+  check("operator may cancel payout", !r && guestCancel == REJECT_NOT_OWNER,
+        "paired operator: safety stop allowed; unpaired player: not owner");
+
+  const uint32_t session = rig.core.sessionId();
+  rig.disconnect(ipad);
+  check("owner disconnect holds session", rig.io.clients.owner() == CLIENT_NONE &&
+                                              rig.io.clients.held((uint32_t)(rig.io.now / 1000)) &&
+                                              !rig.core.extendedEvents(),
+        "no connected owner, ownership held; core back to basic format (no extended client left)");
+
+  // 所有者短暂断线：余额仍在，其他（发过 SET_ROLE 的）玩家不能趁机认领并吐出；
+  // 会话号随 EVT_SESSION_STARTED 广播给了所有订阅者，拿它发 RESUME 也接不回
+  rig.command(guest, { CMD_SET_ROLE, CLIENT_ROLE_PLAYER });
+  rig.clearInbox();
+  const uint16_t credit = rig.core.coinTotal();
+  std::vector<uint8_t> resume(7, 0);
+  resume[0] = CMD_RESUME;
+  putLe32(&resume[1], session);
+  const uint8_t replay = rig.command(guest, resume);
+  r = rig.command(guest, { CMD_PAYOUT, 2, 0 });
+  const uint8_t restart = rig.command(guest, { CMD_START_SESSION });
+  check("held session not taken over", !replay && r == REJECT_NOT_OWNER && restart == REJECT_NOT_OWNER &&
+                                           !rig.core.payoutBusy() && rig.io.clients.owner() == CLIENT_NONE &&
+                                           rig.core.sessionId() == session && rig.core.coinTotal() == credit,
+        fmt("RESUME with the broadcast session id, PAYOUT, START_SESSION from another player; credit %u kept", credit));
+
+  const uint16_t ipadAgain = 3;
+  rig.connect(ipadAgain, both, 185, ipad + 1);
+  rig.clearInbox();
+  r = rig.command(ipadAgain, resume);
+  const Received* batch = rig.last(ipadAgain);
+  check("same peer reclaims session", !r && rig.io.clients.owner() == ipadAgain && batch &&
+                                          batch->data[0] == EVT_RESUME_BATCH && rig.io.inbox[staff].empty(),
+        fmt("owner=%u (reconnected from the owner's address), resume batch unicast", rig.io.clients.owner()));
+  r = rig.command(guest, { CMD_START_SESSION });
+  check("others still locked out", r == REJECT_NOT_OWNER && rig.core.sessionId() == session, "session unchanged");
+
+  rig.pair(ipadAgain, ipad + 1);
+  r = rig.command(ipadAgain, { CMD_SET_ROLE, CLIENT_ROLE_OPERATOR });
+  check("owner turning operator releases", !r && rig.io.clients.owner() == CLIENT_NONE, "no owner");
+  r = rig.command(guest, { CMD_SET_ROLE, 9 });
+  const uint8_t freed = rig.command(guest, { CMD_START_SESSION });
+  check("bad role rejected, guest claims", r == REJECT_ROLE && rig.io.clients.role(guest) == CLIENT_ROLE_PLAYER && !freed &&
+                                              rig.io.clients.owner() == guest,
+        "unknown role refused; free session claimed");
+
+  // 旧 App（不发 SET_ROLE、不续传、不处理拒绝）：同一设备重连直接开局/吐币；另一台旧 App 也不被保留挡住
+  PolicyRig legacy;
+  legacy.connect(ipad, both, 23);
+  legacy.command(ipad, { CMD_START_SESSION });
+  legacy.insertCoin();
+  legacy.disconnect(ipad);
+  legacy.connect(3, both, 23, ipad + 1);
+  const uint8_t back = legacy.command(3, { CMD_PAYOUT, 1, 0 });
+  legacy.runPayout();
+  legacy.disconnect(3);
+  legacy.connect(4, both, 23);
+  const uint8_t other = legacy.command(4, { CMD_START_SESSION });
+  check("legacy app not locked out", !back && !other && legacy.io.clients.owner() == 4,
+        "owner's own reconnect pays out at once; a role-less app claims the held session");
+
+  // 保留超时：CLIENT_OWNER_HOLD_MS 内拒绝，之后其他玩家可认领
+  PolicyRig lapse;
+  lapse.connect(ipad, both, 185);
+  lapse.connect(guest, both, 185);
+  lapse.command(guest, { CMD_SET_ROLE, CLIENT_ROLE_PLAYER });
+  lapse.command(ipad, { CMD_START_SESSION });
+  lapse.disconnect(ipad);
+  lapse.io.now += (CLIENT_OWNER_HOLD_MS - 1) * 1000ULL;
+  const uint8_t early = lapse.command(guest, { CMD_START_SESSION });
+  lapse.io.now += 2000;
+  const uint8_t late = lapse.command(guest, { CMD_START_SESSION });
+  check("hold expires", early == REJECT_NOT_OWNER && !late && lapse.io.clients.owner() == guest,
+        fmt("rejected at %u ms, claimed after %u ms", CLIENT_OWNER_HOLD_MS - 1, CLIENT_OWNER_HOLD_MS + 1));
+
+  // 固件升级：玩家（含会话所有者）不能 BEGIN；运维 BEGIN 后其他连接不能插入分片，断线即释放
+  GattClients<3> ota;
+  for (uint8_t c = 0; c < 3; c++) {
+    ota.connect(c, PolicyRig::peerAddr(c + 1).data());
+    if (c) ota.setPaired(PolicyRig::peerAddr(c + 1).data(), true);
+  }
+  ota.setRole(1, CLIENT_ROLE_OPERATOR);
+  ota.setRole(2, CLIENT_ROLE_OPERATOR);
+  ota.authorize(0, CMD_START_SESSION, 0);
+  const uint8_t playerBegin = ota.authorizeOta(0, OTA_OP_BEGIN);
+  const uint8_t opBegin = ota.authorizeOta(1, OTA_OP_BEGIN);
+  const uint8_t otherChunk = ota.authorizeOta(2, OTA_OP_CHUNK);
+  const uint8_t otherBegin = ota.authorizeOta(2, OTA_OP_BEGIN);
+  const uint8_t opChunk = ota.authorizeOta(1, OTA_OP_CHUNK);
+  ota.disconnect(1, 0);
+  const uint8_t takeover = ota.authorizeOta(2, OTA_OP_BEGIN);
+  check("OTA needs operator", playerBegin == REJECT_ROLE && !opBegin && otherChunk == REJECT_NOT_OWNER &&
+                                  otherBegin == REJECT_NOT_OWNER && !opChunk && !takeover && ota.otaOwner() == 2,
+        "owner/player BEGIN refused; one updating connection at a time, released on disconnect");
+
+  GattClients<2> small;
+  const bool full = small.connect(10) == 0 && small.connect(11) == 1 && small.connect(12) < 0;
+  check("connection limit", full && small.count() == 2, "third central refused");
+}
+
+// 续传回放：逐帧解析，统计帧数、条目数与末帧状态
+struct ResumeReplay {
+  unsigned frames = 0, entries = 0;
+  bool     ordered = true, wellFormed = true;
+  uint16_t lastSeq = 0;
+  ResumeSnapshot snap = {};
+
+  void add(const uint8_t* p, size_t len) {
+    frames++;
+    wellFormed &= parseResumeFrame(p, len, snap, [this](uint8_t, uint16_t seq, const uint8_t*, size_t) {
+      ordered &= entries == 0 || seqAfter(seq, lastSeq);
+      lastSeq = seq;
+      entries++;
+    });
+  }
+};
+
+// 续传在 MTU 23（cap 20）下：首帧带快照 + 一条 coin 事件，后续帧每帧两条；连后续帧都放不下的事件不得越过
+static void runResumeChecks() {
+  EventBacklog<8> backlog;
+  for (uint16_t seq = 1; seq <= 5; seq++) {
+    const uint8_t coin[4] = { (uint8_t)seq, 0, (uint8_t)seq, 0 };
+    backlog.push(seq, EVENT_KIND_COIN, coin, sizeof(coin));
+  }
+  const ResumeSnapshot snap = { 0x1234, 5, 5, 5, RESUME_STATUS_OK };
+  uint8_t frame[RESUME_FRAME_MAX];
+
+  uint16_t cursor = 0;
+  ResumeReplay small;
+  size_t len;
+  do {
+    len = backlog.buildResumeFrame(EVT_RESUME_BATCH, snap, small.frames == 0, cursor, frame, 20);
+    small.add(frame, len);
+  } while (len && (frame[1] & RESUME_FLAG_MORE) && small.frames < 10);
+  check("resume at MTU 23 fits coin events",
+        small.frames == 3 && small.entries == 5 && small.ordered && small.wellFormed && cursor == 5 &&
+            small.snap.status == RESUME_STATUS_OK && small.snap.sessionId == 0x1234,
+        fmt("%u frames, %u entries, cursor %u, status %u", small.frames, small.entries, cursor, small.snap.status));
+
+  // 8 个料斗的吐币完成（20 字节）连后续帧都放不下：回放停在它之前，以 RESUME_STATUS_MTU 结束
+  uint8_t payout[EVENT_BACKLOG_MAX_PAYLOAD] = { EVT_PAYOUT_DONE };
+  backlog.push(6, EVENT_KIND_STATUS, payout, sizeof(payout));
+  backlog.push(7, EVENT_KIND_COIN, payout, 4);
+  cursor = 4;
+  ResumeReplay cut;
+  do {
+    len = backlog.buildResumeFrame(EVT_RESUME_BATCH, snap, cut.frames == 0, cursor, frame, 20);
+    cut.add(frame, len);
+  } while (len && (frame[1] & RESUME_FLAG_MORE) && cut.frames < 10);
+  check("resume stops at an oversized event", cut.entries == 1 && cursor == 5 && cut.snap.status == RESUME_STATUS_MTU,
+        fmt("%u frames, %u entries, cursor %u, status %u", cut.frames, cut.entries, cursor, cut.snap.status));
+
+  // 经核心：MTU 23 的连接一次续传拿到会话开启与两次投币，与大 MTU 的结果一致
+  const uint8_t both = (1u << EVENT_KIND_COIN) | (1u << EVENT_KIND_STATUS);
+  PolicyRig rig;
+  rig.connect(0, both, 23);
+  rig.command(0, { CMD_START_SESSION });
+  rig.insertCoin();
+  rig.insertCoin();
+  std::vector<uint8_t> resume(7, 0);
+  resume[0] = CMD_RESUME;
+  putLe32(&resume[1], rig.core.sessionId());
+  ResumeReplay mtu23, mtu185;
+  rig.clearInbox();
+  rig.command(0, resume);
+  for (const Received& r : rig.io.inbox[0]) mtu23.add(r.data.data(), r.data.size());
+  rig.io.clients.setMtu(0, 185);
+  rig.clearInbox();
+  rig.command(0, resume);
+  for (const Received& r : rig.io.inbox[0]) mtu185.add(r.data.data(), r.data.size());
+  check("resume through the core at MTU 23",
+        mtu23.wellFormed && mtu23.snap.status == RESUME_STATUS_OK && mtu23.entries == 3 && mtu23.frames > 1 &&
+            mtu185.frames == 1 && mtu185.entries == 3 && mtu23.lastSeq == mtu185.lastSeq &&
+            mtu23.snap.coinTotal == 2,
+        fmt("MTU 23: %u frames, status %u; MTU 185: %u frame, %u events", mtu23.frames, mtu23.snap.status,
+            mtu185.frames, mtu185.entries));
+}
+
+// 扫描用的连接组合：conn 0 为玩家（coin + status，扩展格式），其余为运维终端（status，奇数号另订 coin，基础格式）
+static void connectMix(GattClients<FANOUT_MAX_CONNS>& clients, uint8_t conns) {
+  for (uint8_t c = 0; c < conns; c++) {
+    clients.connect(c, PolicyRig::peerAddr(c + 1).data());
+    clients.setPaired(PolicyRig::peerAddr(c + 1).data(), c != 0);
+    clients.setMtu(c, 185);
+    clients.setSubscribed(c, EVENT_KIND_STATUS, true);
+    clients.setSubscribed(c, EVENT_KIND_COIN, c == 0 || (c & 1));
+    clients.setExtended(c, c == 0);
+    if (c) clients.setRole(c, CLIENT_ROLE_OPERATOR);
+  }
+}
+
+// ==== 主机开销：连接表取目标 + 每连接一次入队拷贝（不含协议栈发送本身，那部分按 -c 计） ====
+static double timeFanout(uint8_t conns, uint32_t iterations) {
+  static uint8_t sink[FANOUT_MAX_CONNS][256];
+  GattClients<FANOUT_MAX_CONNS> clients;
+  connectMix(clients, conns);
+  uint8_t frame[7 + EVENT_STAMP_LEN] = {};
+  uint64_t bytes = 0;
+  const double t0 = nowSec();
+  for (uint32_t it = 0; it < iterations; it++) {
+    putLe16(frame, (uint16_t)it);
+    putLe16(frame + 7, (uint16_t)it);
+    const uint8_t kind = (it & 1) ? EVENT_KIND_COIN : EVENT_KIND_STATUS;
+    clients.fanout(kind, frame, kind == EVENT_KIND_COIN ? 4 : 7, EVENT_STAMP_LEN,
+                   [&](uint16_t conn, const uint8_t* d, uint16_t n) {
+                     memcpy(sink[conn], d, n);
+                     bytes += n;
+                     return true;
+                   });
+  }
+  const double ns = (nowSec() - t0) * 1e9 / iterations;
+  return bytes ? ns : 0;
+}
+
+// ==== 空口时延模型 ====
+struct AirModel {
+  double ciMs = 30;         // iOS 常见连接间隔
+  double sendUs = 40;       // 每次 esp_ble_gatts_send_indicate 的协议栈开销（BTC 消息 + 分配 + 拷贝）
+  double rate = 20;         // coin/status 事件每秒
+  uint16_t dle = 27;        // LL 负载上限（未开数据长度扩展为 27）
+  uint8_t perEvent = 6;     // 每连接事件最多包数
+  uint8_t queueCap = 8;     // 每连接发送缓冲（包）
+  double seconds = 120;
+};
+
+// 一个 ATT 通知在空口上的时长：分片，每片 = (前导1 + 地址4 + 头2 + 负载 + CRC3)·8us + T_IFS + 空 ACK 80us + T_IFS
+static double airUs(uint16_t attLen, uint16_t dle) {
+  uint32_t l2cap = attLen + 3 + 4;
+  double us = 0;
+  while (l2cap) {
+    const uint32_t frag = std::min<uint32_t>(l2cap, dle);
+    us += (1 + 4 + 2 + frag + 3) * 8.0 + 150 + 80 + 150;
+    l2cap -= frag;
+  }
+  return us;
+}
+
+struct AirResult {
+  std::vector<double> latencyMs;
+  uint64_t sends = 0, broadcastSends = 0, drops = 0, events = 0;
+};
+
+struct Pending {
+  double readyUs;  // 主机把该包交给控制器的时刻
+  double eventUs;  // 核心产生事件的时刻
+  uint16_t len;
+};
+
+static AirResult simulateAir(uint8_t conns, const AirModel& m, uint32_t seed) {
+  GattClients<FANOUT_MAX_CONNS> clients;
+  connectMix(clients, conns);
+
+  // 主机侧：事件逐个扇出，发送调用串行，后面的连接晚 sendUs 入队
+  AirResult res;
+  std::mt19937 rng(seed);
+  std::exponential_distribution<double> gap(m.rate / 1e6);
+  std::vector<std::vector<Pending>> perConn(conns);
+  double hostFreeUs = 0;
+  for (double t = gap(rng); t < m.seconds * 1e6; t += gap(rng)) {
+    const bool coin = rng() & 1;
+    ClientTarget targets[FANOUT_MAX_CONNS];
+    const uint8_t n = clients.targets(coin ? EVENT_KIND_COIN : EVENT_KIND_STATUS, coin ? 4 : 7, EVENT_STAMP_LEN, targets);
+    double at = std::max(t, hostFreeUs);
+    for (uint8_t i = 0; i < n; i++) {
+      at += m.sendUs;
+      perConn[targets[i].conn].push_back({ at, t, targets[i].len });
+    }
+    hostFreeUs = at;
+    res.events++;
+    res.sends += n;
+    res.broadcastSends += conns;  // BLECharacteristic::notify()：每个连接都发，不看订阅
+  }
+
+  // 控制器：连接 c 的锚点 = c·间隔/n + k·间隔，连接事件时长不超过 间隔/n
+  const double ciUs = m.ciMs * 1000, windowUs = ciUs / conns;
+  for (uint8_t c = 0; c < conns; c++) {
+    std::deque<Pending> queue;
+    size_t next = 0;
+    const std::vector<Pending>& in = perConn[c];
+    for (double anchor = c * windowUs; next < in.size() || !queue.empty(); anchor += ciUs) {
+      for (; next < in.size() && in[next].readyUs <= anchor; next++) {
+        if (queue.size() >= m.queueCap) {
+          res.drops++;
+          continue;
+        }
+        queue.push_back(in[next]);
+      }
+      double used = 0;
+      for (uint8_t k = 0; k < m.perEvent && !queue.empty(); k++) {
+        const double pkt = airUs(queue.front().len, m.dle);
+        if (used + pkt > windowUs && k) break;
+        used += pkt;
+        res.latencyMs.push_back((anchor + used - queue.front().eventUs) / 1000);
+        queue.pop_front();
+      }
+    }
+  }
+  return res;
+}
+
+int main(int argc, char** argv) {
+  AirModel m;
+  int maxConns = FANOUT_MAX_CONNS;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:i:c:r:d:k:q:t:")) != -1) {
+    switch (opt) {
+      case 'n': maxConns = atoi(optarg); break;
+      case 'i': m.ciMs = atof(optarg); break;
+      case 'c': m.sendUs = atof(optarg); break;
+      case 'r': m.rate = atof(optarg); break;
+      case 'd': m.dle = (uint16_t)atoi(optarg); break;
+      case 'k': m.perEvent = (uint8_t)atoi(optarg); break;
+      case 'q': m.queueCap = (uint8_t)atoi(optarg); break;
+      case 't': m.seconds = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: gatt_fanout [-n max_conns] [-i ci_ms] [-c send_us] [-r events_per_s] [-d ll_payload]\n"
+                        "                   [-k packets_per_event] [-q queue] [-t seconds]\n");
+        return 2;
+    }
+  }
+  if (maxConns < 1 || maxConns > FANOUT_MAX_CONNS || m.ciMs <= 0 || m.rate <= 0 || m.dle < 27 || m.dle > 251 ||
+      !m.perEvent || !m.queueCap || m.seconds <= 0) {
+    fprintf(stderr, "max_conns 1..%d, ci_ms/events_per_s/seconds > 0, ll_payload 27..251, packets/queue >= 1\n",
+            FANOUT_MAX_CONNS);
+    return 2;
+  }
+
+  printf("== policy (firmware limit BLE_MAX_CONNECTIONS=%d) ==\n", BLE_MAX_CONNECTIONS);
+  runPolicyChecks();
+  runResumeChecks();
+
+  printf("\n== fan-out vs connections: CI %.1f ms, %.0f us per send, %.0f events/s, LL payload %u, "
+         "%u pkts/event, queue %u ==\n",
+         m.ciMs, m.sendUs, m.rate, m.dle, m.perEvent, m.queueCap);
+  printf("%5s  %13s  %9s  %15s  %26s  %6s\n", "conns", "sends/ev", "table ns", "stack us/ev", "air latency ms p50/p99/max",
+         "drops");
+  printf("%5s  %13s  %9s  %15s\n", "", "table/bcast", "per ev", "table/bcast");
+  for (int n = 1; n <= maxConns; n++) {
+    const double cpuNs = timeFanout((uint8_t)n, 2000000);
+    AirResult air = simulateAir((uint8_t)n, m, 12345u + n);
+    const double perEv = (double)air.sends / air.events, bcastEv = (double)air.broadcastSends / air.events;
+    const double p50 = percentile(air.latencyMs, 0.50), p99 = percentile(air.latencyMs, 0.99);
+    const double mx = air.latencyMs.empty() ? 0 : *std::max_element(air.latencyMs.begin(), air.latencyMs.end());
+    printf("%5d  %5.2f / %5.2f  %9.1f  %6.0f / %6.0f  %8.1f / %6.1f / %6.1f  %6llu%s\n", n, perEv, bcastEv, cpuNs,
+           perEv * m.sendUs, bcastEv * m.sendUs, p50, p99, mx, (unsigned long long)air.drops,
+           n == BLE_MAX_CONNECTIONS ? "  <- firmware limit" : "");
+  }
+  printf("\nmix: conn 0 player (coin+status, extended), others operators (status; odd ones also coin, basic)\n"
+         "table ns: connection-table lookup + one copy per subscriber on this host; stack us: sends x -c\n"
+         "air latency: core event -> peer receives; sends serialise at -c us, so later connections queue later\n");
+
+  printf("\n%s\n", failures ? "FAILED" : "all checks passed");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,569 @@
+// K 线数据包：把 KLineSwift/Resources/*.csv 转成列式二进制包（include/kline_pack.h），并校验、测速
+// 用法：
+//   kline_pack [-s 段长] [-v 成交量小数位] [-o 输出] [CSV目录]   默认目录 ../../KLineSwift/KLineSwift/Resources，
+//                                                               输出 bin/klines.klp
+//   kline_pack dump <包> <代码> [起点] [根数]                    按 CSV 格式输出一段（如 dump bin/klines.klp ETHUSDT 100 5）
+//
+// 文件名 "<代码>_<名称>.csv"，如 ETHUSDT_以太坊.csv；按文件名排序写入。
+// 价格按文件中最长的小数位数转定点（无损）；成交量文本里带浮点打印误差（如 67462293.23999999），
+// 默认保留 3 位小数（四舍五入），-v 可调，最多 KLP_MAX_DIGITS 位。
+// 生成后 mmap 回读，逐根与 CSV 定点值比对，并与 strtod 解析结果比对（误差 ≤ 半个末位）；
+// 报告各币种的压缩比，以及 CSV 解析、开包、全量解码、随机取窗口（与 App 一致：前留 30 根、后留 300 根）的耗时；
+// 另测损坏/截断的包能被拒绝。任一检查失败时退出码为 1。
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "kline_pack.h"
+
+static const char* kDefaultDir = "../../KLineSwift/KLineSwift/Resources";
+static const char* kDefaultOut = "bin/klines.klp";
+static const uint32_t kWindowLead = 30;    // GameViewModel.selectStock：最早 30 天后开始
+static const uint32_t kWindowTail = 300;   // 最晚 300 天前开始
+static const uint32_t kWindowBars = 300;
+
+static double nowSec() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool readFile(const char* path, std::vector<uint8_t>& out) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.insert(out.end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
+
+// ==== CSV ====
+struct Series {
+  std::string symbol, name, path;
+  size_t csvBytes = 0;
+  std::vector<std::string> text[KLP_COLUMN_COUNT];   // 原始字段，定点化与比对用
+  uint32_t interval = 0;
+  uint8_t priceDigits = 0, volumeDigits = 0;
+  std::vector<uint32_t> time;
+  std::vector<int32_t> price[4];
+  std::vector<uint64_t> volume;
+};
+
+static int fractionDigits(const std::string& s) {
+  const size_t dot = s.find('.');
+  return dot == std::string::npos ? 0 : (int)(s.size() - dot - 1);
+}
+
+// 十进制文本 → 定点整数（digits 位小数，超出部分四舍五入）；不接受负数与指数形式
+static bool toFixed(const std::string& s, int digits, uint64_t& out) {
+  uint64_t v = 0;
+  int frac = -1;
+  bool any = false, roundUp = false;
+  for (size_t i = 0; i < s.size(); i++) {
+    const char c = s[i];
+    if (c == '.' && frac < 0) {
+      frac = 0;
+      continue;
+    }
+    if (c < '0' || c > '9') return false;
+    any = true;
+    if (frac >= digits) {
+      if (frac == digits) roundUp = c >= '5';
+      frac++;
+      continue;
+    }
+    if (v > (UINT64_MAX - 9) / 10) return false;
+    v = v * 10 + (uint64_t)(c - '0');
+    if (frac >= 0) frac++;
+  }
+  for (int f = frac < 0 ? 0 : std::min(frac, digits); f < digits; f++) {
+    if (v > UINT64_MAX / 10) return false;
+    v *= 10;
+  }
+  out = v + (roundUp ? 1 : 0);
+  return any;
+}
+
+static bool loadCsv(Series& s, int volumeDigits) {
+  std::vector<uint8_t> raw;
+  if (!readFile(s.path.c_str(), raw)) {
+    fprintf(stderr, "cannot read %s\n", s.path.c_str());
+    return false;
+  }
+  s.csvBytes = raw.size();
+  const std::string all(raw.begin(), raw.end());
+  size_t pos = all.find('\n');  // 跳过标题行
+  int line = 1;
+  while (pos != std::string::npos && pos + 1 < all.size()) {
+    size_t end = all.find('\n', pos + 1);
+    std::string row = all.substr(pos + 1, end == std::string::npos ? std::string::npos : end - pos - 1);
+    pos = end;
+    line++;
+    while (!row.empty() && (row.back() == '\r' || row.back() == ' ')) row.pop_back();
+    if (row.empty()) continue;
+    std::string f[KLP_COLUMN_COUNT];
+    size_t a = 0;
+    int c = 0;
+    for (; c < KLP_COLUMN_COUNT; c++) {
+      const size_t b = row.find(',', a);
+      f[c] = row.substr(a, b == std::string::npos ? std::string::npos : b - a);
+      if (b == std::string::npos) break;
+      a = b + 1;
+    }
+    if (c < KLP_COLUMN_COUNT - 1) {
+      fprintf(stderr, "%s:%d: expected %d columns\n", s.path.c_str(), line, KLP_COLUMN_COUNT);
+      return false;
+    }
+    for (int k = 0; k < KLP_COLUMN_COUNT; k++) s.text[k].push_back(f[k]);
+  }
+  const size_t n = s.text[0].size();
+  if (n == 0) {
+    fprintf(stderr, "%s: no rows\n", s.path.c_str());
+    return false;
+  }
+
+  int pd = 0;
+  for (int c = KLP_COL_OPEN; c <= KLP_COL_CLOSE; c++)
+    for (const std::string& t : s.text[c]) pd = std::max(pd, fractionDigits(t));
+  if (pd > KLP_MAX_DIGITS) {
+    fprintf(stderr, "%s: %d price digits, max %d\n", s.path.c_str(), pd, KLP_MAX_DIGITS);
+    return false;
+  }
+  int vd = 0;
+  for (const std::string& t : s.text[KLP_COL_VOLUME]) vd = std::max(vd, fractionDigits(t));
+  s.priceDigits = (uint8_t)pd;
+  s.volumeDigits = (uint8_t)std::min(vd, volumeDigits);
+
+  std::map<uint32_t, size_t> deltas;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t t, v;
+    if (!toFixed(s.text[KLP_COL_TIME][i], 0, t) || t > UINT32_MAX) {
+      fprintf(stderr, "%s:%zu: bad time %s\n", s.path.c_str(), i + 2, s.text[KLP_COL_TIME][i].c_str());
+      return false;
+    }
+    if (i && t <= s.time.back()) {
+      fprintf(stderr, "%s:%zu: time not increasing\n", s.path.c_str(), i + 2);
+      return false;
+    }
+    if (i) deltas[(uint32_t)t - s.time.back()]++;
+    s.time.push_back((uint32_t)t);
+    for (int c = 0; c < 4; c++) {
+      if (!toFixed(s.text[KLP_COL_OPEN + c][i], pd, v) || v > INT32_MAX) {
+        fprintf(stderr, "%s:%zu: bad price %s\n", s.path.c_str(), i + 2, s.text[KLP_COL_OPEN + c][i].c_str());
+        return false;
+      }
+      s.price[c].push_back((int32_t)v);
+    }
+    if (!toFixed(s.text[KLP_COL_VOLUME][i], s.volumeDigits, v)) {
+      fprintf(stderr, "%s:%zu: bad volume %s\n", s.path.c_str(), i + 2, s.text[KLP_COL_VOLUME][i].c_str());
+      return false;
+    }
+    s.volume.push_back(v);
+  }
+  // 主周期取最常见的相邻差
+  size_t best = 0;
+  for (const auto& d : deltas)
+    if (d.second > best) {
+      best = d.second;
+      s.interval = d.first;
+    }
+  return true;
+}
+
+// ==== 写包 ====
+class BitPacker {
+ public:
+  explicit BitPacker(std::vector<uint8_t>& out) : out_(out) {}
+
+  void put(uint64_t v, uint8_t w) {
+    for (uint8_t i = 0; i < w; i++) {
+      if (!(bit_ & 7)) out_.push_back(0);
+      if ((v >> i) & 1) out_.back() |= (uint8_t)(1u << (bit_ & 7));
+      bit_++;
+    }
+  }
+
+ private:
+  std::vector<uint8_t>& out_;
+  uint64_t bit_ = 0;
+};
+
+static uint8_t bitWidth(uint64_t v) {
+  uint8_t w = 0;
+  while (w < 64 && (v >> w)) w++;
+  return w;
+}
+
+static inline uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+
+static void align4(std::vector<uint8_t>& out) {
+  while (out.size() & 3) out.push_back(0);
+}
+
+static std::vector<uint8_t> buildPack(const std::vector<Series>& all, uint16_t segBars) {
+  std::vector<uint8_t> out(KLP_HEADER_LEN + all.size() * KLP_SYMBOL_ENTRY_LEN, 0);
+  uint32_t total = 0;
+  for (size_t si = 0; si < all.size(); si++) {
+    const Series& s = all[si];
+    const uint32_t n = (uint32_t)s.time.size();
+    const uint16_t segs = (uint16_t)((n + segBars - 1) / segBars);
+    align4(out);
+    const uint32_t indexOff = (uint32_t)out.size();
+    out.resize(out.size() + (size_t)segs * KLP_SEGMENT_ENTRY_LEN, 0);
+    align4(out);
+    const uint32_t dataOff = (uint32_t)out.size();
+    for (uint32_t seg = 0; seg < segs; seg++) {
+      const uint32_t a = seg * segBars, b = std::min(n, a + segBars);
+      uint8_t* e = &out[indexOff + (size_t)seg * KLP_SEGMENT_ENTRY_LEN];
+      putLe32(e, (uint32_t)out.size() - dataOff);
+      putLe32(e + 4, s.time[a]);
+      uint8_t w[KLP_COLUMN_COUNT] = {};
+      std::vector<uint64_t> tz(b - a, 0);
+      for (uint32_t i = a + 1; i < b; i++) {
+        tz[i - a] = zigzag((int64_t)s.time[i] - s.time[i - 1] - s.interval);
+        w[KLP_COL_TIME] = std::max(w[KLP_COL_TIME], bitWidth(tz[i - a]));
+      }
+      int32_t base[4];
+      for (int c = 0; c < 4; c++) {
+        const auto mm = std::minmax_element(s.price[c].begin() + a, s.price[c].begin() + b);
+        base[c] = *mm.first;
+        w[KLP_COL_OPEN + c] = bitWidth((uint64_t)(*mm.second - *mm.first));
+        putLe32(e + 8 + 4 * c, (uint32_t)base[c]);
+      }
+      const auto vm = std::minmax_element(s.volume.begin() + a, s.volume.begin() + b);
+      putLe64(e + 24, *vm.first);
+      w[KLP_COL_VOLUME] = bitWidth(*vm.second - *vm.first);
+      memcpy(e + 32, w, KLP_COLUMN_COUNT);
+
+      // e 之后 out 会扩容，不能再用
+      std::vector<uint8_t> bits;
+      BitPacker bp(bits);
+      for (uint32_t i = a; i < b; i++) bp.put(tz[i - a], w[KLP_COL_TIME]);
+      for (int c = 0; c < 4; c++)
+        for (uint32_t i = a; i < b; i++) bp.put((uint64_t)(s.price[c][i] - base[c]), w[KLP_COL_OPEN + c]);
+      for (uint32_t i = a; i < b; i++) bp.put(s.volume[i] - *vm.first, w[KLP_COL_VOLUME]);
+      out.insert(out.end(), bits.begin(), bits.end());
+    }
+    uint8_t* d = &out[KLP_HEADER_LEN + si * KLP_SYMBOL_ENTRY_LEN];
+    strncpy((char*)d, s.symbol.c_str(), KLP_SYMBOL_LEN - 1);
+    strncpy((char*)d + KLP_SYMBOL_LEN, s.name.c_str(), KLP_NAME_LEN - 1);
+    putLe32(d + 40, s.time[0]);
+    putLe32(d + 44, n);
+    putLe32(d + 48, s.interval);
+    d[52] = s.priceDigits;
+    d[53] = s.volumeDigits;
+    putLe16(d + 54, segs);
+    putLe32(d + 56, indexOff);
+    putLe32(d + 60, dataOff);
+    total += n;
+  }
+  memcpy(&out[0], KLP_MAGIC, 4);
+  out[4] = KLP_FORMAT_VERSION;
+  out[5] = (uint8_t)all.size();
+  putLe16(&out[6], segBars);
+  putLe32(&out[8], total);
+  putLe32(&out[12], (uint32_t)out.size());
+  putLe32(&out[16], fnv1a32(&out[KLP_HEADER_LEN], out.size() - KLP_HEADER_LEN));
+  return out;
+}
+
+static bool listCsv(const char* dir, std::vector<Series>& all) {
+  DIR* d = opendir(dir);
+  if (!d) {
+    fprintf(stderr, "cannot open %s\n", dir);
+    return false;
+  }
+  while (dirent* e = readdir(d)) {
+    const std::string f = e->d_name;
+    if (f.size() < 5 || f.compare(f.size() - 4, 4, ".csv") != 0) continue;
+    Series s;
+    const std::string base = f.substr(0, f.size() - 4);
+    const size_t us = base.find('_');
+    s.symbol = base.substr(0, us);
+    s.name = us == std::string::npos ? "" : base.substr(us + 1);
+    s.path = std::string(dir) + "/" + f;
+    if (s.symbol.empty() || s.symbol.size() >= KLP_SYMBOL_LEN || s.name.size() >= KLP_NAME_LEN) {
+      fprintf(stderr, "%s: symbol/name too long (max %d/%d bytes)\n", f.c_str(), KLP_SYMBOL_LEN - 1, KLP_NAME_LEN - 1);
+      closedir(d);
+      return false;
+    }
+    all.push_back(s);
+  }
+  closedir(d);
+  std::sort(all.begin(), all.end(), [](const Series& a, const Series& b) { return a.path < b.path; });
+  if (all.empty() || all.size() > 255) {
+    fprintf(stderr, "%s: %zu csv files (need 1..255)\n", dir, all.size());
+    return false;
+  }
+  return true;
+}
+
+static int dump(int argc, char** argv) {
+  if (argc < 4) {
+    fprintf(stderr, "usage: kline_pack dump <pack> <symbol> [start] [count]\n");
+    return 2;
+  }
+  KLinePackFile pack;
+  if (!pack.map(argv[2])) {
+    fprintf(stderr, "cannot open pack %s\n", argv[2]);
+    return 2;
+  }
+  const int sym = pack.find(argv[3]);
+  if (sym < 0) {
+    fprintf(stderr, "%s not in pack\n", argv[3]);
+    return 2;
+  }
+  KLineSymbol info;
+  pack.symbol((uint8_t)sym, info);
+  const uint32_t start = argc > 4 ? (uint32_t)strtoul(argv[4], nullptr, 10) : 0;
+  const uint32_t count = argc > 5 ? (uint32_t)strtoul(argv[5], nullptr, 10) : info.bars;
+  printf("time,open,high,low,close,volume\n");
+  for (uint32_t i = start; i < start + count; i++) {
+    KLineBar b;
+    if (!pack.bar((uint8_t)sym, i, b)) break;
+    const int pd = info.priceDigits, vd = info.volumeDigits;
+    printf("%u,%.*f,%.*f,%.*f,%.*f,%.*f\n", b.time, pd, klpToDouble(b.open, pd), pd, klpToDouble(b.high, pd), pd,
+           klpToDouble(b.low, pd), pd, klpToDouble(b.close, pd), vd, klpToDouble((int64_t)b.volume, vd));
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && !strcmp(argv[1], "dump")) return dump(argc, argv);
+  const char* dir = kDefaultDir;
+  const char* outPath = kDefaultOut;
+  int segBars = 64, volumeDigits = 3;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      segBars = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-v") && i + 1 < argc) {
+      volumeDigits = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      outPath = argv[++i];
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "usage: kline_pack [-s segment_bars] [-v volume_digits] [-o out] [csv_dir]\n"
+                      "       kline_pack dump <pack> <symbol> [start] [count]\n");
+      return 2;
+    } else {
+      dir = argv[i];
+    }
+  }
+  if (segBars < 1 || segBars > KLP_MAX_SEGMENT_BARS || (segBars & (segBars - 1)) || volumeDigits < 0 ||
+      volumeDigits > KLP_MAX_DIGITS) {
+    fprintf(stderr, "segment_bars must be a power of two <= %d, volume_digits 0..%d\n", KLP_MAX_SEGMENT_BARS,
+            KLP_MAX_DIGITS);
+    return 2;
+  }
+
+  std::vector<Series> all;
+  if (!listCsv(dir, all)) return 2;
+  for (Series& s : all) {
+    if (!loadCsv(s, volumeDigits)) return 2;
+    if ((s.time.size() + segBars - 1) / segBars > UINT16_MAX) {
+      fprintf(stderr, "%s: %zu bars need more than %u segments, use a larger -s\n", s.path.c_str(), s.time.size(),
+              UINT16_MAX);
+      return 2;
+    }
+  }
+
+  // 基准：与 App（CSVParser.swift）相同的做法，逐行切分后 strtod 成 double
+  size_t csvTotal = 0;
+  uint32_t barTotal = 0;
+  std::vector<std::vector<uint8_t>> csvRaw(all.size());
+  for (size_t i = 0; i < all.size(); i++) readFile(all[i].path.c_str(), csvRaw[i]);
+  double t0 = nowSec();
+  volatile double sink = 0;
+  for (const std::vector<uint8_t>& raw : csvRaw) {
+    std::string text(raw.begin(), raw.end());
+    char* save = nullptr;
+    char* line = strtok_r(&text[0], "\n", &save);
+    for (line = strtok_r(nullptr, "\n", &save); line; line = strtok_r(nullptr, "\n", &save)) {
+      char* p = line;
+      for (int c = 0; c < KLP_COLUMN_COUNT; c++) {
+        sink += strtod(p, &p);
+        if (*p == ',') p++;
+      }
+    }
+  }
+  const double csvParseSec = nowSec() - t0;
+
+  const std::vector<uint8_t> built = buildPack(all, (uint16_t)segBars);
+  FILE* f = fopen(outPath, "wb");
+  if (!f || fwrite(built.data(), 1, built.size(), f) != built.size()) {
+    fprintf(stderr, "cannot write %s\n", outPath);
+    if (f) fclose(f);
+    return 2;
+  }
+  fclose(f);
+
+  t0 = nowSec();
+  KLinePackFile pack;
+  const bool mapped = pack.map(outPath);
+  const double openSec = nowSec() - t0;
+  if (!mapped) {
+    fprintf(stderr, "cannot map %s\n", outPath);
+    return 1;
+  }
+  int failures = 0;
+  auto check = [&](bool ok, const char* what) {
+    printf("  %-44s %s\n", what, ok ? "ok" : "FAIL");
+    if (!ok) failures++;
+  };
+
+  printf("pack: %s, %zu bytes, %u symbols, %u bars, segment %d bars, volume %d digits\n\n", outPath, built.size(),
+         pack.symbolCount(), pack.totalBars(), segBars, volumeDigits);
+  printf("%-10s %6s %4s %4s %9s %9s %6s %10s  %s\n", "symbol", "bars", "pd", "vd", "csv", "pack", "ratio", "bits/bar",
+         "name");
+
+  // ---- 逐根比对 ----
+  bool exact = true, nearCsv = true;
+  std::vector<uint32_t> tm;
+  std::vector<int32_t> col[4];
+  std::vector<uint64_t> vol;
+  for (uint8_t si = 0; si < pack.symbolCount(); si++) {
+    const Series& s = all[si];
+    KLineSymbol info;
+    pack.symbol(si, info);
+    const uint32_t n = info.bars;
+    tm.assign(n, 0);
+    vol.assign(n, 0);
+    for (auto& c : col) c.assign(n, 0);
+    KLineColumns out;
+    out.time = tm.data();
+    out.open = col[0].data();
+    out.high = col[1].data();
+    out.low = col[2].data();
+    out.close = col[3].data();
+    out.volume = vol.data();
+    if (pack.read(si, 0, n, out) != n || strcmp(info.symbol, s.symbol.c_str()) || strcmp(info.name, s.name.c_str()) ||
+        n != s.time.size()) {
+      exact = false;
+      continue;
+    }
+    exact = exact && tm == s.time && vol == s.volume;
+    for (int c = 0; c < 4; c++) exact = exact && col[c] == s.price[c];
+    for (uint32_t i = 0; i < n; i++) {
+      for (int c = 0; c < 4; c++) {
+        const double v = strtod(s.text[KLP_COL_OPEN + c][i].c_str(), nullptr);
+        if (fabs(klpToDouble(col[c][i], info.priceDigits) - v) > 0.5 / pow(10, info.priceDigits) + 1e-12 * v)
+          nearCsv = false;
+      }
+      const double v = strtod(s.text[KLP_COL_VOLUME][i].c_str(), nullptr);
+      if (fabs(klpToDouble((int64_t)vol[i], info.volumeDigits) - v) > 0.5 / pow(10, info.volumeDigits) + 1e-12 * v)
+        nearCsv = false;
+    }
+    // 本币种占用：段索引 + 段数据
+    const uint32_t next = si + 1 < pack.symbolCount() ? getLe32(built.data() + KLP_HEADER_LEN +
+                                                                (si + 1) * KLP_SYMBOL_ENTRY_LEN + 56)
+                                                      : (uint32_t)built.size();
+    const uint32_t bytes = next - getLe32(built.data() + KLP_HEADER_LEN + si * KLP_SYMBOL_ENTRY_LEN + 56) +
+                           KLP_SYMBOL_ENTRY_LEN;
+    printf("%-10s %6u %4u %4u %9zu %9u %5.1fx %10.1f  %s\n", info.symbol, n, info.priceDigits, info.volumeDigits,
+           s.csvBytes, bytes, (double)s.csvBytes / bytes, bytes * 8.0 / n, info.name);
+    csvTotal += s.csvBytes;
+    barTotal += n;
+  }
+  printf("%-10s %6u %4s %4s %9zu %9zu %5.1fx %10.1f\n\n", "total", barTotal, "", "", csvTotal, built.size(),
+         (double)csvTotal / built.size(), built.size() * 8.0 / barTotal);
+
+  // ---- 耗时 ----
+  t0 = nowSec();
+  const int decodeRounds = 20;
+  for (int r = 0; r < decodeRounds; r++)
+    for (uint8_t si = 0; si < pack.symbolCount(); si++) {
+      tm.resize(std::max<size_t>(tm.size(), pack.bars(si)));
+      for (auto& c : col) c.resize(tm.size());
+      vol.resize(tm.size());
+      KLineColumns out;
+      out.time = tm.data();
+      out.open = col[0].data();
+      out.high = col[1].data();
+      out.low = col[2].data();
+      out.close = col[3].data();
+      out.volume = vol.data();
+      pack.read(si, 0, pack.bars(si), out);
+      sink += col[3][0];
+    }
+  const double decodeSec = (nowSec() - t0) / decodeRounds;
+
+  std::mt19937 rng(12345);
+  const int windows = 200000;
+  std::vector<int32_t> closeWin(kWindowBars);
+  std::vector<uint32_t> timeWin(kWindowBars);
+  bool windowsOk = true;
+  t0 = nowSec();
+  for (int w = 0; w < windows; w++) {
+    const uint8_t si = (uint8_t)(rng() % pack.symbolCount());
+    const uint32_t start = pack.randomStart(si, kWindowLead, kWindowTail, rng());
+    KLineColumns out;
+    out.time = timeWin.data();
+    out.close = closeWin.data();
+    const uint32_t got = pack.read(si, start, kWindowBars, out);
+    sink += closeWin[0];
+    if (w < 2000)
+      windowsOk = windowsOk && got == std::min<uint32_t>(kWindowBars, pack.bars(si) - start) && start >= kWindowLead &&
+                  start + kWindowTail <= pack.bars(si) && timeWin[0] == all[si].time[start] &&
+                  closeWin[got - 1] == all[si].price[3][start + got - 1];
+  }
+  const double windowSec = (nowSec() - t0) / windows;
+
+  const int singles = 1000000;
+  bool singlesOk = true;
+  t0 = nowSec();
+  for (int k = 0; k < singles; k++) {
+    const uint8_t si = (uint8_t)(rng() % pack.symbolCount());
+    const uint32_t i = rng() % pack.bars(si);
+    KLineBar b;
+    pack.bar(si, i, b);
+    sink += b.close;
+    if (k < 20000)
+      singlesOk = singlesOk && b.time == all[si].time[i] && b.open == all[si].price[0][i] &&
+                  b.volume == all[si].volume[i];
+  }
+  const double singleSec = (nowSec() - t0) / singles;
+
+  t0 = nowSec();
+  const bool verified = pack.verify();
+  const double verifySec = nowSec() - t0;
+
+  printf("%-36s %12s\n", "operation", "time");
+  printf("%-36s %9.2f ms\n", "csv split + strtod (all symbols)", csvParseSec * 1e3);
+  printf("%-36s %9.2f us\n", "mmap + open (structure check)", openSec * 1e6);
+  printf("%-36s %9.2f us\n", "verify checksum", verifySec * 1e6);
+  printf("%-36s %9.2f ms  (%.1f Mbars/s)\n", "decode all columns (all symbols)", decodeSec * 1e3,
+         barTotal / decodeSec / 1e6);
+  printf("%-36s %9.2f us  (time + close, %u bars)\n", "random window", windowSec * 1e6, kWindowBars);
+  printf("%-36s %9.1f ns\n\n", "random single bar (all columns)", singleSec * 1e9);
+
+  // ---- 损坏/截断 ----
+  std::vector<uint8_t> bad = built;
+  bad[bad.size() / 2] ^= 0x10;
+  KLinePack p1, p2, p3;
+  const bool corruptCaught = !p1.open(bad.data(), bad.size()) || !p1.verify();
+  const bool truncCaught = !p2.open(built.data(), built.size() - 1);
+  bad = built;
+  putLe32(&bad[getLe32(&bad[KLP_HEADER_LEN + 56])], 0x7FFFFFFF);  // 首个币种第 0 段的数据偏移越界
+  putLe32(&bad[16], fnv1a32(&bad[KLP_HEADER_LEN], bad.size() - KLP_HEADER_LEN));
+  const bool offsetCaught = !p3.open(bad.data(), bad.size());
+
+  printf("checks\n");
+  check(exact, "fixed-point round trip (all columns)");
+  check(nearCsv, "matches strtod within half an ulp");
+  check(verified, "checksum");
+  check(windowsOk, "random windows in range and match csv");
+  check(singlesOk, "random single bars match csv");
+  check(corruptCaught, "corrupted byte rejected");
+  check(truncCaught, "truncated pack rejected");
+  check(offsetCaught, "out-of-range segment offset rejected");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,195 @@
+// 端到端时延分析：读取客户端抓取的会话记录，按阶段拆分每条事件的时延
+// 用法：latency_report <capture.csv>
+//
+// 抓包格式（每行一条，# 开头为注释；客户端时间为单调时钟 us）：
+//   ping,<nonce>,<client_send_us>,<client_recv_us>,<pong 负载 hex>
+//   event,<coin|status>,<client_recv_us>,<client_handled_us>,<通知负载 hex>
+// event 负载须为扩展格式（CMD_SET_EVENT_FORMAT bit0），末尾带 event_stamp.h 定义的尾部。
+//
+// 阶段：
+//   input    = readyUs  - originUs   投币：首末脉冲间隔；吐币：指令到继电器全部停止
+//   firmware = notifyUs - readyUs    判定完成到发出通知（含脉冲串间隔判定、排队）
+//   radio    = client_recv - notifyUs（经时钟同步换算）
+//   app      = client_handled - client_recv
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "event_stamp.h"
+
+// 估计时钟漂移所需的最短同步样本跨度（us）
+static const double kMinDriftSpanUs = 60e6;
+
+struct Ping {
+  double clientMid;
+  double deviceMid;
+  double rtt;
+};
+
+struct Event {
+  std::string     kind;
+  uint8_t         id;
+  double          clientRecv;
+  double          clientHandled;
+  EventStamp      stamp;
+};
+
+static bool parseHex(const char* s, std::vector<uint8_t>& out) {
+  out.clear();
+  while (*s && *s != '\n' && *s != '\r') {
+    if (!s[1]) return false;
+    char b[3] = { s[0], s[1], 0 };
+    char* end = nullptr;
+    out.push_back((uint8_t)strtoul(b, &end, 16));
+    if (*end) return false;
+    s += 2;
+  }
+  return true;
+}
+
+// 把设备 u32 时间戳展开到与 ref 最接近的 64 位值
+static double unwrap(uint32_t t, double ref) {
+  const uint32_t refLow = (uint32_t)(int64_t)ref;
+  return ref + (double)(int32_t)(t - refLow);
+}
+
+static double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return NAN;
+  std::sort(v.begin(), v.end());
+  const size_t i = (size_t)llround(p * (double)(v.size() - 1));
+  return v[i];
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <capture.csv>\n", argv[0]);
+    return 2;
+  }
+  FILE* f = fopen(argv[1], "r");
+  if (!f) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  std::vector<Ping>  pings;
+  std::vector<Event> events;
+  std::vector<uint8_t> bytes;
+  char line[1024];
+  double devicePrev = NAN, clientPrev = NAN;
+  int lineNo = 0;
+  while (fgets(line, sizeof(line), f)) {
+    lineNo++;
+    if (line[0] == '#' || line[0] == '\n') continue;
+    char kind[16], field[16], hex[600];
+    double a = 0, b = 0;
+    if (sscanf(line, "ping,%15[^,],%lf,%lf,%599s", field, &a, &b, hex) == 4) {
+      if (!parseHex(hex, bytes) || bytes.size() < EVENT_TIME_PONG_LEN || bytes[0] != EVT_TIME_PONG) {
+        fprintf(stderr, "line %d: bad pong payload\n", lineNo);
+        continue;
+      }
+      // 以客户端流逝时间预测设备时间来展开回绕
+      const double mid = (a + b) / 2.0;
+      const double ref = isnan(devicePrev) ? (double)getLe32(&bytes[5]) : devicePrev + (mid - clientPrev);
+      const double rx  = unwrap(getLe32(&bytes[5]), ref);
+      const double tx  = unwrap(getLe32(&bytes[9]), rx);
+      pings.push_back({ mid, (rx + tx) / 2.0, (b - a) - (tx - rx) });
+      devicePrev = (rx + tx) / 2.0;
+      clientPrev = mid;
+    } else if (sscanf(line, "event,%15[^,],%lf,%lf,%599s", kind, &a, &b, hex) == 4) {
+      Event e;
+      if (!parseHex(hex, bytes) || !decodeEventStamp(bytes.data(), bytes.size(), e.stamp)) {
+        fprintf(stderr, "line %d: event without extended stamp\n", lineNo);
+        continue;
+      }
+      e.kind          = kind;
+      e.id            = strcmp(kind, "status") == 0 ? bytes[0] : 0;
+      e.clientRecv    = a;
+      e.clientHandled = b;
+      events.push_back(e);
+    }
+  }
+  fclose(f);
+
+  if (pings.size() < 2) {
+    fprintf(stderr, "need at least 2 ping samples for clock sync, got %zu\n", pings.size());
+    return 1;
+  }
+
+  // 只用 RTT 较小的一半样本做线性拟合：device = alpha + beta * client
+  std::vector<Ping> good = pings;
+  std::sort(good.begin(), good.end(), [](const Ping& x, const Ping& y) { return x.rtt < y.rtt; });
+  good.resize(std::max<size_t>(2, good.size() / 2));
+  double mc = 0, md = 0;
+  for (const Ping& p : good) { mc += p.clientMid; md += p.deviceMid; }
+  mc /= good.size();
+  md /= good.size();
+  double sxy = 0, sxx = 0;
+  for (const Ping& p : good) {
+    sxy += (p.clientMid - mc) * (p.deviceMid - md);
+    sxx += (p.clientMid - mc) * (p.clientMid - mc);
+  }
+  // 样本跨度太短时漂移估计被 RTT 抖动淹没，只估偏移
+  double lo = good.front().clientMid, hi = lo;
+  for (const Ping& p : good) { lo = std::min(lo, p.clientMid); hi = std::max(hi, p.clientMid); }
+  const double beta  = (sxx > 0 && hi - lo >= kMinDriftSpanUs) ? sxy / sxx : 1.0;
+  const double alpha = md - beta * mc;
+  printf("clock sync: %zu pings (%zu used), min rtt %.0f us, drift %+.1f ppm\n",
+         pings.size(), good.size(), good.front().rtt, (beta - 1.0) * 1e6);
+
+  printf("\n%-6s %-6s %6s %12s %12s %12s %12s %12s\n",
+         "kind", "event", "seq", "input_us", "firmware_us", "radio_us", "app_us", "total_us");
+  struct Stage { std::vector<double> input, firmware, radio, app, total; };
+  Stage coin, status;
+  int gaps = 0;
+  int prevSeq = -1;
+  for (const Event& e : events) {
+    const double devAtRecv = alpha + beta * e.clientRecv;
+    const double notify = unwrap(e.stamp.notifyUs, devAtRecv);
+    const double ready  = unwrap(e.stamp.readyUs, notify);
+    const double origin = unwrap(e.stamp.originUs, ready);
+    const double notifyClient = (notify - alpha) / beta;
+    const double originClient = (origin - alpha) / beta;
+
+    const double input    = ready - origin;
+    const double firmware = notify - ready;
+    const double radio    = e.clientRecv - notifyClient;
+    const double app      = e.clientHandled - e.clientRecv;
+    const double total    = e.clientHandled - originClient;
+    if (prevSeq >= 0 && (uint16_t)(e.stamp.seq - prevSeq) != 1) gaps += (uint16_t)(e.stamp.seq - prevSeq) - 1;
+    prevSeq = e.stamp.seq;
+
+    Stage& st = e.kind == "coin" ? coin : status;
+    st.input.push_back(input);
+    st.firmware.push_back(firmware);
+    st.radio.push_back(radio);
+    st.app.push_back(app);
+    st.total.push_back(total);
+
+    char id[8];
+    snprintf(id, sizeof(id), e.kind == "coin" ? "-" : "0x%02X", e.id);
+    printf("%-6s %-6s %6u %12.0f %12.0f %12.0f %12.0f %12.0f\n",
+           e.kind.c_str(), id, e.stamp.seq, input, firmware, radio, app, total);
+  }
+
+  printf("\nsummary (p50 / p95 / max, us); missing seq: %d\n", gaps);
+  const struct { const char* name; Stage* st; } groups[] = { { "coin", &coin }, { "status", &status } };
+  for (const auto& g : groups) {
+    if (g.st->total.empty()) continue;
+    printf("%s (%zu events)\n", g.name, g.st->total.size());
+    const struct { const char* name; std::vector<double>* v; } cols[] = {
+      { "input", &g.st->input }, { "firmware", &g.st->firmware }, { "radio", &g.st->radio },
+      { "app", &g.st->app }, { "total", &g.st->total },
+    };
+    for (const auto& c : cols) {
+      printf("  %-9s %10.0f %10.0f %10.0f\n", c.name, percentile(*c.v, 0.5), percentile(*c.v, 0.95),
+             percentile(*c.v, 1.0));
+    }
+  }
+  return 0;
+}
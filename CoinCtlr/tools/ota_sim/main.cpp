@@ -0,0 +1,789 @@
+// 固件升级仿真：仿真分区 + BLE 链路模型，测量有效传输速率，验证续传、纠错与回滚（include/ota_update.h）
+// 用法：
+//   ota_sim [-m MTU] [-i 连接间隔ms] [-k 每间隔包数] [镜像]   默认镜像为 ../.pio/build/esp32dev/firmware.bin，
+//                                                              没有时用本程序自身（机器码，可压缩性与固件相近）
+//   ota_sim pack <镜像> <升级包> -a <密钥> [-s]                生成升级包（-s 不压缩）；密钥为目标设备的 OTA_AUTH_KEY
+//                                                              （64 位十六进制），App 把包头放进 BEGIN，其余按 MTU 切片原样发送
+//
+// 链路：每个连接间隔最多 k 个 Write Without Response（每包 MTU - 3 字节），设备应答在下一个连接间隔送达。
+// 设备：单任务按序处理接收队列（长度 = window，满时丢帧），与固件 OTA 任务一致；每帧耗时 = 固定开销
+//   + 解压/校验（按输出字节估算）+ 仿真分区的擦写读时间。分区按 NOR 语义仿真（擦除置 0xFF，写只能 1→0），
+//   未擦先写计为错误。时序取常见 SPI NOR 典型值：4KB 扇区擦除 45ms、64KB 块擦除 150ms、256B 页写 0.7ms、读 20MB/s。
+// 报告：压缩参数对比、各窗口/擦除粒度下的传输时间与有效速率（镜像字节 / 总时间），以及各项测试结果；
+// 任一测试失败时退出码为 1。
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ota_update.h"
+
+static double nowSec() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool readFile(const char* path, std::vector<uint8_t>& out) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.insert(out.end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
+
+// ==== LZSS 压缩（与 OtaLzDecoder 位流对应）：哈希链 + 一步惰性匹配 ====
+class BitWriter {
+ public:
+  void put(uint32_t v, int bits) {
+    acc_ = (acc_ << bits) | (v & ((1u << bits) - 1));
+    n_ += bits;
+    while (n_ >= 8) {
+      n_ -= 8;
+      out.push_back((uint8_t)(acc_ >> n_));
+    }
+    acc_ &= (1ull << n_) - 1;
+  }
+  void flush() {
+    if (n_) out.push_back((uint8_t)(acc_ << (8 - n_)));
+    n_ = 0;
+  }
+  std::vector<uint8_t> out;
+
+ private:
+  uint64_t acc_ = 0;
+  int n_ = 0;
+};
+
+static std::vector<uint8_t> lzCompress(const std::vector<uint8_t>& in, int windowBits, int lookaheadBits) {
+  const size_t n = in.size();
+  const size_t window = (size_t)1 << windowBits;
+  const size_t maxLen = ((size_t)1 << lookaheadBits) - 1 + OTA_LZ_MIN_MATCH;
+  const size_t refBits = 1 + windowBits + lookaheadBits;
+  const int kMaxChain = 256;
+  std::vector<int32_t> head(65536, -1), prev(n, -1);
+  size_t inserted = 0;
+
+  auto key = [&](size_t p) { return (size_t)in[p] << 8 | in[p + 1]; };
+  auto insertUpTo = [&](size_t p) {
+    for (; inserted < p && inserted + 1 < n; inserted++) {
+      prev[inserted] = head[key(inserted)];
+      head[key(inserted)] = (int32_t)inserted;
+    }
+  };
+  auto longest = [&](size_t p, size_t& dist) {
+    size_t best = 0;
+    if (p + 1 >= n) return best;
+    insertUpTo(p);
+    const size_t limit = std::min(maxLen, n - p);
+    int depth = 0;
+    for (int32_t c = head[key(p)]; c >= 0 && p - (size_t)c <= window && depth < kMaxChain; c = prev[c], depth++) {
+      size_t len = 0;
+      while (len < limit && in[(size_t)c + len] == in[p + len]) len++;
+      if (len > best) {
+        best = len;
+        dist = p - (size_t)c;
+        if (len == limit) break;
+      }
+    }
+    return best;
+  };
+
+  BitWriter bw;
+  size_t i = 0;
+  while (i < n) {
+    size_t dist = 0, nextDist = 0;
+    size_t len = longest(i, dist);
+    // 回溯比同样长度的字面量短才用；下一位置匹配更长时先输出一个字面量
+    if (len * 9 <= refBits || (i + 1 < n && longest(i + 1, nextDist) > len)) {
+      bw.put(0x100 | in[i], 9);
+      i++;
+      continue;
+    }
+    bw.put(0, 1);
+    bw.put((uint32_t)(dist - 1), windowBits);
+    bw.put((uint32_t)(len - OTA_LZ_MIN_MATCH), lookaheadBits);
+    i += len;
+  }
+  bw.flush();
+  return bw.out;
+}
+
+// 仿真设备的密钥；打包工具的密钥由 -a 给出
+static const char kTestKey[] = "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f";
+
+// 升级包 = 包头（含标签）+ 数据流
+static std::vector<uint8_t> makePackage(const std::vector<uint8_t>& image, uint8_t method, int windowBits,
+                                        int lookaheadBits, const uint8_t* key) {
+  OtaImageHeader h = {};
+  h.method        = method;
+  h.windowBits    = (uint8_t)(method == OTA_METHOD_LZSS ? windowBits : 0);
+  h.lookaheadBits = (uint8_t)(method == OTA_METHOD_LZSS ? lookaheadBits : 0);
+  h.imageSize     = (uint32_t)image.size();
+  h.imageCrc      = otaCrc32(image.data(), image.size());
+  const std::vector<uint8_t> stream = method == OTA_METHOD_LZSS ? lzCompress(image, windowBits, lookaheadBits) : image;
+  h.streamSize = (uint32_t)stream.size();
+  otaSignHeader(h, key, image.data(), image.size());
+  std::vector<uint8_t> pkg(OTA_HEADER_LEN);
+  otaPutHeader(pkg.data(), h);
+  pkg.insert(pkg.end(), stream.begin(), stream.end());
+  return pkg;
+}
+
+// ==== 仿真分区 ====
+struct FlashTiming {
+  double sectorEraseUs = 45000;   // 4KB
+  double blockEraseUs  = 150000;  // 64KB
+  double pageProgUs    = 700;     // 256B
+  double readUsPerByte = 0.05;
+};
+
+class EmuFlash : public OtaFlash {
+ public:
+  EmuFlash(uint32_t size, uint8_t fill) : mem(size, fill) {}
+
+  uint32_t size() override { return (uint32_t)mem.size(); }
+
+  bool erase(uint32_t offset, uint32_t len) override {
+    if (offset % OTA_FLASH_SECTOR || len % OTA_FLASH_SECTOR || offset + len > mem.size()) {
+      violations++;
+      return false;
+    }
+    memset(mem.data() + offset, 0xFF, len);
+    while (len) {
+      const bool block = offset % 65536 == 0 && len >= 65536;
+      const uint32_t n = block ? 65536 : OTA_FLASH_SECTOR;
+      busyUs += block ? timing.blockEraseUs : timing.sectorEraseUs;
+      erases++;
+      offset += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  bool write(uint32_t offset, const uint8_t* data, size_t len) override {
+    if (offset + len > mem.size()) return false;
+    if (failAfterBytes && bytesWritten + len > failAfterBytes) return false;
+    for (size_t i = 0; i < len; i++) {
+      if ((mem[offset + i] & data[i]) != data[i]) violations++;  // 需要 0→1：未擦除
+      mem[offset + i] &= data[i];
+    }
+    busyUs += (double)((offset + len + 255) / 256 - offset / 256) * timing.pageProgUs;
+    bytesWritten += len;
+    return true;
+  }
+
+  bool read(uint32_t offset, uint8_t* data, size_t len) override {
+    if (offset + len > mem.size()) return false;
+    memcpy(data, mem.data() + offset, len);
+    busyUs += (double)len * timing.readUsPerByte;
+    return true;
+  }
+
+  std::vector<uint8_t> mem;
+  FlashTiming timing;
+  double   busyUs = 0;
+  uint32_t erases = 0, violations = 0;
+  uint64_t bytesWritten = 0, failAfterBytes = 0;
+};
+
+// ==== 链路与设备 ====
+static const uint32_t kPartitionSize = 0x140000;  // 默认分区表的 app 分区（1.25MB）
+static const double   kFrameUs       = 80;        // 每帧固定开销：BLE 回调、入队、任务切换、应答通知（估算）
+static const double   kLzNsPerByte   = 120;       // 解压 + CRC32，按输出字节（240MHz 估算）
+static const double   kCopyNsPerByte = 40;        // 不压缩：拷贝 + CRC32
+static const double   kTimeoutUs     = 1e6;       // App 等不到应答时重新 BEGIN 查询偏移
+static const char*    kDefaultImage  = "../.pio/build/esp32dev/firmware.bin";
+
+struct LinkModel {
+  int    mtu    = 247;
+  double ciMs   = 15;  // iOS 最短连接间隔
+  int    perCi  = 4;   // 每个连接间隔的写入包数
+};
+
+struct Faults {
+  double              corruptRate = 0;  // 分片发出后翻转一位（CRC 之后），设备应检出
+  std::vector<double> disconnectAt;     // 设备写入进度达到数据流的该比例时断线；reconnectUs 后重连并以同一包头 BEGIN
+  double              reconnectUs = 1.5e6;
+  std::vector<int>    reconnectMtu;     // 重连后的 MTU（按顺序），续传按字节偏移与 MTU 无关
+  int                 clientWindow = 0; // >0 时 App 不按设备公布的 window（用于制造队列溢出）
+  uint32_t            seed = 1;
+};
+
+struct TransferResult {
+  bool     verified   = false;
+  uint8_t  lastResult = OTA_OK;
+  double   seconds    = 0;
+  uint64_t streamBytesSent = 0;  // 分片数据字节（含重发）
+  uint32_t frames = 0, corrupted = 0, dropped = 0, reconnects = 0, timeouts = 0;
+  double   flashBusyUs = 0;
+  OtaStats stats = {};
+};
+
+// 离散事件仿真：App（go-back-N 发送）、链路（按连接间隔限速）、设备（单任务处理队列）
+static TransferResult simulate(const std::vector<uint8_t>& pkg, LinkModel link, const Faults& faults,
+                               EmuFlash& flash, OtaReceiver& rx, uint8_t queueLen) {
+  enum EventType { ARRIVE, DEVICE_DONE, RESPONSE, DISCONNECT, RECONNECT, TIMEOUT };
+  struct Event {
+    double               t;
+    uint64_t             order;
+    int                  type;
+    uint32_t             epoch;
+    std::vector<uint8_t> data;
+    bool operator>(const Event& o) const { return t != o.t ? t > o.t : order > o.order; }
+  };
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  uint64_t order = 0;
+  auto schedule = [&](double t, int type, uint32_t epoch, std::vector<uint8_t> data) {
+    events.push({ t, order++, type, epoch, std::move(data) });
+  };
+
+  const uint8_t* stream = pkg.data() + OTA_HEADER_LEN;
+  const uint32_t streamSize = (uint32_t)(pkg.size() - OTA_HEADER_LEN);
+  const double lzNs = pkg[5] == OTA_METHOD_LZSS ? kLzNsPerByte : kCopyNsPerByte;
+  std::mt19937 rng(faults.seed);
+  TransferResult res;
+
+  // App
+  enum Phase { WAIT_BEGIN, STREAMING, OFFLINE, DONE };
+  int      phase = WAIT_BEGIN;
+  uint32_t epoch = 0, acked = 0, sendOff = 0, timerId = 0;
+  size_t   mtuIdx = 0;
+  int      window = 1;
+  std::deque<uint32_t> inflight;
+  double   linkFree = 0, now = 0;
+
+  auto sendFrame = [&](std::vector<uint8_t> frame) {
+    linkFree = std::max(linkFree, now) + link.ciMs * 1000 / link.perCi;
+    res.frames++;
+    schedule(linkFree, ARRIVE, epoch, std::move(frame));
+  };
+  auto armTimeout = [&]() { schedule(std::max(now, linkFree) + kTimeoutUs, TIMEOUT, ++timerId, {}); };
+  auto sendBegin = [&]() {
+    std::vector<uint8_t> f(1 + OTA_HEADER_LEN);
+    f[0] = OTA_OP_BEGIN;
+    memcpy(f.data() + 1, pkg.data(), OTA_HEADER_LEN);
+    phase = WAIT_BEGIN;
+    inflight.clear();
+    sendFrame(std::move(f));
+    armTimeout();
+  };
+  auto pump = [&]() {
+    if (phase != STREAMING) return;
+    const size_t maxData = (size_t)link.mtu - 3 - OTA_CHUNK_HEADER_LEN;
+    bool sent = false;
+    while (sendOff < streamSize && inflight.size() < (size_t)window) {
+      const size_t n = std::min(maxData, (size_t)(streamSize - sendOff));
+      std::vector<uint8_t> f(OTA_CHUNK_HEADER_LEN + n);
+      otaPutChunk(f.data(), sendOff, stream + sendOff, n);
+      if (faults.corruptRate > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < faults.corruptRate) {
+        f[OTA_CHUNK_HEADER_LEN + rng() % n] ^= (uint8_t)(1u << (rng() % 8));
+        res.corrupted++;
+      }
+      inflight.push_back(sendOff);
+      res.streamBytesSent += n;
+      sendOff += (uint32_t)n;
+      sendFrame(std::move(f));
+      sent = true;
+    }
+    if (sent) armTimeout();
+  };
+
+  // 设备
+  std::deque<std::vector<uint8_t>> queue;
+  bool busy = false;
+  bool connected = true;
+  size_t nextDisconnect = 0;
+  auto startDevice = [&]() {
+    if (busy || queue.empty()) return;
+    busy = true;
+    const std::vector<uint8_t> f = std::move(queue.front());
+    queue.pop_front();
+    const double flashBefore = flash.busyUs;
+    const uint32_t writtenBefore = rx.written();
+    uint8_t resp[OTA_STATUS_LEN];
+    const size_t n = rx.handle(f.data(), f.size(), resp);
+    const double cost = kFrameUs + (rx.written() - writtenBefore) * lzNs / 1000 + (flash.busyUs - flashBefore);
+    schedule(now + cost, DEVICE_DONE, 0, std::vector<uint8_t>(resp, resp + n));
+  };
+
+  sendBegin();
+
+  while (!events.empty() && phase != DONE) {
+    Event ev = events.top();
+    events.pop();
+    now = ev.t;
+    if (now > 3600e6) break;
+    switch (ev.type) {
+      case ARRIVE:
+        if (ev.epoch != epoch || !connected) break;  // 断线时仍在空中的包丢失
+        if (queue.size() >= queueLen) {
+          res.dropped++;  // 固件：队列满，回调丢帧
+          break;
+        }
+        queue.push_back(std::move(ev.data));
+        startDevice();
+        break;
+
+      case DEVICE_DONE:
+        busy = false;
+        if (connected && nextDisconnect < faults.disconnectAt.size() &&
+            rx.streamOffset() >= faults.disconnectAt[nextDisconnect] * streamSize) {
+          nextDisconnect++;
+          schedule(now, DISCONNECT, 0, {});
+        }
+        if (!ev.data.empty() && connected) schedule(now + link.ciMs * 1000, RESPONSE, epoch, std::move(ev.data));
+        startDevice();
+        break;
+
+      case RESPONSE: {
+        if (ev.epoch != epoch || phase == OFFLINE) break;
+        const uint8_t state = ev.data[1], result = ev.data[2];
+        const uint32_t off = getLe32(ev.data.data() + 3);
+        res.lastResult = result;
+        if (state == OTA_STATE_VERIFIED) {
+          res.verified = true;
+          phase = DONE;
+          break;
+        }
+        if (result == OTA_OK || result == OTA_RESUMED) {
+          if (phase == WAIT_BEGIN) {
+            window  = faults.clientWindow ? faults.clientWindow : ev.data[7];
+            acked   = sendOff = off;
+            phase   = STREAMING;
+          }
+          acked = std::max(acked, off);
+          while (!inflight.empty() && inflight.front() < acked) inflight.pop_front();
+          armTimeout();
+        } else if (result == OTA_ERR_CRC || result == OTA_ERR_SEQUENCE) {
+          if (phase == STREAMING) {
+            acked = sendOff = off;
+            inflight.clear();
+            armTimeout();
+          }
+        } else {
+          phase = DONE;  // 不可恢复的错误
+          break;
+        }
+        pump();
+        break;
+      }
+
+      case DISCONNECT:
+        connected = false;
+        epoch++;
+        phase = OFFLINE;
+        inflight.clear();
+        schedule(now + faults.reconnectUs, RECONNECT, 0, {});
+        break;
+
+      case RECONNECT:
+        connected = true;
+        res.reconnects++;
+        if (mtuIdx < faults.reconnectMtu.size()) link.mtu = faults.reconnectMtu[mtuIdx++];
+        linkFree = now;
+        sendBegin();
+        break;
+
+      case TIMEOUT:
+        if (ev.epoch != timerId || phase == OFFLINE || phase == DONE) break;
+        res.timeouts++;
+        sendBegin();
+        break;
+    }
+  }
+  res.seconds     = now / 1e6;
+  res.flashBusyUs = flash.busyUs;
+  res.stats       = rx.stats();
+  return res;
+}
+
+// ==== 报告 ====
+static int failures = 0;
+
+static void check(const char* name, bool ok, const std::string& detail) {
+  printf("%-28s %s  %s\n", name, ok ? "PASS" : "FAIL", detail.c_str());
+  failures += !ok;
+}
+
+static std::string fmt(const char* f, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, f);
+  vsnprintf(buf, sizeof(buf), f, ap);
+  va_end(ap);
+  return buf;
+}
+
+static bool imageMatches(const EmuFlash& flash, const std::vector<uint8_t>& image) {
+  return memcmp(flash.mem.data(), image.data(), image.size()) == 0;
+}
+
+// 单次传输：新分区（旧内容全 0，未擦先写会被检出）
+struct Run {
+  EmuFlash       flash;
+  OtaReceiver    rx;
+  TransferResult res;
+  Run(const std::vector<uint8_t>& pkg, const LinkModel& link, const Faults& faults, uint8_t window,
+      uint32_t eraseBlock)
+      : flash(kPartitionSize, 0x00), rx(flash, window, eraseBlock) {
+    uint8_t key[OTA_KEY_LEN];
+    otaParseKey(kTestKey, key);
+    rx.setKey(key);
+    res = simulate(pkg, link, faults, flash, rx, window);
+  }
+};
+
+// ==== 启动：两个 app 分区 + 持久化的启动记录 ====
+struct BootSim {
+  uint8_t       bootApp = 0x10;     // 引导程序启动的分区（ota_0 = 0x10，ota_1 = 0x11）
+  OtaBootRecord rec     = {};
+  int           restarts = 0;
+
+  // 启动一次：返回动作；ROLLBACK 时按固件逻辑切回旧分区
+  OtaBootAction boot() {
+    restarts++;
+    const OtaBootAction a = otaBootDecide(rec, bootApp);
+    if (a == OTA_BOOT_ROLLBACK) bootApp = rec.previousApp;
+    return a;
+  }
+  void apply(uint32_t crc) {
+    otaBootArm(rec, bootApp, (uint8_t)(bootApp ^ 1), crc);
+    bootApp ^= 1;
+  }
+};
+
+static void bootTests(uint32_t crc) {
+  {
+    BootSim b;
+    b.apply(crc);
+    const OtaBootAction a = b.boot();
+    const OtaBootAction f = otaBootFinish(b.rec, true);
+    const OtaBootAction again = b.boot();
+    check("boot: self-check passes", a == OTA_BOOT_SELF_CHECK && f == OTA_BOOT_NORMAL && again == OTA_BOOT_NORMAL &&
+                                          b.bootApp == 0x11 && !b.rec.rolledBack,
+          fmt("running ota_%d, confirmed after 1 trial boot", b.bootApp - 0x10));
+  }
+  {
+    BootSim b;
+    b.apply(crc);
+    b.boot();
+    if (otaBootFinish(b.rec, false) == OTA_BOOT_ROLLBACK) b.bootApp = b.rec.previousApp;
+    const OtaBootAction again = b.boot();
+    check("boot: self-check fails", again == OTA_BOOT_NORMAL && b.bootApp == 0x10 && b.rec.rolledBack,
+          fmt("rolled back to ota_%d", b.bootApp - 0x10));
+  }
+  {
+    BootSim b;
+    b.apply(crc);
+    int trials = 0;
+    OtaBootAction a;
+    while ((a = b.boot()) == OTA_BOOT_SELF_CHECK) trials++;  // 每次都在自检前崩溃
+    const OtaBootAction again = b.boot();
+    check("boot: crash before self-check", a == OTA_BOOT_ROLLBACK && trials == OTA_MAX_TRIAL_BOOTS &&
+                                               again == OTA_BOOT_NORMAL && b.bootApp == 0x10,
+          fmt("%d trial boots, then rolled back to ota_%d", trials, b.bootApp - 0x10));
+  }
+  {
+    BootSim b;
+    b.apply(crc);
+    b.bootApp ^= 1;  // 引导程序校验新镜像失败，仍启动旧分区
+    const OtaBootAction a = b.boot();
+    check("boot: bootloader rejects", a == OTA_BOOT_REJECTED && b.rec.state == OTA_BOOT_CONFIRMED &&
+                                          b.rec.rolledBack && b.boot() == OTA_BOOT_NORMAL,
+          "reported once, old image keeps running");
+  }
+}
+
+// 公开测试向量：FIPS 180-2 附录 B.1/B.2、RFC 4231 测试用例 2（含跨块分段 update）
+static void shaTests() {
+  auto hex = [](const uint8_t* d) {
+    std::string s;
+    for (int i = 0; i < SHA256_LEN; i++) s += fmt("%02x", d[i]);
+    return s;
+  };
+  uint8_t out[SHA256_LEN];
+  Sha256 sha;
+  sha.update((const uint8_t*)"abc", 3);
+  sha.final(out);
+  const bool abc = hex(out) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+  const char* two = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  sha.reset();
+  for (const char* p = two; *p; p += 5) sha.update((const uint8_t*)p, strnlen(p, 5));
+  sha.final(out);
+  const bool block2 = hex(out) == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1";
+  HmacSha256 mac;
+  mac.begin((const uint8_t*)"Jefe", 4);
+  mac.update((const uint8_t*)"what do ya want for nothing?", 28);
+  mac.final(out);
+  const bool hmac = hex(out) == "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843";
+  check("sha256 vectors", abc && block2 && hmac,
+        fmt("sha256 abc %s, two blocks %s, hmac %s", abc ? "ok" : "BAD", block2 ? "ok" : "BAD", hmac ? "ok" : "BAD"));
+}
+
+int main(int argc, char** argv) {
+  LinkModel link;
+  std::vector<const char*> args;
+  bool stored = false;
+  const char* keyHex = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+      link.mtu = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+      link.ciMs = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+      link.perCi = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+      keyHex = argv[++i];
+    } else if (!strcmp(argv[i], "-s")) {
+      stored = true;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "usage: ota_sim [-m mtu] [-i ci_ms] [-k packets_per_ci] [image]\n"
+                      "       ota_sim pack <image> <package> -a <key_hex> [-s]\n");
+      return 2;
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  if (link.mtu < 3 + OTA_CHUNK_HEADER_LEN + 1 || link.mtu > OTA_FRAME_MAX + 3 || link.perCi < 1 || link.ciMs <= 0) {
+    fprintf(stderr, "mtu must be %d..%d, ci_ms > 0, packets_per_ci >= 1\n", 3 + OTA_CHUNK_HEADER_LEN + 1,
+            OTA_FRAME_MAX + 3);
+    return 2;
+  }
+
+  const bool pack = !args.empty() && !strcmp(args[0], "pack");
+  // 默认：PlatformIO 构建出的固件，没有时用本程序自身
+  const char* imagePath = pack ? (args.size() > 1 ? args[1] : nullptr) : (args.empty() ? kDefaultImage : args[0]);
+  std::vector<uint8_t> image;
+  if (!pack && args.empty() && !readFile(imagePath, image)) imagePath = argv[0];
+  if (!imagePath || (image.empty() && !readFile(imagePath, image)) || image.empty()) {
+    fprintf(stderr, "cannot read image %s\n", imagePath ? imagePath : "");
+    return 2;
+  }
+  if (image.size() > kPartitionSize) {
+    fprintf(stderr, "image is %zu bytes, partition holds %u\n", image.size(), kPartitionSize);
+    return 2;
+  }
+
+  // ---- 压缩参数 ----
+  struct Params { int w, l; };
+  const Params kParams[] = { { 8, 4 }, { 10, 4 }, { 11, 4 }, { 12, 4 }, { 12, 5 }, { 12, 6 } };
+  Params best = { 12, 4 };
+  size_t bestSize = SIZE_MAX;
+  if (!pack) printf("image: %zu bytes (%s)\n\n%-12s %10s %7s %12s %10s\n", image.size(), imagePath, "lzss w/l",
+                    "stream", "ratio", "decode MB/s", "RAM");
+  for (const Params& p : kParams) {
+    if (p.w > OTA_LZ_MAX_WINDOW_BITS) continue;
+    const std::vector<uint8_t> s = lzCompress(image, p.w, p.l);
+    if (s.size() < bestSize) {
+      bestSize = s.size();
+      best = p;
+    }
+    if (pack) continue;
+    OtaLzDecoder* dec = new OtaLzDecoder;
+    std::vector<uint8_t> out;
+    out.reserve(image.size());
+    const double t0 = nowSec();
+    dec->begin((uint8_t)p.w, (uint8_t)p.l, (uint32_t)image.size());
+    const bool ok = dec->feed(s.data(), s.size(), [&](uint8_t b) {
+      out.push_back(b);
+      return true;
+    });
+    const double dt = nowSec() - t0;
+    delete dec;
+    if (!ok || out != image) {
+      printf("lzss %d/%d round trip FAILED\n", p.w, p.l);
+      failures++;
+    }
+    printf("%4d/%-7d %10zu %6.1f%% %12.0f %9uB\n", p.w, p.l, s.size(), 100.0 * s.size() / image.size(),
+           image.size() / dt / 1e6, 1u << p.w);
+  }
+
+  if (pack) {
+    uint8_t key[OTA_KEY_LEN];
+    if (args.size() < 3 || !keyHex) {
+      fprintf(stderr, "usage: ota_sim pack <image> <package> -a <key_hex> [-s]\n");
+      return 2;
+    }
+    if (!otaParseKey(keyHex, key)) {
+      fprintf(stderr, "key must be %d hex digits (the device's OTA_AUTH_KEY)\n", 2 * OTA_KEY_LEN);
+      return 2;
+    }
+    const std::vector<uint8_t> pkg =
+        makePackage(image, stored ? OTA_METHOD_STORED : OTA_METHOD_LZSS, best.w, best.l, key);
+    FILE* f = fopen(args[2], "wb");
+    if (!f || fwrite(pkg.data(), 1, pkg.size(), f) != pkg.size()) {
+      perror(args[2]);
+      return 2;
+    }
+    fclose(f);
+    printf("%s: %zu -> %zu bytes (%s, %.1f%%)\n", args[2], image.size(), pkg.size(),
+           stored ? "stored" : fmt("lzss %d/%d", best.w, best.l).c_str(), 100.0 * pkg.size() / image.size());
+    return 0;
+  }
+
+  uint8_t testKey[OTA_KEY_LEN];
+  otaParseKey(kTestKey, testKey);
+  const std::vector<uint8_t> lzPkg  = makePackage(image, OTA_METHOD_LZSS, best.w, best.l, testKey);
+  const std::vector<uint8_t> rawPkg = makePackage(image, OTA_METHOD_STORED, 0, 0, testKey);
+
+  // ---- 传输速率 ----
+  const double linkKBs = (link.mtu - 3 - OTA_CHUNK_HEADER_LEN) * link.perCi / link.ciMs;
+  printf("\nlink: MTU %d, %d writes per %.1f ms interval = %.1f KB/s payload\n", link.mtu, link.perCi, link.ciMs,
+         linkKBs);
+  printf("%-8s %6s %6s %10s %9s %11s %11s\n", "mode", "window", "erase", "stream KB", "time s", "image KB/s",
+         "flash busy");
+  double baseline = 0;
+  const uint8_t kWindows[] = { 1, 4, OTA_WINDOW, 16 };
+  for (int m = 0; m < 2; m++) {
+    const std::vector<uint8_t>& pkg = m ? lzPkg : rawPkg;
+    for (uint8_t w : kWindows) {
+      for (uint32_t eb : { (uint32_t)OTA_ERASE_BLOCK, 65536u }) {
+        if (eb != OTA_ERASE_BLOCK && w != OTA_WINDOW) continue;
+        Run run(pkg, link, Faults(), w, eb);
+        if (!run.res.verified || !imageMatches(run.flash, image)) {
+          printf("transfer FAILED (result %u)\n", run.res.lastResult);
+          failures++;
+          continue;
+        }
+        if (m && w == OTA_WINDOW && eb == OTA_ERASE_BLOCK) baseline = run.res.seconds;
+        printf("%-8s %6u %5uK %10.1f %9.2f %11.1f %10.0f%%%s\n", m ? "lzss" : "stored", w, eb / 1024,
+               (pkg.size() - OTA_HEADER_LEN) / 1024.0, run.res.seconds, image.size() / 1024.0 / run.res.seconds,
+               100 * run.res.flashBusyUs / 1e6 / run.res.seconds,
+               w == OTA_WINDOW && eb == OTA_ERASE_BLOCK ? "  <- firmware" : "");
+      }
+    }
+  }
+
+  // ---- 测试 ----
+  printf("\n");
+  {
+    Run run(lzPkg, link, Faults(), OTA_WINDOW, OTA_ERASE_BLOCK);
+    check("transfer", run.res.verified && imageMatches(run.flash, image) && !run.flash.violations,
+          fmt("%u chunks, %u erases, %u write-before-erase", run.res.stats.chunks, run.flash.erases,
+              run.flash.violations));
+    uint8_t resp[OTA_STATUS_LEN];
+    const uint8_t apply = OTA_OP_APPLY;
+    run.rx.handle(&apply, 1, resp);
+    check("apply after verify", resp[2] == OTA_OK, "accepted");
+  }
+  {
+    Faults f;
+    f.disconnectAt = { 0.1, 0.35, 0.6, 0.85 };
+    f.reconnectMtu = { 185, 247, 23 + 40, 247 };  // 重连后 MTU 不同，续传按字节偏移
+    Run run(lzPkg, link, f, OTA_WINDOW, OTA_ERASE_BLOCK);
+    const uint32_t streamSize = (uint32_t)(lzPkg.size() - OTA_HEADER_LEN);
+    check("resume after disconnect",
+          run.res.verified && imageMatches(run.flash, image) && run.res.stats.resumes == f.disconnectAt.size(),
+          fmt("%u disconnects, resent %.1f KB, %.2f s = %.2f s offline + %.2f s (baseline %.2f s)",
+              run.res.reconnects, (run.res.streamBytesSent - streamSize) / 1024.0, run.res.seconds,
+              run.res.reconnects * f.reconnectUs / 1e6, run.res.seconds - run.res.reconnects * f.reconnectUs / 1e6,
+              baseline));
+  }
+  {
+    Faults f;
+    f.corruptRate = 0.02;
+    Run run(lzPkg, link, f, OTA_WINDOW, OTA_ERASE_BLOCK);
+    check("corrupted chunks", run.res.verified && imageMatches(run.flash, image) &&
+                                  run.res.stats.crcErrors > 0 && run.res.stats.crcErrors <= run.res.corrupted,
+          fmt("%u injected, %u CRC NACKs (rest discarded after an earlier NACK), %.2f s", run.res.corrupted,
+              run.res.stats.crcErrors, run.res.seconds));
+  }
+  {
+    Faults f;
+    f.clientWindow = OTA_WINDOW * 3;  // App 不守窗口：设备队列溢出丢帧
+    Run run(lzPkg, link, f, OTA_WINDOW, OTA_ERASE_BLOCK);
+    check("queue overflow", run.res.verified && imageMatches(run.flash, image) && run.res.dropped > 0,
+          fmt("%u frames dropped, %u gap NACKs, %u timeouts", run.res.dropped, run.res.stats.sequenceErrors,
+              run.res.timeouts));
+  }
+  {
+    std::vector<uint8_t> bad = lzPkg;
+    putLe32(bad.data() + 12, getLe32(bad.data() + 12) ^ 1);  // 包头 CRC 与内容不符
+    Run run(bad, link, Faults(), OTA_WINDOW, OTA_ERASE_BLOCK);
+    uint8_t resp[OTA_STATUS_LEN];
+    const uint8_t apply = OTA_OP_APPLY;
+    run.rx.handle(&apply, 1, resp);
+    check("image crc mismatch", !run.res.verified && run.res.lastResult == OTA_ERR_VERIFY && resp[2] == OTA_ERR_STATE,
+          "rejected, APPLY refused");
+  }
+  {
+    std::vector<uint8_t> bad = lzPkg;
+    bad[OTA_HEADER_LEN + bad.size() / 2] ^= 0x10;  // 数据流损坏但分片 CRC 按损坏后的内容计算
+    Run run(bad, link, Faults(), OTA_WINDOW, OTA_ERASE_BLOCK);
+    check("corrupted stream", !run.res.verified &&
+                                  (run.res.lastResult == OTA_ERR_VERIFY || run.res.lastResult == OTA_ERR_STREAM),
+          run.res.lastResult == OTA_ERR_VERIFY ? "caught by image CRC" : "caught by decoder");
+  }
+  {
+    // 换了密钥打包：CRC 全对，只有标签不符
+    uint8_t otherKey[OTA_KEY_LEN];
+    memcpy(otherKey, testKey, OTA_KEY_LEN);
+    otherKey[0] ^= 1;
+    Run run(makePackage(image, OTA_METHOD_LZSS, best.w, best.l, otherKey), link, Faults(), OTA_WINDOW,
+            OTA_ERASE_BLOCK);
+    uint8_t resp[OTA_STATUS_LEN];
+    const uint8_t apply = OTA_OP_APPLY;
+    run.rx.handle(&apply, 1, resp);
+    check("wrong key", !run.res.verified && run.res.lastResult == OTA_ERR_AUTH && resp[2] == OTA_ERR_STATE,
+          "rejected as OTA_ERR_AUTH, APPLY refused");
+  }
+  {
+    // 篡改镜像并按新内容重算 CRC，沿用原标签（不知道密钥的攻击者能做到的全部）
+    std::vector<uint8_t> forged = image;
+    forged[forged.size() / 3] ^= 0x5A;
+    std::vector<uint8_t> bad = makePackage(forged, OTA_METHOD_STORED, 0, 0, testKey);
+    memcpy(bad.data() + OTA_HEADER_SIGNED_LEN, rawPkg.data() + OTA_HEADER_SIGNED_LEN, SHA256_LEN);
+    Run run(bad, link, Faults(), OTA_WINDOW, OTA_ERASE_BLOCK);
+    check("forged image", !run.res.verified && run.res.lastResult == OTA_ERR_AUTH, "CRC consistent, tag rejected");
+  }
+  {
+    EmuFlash flash(kPartitionSize, 0x00);
+    OtaReceiver rx(flash, OTA_WINDOW);  // 未设密钥
+    uint8_t frame[1 + OTA_HEADER_LEN], resp[OTA_STATUS_LEN];
+    frame[0] = OTA_OP_BEGIN;
+    memcpy(frame + 1, lzPkg.data(), OTA_HEADER_LEN);
+    rx.handle(frame, sizeof(frame), resp);
+    check("no device key", resp[2] == OTA_ERR_AUTH && rx.state() == OTA_STATE_IDLE && !flash.erases,
+          "BEGIN refused before erasing");
+  }
+  {
+    EmuFlash flash(kPartitionSize, 0x00);
+    flash.failAfterBytes = image.size() / 2;
+    OtaReceiver rx(flash, OTA_WINDOW);
+    rx.setKey(testKey);
+    const TransferResult res = simulate(lzPkg, link, Faults(), flash, rx, OTA_WINDOW);
+    check("flash write failure", !res.verified && res.lastResult == OTA_ERR_FLASH, "reported as OTA_ERR_FLASH");
+  }
+  {
+    // 同一接收端：换了升级包的 BEGIN 从头开始，不续传
+    EmuFlash flash(kPartitionSize, 0x00);
+    OtaReceiver rx(flash, OTA_WINDOW);
+    rx.setKey(testKey);
+    uint8_t frame[1 + OTA_HEADER_LEN], resp[OTA_STATUS_LEN];
+    frame[0] = OTA_OP_BEGIN;
+    memcpy(frame + 1, rawPkg.data(), OTA_HEADER_LEN);
+    rx.handle(frame, sizeof(frame), resp);
+    std::vector<uint8_t> chunk(OTA_CHUNK_HEADER_LEN + 200);
+    rx.handle(chunk.data(), otaPutChunk(chunk.data(), 0, rawPkg.data() + OTA_HEADER_LEN, 200), resp);
+    memcpy(frame + 1, lzPkg.data(), OTA_HEADER_LEN);
+    rx.handle(frame, sizeof(frame), resp);
+    check("new package restarts", resp[2] == OTA_OK && getLe32(resp + 3) == 0, "offset 0, not resumed");
+  }
+  bootTests(otaCrc32(image.data(), image.size()));
+  shaTests();
+
+  printf("\n%s\n", failures ? "FAILURES" : "all OTA checks passed");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+// 指令编解码：由 include/protocol.h 的指令表驱动，与固件分发共用同一份定义
+// 用法：
+//   proto_codec [check]                 打印指令表并自检（编码→解码往返、长度边界、未知操作码）
+//   proto_codec encode <指令名> [参数...]  输出十六进制帧，如 encode Payout 200 3 → 02c80003
+//                                       字节参数以 0x 开头时按十六进制解析，如 encode PrintRaster 0 0x01300a0002
+//   proto_codec decode <十六进制帧>         解出指令名与字段，如 decode 0700010000
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "protocol.h"
+
+static const char* layoutName(PayloadLayout l) {
+  switch (l) {
+    case LAYOUT_NONE:       return "-";
+    case LAYOUT_U8:         return "u8";
+    case LAYOUT_OPT_U8:     return "[u8]";
+    case LAYOUT_U16_OPT_U8: return "u16 [u8]";
+    case LAYOUT_U32:        return "u32";
+    case LAYOUT_U32_U16:    return "u32 u16";
+    case LAYOUT_TEXT:       return "bytes";
+    case LAYOUT_U8_BYTES:   return "u8 bytes";
+    case LAYOUT_U32_BYTES:  return "u32 bytes";
+  }
+  return "?";
+}
+
+static void printHex(const uint8_t* p, size_t n) {
+  for (size_t i = 0; i < n; i++) printf("%02x", p[i]);
+  printf("\n");
+}
+
+// 十六进制串 → 字节；含非十六进制字符返回 -1
+static long parseHex(const char* hex, uint8_t* out, size_t cap) {
+  size_t n = 0;
+  for (const char* p = hex; p[0] && p[1] && n < cap; p += 2) {
+    if (!isxdigit((unsigned char)p[0]) || !isxdigit((unsigned char)p[1])) return -1;
+    const char byte[3] = { p[0], p[1], 0 };
+    out[n++] = (uint8_t)strtoul(byte, nullptr, 16);
+  }
+  return (long)n;
+}
+
+static const OpcodeSpec* findByName(const char* name) {
+  for (const OpcodeSpec& s : kOpcodeSpecs) {
+    if (!strcasecmp(s.name, name)) return &s;
+  }
+  return nullptr;
+}
+
+// 可打印文本加引号输出，否则输出前 32 字节十六进制
+static void printBytes(const uint8_t* p, size_t n) {
+  bool text = true;
+  for (size_t i = 0; i < n; i++) text &= isprint(p[i]) != 0;
+  printf(" len=%zu ", n);
+  if (text) {
+    printf("\"%.*s\"", (int)n, (const char*)p);
+    return;
+  }
+  for (size_t i = 0; i < n && i < 32; i++) printf("%02x", p[i]);
+  if (n > 32) printf("...");
+}
+
+static void printFrame(const CommandFrame& cmd) {
+  const OpcodeSpec& spec = kOpcodeSpecs[cmd.index];
+  printf("%s (0x%02x)", spec.name, cmd.op);
+  if (spec.layout == LAYOUT_TEXT) {
+    printf(" len=%zu \"%.*s\"", cmd.dataLen, (int)cmd.dataLen, (const char*)cmd.data);
+  } else {
+    if (cmd.argCount >= 1) printf(" a=%u", cmd.a);
+    if (cmd.argCount >= 2) printf(" b=%u", cmd.b);
+    if (spec.layout == LAYOUT_U8_BYTES || spec.layout == LAYOUT_U32_BYTES) printBytes(cmd.data, cmd.dataLen);
+  }
+  printf("\n");
+}
+
+static int checkFail(const char* what, const OpcodeSpec& s, size_t n) {
+  printf("FAIL %s: %s payload=%zu\n", what, s.name, n);
+  return 1;
+}
+
+// 对每条指令：在 [minLen, maxLen] 内（文本取两端与中点）构造负载，解码后再编码须逐字节一致；
+// 低于 minLen、高于 maxLen（无负载指令除外）须被拒绝
+static int selfCheck() {
+  printf("protocol v%u, %zu opcodes\n", PROTOCOL_VERSION, kOpcodeCount);
+  printf("%6s %-16s %6s %6s  %s\n", "op", "name", "min", "max", "layout");
+  for (const OpcodeSpec& s : kOpcodeSpecs) {
+    printf("  0x%02x %-16s %6u %6u  %s\n", s.op, s.name, s.minLen, s.maxLen, layoutName(s.layout));
+  }
+
+  int failures = 0;
+  uint32_t cases = 0;
+  static uint8_t frame[1 + 1024];
+  static uint8_t again[1 + 1024];
+  for (const OpcodeSpec& s : kOpcodeSpecs) {
+    const size_t lens[] = { s.minLen, (size_t)(s.minLen + s.maxLen) / 2, s.maxLen };
+    for (size_t n : lens) {
+      frame[0] = s.op;
+      for (size_t i = 0; i < n; i++) frame[1 + i] = (uint8_t)(0x5a ^ (i * 37) ^ s.op);
+      CommandFrame cmd;
+      cases++;
+      if (decodeCommand(frame, 1 + n, cmd) != CMD_OK) {
+        failures += checkFail("decode in-range", s, n);
+        continue;
+      }
+      // 无负载指令的填充字节不参与编码
+      const size_t expect = s.layout == LAYOUT_NONE ? 1 : 1 + n;
+      const size_t len = encodeCommand(cmd, again, sizeof(again));
+      if (len != expect || memcmp(frame, again, expect) != 0) failures += checkFail("round trip", s, n);
+    }
+
+    CommandFrame cmd;
+    if (s.minLen > 0) {
+      cases++;
+      if (decodeCommand(frame, s.minLen, cmd) != CMD_ERR_LENGTH) failures += checkFail("short accepted", s, s.minLen - 1);
+    }
+    if (s.layout != LAYOUT_NONE && s.maxLen < sizeof(frame) - 1) {
+      cases++;
+      if (decodeCommand(frame, s.maxLen + 2, cmd) != CMD_ERR_LENGTH) failures += checkFail("long accepted", s, s.maxLen + 1);
+    }
+  }
+
+  for (int op = 0; op < 256; op++) {
+    bool listed = false;
+    for (const OpcodeSpec& s : kOpcodeSpecs) listed |= s.op == op;
+    if (listed) continue;
+    const uint8_t f[8] = { (uint8_t)op };
+    CommandFrame cmd;
+    cases++;
+    if (decodeCommand(f, sizeof(f), cmd) != CMD_ERR_UNKNOWN) {
+      printf("FAIL unknown opcode 0x%02x accepted\n", op);
+      failures++;
+    }
+  }
+
+  // 旧版 iOS 的 0x01 带 3 字节 0 填充
+  const uint8_t legacyStart[4] = { CMD_START_SESSION, 0, 0, 0 };
+  CommandFrame cmd;
+  cases++;
+  if (decodeCommand(legacyStart, sizeof(legacyStart), cmd) != CMD_OK) {
+    printf("FAIL legacy START_SESSION padding rejected\n");
+    failures++;
+  }
+
+  cases++;
+  if (kCapabilities.bytes[0] != EVT_CAPS || kCapabilities.bytes[2] != kOpcodeCount) {
+    printf("FAIL capabilities frame header\n");
+    failures++;
+  }
+
+  printf("%u cases, %d failures\n", cases, failures);
+  return failures ? 1 : 0;
+}
+
+static int encode(int argc, char** argv) {
+  const OpcodeSpec* s = findByName(argv[0]);
+  if (!s) {
+    fprintf(stderr, "unknown command: %s\n", argv[0]);
+    return 2;
+  }
+  CommandFrame cmd = {};
+  cmd.op = s->op;
+  static uint8_t bytes[1024];
+  if (s->layout == LAYOUT_TEXT) {
+    cmd.data    = reinterpret_cast<const uint8_t*>(argc > 1 ? argv[1] : "");
+    cmd.dataLen = argc > 1 ? strlen(argv[1]) : 0;
+  } else if (s->layout == LAYOUT_U8_BYTES || s->layout == LAYOUT_U32_BYTES) {
+    cmd.argCount = argc > 1 ? 1 : 0;
+    if (argc > 1) cmd.a = (uint32_t)strtoul(argv[1], nullptr, 0);
+    const char* arg = argc > 2 ? argv[2] : "";
+    cmd.data = bytes;
+    if (!strncmp(arg, "0x", 2)) {
+      const long n = parseHex(arg + 2, bytes, sizeof(bytes));
+      if (n < 0) {
+        fprintf(stderr, "bad hex: %s\n", arg);
+        return 2;
+      }
+      cmd.dataLen = (size_t)n;
+    } else {
+      cmd.dataLen = strlen(arg) < sizeof(bytes) ? strlen(arg) : sizeof(bytes);
+      memcpy(bytes, arg, cmd.dataLen);
+    }
+  } else {
+    cmd.argCount = (uint8_t)(argc - 1 > 2 ? 2 : argc - 1);
+    if (argc > 1) cmd.a = (uint32_t)strtoul(argv[1], nullptr, 0);
+    if (argc > 2) cmd.b = (uint32_t)strtoul(argv[2], nullptr, 0);
+  }
+  static uint8_t out[1 + 1024];
+  const size_t len = encodeCommand(cmd, out, sizeof(out));
+  if (!len) {
+    fprintf(stderr, "arguments do not match %s (%s, payload %u..%u bytes)\n",
+            s->name, layoutName(s->layout), s->minLen, s->maxLen);
+    return 2;
+  }
+  printHex(out, len);
+  return 0;
+}
+
+static int decode(const char* hex) {
+  static uint8_t frame[1024];
+  const long parsed = parseHex(hex, frame, sizeof(frame));
+  if (parsed < 0) {
+    fprintf(stderr, "bad hex: %s\n", hex);
+    return 2;
+  }
+  const size_t n = (size_t)parsed;
+  CommandFrame cmd;
+  switch (decodeCommand(frame, n, cmd)) {
+    case CMD_OK:          printFrame(cmd); return 0;
+    case CMD_ERR_EMPTY:   fprintf(stderr, "empty frame\n"); break;
+    case CMD_ERR_UNKNOWN: fprintf(stderr, "unknown opcode 0x%02x\n", frame[0]); break;
+    case CMD_ERR_LENGTH:  fprintf(stderr, "bad payload length %zu for 0x%02x\n", n - 1, frame[0]); break;
+  }
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2 || !strcmp(argv[1], "check")) return selfCheck();
+  if (!strcmp(argv[1], "encode") && argc >= 3) return encode(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "decode") && argc >= 3) return decode(argv[2]);
+  fprintf(stderr, "usage: proto_codec [check] | encode <name> [args...] | decode <hex>\n");
+  return 2;
+}
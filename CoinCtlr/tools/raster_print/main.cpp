@@ -0,0 +1,1046 @@
+// 光栅图像/二维码打印：压缩率、BLE 传输与打印时间对比，及解码器/二维码编码器自检
+// （include/raster_print.h、include/qr_code.h）
+// 用法：
+//   raster_print [-m MTU] [-i 连接间隔ms] [-k 每间隔包数] [-b 串口波特率] [-s 走纸mm/s] [图像.pbm]
+//       内置测试图（logo、二维码、抖动灰度图）外可加一幅 PBM（P1/P4，宽 ≤ 384 点）
+//   raster_print qr <文本> [L|M|Q|H]                 终端预览设备生成的二维码
+//
+// 图像按 App 侧三种编码（RAW / PACKBITS / PACKBITS_DELTA）切片发送，设备端二维码只发文本。
+// 链路同 ota_sim：每个连接间隔最多 k 个写入（每包 MTU - 3 字节，含操作码与 u32 偏移），应答在下一个间隔送达；
+// App 未确认分片不超过打印队列长度（PRINT_QUEUE_LEN），缺口/超时从应答偏移重发。
+// 设备：打印任务逐片解码，写串口后 flush（与固件 printerTask 一致），串口按波特率计时；机芯按走纸速度出纸，
+// 自带接收缓冲。打印时间 = 第一包发出到最后一行走完。
+// 自检：各编码随机切片往返（解析输出的 GS v 0 / ESC J 还原位图逐位比对）、缺口/重叠/重发、错误流、
+// 经 CoinBoxCore 的指令与应答，二维码按标准流程回读（格式信息、RS 校验、数据解析）。任一失败退出码为 1。
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "coinbox_core.h"
+#include "raster_print.h"
+
+static double nowSec() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int failures = 0;
+
+static void check(const char* name, bool ok, const std::string& detail) {
+  printf("%-28s %s  %s\n", name, ok ? "PASS" : "FAIL", detail.c_str());
+  failures += !ok;
+}
+
+static std::string fmt(const char* f, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, f);
+  vsnprintf(buf, sizeof(buf), f, ap);
+  va_end(ap);
+  return buf;
+}
+
+// ==== 1bpp 位图（高位在左，1 = 黑） ====
+struct Bitmap {
+  int widthBytes = 0;
+  int height     = 0;
+  std::vector<uint8_t> bits;
+
+  Bitmap() = default;
+  Bitmap(int wb, int h) : widthBytes(wb), height(h), bits((size_t)wb * h, 0) {}
+  uint8_t* row(int y) { return bits.data() + (size_t)y * widthBytes; }
+  const uint8_t* row(int y) const { return bits.data() + (size_t)y * widthBytes; }
+  void set(int x, int y) {
+    if (x >= 0 && y >= 0 && x < widthBytes * 8 && y < height) row(y)[x >> 3] |= (uint8_t)(0x80 >> (x & 7));
+  }
+  void fill(int x0, int y0, int x1, int y1) {
+    for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) set(x, y);
+    }
+  }
+};
+
+// 模拟打印机：解析 GS v 0 与 ESC J，按纸宽还原位图（条带裁掉的右侧补 0）
+static bool renderEscPos(const std::vector<uint8_t>& uart, Bitmap& out) {
+  out = Bitmap(RASTER_MAX_WIDTH_BYTES, 0);
+  size_t i = 0;
+  while (i < uart.size()) {
+    if (uart[i] == 0x1D && i + 8 <= uart.size() && uart[i + 1] == 'v' && uart[i + 2] == '0') {
+      const int w = getLe16(&uart[i + 4]), h = getLe16(&uart[i + 6]);
+      if (w > RASTER_MAX_WIDTH_BYTES || i + 8 + (size_t)w * h > uart.size()) return false;
+      for (int r = 0; r < h; r++) {
+        out.bits.resize(out.bits.size() + RASTER_MAX_WIDTH_BYTES, 0);
+        memcpy(out.row(out.height), &uart[i + 8 + (size_t)r * w], w);
+        out.height++;
+      }
+      i += 8 + (size_t)w * h;
+    } else if (uart[i] == 0x1B && i + 3 <= uart.size() && uart[i + 1] == 'J') {
+      out.bits.resize(out.bits.size() + (size_t)uart[i + 2] * RASTER_MAX_WIDTH_BYTES, 0);
+      out.height += uart[i + 2];
+      i += 3;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// 与纸宽位图比对（图像宽度不足纸宽时右侧应为 0）
+static bool sameImage(const Bitmap& paper, const Bitmap& img, int rowOffset = 0) {
+  if (paper.height != img.height + 2 * rowOffset) return false;
+  for (int y = 0; y < paper.height; y++) {
+    const int iy = y - rowOffset;
+    for (int b = 0; b < RASTER_MAX_WIDTH_BYTES; b++) {
+      const uint8_t want = iy >= 0 && iy < img.height && b < img.widthBytes ? img.row(iy)[b] : 0;
+      if (paper.row(y)[b] != want) return false;
+    }
+  }
+  return true;
+}
+
+// ==== App 侧编码 ====
+static void packBits(const std::vector<uint8_t>& in, std::vector<uint8_t>& out) {
+  const size_t n = in.size();
+  size_t i = 0;
+  auto runAt = [&](size_t p) { return p + 2 < n && in[p] == in[p + 1] && in[p] == in[p + 2]; };
+  while (i < n) {
+    if (runAt(i)) {
+      size_t j = i + 1;
+      while (j < n && j - i < 128 && in[j] == in[i]) j++;
+      out.push_back((uint8_t)(257 - (j - i)));
+      out.push_back(in[i]);
+      i = j;
+    } else {
+      const size_t start = i;
+      while (i < n && i - start < 128 && !runAt(i)) i++;
+      out.push_back((uint8_t)(i - start - 1));
+      out.insert(out.end(), in.begin() + (long)start, in.begin() + (long)i);
+    }
+  }
+}
+
+static std::vector<uint8_t> encodeStream(const Bitmap& img, uint8_t encoding, uint8_t imageNo) {
+  std::vector<uint8_t> s = { imageNo, (uint8_t)img.widthBytes, 0, 0, encoding };
+  putLe16(&s[2], (uint16_t)img.height);
+  if (encoding == RASTER_ENC_RAW) {
+    s.insert(s.end(), img.bits.begin(), img.bits.end());
+    return s;
+  }
+  std::vector<uint8_t> body = img.bits;
+  if (encoding == RASTER_ENC_PACKBITS_DELTA) {
+    for (int y = img.height - 1; y >= 1; y--) {
+      for (int b = 0; b < img.widthBytes; b++) body[(size_t)y * img.widthBytes + b] ^= img.row(y - 1)[b];
+    }
+  }
+  packBits(body, s);
+  return s;
+}
+
+// ==== 测试图 ====
+// logo：K 线蜡烛图 + 圆环 + 文字块，居中 256 点宽，两侧留白
+static Bitmap makeLogo() {
+  Bitmap img(RASTER_MAX_WIDTH_BYTES, 160);
+  for (int y = 0; y < img.height; y++) {
+    for (int x = 64; x < 200; x++) {
+      const int dx = x - 130, dy = y - 80, d2 = dx * dx + dy * dy;
+      if (d2 >= 60 * 60 && d2 < 70 * 70) img.set(x, y);
+    }
+  }
+  const int open[6] = { 100, 90, 70, 85, 60, 50 }, close[6] = { 90, 70, 85, 60, 50, 40 };
+  for (int c = 0; c < 6; c++) {
+    const int x = 92 + c * 14, top = std::min(open[c], close[c]), bottom = std::max(open[c], close[c]);
+    img.fill(x + 4, top - 10, x + 6, bottom + 10);  // 影线
+    if (close[c] < open[c]) {
+      img.fill(x, top, x + 10, bottom);  // 阳线实心
+    } else {
+      img.fill(x, top, x + 10, top + 2);
+      img.fill(x, bottom - 2, x + 10, bottom);
+      img.fill(x, top, x + 2, bottom);
+      img.fill(x + 8, top, x + 10, bottom);
+    }
+  }
+  for (int line = 0; line < 3; line++) {
+    const int y0 = 40 + line * 32, h = line ? 14 : 22;
+    for (int x = 212, k = 0; x < 320; k++) {
+      const int w = 6 + (k * 7 + line * 3) % 9;
+      img.fill(x, y0, std::min(x + w, 320), y0 + h);
+      x += w + 4;
+    }
+  }
+  img.fill(64, 150, 320, 152);
+  return img;
+}
+
+// 抖动灰度图：径向渐变 + 正弦纹理 Floyd–Steinberg 二值化，相邻字节几乎不重复（PackBits 最坏情况）
+static Bitmap makeDither() {
+  const int w = RASTER_MAX_WIDTH_BYTES * 8, h = 120;
+  std::vector<double> g((size_t)w * h);
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      const double r = hypot(x - w / 2.0, (y - h / 2.0) * 2) / (w / 2.0);
+      g[(size_t)y * w + x] = std::min(1.0, std::max(0.0, 0.5 * r + 0.25 * sin(x * 0.07) * cos(y * 0.11) + 0.1));
+    }
+  }
+  Bitmap img(RASTER_MAX_WIDTH_BYTES, h);
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      const double v = g[(size_t)y * w + x], q = v < 0.5 ? 0 : 1, e = v - q;
+      if (q == 0) img.set(x, y);
+      if (x + 1 < w) g[(size_t)y * w + x + 1] += e * 7 / 16;
+      if (y + 1 < h) {
+        if (x) g[(size_t)(y + 1) * w + x - 1] += e * 3 / 16;
+        g[(size_t)(y + 1) * w + x] += e * 5 / 16;
+        if (x + 1 < w) g[(size_t)(y + 1) * w + x + 1] += e / 16;
+      }
+    }
+  }
+  return img;
+}
+
+static bool readFile(const char* path, std::vector<uint8_t>& out) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.insert(out.end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
+
+// PBM：P4（二进制）或 P1（文本），1 = 黑
+static bool loadPbm(const char* path, Bitmap& img) {
+  std::vector<uint8_t> raw;
+  if (!readFile(path, raw) || raw.size() < 3 || raw[0] != 'P' || (raw[1] != '1' && raw[1] != '4')) return false;
+  size_t p = 2;
+  auto number = [&](int& v) {
+    while (p < raw.size()) {
+      if (raw[p] == '#') {
+        while (p < raw.size() && raw[p] != '\n') p++;
+      } else if (isspace(raw[p])) {
+        p++;
+      } else {
+        break;
+      }
+    }
+    if (p >= raw.size() || !isdigit(raw[p])) return false;
+    v = 0;
+    while (p < raw.size() && isdigit(raw[p])) v = v * 10 + (raw[p++] - '0');
+    return true;
+  };
+  int w, h;
+  if (!number(w) || !number(h) || w < 1 || w > RASTER_MAX_WIDTH_BYTES * 8 || h < 1 || h > RASTER_MAX_HEIGHT) return false;
+  img = Bitmap((w + 7) / 8, h);
+  if (raw[1] == '4') {
+    p++;
+    if (raw.size() < p + img.bits.size()) return false;
+    memcpy(img.bits.data(), &raw[p], img.bits.size());
+    if (w % 8) {
+      for (int y = 0; y < h; y++) img.row(y)[img.widthBytes - 1] &= (uint8_t)(0xFF << (8 - w % 8));
+    }
+    return true;
+  }
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      while (p < raw.size() && raw[p] != '0' && raw[p] != '1') p++;
+      if (p >= raw.size()) return false;
+      if (raw[p++] == '1') img.set(x, y);
+    }
+  }
+  return true;
+}
+
+// ==== 设备侧（直接驱动 RasterPrinter，输出收集为串口字节） ====
+struct Capture {
+  std::vector<uint8_t> uart;
+  uint32_t writes = 0;
+  void operator()(const uint8_t* p, size_t n) {
+    uart.insert(uart.end(), p, p + n);
+    writes++;
+  }
+};
+
+// 按给定切片长度把整条流送入解码器
+static RasterAck feedAll(RasterPrinter& rp, const std::vector<uint8_t>& s, Capture& cap, std::mt19937& rng,
+                         size_t maxChunk) {
+  RasterAck ack = { RASTER_OK, 0, 0 };
+  for (size_t off = 0; off < s.size();) {
+    const size_t n = std::min(s.size() - off, 1 + rng() % maxChunk);
+    ack = rp.feed((uint32_t)off, &s[off], n, cap);
+    if (ack.status != RASTER_OK && ack.status != RASTER_DONE) return ack;
+    off += n;
+  }
+  return ack;
+}
+
+// 二维码在纸上的期望位图（与 RasterPrinter::printQr 相同的尺寸/居中规则，由矩阵独立生成）
+static Bitmap qrExpected(const QrCode& qr, int& quietRows) {
+  const int paperDots = RASTER_MAX_WIDTH_BYTES * 8, size = qr.size();
+  const int dots = std::min(QR_MODULE_DOTS_MAX, paperDots / (size + 2 * QR_QUIET_MODULES));
+  const int left = (paperDots - size * dots) / 2;
+  Bitmap img(RASTER_MAX_WIDTH_BYTES, size * dots);
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      if (qr.module((uint8_t)x, (uint8_t)y)) img.fill(left + x * dots, y * dots, left + (x + 1) * dots, (y + 1) * dots);
+    }
+  }
+  quietRows = QR_QUIET_MODULES * dots;
+  return img;
+}
+
+// ==== 二维码回读：格式信息 → 去掩膜 → 之字形取码字 → 解交织 → RS 校验 → 解析字节模式 ====
+static bool qrReadBack(const QrCode& qr, std::vector<uint8_t>& text, std::string& why) {
+  const int size = qr.size();
+  uint16_t fmtBits = 0;
+  for (int i = 0; i <= 5; i++) fmtBits |= (uint16_t)(qr.module(8, (uint8_t)i) << i);
+  fmtBits |= (uint16_t)(qr.module(8, 7) << 6 | qr.module(8, 8) << 7 | qr.module(7, 8) << 8);
+  for (int i = 9; i < 15; i++) fmtBits |= (uint16_t)(qr.module((uint8_t)(14 - i), 8) << i);
+  int ecc = -1, mask = -1;
+  for (int e = 0; e < 4; e++) {
+    for (int m = 0; m < 8; m++) {
+      if (QrCode::formatBits((uint8_t)e, (uint8_t)m) == fmtBits) {
+        ecc = e;
+        mask = m;
+      }
+    }
+  }
+  uint16_t copy2 = 0;
+  for (int i = 0; i < 8; i++) copy2 |= (uint16_t)(qr.module((uint8_t)(size - 1 - i), 8) << i);
+  for (int i = 8; i < 15; i++) copy2 |= (uint16_t)(qr.module(8, (uint8_t)(size - 15 + i)) << i);
+  if (ecc < 0 || copy2 != fmtBits) {
+    why = "format info";
+    return false;
+  }
+
+  const uint8_t v = qr.version();
+  std::vector<uint8_t> cw(QrCode::rawCodewords(v), 0);
+  size_t bit = 0;
+  for (int right = size - 1; right >= 1; right -= 2) {
+    if (right == 6) right = 5;
+    const bool upward = ((right + 1) & 2) == 0;
+    for (int vert = 0; vert < size; vert++) {
+      for (int j = 0; j < 2; j++) {
+        const uint8_t x = (uint8_t)(right - j), y = (uint8_t)(upward ? size - 1 - vert : vert);
+        if (qr.isFunction(x, y) || bit >= cw.size() * 8) continue;
+        if (qr.module(x, y) != QrCode::maskBit((uint8_t)mask, x, y)) cw[bit >> 3] |= (uint8_t)(0x80 >> (bit & 7));
+        bit++;
+      }
+    }
+  }
+
+  const int blocks = QrCode::blockCount(v, (uint8_t)ecc), eccLen = QrCode::eccPerBlock(v, (uint8_t)ecc);
+  const int raw = QrCode::rawCodewords(v), shortBlocks = blocks - raw % blocks, shortData = raw / blocks - eccLen;
+  std::vector<std::vector<uint8_t>> block(blocks);
+  size_t k = 0;
+  for (int i = 0; i <= shortData; i++) {
+    for (int b = 0; b < blocks; b++) {
+      if (i < shortData + (b < shortBlocks ? 0 : 1)) block[b].push_back(cw[k++]);
+    }
+  }
+  std::vector<uint8_t> data;
+  for (int b = 0; b < blocks; b++) data.insert(data.end(), block[b].begin(), block[b].end());
+  std::vector<uint8_t> divisor(eccLen), rem(eccLen);
+  QrCode::rsDivisor((uint8_t)eccLen, divisor.data());
+  for (int i = 0; i < eccLen; i++) {
+    for (int b = 0; b < blocks; b++) block[b].push_back(cw[k++]);
+  }
+  for (int b = 0; b < blocks; b++) {
+    const size_t n = block[b].size() - eccLen;
+    QrCode::rsRemainder(block[b].data(), n, divisor.data(), (uint8_t)eccLen, rem.data());
+    if (memcmp(rem.data(), block[b].data() + n, eccLen) != 0) {
+      why = fmt("RS block %d", b);
+      return false;
+    }
+  }
+
+  auto read = [&](size_t& pos, int n) {
+    uint32_t val = 0;
+    for (int i = 0; i < n; i++, pos++) val = val << 1 | ((data[pos >> 3] >> (7 - (pos & 7))) & 1);
+    return val;
+  };
+  size_t pos = 0;
+  if (read(pos, 4) != 0x4) {
+    why = "mode";
+    return false;
+  }
+  const uint32_t len = read(pos, QrCode::countBits(v));
+  if (pos + len * 8 > data.size() * 8) {
+    why = "length";
+    return false;
+  }
+  text.clear();
+  for (uint32_t i = 0; i < len; i++) text.push_back((uint8_t)read(pos, 8));
+  return true;
+}
+
+// "https://kline.example/r/000123" 版本 3-M 的矩阵
+static constexpr uint8_t  kGoldenMask = 2;
+static constexpr uint32_t kGoldenHash = 0x46fcd6bcu;
+
+static uint32_t matrixHash(const QrCode& qr) {
+  uint32_t h = 2166136261u;
+  for (int y = 0; y < qr.size(); y++) {
+    for (int x = 0; x < qr.size(); x++) h = (h ^ (uint32_t)qr.module((uint8_t)x, (uint8_t)y)) * 16777619u;
+  }
+  return h;
+}
+
+// ==== 传输 + 打印仿真 ====
+struct LinkModel {
+  int    mtu   = 247;
+  double ciMs  = 15;  // iOS 最短连接间隔
+  int    perCi = 4;   // 每个连接间隔的写入包数
+};
+
+struct PrinterModel {
+  double baud     = PRINTER_UART_BAUD;
+  double mmPerSec = 60;  // 58mm 热敏机芯常见 50–80mm/s，8 点/mm
+};
+
+// 设备耗时估算（ESP32 240MHz）：每片排队/解析开销、每输出字节解码、二维码生成（版本 10 含 8 次掩膜评估）
+static constexpr double kChunkUs     = 150;
+static constexpr double kDecodeNsOut = 25;
+static constexpr double kQrEncodeUs  = 20000;
+static constexpr double kTimeoutUs   = 1e6;
+
+struct SimResult {
+  bool     done = false;
+  double   printUs = 0;     // 第一包发出到最后一行走完
+  double   bleUs = 0;       // 最后一包送达
+  uint64_t bleBytes = 0;    // ATT 负载字节（含操作码/偏移与重发）
+  uint32_t writes = 0, dropped = 0, gaps = 0, timeouts = 0;
+  std::vector<uint8_t> uart;
+};
+
+// 离散事件仿真：App（按应答窗口发送，缺口/超时回退重发）、链路、打印队列（满则丢）、打印任务、串口、机芯
+static SimResult simulate(const std::vector<uint8_t>& stream, const std::string* qrText, const LinkModel& link,
+                          const PrinterModel& pm, size_t window, double dropRate = 0, uint32_t seed = 1) {
+  enum EventType { ARRIVE, TASK_DONE, RESPONSE, TIMEOUT };
+  struct Event {
+    double               t;
+    uint64_t             order;
+    int                  type;
+    uint32_t             id;
+    std::vector<uint8_t> data;
+    bool operator>(const Event& o) const { return t != o.t ? t > o.t : order > o.order; }
+  };
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  uint64_t order = 0;
+  auto schedule = [&](double t, int type, uint32_t id, std::vector<uint8_t> data) {
+    events.push({ t, order++, type, id, std::move(data) });
+  };
+  std::mt19937 rng(seed);
+  SimResult res;
+  RasterPrinter* rp = new RasterPrinter;
+
+  // App
+  const size_t maxData = (size_t)link.mtu - 3 - 5;
+  uint32_t sendOff = 0, timerId = 0;
+  std::deque<uint32_t> inflight;
+  double linkFree = 0, now = 0;
+  auto sendFrame = [&](std::vector<uint8_t> frame) {
+    linkFree = std::max(linkFree, now) + link.ciMs * 1000 / link.perCi;
+    res.writes++;
+    res.bleBytes += frame.size();
+    if (dropRate > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < dropRate) return;  // 空口丢包
+    schedule(linkFree, ARRIVE, 0, std::move(frame));
+  };
+  auto armTimeout = [&]() { schedule(std::max(now, linkFree) + kTimeoutUs, TIMEOUT, ++timerId, {}); };
+  auto pump = [&]() {
+    bool sent = false;
+    while (sendOff < stream.size() && inflight.size() < window) {
+      const size_t n = std::min(maxData, stream.size() - sendOff);
+      std::vector<uint8_t> f(5 + n);
+      f[0] = CMD_PRINT_RASTER;
+      putLe32(&f[1], sendOff);
+      memcpy(&f[5], &stream[sendOff], n);
+      inflight.push_back(sendOff);
+      sendOff += (uint32_t)n;
+      sendFrame(std::move(f));
+      sent = true;
+    }
+    if (sent) armTimeout();
+  };
+
+  // 设备：打印任务逐个处理队列；写串口后 flush，任务耗时含串口发送
+  std::deque<std::vector<uint8_t>> queue;
+  bool busy = false;
+  double uartFree = 0, mechFree = 0;
+  const double rowUs = 1e6 / (pm.mmPerSec * 8);
+  auto out = [&](const uint8_t* p, size_t n) {
+    res.uart.insert(res.uart.end(), p, p + n);
+    uartFree = std::max(uartFree, now) + n * 10 / pm.baud * 1e6;
+    const int rows = n == 3 ? p[2] : getLe16(p + 6);  // ESC J n / GS v 0
+    mechFree = std::max(mechFree, uartFree) + rows * rowUs;
+  };
+  auto startTask = [&]() {
+    if (busy || queue.empty()) return;
+    busy = true;
+    const std::vector<uint8_t> f = std::move(queue.front());
+    queue.pop_front();
+    const size_t before = res.uart.size();
+    RasterAck ack;
+    double cpu = kChunkUs;
+    if (f[0] == CMD_PRINT_QR) {
+      ack = rp->printQr(f[1], &f[2], f.size() - 2, out);
+      cpu += kQrEncodeUs;
+    } else {
+      ack = rp->feed(getLe32(&f[1]), &f[5], f.size() - 5, out);
+    }
+    cpu += (res.uart.size() - before) * kDecodeNsOut / 1000;
+    uint8_t frame[RASTER_ACK_LEN];
+    encodeRasterAck(ack, frame);
+    schedule(std::max(now + cpu, uartFree), TASK_DONE, 0, std::vector<uint8_t>(frame, frame + sizeof(frame)));
+  };
+
+  if (qrText) {
+    std::vector<uint8_t> f = { CMD_PRINT_QR, QR_ECC_M };
+    f.insert(f.end(), qrText->begin(), qrText->end());
+    sendFrame(std::move(f));
+    armTimeout();
+  } else {
+    pump();
+  }
+
+  while (!events.empty() && !res.done) {
+    Event ev = events.top();
+    events.pop();
+    now = ev.t;
+    if (now > 600e6) break;
+    switch (ev.type) {
+      case ARRIVE:
+        res.bleUs = now;
+        if (queue.size() >= PRINT_QUEUE_LEN) {
+          res.dropped++;  // 固件：打印队列满，回调丢弃
+          break;
+        }
+        queue.push_back(std::move(ev.data));
+        startTask();
+        break;
+      case TASK_DONE:
+        busy = false;
+        schedule(now + link.ciMs * 1000, RESPONSE, 0, std::move(ev.data));
+        startTask();
+        break;
+      case RESPONSE: {
+        const uint8_t status = ev.data[1];
+        const uint32_t next = getLe32(&ev.data[2]);
+        if (status == RASTER_DONE) {
+          res.done = true;
+          break;
+        }
+        if (status == RASTER_OK) {
+          while (!inflight.empty() && inflight.front() < next) inflight.pop_front();
+          armTimeout();
+        } else if (status == RASTER_GAP) {
+          res.gaps++;
+          sendOff = next;
+          inflight.clear();
+        } else {
+          events = {};  // 不可恢复的错误
+          break;
+        }
+        pump();
+        break;
+      }
+      case TIMEOUT:
+        if (ev.id != timerId || res.done) break;
+        res.timeouts++;
+        if (qrText) {
+          events = {};
+          break;
+        }
+        sendOff = inflight.empty() ? sendOff : inflight.front();
+        inflight.clear();
+        pump();
+        break;
+    }
+  }
+  res.printUs = std::max(mechFree, now);
+  delete rp;
+  return res;
+}
+
+// ==== 经 CoinBoxCore：指令帧 → 串口与应答（固件打印任务与 session_replay 走同一路径） ====
+class RigPlatform : public CoinBoxPlatform {
+ public:
+  uint64_t nowUs() override { return 0; }
+  void notify(uint8_t, const uint8_t* data, size_t len) override { replies.emplace_back(data, data + len); }
+  void setRelay(uint8_t, bool) override {}
+  void printerWrite(const uint8_t* data, size_t len) override { uart.insert(uart.end(), data, data + len); }
+  uint32_t random32() override { return 1; }
+
+  std::vector<uint8_t> uart;
+  std::vector<std::vector<uint8_t>> replies;
+};
+
+static const CoinDenomination kDenominations[] = COIN_DENOMINATIONS;
+static const HopperSpec kHoppers[] = HOPPERS;
+
+static void coreTests(const Bitmap& logo) {
+  RigPlatform rig;
+  RigPlatform* io = &rig;
+  CoinBoxCore core(rig, kHoppers, HOPPER_COUNT, kDenominations, sizeof(kDenominations) / sizeof(kDenominations[0]));
+  auto run = [&](const CommandFrame& c) {
+    static uint8_t frame[1 + 4 + PRINT_JOB_MAX_BYTES];
+    const size_t n = encodeCommand(c, frame, sizeof(frame));
+    CommandFrame cmd;
+    if (!n || decodeCommand(frame, n, cmd) != CMD_OK) return false;
+    core.execute(cmd, 0);
+    return true;
+  };
+
+  const std::vector<uint8_t> s = encodeStream(logo, RASTER_ENC_PACKBITS_DELTA, 7);
+  bool framed = true;
+  for (size_t off = 0; off < s.size(); off += 239) {
+    CommandFrame c = {};
+    c.op = CMD_PRINT_RASTER;
+    c.argCount = 1;
+    c.a = (uint32_t)off;
+    c.data = &s[off];
+    c.dataLen = std::min((size_t)239, s.size() - off);
+    framed &= run(c);
+  }
+  Bitmap paper;
+  const std::vector<uint8_t>& last = io->replies.back();
+  const bool acksOk = io->replies.size() == (s.size() + 238) / 239 && last.size() == RASTER_ACK_LEN &&
+                      last[0] == EVT_RASTER_ACK && last[1] == RASTER_DONE && getLe32(&last[2]) == s.size() &&
+                      getLe16(&last[6]) == logo.height;
+  check("core raster command", framed && acksOk && renderEscPos(io->uart, paper) && sameImage(paper, logo),
+        fmt("%zu frames, %zu acks, last status %u", (s.size() + 238) / 239, io->replies.size(), last[1]));
+
+  // 开新会话后同一条流（图像号相同）重新打印
+  io->uart.clear();
+  io->replies.clear();
+  CommandFrame start = {};
+  start.op = CMD_START_SESSION;
+  run(start);
+  io->replies.clear();
+  for (size_t off = 0; off < s.size(); off += 239) {
+    CommandFrame c = {};
+    c.op = CMD_PRINT_RASTER;
+    c.argCount = 1;
+    c.a = (uint32_t)off;
+    c.data = &s[off];
+    c.dataLen = std::min((size_t)239, s.size() - off);
+    run(c);
+  }
+  Bitmap again;
+  check("new session reprints", !io->replies.empty() && io->replies.back()[1] == RASTER_DONE &&
+                                    renderEscPos(io->uart, again) && sameImage(again, logo),
+        fmt("%zu uart bytes after CMD_START_SESSION", io->uart.size()));
+
+  io->uart.clear();
+  io->replies.clear();
+  const char* url = "https://kline.example/r/000123";
+  CommandFrame c = {};
+  c.op = CMD_PRINT_QR;
+  c.argCount = 1;
+  c.a = QR_ECC_Q;
+  c.data = reinterpret_cast<const uint8_t*>(url);
+  c.dataLen = strlen(url);
+  run(c);
+  QrCode* qr = new QrCode;
+  qr->encode(c.data, c.dataLen, QR_ECC_Q);
+  int quiet = 0;
+  const Bitmap want = qrExpected(*qr, quiet);
+  const bool qrOk = io->replies.size() == 1 && io->replies[0][1] == RASTER_DONE && renderEscPos(io->uart, paper) &&
+                    sameImage(paper, want, quiet);
+  check("core QR command", qrOk, fmt("v%u, %zu uart bytes for a %zu-byte frame", qr->version(), io->uart.size(),
+                                      1 + 1 + c.dataLen));
+
+  std::string big(QR_MAX_TEXT_BYTES, 'x');
+  io->replies.clear();
+  c.a = QR_ECC_H;
+  c.data = reinterpret_cast<const uint8_t*>(big.data());
+  c.dataLen = big.size();
+  run(c);
+  check("core QR too long", io->replies.size() == 1 && io->replies[0][1] == RASTER_ERR_QR,
+        fmt("%zu bytes at H -> RASTER_ERR_QR", big.size()));
+  delete qr;
+}
+
+// ==== 解码器自检 ====
+static void decoderTests(const Bitmap& logo, const Bitmap& dither) {
+  std::mt19937 rng(41);
+  static const char* kEncNames[] = { "raw", "packbits", "delta" };
+  RasterPrinter* rp = new RasterPrinter;
+  uint8_t imageNo = 0;
+
+  // 各编码随机切片往返；含 1 行、非整带行数与窄图
+  Bitmap narrow(5, 37);
+  for (int y = 0; y < narrow.height; y++) narrow.set((y * 7) % 40, y);
+  Bitmap blank(RASTER_MAX_WIDTH_BYTES, 50), one(RASTER_MAX_WIDTH_BYTES, 1);
+  one.fill(0, 0, 384, 1);
+  const Bitmap* shapes[] = { &logo, &dither, &narrow, &blank, &one };
+  int roundTrips = 0, bad = 0;
+  for (const Bitmap* bmp : shapes) {
+    for (uint8_t e = 0; e < 3; e++) {
+      for (size_t chunk : { (size_t)1, (size_t)17, (size_t)239 }) {
+        const std::vector<uint8_t> s = encodeStream(*bmp, e, ++imageNo);
+        Capture cap;
+        const RasterAck a = feedAll(*rp, s, cap, rng, chunk);
+        Bitmap paper;
+        roundTrips++;
+        if (a.status != RASTER_DONE || a.next != s.size() || a.rows != bmp->height || !renderEscPos(cap.uart, paper) ||
+            !sameImage(paper, *bmp)) {
+          bad++;
+          printf("  round trip %dx%d %s chunk<=%zu: status %u rows %u\n", bmp->widthBytes * 8, bmp->height,
+                 kEncNames[e], chunk, a.status, a.rows);
+        }
+      }
+    }
+  }
+  check("round trip", !bad, fmt("%d image x encoding x chunking cases", roundTrips));
+
+  // 缺口 → GAP 且不消耗数据；从应答偏移重发后完成
+  {
+    const std::vector<uint8_t> s = encodeStream(logo, RASTER_ENC_PACKBITS, ++imageNo);
+    Capture cap;
+    RasterAck a1 = rp->feed(0, s.data(), 100, cap);
+    RasterAck gap = rp->feed(200, &s[200], 100, cap);
+    RasterAck a2 = rp->feed(gap.next, &s[gap.next], s.size() - gap.next, cap);
+    Bitmap paper;
+    check("gap then resend",
+          a1.status == RASTER_OK && gap.status == RASTER_GAP && gap.next == 100 && a2.status == RASTER_DONE &&
+              renderEscPos(cap.uart, paper) && sameImage(paper, logo),
+          fmt("GAP next=%u, then DONE at %u", gap.next, a2.next));
+  }
+
+  // 重叠重发（应答丢失）：已收部分跳过，输出不重复
+  {
+    const std::vector<uint8_t> s = encodeStream(dither, RASTER_ENC_PACKBITS_DELTA, ++imageNo);
+    Capture cap;
+    rp->feed(0, s.data(), 300, cap);
+    const RasterAck dup = rp->feed(0, s.data(), 300, cap);  // 同图像号的首片重发
+    const RasterAck mid = rp->feed(150, &s[150], 400, cap);
+    const RasterAck end = rp->feed(550, &s[550], s.size() - 550, cap);
+    Bitmap paper;
+    check("overlap resend",
+          dup.status == RASTER_OK && dup.next == 300 && mid.next == 550 && end.status == RASTER_DONE &&
+              renderEscPos(cap.uart, paper) && sameImage(paper, dither),
+          fmt("first chunk resent at 300, overlap 150..550 -> next %u", mid.next));
+
+    // 完成后末片重发 → DONE 不再出纸；进度查询（无数据）同样回 DONE
+    const size_t before = cap.uart.size();
+    const RasterAck again = rp->feed(550, &s[550], s.size() - 550, cap);
+    const RasterAck query = rp->feed((uint32_t)s.size(), nullptr, 0, cap);
+    check("done resend", again.status == RASTER_DONE && query.status == RASTER_DONE && query.rows == dither.height &&
+                             cap.uart.size() == before,
+          fmt("DONE next=%u rows=%u, no extra output", query.next, query.rows));
+  }
+
+  // 新图像号打断进行中的图像
+  {
+    const uint32_t abortedBefore = rp->stats().aborted;
+    const std::vector<uint8_t> s1 = encodeStream(logo, RASTER_ENC_RAW, ++imageNo);
+    const std::vector<uint8_t> s2 = encodeStream(dither, RASTER_ENC_PACKBITS, ++imageNo);
+    Capture cap;
+    rp->feed(0, s1.data(), 2000, cap);
+    Capture cap2;
+    const RasterAck a = rp->feed(0, s2.data(), s2.size(), cap2);
+    Bitmap paper;
+    check("new image aborts old",
+          a.status == RASTER_DONE && rp->stats().aborted == abortedBefore + 1 && renderEscPos(cap2.uart, paper) &&
+              sameImage(paper, dither),
+          fmt("aborted %u -> %u", abortedBefore, rp->stats().aborted));
+  }
+
+  // 图像号重复（App 重启、换所有者、256 回绕）：头不同即为新图像；头相同须在 forgetDone 后才重新打印
+  {
+    Bitmap small1(1, 3), small2(2, 3);
+    small1.fill(0, 0, 8, 3);
+    small2.fill(4, 0, 12, 3);
+    const std::vector<uint8_t> s1 = encodeStream(small1, RASTER_ENC_RAW, 1);
+    const std::vector<uint8_t> s2 = encodeStream(small2, RASTER_ENC_RAW, 1);
+    Capture c1, c2, c3, c4;
+    const RasterAck a1 = rp->feed(0, s1.data(), s1.size(), c1);
+    const RasterAck a2 = rp->feed(0, s2.data(), s2.size(), c2);
+    const RasterAck again = rp->feed(0, s2.data(), s2.size(), c3);
+    rp->forgetDone();
+    const RasterAck reprint = rp->feed(0, s2.data(), s2.size(), c4);
+    Bitmap paper;
+    check("reused image number", a1.status == RASTER_DONE && a2.status == RASTER_DONE && !c2.uart.empty() &&
+                                     renderEscPos(c2.uart, paper) && sameImage(paper, small2) &&
+                                     again.status == RASTER_DONE && c3.uart.empty() &&
+                                     reprint.status == RASTER_DONE && c4.uart == c2.uart,
+          fmt("#1 %zu B, other #1 %zu B, resend %zu B, after forgetDone %zu B", c1.uart.size(), c2.uart.size(),
+              c3.uart.size(), c4.uart.size()));
+  }
+
+  // 错误流
+  {
+    Capture cap;
+    const uint8_t badWidth[] = { ++imageNo, RASTER_MAX_WIDTH_BYTES + 1, 1, 0, RASTER_ENC_RAW };
+    const uint8_t badEnc[]   = { ++imageNo, 1, 1, 0, 7 };
+    const uint8_t zeroRows[] = { ++imageNo, 1, 0, 0, RASTER_ENC_RAW };
+    const RasterAck h1 = rp->feed(0, badWidth, sizeof(badWidth), cap);
+    const RasterAck h2 = rp->feed(0, badEnc, sizeof(badEnc), cap);
+    const RasterAck h3 = rp->feed(0, zeroRows, sizeof(zeroRows), cap);
+    check("bad header", h1.status == RASTER_ERR_HEADER && h2.status == RASTER_ERR_HEADER &&
+                            h3.status == RASTER_ERR_HEADER && !rp->active(),
+          "width 49 / encoding 7 / 0 rows -> RASTER_ERR_HEADER");
+
+    // 2 行 × 1 字节，PackBits 重复 5 次 → 超出声明行数
+    const uint8_t over[] = { ++imageNo, 1, 2, 0, RASTER_ENC_PACKBITS, (uint8_t)(257 - 5), 0xAA };
+    const uint8_t trailing[] = { ++imageNo, 1, 1, 0, RASTER_ENC_RAW, 0xFF, 0x00 };
+    const RasterAck d1 = rp->feed(0, over, sizeof(over), cap);
+    const RasterAck d2 = rp->feed(0, trailing, sizeof(trailing), cap);
+    check("overflow", d1.status == RASTER_ERR_DATA && d2.status == RASTER_ERR_DATA && !rp->active(),
+          "run past the last row / bytes after it -> RASTER_ERR_DATA");
+
+    const RasterAck idle = rp->feed(1234, over, 3, cap);
+    check("idle offset", idle.status == RASTER_ERR_IDLE, "non-zero offset with no image -> RASTER_ERR_IDLE");
+  }
+
+  // 断线重连：只带偏移的查询返回进度，不消耗数据
+  {
+    const std::vector<uint8_t> s = encodeStream(logo, RASTER_ENC_PACKBITS_DELTA, ++imageNo);
+    Capture cap;
+    rp->feed(0, s.data(), 120, cap);
+    const RasterAck q = rp->feed(0, nullptr, 0, cap);
+    const RasterAck a = rp->feed(q.next, &s[q.next], s.size() - q.next, cap);
+    check("progress query", q.status == RASTER_OK && q.next == 120 && a.status == RASTER_DONE,
+          fmt("query -> next %u, resume to DONE", q.next));
+  }
+  delete rp;
+}
+
+// ==== 二维码自检 ====
+static void qrTests() {
+  QrCode* qr = new QrCode;
+  static const char* kTexts[] = {
+    "", "1", "HELLO WORLD", "https://kline.example/r/000123",
+    "投币 50 枚 / 出币 12 枚 — 会话 0x3FA91C07",
+    "The quick brown fox jumps over the lazy dog. The quick brown fox jumps over the lazy dog. 0123456789",
+  };
+  int cases = 0, bad = 0;
+  std::string why;
+  for (const char* t : kTexts) {
+    for (uint8_t ecc = QR_ECC_L; ecc <= QR_ECC_H; ecc++) {
+      for (int mask = -1; mask < 8; mask++) {
+        const size_t len = strlen(t);
+        cases++;
+        std::vector<uint8_t> back;
+        if (!qr->encode(reinterpret_cast<const uint8_t*>(t), len, ecc, mask) || !qrReadBack(*qr, back, why) ||
+            back.size() != len || memcmp(back.data(), t, len) != 0 || (mask >= 0 && qr->mask() != mask)) {
+          bad++;
+          if (bad <= 3) printf("  qr \"%.20s\" ecc %u mask %d: %s\n", t, ecc, mask, why.c_str());
+        }
+      }
+    }
+  }
+  // 每个版本的容量上限（L 级）：正好装满可编码，多一个字节失败
+  for (uint8_t v = 1; v <= QR_MAX_VERSION; v++) {
+    const size_t cap = (QrCode::dataCodewords(v, QR_ECC_L) * 8 - 4 - QrCode::countBits(v)) / 8;
+    const std::string full(cap, 'a' + v);
+    std::vector<uint8_t> back;
+    cases++;
+    if (!qr->encode(reinterpret_cast<const uint8_t*>(full.data()), cap, QR_ECC_L) || qr->version() != v ||
+        !qrReadBack(*qr, back, why) || back.size() != cap) {
+      bad++;
+      printf("  qr capacity v%u (%zu bytes): %s\n", v, cap, why.c_str());
+    }
+  }
+  check("qr read back", !bad, fmt("%d texts x ecc x mask + capacity cases", cases));
+
+  const std::string tooLong(QR_MAX_TEXT_BYTES + 1, 'x');
+  check("qr capacity limit",
+        qr->encode(reinterpret_cast<const uint8_t*>(tooLong.data()), QR_MAX_TEXT_BYTES, QR_ECC_L) &&
+            !qr->encode(reinterpret_cast<const uint8_t*>(tooLong.data()), tooLong.size(), QR_ECC_L),
+        fmt("%d bytes fit version %d-L, %zu do not", QR_MAX_TEXT_BYTES, QR_MAX_VERSION, tooLong.size()));
+
+  // 固定样例：掩膜选择或编码变化都会改变矩阵
+  const char* golden = "https://kline.example/r/000123";
+  qr->encode(reinterpret_cast<const uint8_t*>(golden), strlen(golden), QR_ECC_M);
+  const uint32_t h = matrixHash(*qr);
+  check("qr golden", qr->version() == 3 && qr->mask() == kGoldenMask && h == kGoldenHash,
+        fmt("v%u-M mask %u hash %08x", qr->version(), qr->mask(), h));
+  delete qr;
+}
+
+// ==== 终端预览 ====
+static int previewQr(const char* text, const char* level) {
+  const char* levels = "LMQH";
+  const char* p = level ? strchr(levels, level[0]) : nullptr;
+  const uint8_t ecc = p && level[0] ? (uint8_t)(p - levels) : (uint8_t)QR_ECC_M;
+  QrCode* qr = new QrCode;
+  if (!qr->encode(reinterpret_cast<const uint8_t*>(text), strlen(text), ecc)) {
+    fprintf(stderr, "text too long for version %d at %c\n", QR_MAX_VERSION, levels[ecc]);
+    return 2;
+  }
+  const int q = 2;
+  for (int y = -q; y < qr->size() + q; y += 2) {
+    for (int x = -q; x < qr->size() + q; x++) {
+      auto at = [&](int yy) {
+        return x >= 0 && yy >= 0 && x < qr->size() && yy < qr->size() && qr->module((uint8_t)x, (uint8_t)yy);
+      };
+      const bool a = at(y), b = at(y + 1);
+      fputs(a && b ? "█" : a ? "▀" : b ? "▄" : " ", stdout);
+    }
+    putchar('\n');
+  }
+  printf("version %u-%c, %ux%u modules, mask %u\n", qr->version(), levels[ecc], qr->size(), qr->size(), qr->mask());
+  delete qr;
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 3 && !strcmp(argv[1], "qr")) return previewQr(argv[2], argc > 3 ? argv[3] : nullptr);
+
+  LinkModel link;
+  PrinterModel pm;
+  const char* pbmPath = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+      link.mtu = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+      link.ciMs = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+      link.perCi = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+      pm.baud = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      pm.mmPerSec = atof(argv[++i]);
+    } else if (argv[i][0] == '-' || pbmPath) {
+      fprintf(stderr, "usage: raster_print [-m mtu] [-i ci_ms] [-k writes_per_ci] [-b baud] [-s mm_per_s] [image.pbm]\n"
+                      "       raster_print qr <text> [L|M|Q|H]\n");
+      return 2;
+    } else {
+      pbmPath = argv[i];
+    }
+  }
+  if (link.mtu < 3 + 5 + 1 || link.mtu > 517 || link.perCi < 1 || link.ciMs <= 0 || pm.baud <= 0 || pm.mmPerSec <= 0) {
+    fprintf(stderr, "mtu must be 9..517, ci_ms > 0, writes_per_ci >= 1, baud/speed > 0\n");
+    return 2;
+  }
+
+  // ---- 测试图 ----
+  struct Image {
+    std::string name;
+    Bitmap      bmp;
+    std::string qrText;  // 非空：设备端可直接生成
+    int         quietRows;
+  };
+  std::vector<Image> images;
+  images.push_back({ "logo", makeLogo(), "", 0 });
+  const std::string url = "https://kline.example/receipt?s=0x3FA91C07&n=128&v=4";
+  {
+    QrCode* qr = new QrCode;
+    qr->encode(reinterpret_cast<const uint8_t*>(url.data()), url.size(), QR_ECC_M);
+    int quiet = 0;
+    Bitmap bmp = qrExpected(*qr, quiet);
+    images.push_back({ "qr", bmp, url, quiet });
+    delete qr;
+  }
+  images.push_back({ "dither", makeDither(), "", 0 });
+  if (pbmPath) {
+    Bitmap b;
+    if (!loadPbm(pbmPath, b)) {
+      fprintf(stderr, "cannot read %s (P1/P4, width <= %d)\n", pbmPath, RASTER_MAX_WIDTH_BYTES * 8);
+      return 2;
+    }
+    images.push_back({ pbmPath, b, "", 0 });
+  }
+
+  printf("device RAM: RasterPrinter %zu B (band %d rows x %d B + QrCode %zu B), print job %zu B x %d queue\n\n",
+         sizeof(RasterPrinter), RASTER_BAND_ROWS, RASTER_MAX_WIDTH_BYTES, sizeof(QrCode),
+         (size_t)(1 + 4 + PRINT_JOB_MAX_BYTES + 12), PRINT_QUEUE_LEN);
+
+  // ---- 压缩 ----
+  static const char* kEncNames[] = { "raw", "packbits", "delta" };
+  printf("%-10s %9s %9s %9s %9s %7s %11s %12s\n", "image", "size", "raw B", "packbits", "delta", "ratio", "uart B",
+         "decode MB/s");
+  for (const Image& im : images) {
+    size_t sizes[3];
+    for (uint8_t e = 0; e < 3; e++) sizes[e] = encodeStream(im.bmp, e, 1).size();
+    std::vector<uint8_t> s = encodeStream(im.bmp, RASTER_ENC_PACKBITS_DELTA, 1);
+    RasterPrinter* rp = new RasterPrinter;
+    size_t uartBytes = 0;
+    const int reps = 200;
+    const double t0 = nowSec();
+    for (int r = 0; r < reps; r++) {
+      uartBytes = 0;
+      s[0] = (uint8_t)r;  // 每轮换图像号，从头解码
+      rp->feed(0, s.data(), s.size(), [&](const uint8_t*, size_t n) { uartBytes += n; });
+    }
+    const double dt = nowSec() - t0;
+    delete rp;
+    const size_t best = std::min(sizes[1], sizes[2]);
+    printf("%-10s %4dx%-4d %9zu %9zu %9zu %6.1f%% %11zu %12.0f\n", im.name.c_str(), im.bmp.widthBytes * 8,
+           im.bmp.height, sizes[0], sizes[1], sizes[2], 100.0 * best / sizes[0], uartBytes,
+           im.bmp.bits.size() * (double)reps / dt / 1e6);
+  }
+  printf("(uart B: GS v 0 bands after trimming blank right columns / blank bands; full width = %d B per row)\n",
+         RASTER_MAX_WIDTH_BYTES);
+
+  // ---- 传输与打印 ----
+  const double linkKBs = (link.mtu - 3 - 5) * link.perCi / link.ciMs;
+  printf("\nlink: MTU %d, %d writes per %.1f ms interval = %.1f KB/s payload, window %d; printer %.0f baud, %.0f mm/s\n",
+         link.mtu, link.perCi, link.ciMs, linkKBs, PRINT_QUEUE_LEN, pm.baud, pm.mmPerSec);
+  printf("%-10s %-9s %9s %7s %9s %9s %9s %8s\n", "image", "mode", "BLE B", "writes", "BLE s", "uart B", "print s",
+         "vs raw");
+  for (const Image& im : images) {
+    double rawUs = 0;
+    for (int m = 0; m < 4; m++) {
+      if (m == 3 && im.qrText.empty()) continue;
+      const std::vector<uint8_t> s = m < 3 ? encodeStream(im.bmp, (uint8_t)m, 1) : std::vector<uint8_t>();
+      const SimResult r = simulate(s, m == 3 ? &im.qrText : nullptr, link, pm, PRINT_QUEUE_LEN);
+      Bitmap paper;
+      const bool ok = r.done && renderEscPos(r.uart, paper) && sameImage(paper, im.bmp, m == 3 ? im.quietRows : 0);
+      if (!ok) {
+        printf("%-10s %-9s transfer FAILED\n", im.name.c_str(), m < 3 ? kEncNames[m] : "qr-text");
+        failures++;
+        continue;
+      }
+      if (!m) rawUs = r.printUs;
+      printf("%-10s %-9s %9llu %7u %9.3f %9zu %9.3f %7.2fx\n", im.name.c_str(), m < 3 ? kEncNames[m] : "qr-text",
+             (unsigned long long)r.bleBytes, r.writes, r.bleUs / 1e6, r.uart.size(), r.printUs / 1e6,
+             rawUs / r.printUs);
+    }
+  }
+
+  // 链路档位：BLE 不再是瓶颈后打印时间由串口/机芯决定
+  const LinkModel profiles[] = { { 23, 45, 1 }, { 185, 30, 2 }, { 247, 15, 4 } };
+  printf("\n%-10s %-16s %10s %10s %10s\n", "image", "link", "raw s", "best s", "qr-text s");
+  for (const Image& im : images) {
+    for (const LinkModel& lm : profiles) {
+      const SimResult raw = simulate(encodeStream(im.bmp, RASTER_ENC_RAW, 1), nullptr, lm, pm, PRINT_QUEUE_LEN);
+      const SimResult pb = simulate(encodeStream(im.bmp, RASTER_ENC_PACKBITS, 1), nullptr, lm, pm, PRINT_QUEUE_LEN);
+      const SimResult dl = simulate(encodeStream(im.bmp, RASTER_ENC_PACKBITS_DELTA, 1), nullptr, lm, pm, PRINT_QUEUE_LEN);
+      const double best = std::min(pb.printUs, dl.printUs);
+      std::string qrCol = "-";
+      if (!im.qrText.empty()) qrCol = fmt("%.3f", simulate({}, &im.qrText, lm, pm, PRINT_QUEUE_LEN).printUs / 1e6);
+      printf("%-10s %-16s %10.3f %10.3f %10s\n", im.name.c_str(), fmt("%d/%.0fms/%d", lm.mtu, lm.ciMs, lm.perCi).c_str(),
+             raw.printUs / 1e6, best / 1e6, qrCol.c_str());
+    }
+  }
+  printf("\n");
+
+  decoderTests(images[0].bmp, images[2].bmp);
+  qrTests();
+  coreTests(images[0].bmp);
+
+  // App 超出窗口：队列满的分片被丢弃，靠缺口/超时重发仍能完成；空口丢包同理
+  {
+    const std::vector<uint8_t> s = encodeStream(images[2].bmp, RASTER_ENC_PACKBITS, 1);
+    const SimResult over = simulate(s, nullptr, link, pm, 4 * PRINT_QUEUE_LEN);
+    const SimResult lossy = simulate(s, nullptr, link, pm, PRINT_QUEUE_LEN, 0.05, 7);
+    Bitmap p1, p2;
+    check("window overrun", over.done && renderEscPos(over.uart, p1) && sameImage(p1, images[2].bmp),
+          fmt("window %d: %u dropped, %u gaps, %u timeouts", 4 * PRINT_QUEUE_LEN, over.dropped, over.gaps,
+              over.timeouts));
+    check("lossy link", lossy.done && renderEscPos(lossy.uart, p2) && sameImage(p2, images[2].bmp),
+          fmt("5%% loss: %u writes, %u gaps, %u timeouts", lossy.writes, lossy.gaps, lossy.timeouts));
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,472 @@
+// 会话重放：把录制日志（include/session_log.h）在虚拟时钟下喂给 coinbox_core.h，与录制结果比对
+// 用法：session_replay <日志> [-v]
+//   日志为二进制（coinbox_farm -r 的 box-<i>.cblg），或固件串口日志（CAPTURE_ENABLE 时的
+//   "[CAP] <hex>" 行，其余行忽略）
+//
+// 重放：输入（投币器边沿、指令帧、断线）按录制时刻送入；random32/peerMtu 按录制顺序返回；
+// 吐币截止与脉冲串判定在虚拟时钟上准时触发（理想调度），不睡眠，远快于实时。
+// 比对：
+//   - 事件：按流（coin、pong、各类 status 事件）逐条比对负载，时间字段除外（扩展尾部只比 seq）
+//   - 计数：投币枚数/面值、吐币请求结果、继电器通断次数、打印机串口写入（长度 + 校验）
+//   - 时延：事件相对起因的时延，录制 vs 重放（coin：末个脉冲；指令应答：收到指令；吐币完成：继电器断开）
+//   - 继电器每次接通时长：录制 - 重放 即设备侧定时误差（决定实际出币数）
+//   - 确定性：同一日志重放两次，输出（含时刻）逐条一致
+// 事件或计数不一致时退出码为 1。
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "coinbox_core.h"
+#include "session_log.h"
+
+static double nowSec() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ==== 日志读取 ====
+struct Input {
+  uint64_t             t;
+  uint8_t              type;   // LOG_PULSE / LOG_COMMAND / LOG_DISCONNECT
+  std::vector<uint8_t> frame;
+};
+
+struct Output {
+  uint64_t             t;
+  uint8_t              type;   // LOG_NOTIFY / LOG_RELAY / LOG_UART
+  uint8_t              kind;
+  uint32_t             value;
+  std::vector<uint8_t> data;   // LOG_NOTIFY 负载
+  size_t               len;    // LOG_UART 字节数
+
+  bool operator==(const Output& o) const {
+    return t == o.t && type == o.type && kind == o.kind && value == o.value && data == o.data && len == o.len;
+  }
+};
+
+struct Recording {
+  SessionLogHeader      header;
+  std::vector<Input>    inputs;
+  std::vector<uint32_t> randoms;
+  std::vector<uint16_t> mtus;
+  std::vector<Output>   outputs;
+  uint32_t              dropped = 0;
+  uint32_t              connects = 0;
+  uint64_t              otherUartBytes = 0;
+  uint64_t              firstUs = UINT64_MAX, lastUs = 0;
+  bool                  corrupt = false;
+};
+
+static bool readFile(const char* path, std::vector<uint8_t>& out) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.insert(out.end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
+
+// 串口日志：拼接所有 "[CAP] " 行的十六进制
+static std::vector<uint8_t> extractCapture(const std::vector<uint8_t>& text) {
+  std::vector<uint8_t> out;
+  const std::string s(text.begin(), text.end());
+  size_t pos = 0;
+  while ((pos = s.find("[CAP] ", pos)) != std::string::npos) {
+    pos += 6;
+    while (pos + 1 < s.size() && isxdigit((unsigned char)s[pos]) && isxdigit((unsigned char)s[pos + 1])) {
+      out.push_back((uint8_t)strtoul(s.substr(pos, 2).c_str(), nullptr, 16));
+      pos += 2;
+    }
+  }
+  return out;
+}
+
+static bool loadRecording(const std::vector<uint8_t>& log, Recording& rec) {
+  SessionLogReader reader(log.data(), log.size());
+  if (!reader.header(rec.header)) return false;
+  SessionLogRecord r;
+  while (reader.next(r)) {
+    rec.firstUs = std::min(rec.firstUs, r.t);
+    rec.lastUs  = std::max(rec.lastUs, r.t);
+    switch (r.type) {
+      case LOG_PULSE:
+      case LOG_DISCONNECT:
+        rec.inputs.push_back({ r.t, r.type, {} });
+        break;
+      case LOG_COMMAND:
+        rec.inputs.push_back({ r.t, r.type, std::vector<uint8_t>(r.payload, r.payload + r.len) });
+        break;
+      case LOG_CONNECT:
+        rec.connects++;
+        break;
+      case LOG_RANDOM:
+        rec.randoms.push_back(r.value);
+        break;
+      case LOG_MTU:
+        rec.mtus.push_back((uint16_t)r.value);
+        break;
+      case LOG_NOTIFY:
+        rec.outputs.push_back({ r.t, r.type, r.kind, 0, std::vector<uint8_t>(r.payload, r.payload + r.len), 0 });
+        break;
+      case LOG_RELAY:
+        rec.outputs.push_back({ r.t, r.type, r.kind, r.value, {}, 0 });
+        break;
+      case LOG_UART:
+        if (r.kind == UART_SOURCE_CORE) {
+          rec.outputs.push_back({ r.t, r.type, r.kind, r.value, {}, r.len });
+        } else {
+          rec.otherUartBytes += r.len;
+        }
+        break;
+      case LOG_DROPPED:
+        rec.dropped += r.value;
+        break;
+    }
+  }
+  rec.corrupt = reader.corrupt();
+  // 不同上下文写入的记录可能略有倒序：输入按时刻排序（同一时刻保持录制顺序）
+  std::stable_sort(rec.inputs.begin(), rec.inputs.end(), [](const Input& a, const Input& b) { return a.t < b.t; });
+  return true;
+}
+
+// ==== 重放 ====
+static const CoinDenomination kDenominations[] = COIN_DENOMINATIONS;
+static const HopperSpec kHoppers[] = HOPPERS;
+
+class ReplayPlatform : public CoinBoxPlatform {
+ public:
+  explicit ReplayPlatform(const Recording& rec) : rec_(rec) {}
+
+  uint64_t nowUs() override { return now; }
+
+  void notify(uint8_t kind, const uint8_t* data, size_t len) override {
+    outputs.push_back({ now, LOG_NOTIFY, kind, 0, std::vector<uint8_t>(data, data + len), 0 });
+  }
+
+  void setRelay(uint8_t hopper, bool on) override { outputs.push_back({ now, LOG_RELAY, hopper, on, {}, 0 }); }
+
+  void printerWrite(const uint8_t* data, size_t len) override {
+    outputs.push_back({ now, LOG_UART, UART_SOURCE_CORE, fnv1a32(data, len), {}, len });
+  }
+
+  uint32_t random32() override {
+    if (randomIdx_ < rec_.randoms.size()) return rec_.randoms[randomIdx_++];
+    missing++;
+    return 0x5EED0001u + missing;
+  }
+
+  uint16_t peerMtu(uint16_t) override {
+    if (mtuIdx_ < rec_.mtus.size()) return rec_.mtus[mtuIdx_++];
+    missing++;
+    return 23;
+  }
+
+  uint64_t            now = 0;
+  std::vector<Output> outputs;
+  uint32_t            missing = 0;  // 录制中缺少的平台返回值（日志被截断或丢弃记录）
+
+ private:
+  const Recording& rec_;
+  size_t randomIdx_ = 0, mtuIdx_ = 0;
+};
+
+struct ReplayResult {
+  std::vector<Output> outputs;
+  uint32_t commands = 0, rejected = 0, pulses = 0, disconnects = 0, missing = 0;
+  uint16_t coinTotal = 0, coinValue = 0;
+  uint64_t steps = 0;
+};
+
+static ReplayResult replay(const Recording& rec) {
+  ReplayPlatform io(rec);
+  CoinBoxCore core(io, kHoppers, HOPPER_COUNT, kDenominations, sizeof(kDenominations) / sizeof(kDenominations[0]));
+  ReplayResult res;
+  io.now = rec.header.startUs;
+
+  size_t i = 0;
+  for (;;) {
+    const uint64_t inputUs = i < rec.inputs.size() ? rec.inputs[i].t : UINT64_MAX;
+    uint64_t timerUs = core.nextPayoutUs();
+    const uint32_t coinDue = core.coinDueInUs((uint32_t)io.now);
+    if (coinDue != UINT32_MAX) timerUs = std::min(timerUs, io.now + coinDue);
+    if (inputUs == UINT64_MAX && timerUs == UINT64_MAX) break;
+
+    // 同一时刻先处理输入，再推进定时
+    if (timerUs < inputUs) {
+      io.now = std::max(io.now, timerUs);
+    } else {
+      const Input& in = rec.inputs[i++];
+      io.now = std::max(io.now, in.t);
+      if (in.type == LOG_PULSE) {
+        core.feedPulse((uint32_t)in.t);
+        res.pulses++;
+      } else if (in.type == LOG_DISCONNECT) {
+        core.onDisconnect();
+        res.disconnects++;
+      } else {
+        CommandFrame cmd;
+        if (decodeCommand(in.frame.data(), in.frame.size(), cmd) != CMD_OK) {
+          if (!in.frame.empty()) res.rejected++;
+        } else {
+          res.commands++;
+          if (cmd.op != CMD_DEBUG_PRINTER) core.execute(cmd, (uint32_t)in.t);  // 打印机自检不经核心逻辑
+        }
+      }
+    }
+    core.flushCoins();
+    while (core.servicePayout()) {
+    }
+    res.steps++;
+  }
+  res.outputs   = std::move(io.outputs);
+  res.missing   = io.missing;
+  res.coinTotal = core.coinTotal();
+  res.coinValue = core.coinValue();
+  return res;
+}
+
+// ==== 比对 ====
+static const char* streamOf(const Output& o) {
+  if (o.kind == EVENT_KIND_COIN) return "coin";
+  switch (o.data.empty() ? 0 : o.data[0]) {
+    case EVT_TIME_PONG:           return "pong";
+    case EVT_SESSION_STARTED:     return "session";
+    case EVT_PAYOUT_REQUEST_DONE: return "payout_request";
+    case EVT_PAYOUT_DONE:         return "payout_run";
+    case EVT_RESUME_BATCH:        return "resume";
+    case EVT_CAPS:                return "caps";
+    case EVT_RASTER_ACK:          return "raster";
+  }
+  return "status_other";
+}
+
+// 去掉时间字段后的负载；扩展尾部只保留 seq
+static std::vector<uint8_t> signatureOf(const Output& o) {
+  const std::vector<uint8_t>& d = o.data;
+  size_t base = d.size();
+  const std::string s = streamOf(o);
+  if (s == "pong") return std::vector<uint8_t>(d.begin(), d.begin() + std::min(d.size(), (size_t)5));
+  if (s == "coin") base = 4;
+  if (s == "session") base = 5;
+  if (s == "payout_request") base = 7;
+  if (s == "payout_run" && d.size() >= 4) base = 4 + 2 * (size_t)d[3];
+  if (d.size() != base + EVENT_STAMP_LEN) return d;
+  std::vector<uint8_t> sig(d.begin(), d.begin() + (long)base + 2);
+  return sig;
+}
+
+// 事件起因时刻（见文件头）；找不到时返回 UINT64_MAX
+static uint64_t causeOf(const Output& o, const Recording& rec, const std::vector<Output>& outputs) {
+  const std::string s = streamOf(o);
+  uint64_t cause = UINT64_MAX;
+  bool relay = s == "payout_run" || (s == "payout_request" && o.data.size() >= 7 && o.data[6] != PAYOUT_STATUS_REJECTED);
+  if (relay) {
+    for (const Output& r : outputs) {
+      if (r.t > o.t) break;
+      if (r.type == LOG_RELAY && !r.value) cause = r.t;
+    }
+    return cause;
+  }
+  const uint8_t want = s == "coin" ? LOG_PULSE : LOG_COMMAND;
+  for (const Input& in : rec.inputs) {
+    if (in.t > o.t) break;
+    if (in.type == want) cause = in.t;
+  }
+  return cause;
+}
+
+struct LatencySet {
+  std::vector<double> rec, rep;
+};
+
+static double pct(std::vector<double> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * (double)(v.size() - 1) + 0.5))];
+}
+
+static void hex(const std::vector<uint8_t>& d) {
+  for (uint8_t b : d) printf("%02x", b);
+}
+
+// 继电器每次接通时长（us），按料斗
+static std::map<uint8_t, std::vector<int64_t>> relayPulses(const std::vector<Output>& outputs) {
+  std::map<uint8_t, std::vector<int64_t>> out;
+  std::map<uint8_t, uint64_t> onAt;
+  for (const Output& o : outputs) {
+    if (o.type != LOG_RELAY) continue;
+    if (o.value) {
+      onAt[o.kind] = o.t;
+    } else if (onAt.count(o.kind)) {
+      out[o.kind].push_back((int64_t)(o.t - onAt[o.kind]));
+      onAt.erase(o.kind);
+    }
+  }
+  return out;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: session_replay <capture.cblg | serial.log> [-v]\n");
+    return 2;
+  }
+  const bool verbose = argc > 2 && !strcmp(argv[2], "-v");
+  std::vector<uint8_t> raw;
+  if (!readFile(argv[1], raw)) {
+    perror(argv[1]);
+    return 2;
+  }
+  if (raw.size() < 4 || memcmp(raw.data(), SESSION_LOG_MAGIC, 4) != 0) raw = extractCapture(raw);
+
+  Recording rec;
+  if (!loadRecording(raw, rec)) {
+    fprintf(stderr, "%s: not a session log (version %d expected)\n", argv[1], SESSION_LOG_VERSION);
+    return 2;
+  }
+  const double spanSec = rec.lastUs > rec.firstUs ? (rec.lastUs - rec.firstUs) / 1e6 : 0;
+  printf("log: %zu bytes, %.1f s, %zu inputs, %zu outputs, %u connects%s\n", raw.size(), spanSec,
+         rec.inputs.size(), rec.outputs.size(), rec.connects, rec.corrupt ? " (TRUNCATED/CORRUPT tail)" : "");
+  if (rec.dropped) printf("WARNING: %u records dropped during capture, expect differences\n", rec.dropped);
+  if (rec.header.hopperCount != HOPPER_COUNT || rec.header.coinTrainGapUs != COIN_TRAIN_GAP_US) {
+    printf("NOTE: recorded with hoppers=%u gap=%uus; replaying with %u/%u\n", rec.header.hopperCount,
+           rec.header.coinTrainGapUs, HOPPER_COUNT, COIN_TRAIN_GAP_US);
+  }
+
+  const double t0 = nowSec();
+  const ReplayResult res = replay(rec);
+  const double wall = nowSec() - t0;
+  const ReplayResult again = replay(rec);
+  const bool deterministic = again.outputs == res.outputs;
+  printf("replay: %llu steps in %.2f ms (%.0fx real time), deterministic: %s%s\n", (unsigned long long)res.steps,
+         wall * 1e3, wall > 0 ? spanSec / wall : 0, deterministic ? "yes" : "NO",
+         res.missing ? ", platform values missing from log" : "");
+
+  // ---- 事件 ----
+  std::map<std::string, std::vector<const Output*>> recStreams, repStreams;
+  for (const Output& o : rec.outputs) {
+    if (o.type == LOG_NOTIFY) recStreams[streamOf(o)].push_back(&o);
+  }
+  for (const Output& o : res.outputs) {
+    if (o.type == LOG_NOTIFY) repStreams[streamOf(o)].push_back(&o);
+  }
+  std::map<std::string, bool> names;
+  for (auto& kv : recStreams) names[kv.first] = true;
+  for (auto& kv : repStreams) names[kv.first] = true;
+
+  int failures = !deterministic;
+  int shown = 0;
+  std::map<std::string, LatencySet> latency;
+  printf("\n%-15s %8s %8s %8s %9s\n", "events", "recorded", "replayed", "matched", "mismatch");
+  for (auto& kv : names) {
+    const std::vector<const Output*>& a = recStreams[kv.first];
+    const std::vector<const Output*>& b = repStreams[kv.first];
+    size_t matched = 0, mismatched = 0;
+    for (size_t i = 0; i < std::min(a.size(), b.size()); i++) {
+      if (signatureOf(*a[i]) != signatureOf(*b[i])) {
+        mismatched++;
+        if (shown++ < 10 || verbose) {
+          printf("  %s #%zu at %.3f s: recorded ", kv.first.c_str(), i, (a[i]->t - rec.header.startUs) / 1e6);
+          hex(a[i]->data);
+          printf(", replayed ");
+          hex(b[i]->data);
+          printf("\n");
+        }
+        continue;
+      }
+      matched++;
+      const uint64_t ca = causeOf(*a[i], rec, rec.outputs);
+      const uint64_t cb = causeOf(*b[i], rec, res.outputs);
+      if (ca != UINT64_MAX && cb != UINT64_MAX) {
+        latency[kv.first].rec.push_back((double)(a[i]->t - ca));
+        latency[kv.first].rep.push_back((double)(b[i]->t - cb));
+      }
+    }
+    const bool ok = !mismatched && a.size() == b.size();
+    failures += !ok;
+    printf("%-15s %8zu %8zu %8zu %9zu%s\n", kv.first.c_str(), a.size(), b.size(), matched, mismatched, ok ? "" : "  <-");
+  }
+
+  // ---- 计数 ----
+  uint16_t recCoins = 0, recValue = 0;
+  for (const Output& o : rec.outputs) {
+    if (o.type == LOG_NOTIFY && o.kind == EVENT_KIND_COIN && o.data.size() >= 4) {
+      recCoins = getLe16(o.data.data());
+      recValue = getLe16(o.data.data() + 2);
+    }
+  }
+  auto relayCount = [](const std::vector<Output>& v) {
+    size_t n = 0;
+    for (const Output& o : v) n += o.type == LOG_RELAY;
+    return n;
+  };
+  auto uartSummary = [](const std::vector<Output>& v, uint64_t& bytes, uint32_t& hash) {
+    size_t writes = 0;
+    bytes = 0;
+    hash  = 2166136261u;
+    for (const Output& o : v) {
+      if (o.type != LOG_UART) continue;
+      writes++;
+      bytes += o.len;
+      hash = fnv1a32(reinterpret_cast<const uint8_t*>(&o.value), 4, hash);
+    }
+    return writes;
+  };
+  uint64_t recUartBytes, repUartBytes;
+  uint32_t recUartHash, repUartHash;
+  const size_t recUartWrites = uartSummary(rec.outputs, recUartBytes, recUartHash);
+  const size_t repUartWrites = uartSummary(res.outputs, repUartBytes, repUartHash);
+  const bool coinsOk = recCoins == res.coinTotal && recValue == res.coinValue;
+  const bool relayOk = relayCount(rec.outputs) == relayCount(res.outputs);
+  const bool uartOk  = recUartWrites == repUartWrites && recUartBytes == repUartBytes && recUartHash == repUartHash;
+  failures += !coinsOk + !relayOk + !uartOk;
+  printf("\n%-15s %16s %16s\n", "counts", "recorded", "replayed");
+  printf("%-15s %16s %16s%s\n", "coins/value", (std::to_string(recCoins) + "/" + std::to_string(recValue)).c_str(),
+         (std::to_string(res.coinTotal) + "/" + std::to_string(res.coinValue)).c_str(), coinsOk ? "" : "  <-");
+  printf("%-15s %16zu %16zu%s\n", "relay switches", relayCount(rec.outputs), relayCount(res.outputs), relayOk ? "" : "  <-");
+  printf("%-15s %10zu/%5llu %10zu/%5llu%s\n", "uart writes/B", recUartWrites, (unsigned long long)recUartBytes,
+         repUartWrites, (unsigned long long)repUartBytes, uartOk ? "" : "  <-");
+  printf("%-15s %16zu %16u (rejected %u)\n", "inputs", rec.inputs.size(),
+         res.commands + res.pulses + res.disconnects, res.rejected);
+  if (rec.otherUartBytes) printf("other uart     %16llu bytes (printer library / self test, not replayed)\n",
+                                 (unsigned long long)rec.otherUartBytes);
+
+  // ---- 时延 ----
+  printf("\n%-15s %26s %26s\n", "latency ms", "recorded p50/p99/max", "replayed p50/p99/max");
+  for (auto& kv : latency) {
+    const LatencySet& l = kv.second;
+    printf("%-15s %10.3f/%7.3f/%7.3f %10.3f/%7.3f/%7.3f\n", kv.first.c_str(), pct(l.rec, 0.5) / 1e3,
+           pct(l.rec, 0.99) / 1e3, pct(l.rec, 1) / 1e3, pct(l.rep, 0.5) / 1e3, pct(l.rep, 0.99) / 1e3,
+           pct(l.rep, 1) / 1e3);
+  }
+
+  // ---- 继电器定时 ----
+  const auto recPulses = relayPulses(rec.outputs);
+  const auto repPulses = relayPulses(res.outputs);
+  for (const auto& kv : recPulses) {
+    const auto it = repPulses.find(kv.first);
+    if (it == repPulses.end()) continue;
+    const size_t n = std::min(kv.second.size(), it->second.size());
+    if (!n) continue;
+    int64_t minErr = INT64_MAX, maxErr = INT64_MIN;
+    double sumAbs = 0;
+    for (size_t i = 0; i < n; i++) {
+      const int64_t err = kv.second[i] - it->second[i];
+      minErr = std::min(minErr, err);
+      maxErr = std::max(maxErr, err);
+      sumAbs += (double)(err < 0 ? -err : err);
+    }
+    printf("\nhopper %u on-time recorded - replayed: %zu runs, min %lld us, mean |err| %.0f us, max %lld us\n",
+           kv.first, n, (long long)minErr, sumAbs / (double)n, (long long)maxErr);
+  }
+
+  printf("\n%s\n", failures ? "DIFFERENCES FOUND" : "replay matches recording");
+  return failures ? 1 : 0;
+}
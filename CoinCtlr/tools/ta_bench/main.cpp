@@ -0,0 +1,399 @@
+// 指标内核基准（include/indicators.h）：在 K 线包全部币种上测各指标各版本的吞吐（百万根/秒），
+// 并与本文件的标量参考实现（逐窗口直接求和、逐根递推）逐元素按位比对。
+// 用法：ta_bench [-t 每项秒数] [包]   默认 bin/klines.klp（先运行 kline_pack 生成）
+//
+// 指标：SMA(20)、布林带(20, 2)、EMA(26)、RSI(14)、随机窗口回测（持仓 = sign(SMA10 - SMA30)）。
+// SMA / 布林带在每个币种的整条序列上算；EMA / RSI / 回测在一批随机窗口（每个 300 根，起点规则同 App）上算，
+// 另给出 EMA / RSI 逐条序列计算（lanes = 1）的吞吐作对比。
+// 版本：ref（参考）、scalar / sse2 / avx2（批量内核，CPU 不支持的列显示 -）、stream（增量版本逐根喂入）。
+// 任一版本与参考不一致时退出码为 1。
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "indicators.h"
+#include "kline_pack.h"
+
+static const char* kDefaultPack = "bin/klines.klp";
+static const uint16_t kSmaPeriod = 20, kBollPeriod = 20, kEmaPeriod = 26, kRsiPeriod = 14;
+static const double kBollK = 2;
+static const uint16_t kFast = 10, kSlow = 30;
+static const uint32_t kWindowBars = 300, kWindowLead = 30, kWindowTail = 300;
+static const size_t kWindows = 1024;
+
+static double nowSec() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ==== 标量参考实现 ====
+static void refSma(const int32_t* x, size_t n, uint16_t p, double* out) {
+  for (size_t i = 0; i < n; i++) {
+    if (i + 1 < p) {
+      out[i] = taNan();
+      continue;
+    }
+    double s = 0;
+    for (size_t j = i + 1 - p; j <= i; j++) s += x[j];
+    out[i] = s / p;
+  }
+}
+
+static void refBollinger(const int32_t* x, size_t n, uint16_t p, double k, double* mid, double* up, double* lo) {
+  for (size_t i = 0; i < n; i++) {
+    if (i + 1 < p) {
+      mid[i] = up[i] = lo[i] = taNan();
+      continue;
+    }
+    double s = 0, q = 0;
+    for (size_t j = i + 1 - p; j <= i; j++) {
+      s += x[j];
+      q += (double)x[j] * x[j];
+    }
+    const double m = s / p;
+    const double sd = sqrt(taMax0(q / p - m * m));
+    mid[i] = m;
+    up[i] = m + k * sd;
+    lo[i] = m - k * sd;
+  }
+}
+
+static void refEma(const int32_t* x, size_t n, uint16_t p, double* out) {
+  double s = 0, e = 0;
+  const double a = 2.0 / (p + 1);
+  for (size_t i = 0; i < n; i++) {
+    if (i < p) {
+      s += x[i];
+      out[i] = i + 1 == p ? (e = s / p) : taNan();
+    } else {
+      e = e + a * ((double)x[i] - e);
+      out[i] = e;
+    }
+  }
+}
+
+static void refRsi(const int32_t* x, size_t n, uint16_t p, double* out) {
+  double g = 0, l = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (i == 0) {
+      out[i] = taNan();
+      continue;
+    }
+    const double d = (double)x[i] - (double)x[i - 1];
+    if (i <= p) {
+      g += taMax0(d);
+      l += taMax0(0 - d);
+      if (i < p) {
+        out[i] = taNan();
+        continue;
+      }
+      g /= p;
+      l /= p;
+    } else {
+      g = (g * (p - 1) + taMax0(d)) / p;
+      l = (l * (p - 1) + taMax0(0 - d)) / p;
+    }
+    out[i] = l == 0 ? 100 : 100 - 100 / (1 + g / l);
+  }
+}
+
+static void refBacktest(const int32_t* close, const int8_t* pos, const uint32_t* starts, size_t windows, uint32_t len,
+                        double* pnl, double* drawdown) {
+  for (size_t w = 0; w < windows; w++) {
+    const int32_t* c = close + starts[w];
+    const int8_t* q = pos + starts[w];
+    double eq = 0, peak = 0, dd = 0;
+    for (uint32_t t = 0; t + 1 < len; t++) {
+      eq = eq + (double)q[t] * ((double)c[t + 1] - (double)c[t]);
+      peak = taMax(peak, eq);
+      dd = taMax(dd, peak - eq);
+    }
+    pnl[w] = eq;
+    drawdown[w] = dd;
+  }
+}
+
+// ==== 计时与比对 ====
+static double minSec = 0.2;
+
+// 反复运行直到累计 minSec，返回每秒根数
+static double rate(const std::function<void()>& fn, double bars) {
+  fn();
+  int reps = 0;
+  const double t0 = nowSec();
+  double t;
+  do {
+    fn();
+    reps++;
+  } while ((t = nowSec() - t0) < minSec);
+  return bars * reps / t;
+}
+
+// 按位比对（NaN 位型一致）
+static size_t diffCount(const std::vector<double>& a, const std::vector<double>& b) {
+  if (a.size() != b.size()) return a.size() + b.size();
+  size_t d = 0;
+  for (size_t i = 0; i < a.size(); i++) d += memcmp(&a[i], &b[i], sizeof(double)) != 0;
+  return d;
+}
+
+enum Column { COL_REF, COL_SCALAR, COL_SSE2, COL_AVX2, COL_STREAM, COL_COUNT };
+static const char* const kColumnNames[COL_COUNT] = { "ref", "scalar", "sse2", "avx2", "stream" };
+
+struct Row {
+  std::string name;
+  double bars = 0;
+  // 各版本：运行一遍并把结果写入 out；为空表示该版本不适用
+  std::function<void(std::vector<double>&)> run[COL_COUNT];
+};
+
+int main(int argc, char** argv) {
+  const char* path = kDefaultPack;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      minSec = atof(argv[++i]);
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "usage: ta_bench [-t seconds_per_cell] [pack]\n");
+      return 2;
+    } else {
+      path = argv[i];
+    }
+  }
+  KLinePackFile pack;
+  if (!pack.map(path)) {
+    fprintf(stderr, "cannot open pack %s (run ./bin/kline_pack first)\n", path);
+    return 2;
+  }
+
+  // 各币种收盘价列首尾相接成一列，回测窗口不跨币种
+  const size_t symbols = pack.symbolCount();
+  std::vector<int32_t> close(pack.totalBars());
+  std::vector<size_t> begin(symbols + 1, 0);
+  bool exactRange = true;
+  printf("pack: %s, %zu symbols, %u bars; isa: %s\n\n", path, symbols, pack.totalBars(), taIsaName(taBestIsa()));
+  for (size_t s = 0; s < symbols; s++) {
+    KLineSymbol info = {};
+    pack.symbol((uint8_t)s, info);
+    begin[s + 1] = begin[s] + info.bars;
+    KLineColumns c;
+    c.close = close.data() + begin[s];
+    pack.read((uint8_t)s, 0, info.bars, c);
+    int32_t hi = 0;
+    for (uint32_t i = 0; i < info.bars; i++) hi = std::max(hi, c.close[i]);
+    // 布林带窗口平方和须在 2^53 内
+    const double maxPeriod = 9007199254740992.0 / ((double)hi * hi);
+    exactRange = exactRange && maxPeriod >= kBollPeriod;
+    printf("%-10s %5u bars  max close %.*f  bollinger exact up to period %.0f\n", info.symbol, info.bars,
+           info.priceDigits, klpToDouble(hi, info.priceDigits), maxPeriod < 1e6 ? maxPeriod : 1e6);
+  }
+  printf("\n");
+
+  // 持仓：SMA10 与 SMA30 比较（整条序列，按币种）
+  std::vector<int8_t> pos(close.size(), 0);
+  {
+    std::vector<double> f(close.size()), s(close.size());
+    for (size_t k = 0; k < symbols; k++) {
+      refSma(&close[begin[k]], begin[k + 1] - begin[k], kFast, &f[begin[k]]);
+      refSma(&close[begin[k]], begin[k + 1] - begin[k], kSlow, &s[begin[k]]);
+    }
+    for (size_t i = 0; i < close.size(); i++) pos[i] = f[i] > s[i] ? 1 : f[i] < s[i] ? -1 : 0;
+  }
+
+  // 随机窗口（起点为合并列中的下标）
+  std::mt19937 rng(2024);
+  std::vector<uint32_t> starts(kWindows);
+  std::vector<const int32_t*> winPtr(kWindows);
+  for (size_t w = 0; w < kWindows; w++) {
+    const uint8_t s = (uint8_t)(rng() % symbols);
+    starts[w] = (uint32_t)(begin[s] + pack.randomStart(s, kWindowLead, kWindowTail, rng()));
+    winPtr[w] = &close[starts[w]];
+  }
+  const double winBars = (double)kWindows * kWindowBars;
+  const size_t n = close.size();
+
+  std::vector<Row> rows;
+  auto isaRuns = [](Row& r, const std::function<void(TaIsa, std::vector<double>&)>& fn) {
+    const TaIsa isas[3] = { TA_ISA_SCALAR, TA_ISA_SSE2, TA_ISA_AVX2 };
+    for (int k = 0; k < 3; k++)
+      if (taIsaSupported(isas[k]))
+        r.run[COL_SCALAR + k] = [fn, isa = isas[k]](std::vector<double>& out) { fn(isa, out); };
+  };
+
+  // 按币种逐段处理整条序列
+  auto perSymbol = [&](std::vector<double>& out, size_t outsPerBar,
+                       const std::function<void(const int32_t*, size_t, double*)>& fn) {
+    out.resize(n * outsPerBar);
+    for (size_t k = 0; k < symbols; k++) fn(&close[begin[k]], begin[k + 1] - begin[k], &out[begin[k] * outsPerBar]);
+  };
+
+  {
+    Row r;
+    r.name = "sma(20)";
+    r.bars = (double)n;
+    r.run[COL_REF] = [&](std::vector<double>& out) {
+      perSymbol(out, 1, [](const int32_t* x, size_t m, double* o) { refSma(x, m, kSmaPeriod, o); });
+    };
+    isaRuns(r, [&](TaIsa isa, std::vector<double>& out) {
+      perSymbol(out, 1, [isa](const int32_t* x, size_t m, double* o) { taSma(x, m, kSmaPeriod, o, isa); });
+    });
+    r.run[COL_STREAM] = [&](std::vector<double>& out) {
+      perSymbol(out, 1, [](const int32_t* x, size_t m, double* o) {
+        TaSma<64> sma(kSmaPeriod);
+        for (size_t i = 0; i < m; i++) o[i] = sma.update(x[i]);
+      });
+    };
+    rows.push_back(r);
+  }
+  {
+    // 三条轨道依次存放：[mid 0..m)[upper 0..m)[lower 0..m)
+    Row r;
+    r.name = "bollinger(20,2)";
+    r.bars = (double)n;
+    r.run[COL_REF] = [&](std::vector<double>& out) {
+      perSymbol(out, 3, [](const int32_t* x, size_t m, double* o) {
+        refBollinger(x, m, kBollPeriod, kBollK, o, o + m, o + 2 * m);
+      });
+    };
+    isaRuns(r, [&](TaIsa isa, std::vector<double>& out) {
+      perSymbol(out, 3, [isa](const int32_t* x, size_t m, double* o) {
+        taBollinger(x, m, kBollPeriod, kBollK, o, o + m, o + 2 * m, isa);
+      });
+    });
+    r.run[COL_STREAM] = [&](std::vector<double>& out) {
+      perSymbol(out, 3, [](const int32_t* x, size_t m, double* o) {
+        TaBollinger<64> bb(kBollPeriod, kBollK);
+        for (size_t i = 0; i < m; i++) {
+          bb.update(x[i]);
+          o[i] = bb.mid();
+          o[m + i] = bb.upper();
+          o[2 * m + i] = bb.lower();
+        }
+      });
+    };
+    rows.push_back(r);
+  }
+
+  // 窗口批：输出 [窗口][根]
+  std::vector<double*> outPtr(kWindows);
+  auto windowsOut = [&](std::vector<double>& out) {
+    out.resize(kWindows * kWindowBars);
+    for (size_t w = 0; w < kWindows; w++) outPtr[w] = &out[w * kWindowBars];
+  };
+  auto recurrent = [&](const char* name, uint16_t period, void (*ref)(const int32_t*, size_t, uint16_t, double*),
+                       void (*batch)(const int32_t* const*, size_t, size_t, uint16_t, double* const*, TaIsa),
+                       const std::function<void(const int32_t*, double*)>& stream) {
+    Row r;
+    r.name = std::string(name) + "(" + std::to_string(period) + ") x" + std::to_string(kWindows);
+    r.bars = winBars;
+    r.run[COL_REF] = [&, ref, period](std::vector<double>& out) {
+      windowsOut(out);
+      for (size_t w = 0; w < kWindows; w++) ref(winPtr[w], kWindowBars, period, outPtr[w]);
+    };
+    isaRuns(r, [&, batch, period](TaIsa isa, std::vector<double>& out) {
+      windowsOut(out);
+      batch(winPtr.data(), kWindows, kWindowBars, period, outPtr.data(), isa);
+    });
+    r.run[COL_STREAM] = [&, stream](std::vector<double>& out) {
+      windowsOut(out);
+      for (size_t w = 0; w < kWindows; w++) stream(winPtr[w], outPtr[w]);
+    };
+    rows.push_back(r);
+
+    // 同一批窗口逐条计算（lanes = 1），向量版本退化为标量递推
+    Row s;
+    s.name = std::string(name) + "(" + std::to_string(period) + ") x1";
+    s.bars = winBars;
+    s.run[COL_REF] = r.run[COL_REF];
+    isaRuns(s, [&, batch, period](TaIsa isa, std::vector<double>& out) {
+      windowsOut(out);
+      for (size_t w = 0; w < kWindows; w++) batch(&winPtr[w], 1, kWindowBars, period, &outPtr[w], isa);
+    });
+    rows.push_back(s);
+  };
+  recurrent("ema", kEmaPeriod, refEma, taEma, [](const int32_t* x, double* o) {
+    TaEma ema(kEmaPeriod);
+    for (uint32_t i = 0; i < kWindowBars; i++) o[i] = ema.update(x[i]);
+  });
+  recurrent("rsi", kRsiPeriod, refRsi, taRsi, [](const int32_t* x, double* o) {
+    TaRsi rsi(kRsiPeriod);
+    for (uint32_t i = 0; i < kWindowBars; i++) o[i] = rsi.update(x[i]);
+  });
+
+  {
+    // 输出 [盈亏 0..W)[回撤 0..W)
+    Row r;
+    r.name = "backtest x" + std::to_string(kWindows);
+    r.bars = winBars;
+    r.run[COL_REF] = [&](std::vector<double>& out) {
+      out.resize(2 * kWindows);
+      refBacktest(close.data(), pos.data(), starts.data(), kWindows, kWindowBars, &out[0], &out[kWindows]);
+    };
+    isaRuns(r, [&](TaIsa isa, std::vector<double>& out) {
+      out.resize(2 * kWindows);
+      taBacktest(close.data(), pos.data(), starts.data(), kWindows, kWindowBars, &out[0], &out[kWindows], isa);
+    });
+    r.run[COL_STREAM] = [&](std::vector<double>& out) {
+      out.resize(2 * kWindows);
+      for (size_t w = 0; w < kWindows; w++) {
+        TaBacktest bt;
+        for (uint32_t t = 0; t < kWindowBars; t++) bt.update(close[starts[w] + t], pos[starts[w] + t]);
+        out[w] = bt.pnl();
+        out[kWindows + w] = bt.drawdown();
+      }
+    };
+    rows.push_back(r);
+  }
+
+  printf("%-20s", "Mbars/s");
+  for (int c = 0; c < COL_COUNT; c++) printf(" %9s", kColumnNames[c]);
+  printf("  %s\n", "vs ref");
+  int failures = 0;
+  for (Row& r : rows) {
+    std::vector<double> ref, out;
+    r.run[COL_REF](ref);
+    printf("%-20s", r.name.c_str());
+    std::string diffs;
+    for (int c = 0; c < COL_COUNT; c++) {
+      if (!r.run[c]) {
+        printf(" %9s", "-");
+        continue;
+      }
+      printf(" %9.1f", rate([&] { r.run[c](out); }, r.bars) / 1e6);
+      fflush(stdout);
+      r.run[c](out);
+      const size_t d = diffCount(ref, out);
+      if (d) {
+        diffs += std::string(" ") + kColumnNames[c] + ":" + std::to_string(d);
+        failures++;
+      }
+    }
+    printf("  %s\n", diffs.empty() ? "exact" : ("DIFF" + diffs).c_str());
+  }
+
+  // 回测结果概要（收益率、回撤按窗口首根收盘价计，取中位数）
+  {
+    std::vector<double> res(2 * kWindows), ret(kWindows), dd(kWindows);
+    taBacktest(close.data(), pos.data(), starts.data(), kWindows, kWindowBars, &res[0], &res[kWindows]);
+    size_t wins = 0;
+    for (size_t w = 0; w < kWindows; w++) {
+      ret[w] = res[w] / close[starts[w]];
+      dd[w] = res[kWindows + w] / close[starts[w]];
+      wins += res[w] > 0;
+    }
+    std::nth_element(ret.begin(), ret.begin() + kWindows / 2, ret.end());
+    std::nth_element(dd.begin(), dd.begin() + kWindows / 2, dd.end());
+    printf("\nsma%u/%u cross over %zu windows of %u bars: median return %+.1f%%, median max drawdown %.1f%%, "
+           "%zu%% profitable\n",
+           kFast, kSlow, kWindows, kWindowBars, 100 * ret[kWindows / 2], 100 * dd[kWindows / 2], wins * 100 / kWindows);
+  }
+  if (!exactRange) printf("warning: bollinger sums exceed 2^53 for some symbols, results may differ\n");
+  return failures ? 1 : 0;
+}
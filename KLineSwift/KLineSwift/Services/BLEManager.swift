@@ -25,7 +25,7 @@ final class BLEManager: NSObject, ObservableObject {
     // MARK: - ESP32 GATT UUIDs (must match firmware)
     struct UUIDs {
         static let service = CBUUID(string: "8F1D0001-7E08-4E27-9D94-7A2C3B6E10A1")
-        static let coinCountNotify = CBUUID(string: "8F1D0002-7E08-4E27-9D94-7A2C3B6E10A1") // notify: uint16 little-endian running total
+        static let coinCountNotify = CBUUID(string: "8F1D0002-7E08-4E27-9D94-7A2C3B6E10A1") // notify: uint16 LE coin count [+ uint16 LE value total]
         static let commandWrite = CBUUID(string: "8F1D0003-7E08-4E27-9D94-7A2C3B6E10A1")   // write: command payload
         static let statusNotify = CBUUID(string: "8F1D0004-7E08-4E27-9D94-7A2C3B6E10A1")   // notify: status/events
     }
@@ -42,6 +42,19 @@ final class BLEManager: NSObject, ObservableObject {
     private var latestCoinTotal: Int = 0
     private var coinSessionActive: Bool = false
 
+    // Resume across disconnects (firmware event_backlog.h, protocol v5): the session id comes from
+    // 0x14, the last seen seq from the extended-format trailer; after reconnect RESUME (0x08) replays the gap.
+    private struct ResumeSnapshot {
+        let sessionId: UInt32
+        let coinTotal: UInt16
+        let coinValue: UInt16
+        let headSeq: UInt16
+    }
+    private var sessionId: UInt32?
+    private var lastSeq: UInt16 = 0
+    private var resumeSnapshot: ResumeSnapshot?
+    private static let eventStampLength = 14  // [seq u16][notifyUs u32][originUs u32][readyUs u32]
+
     private let stateQueue = DispatchQueue(label: "ble.manager.state")
     private var retryTimer: Timer?
     private var pendingReconnectAttempts: Int = 0
@@ -172,6 +185,8 @@ final class BLEManager: NSObject, ObservableObject {
     private enum OutCommand {
         case startCoinSession
         case payout(amount: Int)
+        case extendedEvents
+        case resume(sessionId: UInt32, lastSeq: UInt16)
     }
 
     private func sendCommand(_ cmd: OutCommand) {
@@ -185,6 +200,15 @@ final class BLEManager: NSObject, ObservableObject {
             var buf = Data([0x02])
             withUnsafeBytes(of: &amtLE) { buf.append(contentsOf: $0) } // 2 bytes count
             data = buf
+        case .extendedEvents:
+            data = Data([0x06, 0x01]) // CMD_SET_EVENT_FORMAT: append the seq/timestamp trailer
+        case .resume(let session, let seq):
+            var buf = Data([0x08])
+            var sessionLE = session.littleEndian
+            var seqLE = seq.littleEndian
+            withUnsafeBytes(of: &sessionLE) { buf.append(contentsOf: $0) }
+            withUnsafeBytes(of: &seqLE) { buf.append(contentsOf: $0) }
+            data = buf
         }
         p.writeValue(data, for: commandChar, type: .withResponse)
     }
@@ -233,8 +257,12 @@ extension BLEManager: CBCentralManagerDelegate {
     }
 
     func centralManager(_ central: CBCentralManager, didDisconnectPeripheral peripheral: CBPeripheral, error: Error?) {
-        coinContinuation = nil
-        pendingPayoutContinuation = nil
+        // With a session to resume, waiters stay pending: the replay after reconnect delivers their events
+        if sessionId == nil {
+            coinContinuation = nil
+            pendingPayoutContinuation = nil
+        }
+        resumeSnapshot = nil
         DispatchQueue.main.async {
             self.isConnected = false
             self.connectedPeripheralName = nil
@@ -290,41 +318,129 @@ extension BLEManager: CBPeripheralDelegate {
                 break
             }
         }
+        // Writes are queued behind the subscriptions above. Event format is per connection, so set it every time.
+        guard commandChar != nil else { return }
+        sendCommand(.extendedEvents)
+        if let session = sessionId {
+            sendCommand(.resume(sessionId: session, lastSeq: lastSeq))
+        }
     }
 
     func peripheral(_ peripheral: CBPeripheral, didUpdateValueFor characteristic: CBCharacteristic, error: Error?) {
         guard error == nil, let data = characteristic.value else { return }
         if characteristic.uuid == UUIDs.coinCountNotify {
-            // Expect 2 bytes little-endian uint16 = total inserted
-            if data.count >= 2 {
-                let total = Int(UInt16(littleEndian: data.withUnsafeBytes { $0.load(as: UInt16.self) }))
-                latestCoinTotal = total
-                DispatchQueue.main.async {
-                    self.currentCoinTotal = total
-                }
-                if coinSessionActive, total >= requiredCoins, let cont = coinContinuation {
-                    coinSessionActive = false
-                    coinContinuation = nil
-                    DispatchQueue.main.async { cont.resume(returning: total) }
-                }
-            }
+            handleCoinEvent(data, stamped: data.count >= 4 + Self.eventStampLength)
         } else if characteristic.uuid == UUIDs.statusNotify {
-            // Status/event framing: [eventId, payload...]
-            if let eventId = data.first {
-                switch eventId {
-                case 0x10: // payout done, payload: dispensedCount u16 LE
-                    if data.count >= 3, let cont = pendingPayoutContinuation {
-                        let countLE: UInt16 = data.subdata(in: 1..<(3)).withUnsafeBytes { $0.load(as: UInt16.self) }
-                        let dispensed = Int(UInt16(littleEndian: countLE))
-                        pendingPayoutContinuation = nil
-                        DispatchQueue.main.async { cont.resume(returning: (dispensed, 0, 0)) }
-                    }
-                default:
-                    break
-                }
+            handleStatusEvent(data, stamped: true)
+        }
+    }
+
+    // Coin event, live or replayed. stamped: the extended-format trailer follows the payload.
+    private func handleCoinEvent(_ data: Data, stamped: Bool) {
+        // [count u16 LE, value u16 LE]; older firmware sends only the count.
+        // Credits follow the value total so multi-pulse (higher value) coins count fully.
+        guard data.count >= 2 else { return }
+        if stamped { lastSeq = data.le16(4) }
+        let offset = data.count >= 4 ? 2 : 0
+        updateCoinTotal(Int(data.le16(offset)))
+    }
+
+    private func updateCoinTotal(_ total: Int) {
+        latestCoinTotal = total
+        DispatchQueue.main.async {
+            self.currentCoinTotal = total
+        }
+        if coinSessionActive, total >= requiredCoins, let cont = coinContinuation {
+            coinSessionActive = false
+            coinContinuation = nil
+            DispatchQueue.main.async { cont.resume(returning: total) }
+        }
+    }
+
+    // Status/event framing: [eventId, payload...]. Events that take a seq carry the trailer when stamped;
+    // replies (0x12, 0x13, 0x15-0x18) never do.
+    private func handleStatusEvent(_ data: Data, stamped: Bool) {
+        guard let eventId = data.first else { return }
+        let hasStamp = stamped && [0x10, 0x11, 0x14].contains(eventId) && data.count > Self.eventStampLength
+        if hasStamp { lastSeq = data.le16(data.count - Self.eventStampLength) }
+        switch eventId {
+        case 0x10: // payout done, payload: dispensedCount u16 LE
+            if data.count >= 3, let cont = pendingPayoutContinuation {
+                let dispensed = Int(data.le16(1))
+                pendingPayoutContinuation = nil
+                DispatchQueue.main.async { cont.resume(returning: (dispensed, 0, 0)) }
             }
+        case 0x13: // resume replay
+            handleResumeFrame(data)
+        case 0x14: // session started, payload: sessionId u32 LE
+            if data.count >= 5 { sessionId = data.le32(1) }
+        case 0x17: // command rejected, payload: opcode u8, reason u8
+            guard data.count >= 3 else { return }
+            let op = data[data.startIndex + 1]
+            if op == 0x02, let cont = pendingPayoutContinuation {
+                pendingPayoutContinuation = nil
+                DispatchQueue.main.async { cont.resume(returning: (0, 0, 0)) }
+            } else if op == 0x01, coinSessionActive, let cont = coinContinuation {
+                // Another connection holds the session: report what was counted so far
+                coinSessionActive = false
+                coinContinuation = nil
+                let total = latestCoinTotal
+                DispatchQueue.main.async { cont.resume(returning: total) }
+            } else if op == 0x08 {
+                sessionId = nil
+            }
+        default:
+            break
         }
     }
+
+    // First frame: [0x13, flags, sessionId u32, coinTotal u16, coinValue u16, headSeq u16, entries...]
+    // Continued (flags bit3): [0x13, flags, entries...]; entry: [seq u16, kindLen u8 (bit7 status, low 5 bits length), payload]
+    // flags bit0: more frames follow; bits1-2: 0 complete, 1 backlog overflowed, 2 unknown session, 3 stopped at MTU.
+    private func handleResumeFrame(_ data: Data) {
+        guard data.count >= 2 else { return }
+        let flags = data[data.startIndex + 1]
+        let first = flags & 0x08 == 0
+        var off = first ? 12 : 2
+        guard data.count >= off else { return }
+        if first {
+            resumeSnapshot = ResumeSnapshot(sessionId: data.le32(2), coinTotal: data.le16(6),
+                                            coinValue: data.le16(8), headSeq: data.le16(10))
+        }
+        while off + 3 <= data.count {
+            let kindLen = data[data.startIndex + off + 2]
+            let n = Int(kindLen & 0x1F)
+            guard off + 3 + n <= data.count else { break }
+            let start = data.startIndex + off + 3
+            let payload = data.subdata(in: start..<(start + n))
+            if kindLen & 0x80 != 0 { handleStatusEvent(payload, stamped: false) } else { handleCoinEvent(payload, stamped: false) }
+            lastSeq = data.le16(off)
+            off += 3 + n
+        }
+        guard flags & 0x01 == 0, let snap = resumeSnapshot else { return }
+        resumeSnapshot = nil
+        if (flags >> 1) & 0x03 == 2 {
+            // Device lost the session (restart): counters are gone, start over if a wait is in progress
+            sessionId = nil
+            if coinSessionActive {
+                resetDisplayedCoinCount()
+                sendCommand(.startCoinSession)
+            }
+            return
+        }
+        // The snapshot is authoritative even when the backlog overflowed or replay stopped early
+        lastSeq = snap.headSeq
+        updateCoinTotal(Int(snap.coinValue))
+    }
 }
 
+private extension Data {
+    // Little-endian integers at a byte offset from startIndex
+    func le16(_ at: Int) -> UInt16 {
+        UInt16(self[startIndex + at]) | UInt16(self[startIndex + at + 1]) << 8
+    }
 
+    func le32(_ at: Int) -> UInt32 {
+        UInt32(le16(at)) | UInt32(le16(at + 2)) << 16
+    }
+}